@@ -0,0 +1,585 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <map>
+# include <mutex>
+# include <atomic>
+# include <vector>
+# include <cstddef>
+# include <cstdlib>
+# include <cstring>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+
+# ifdef _WIN32
+# ifndef NOMINMAX
+# define NOMINMAX
+# endif
+# include <windows.h>
+# elif defined(__linux__)
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# endif
+
+///
+/// Арена для матриц библиотеки на больших страницах с привязкой к узлу NUMA.
+///
+/// Eigen выделяет память матриц через malloc, и большие буферы (веса и
+/// производные слоев, Z / A батча) лежат на страницах 4 КБ: на проходе по ним
+/// много промахов dTLB, а страницы оказываются на том узле NUMA, где их впервые
+/// тронули.
+///
+/// MatrixArena берет у ОС куски по ArenaOptions::chunk_size, выровненные на
+/// 2 МБ, на прозрачных (madvise) или явных (MAP_HUGETLB) больших страницах и,
+/// если задан узел, привязанные к нему (mbind). Блоки выдаются сдвигом указателя.
+/// Освобожденный блок сливается с соседними свободными блоками своего куска, а блок
+/// в конце занятой части куска возвращается в нее. Запрос берет наименьший
+/// подходящий свободный блок (остаток снова свободен), иначе сдвиг указателя.
+/// Z / A батча освобождаются, только когда меняется размер батча: следующий батч
+/// того же размера берет тот же блок, а растущий батч - слитые блоки прежних.
+///
+/// Матрицы попадают в арену, если проект собран с NN_USE_ARENA: тогда
+/// хранилище всех Eigen::Matrix со Scalar идет через internal::arena_malloc(), и
+/// пока жив ArenaScope, блоки от Scalar * min_size байт берутся из его арены,
+/// остальное - как раньше через malloc. NN_USE_ARENA должен быть определен до
+/// первого включения заголовков библиотеки и до первого использования матриц
+/// Scalar в единице трансляции.
+///
+/// У Eigen::Matrix нет параметра аллокатора, поэтому арена подключается
+/// специализацией функций выделения хранилища Eigen для Scalar (в конце файла).
+/// Матрица, выделенная в единице трансляции с NN_USE_ARENA, не может быть
+/// освобождена кодом без него, поэтому все единицы программы собираются с одним
+/// значением NN_USE_ARENA; Config.h проверяет это при компоновке (MSVC) или при
+/// запуске программы.
+///
+/// Арена должна жить дольше всех матриц, выделенных в ней. Память возвращается
+/// ОС в деструкторе.
+///
+
+
+/// <summary>
+/// Страницы кусков арены
+/// </summary>
+enum ArenaPages
+{
+    ARENA_SMALL_PAGES, // обычные страницы
+    ARENA_THP,         // прозрачные большие страницы (madvise(MADV_HUGEPAGE))
+    ARENA_HUGETLB      // явные большие страницы (MAP_HUGETLB / MEM_LARGE_PAGES), при неудаче - ARENA_THP
+};
+
+/// <summary>
+/// Настройки арены
+/// </summary>
+struct ArenaOptions
+{
+    ArenaPages pages;
+    int numa_node;          // узел NUMA для памяти, -1 - без привязки
+    std::size_t chunk_size; // байт в куске, округляется до 2 МБ
+    std::size_t min_size;   // блоки меньше идут через malloc: смещения и мелкие буферы
+
+    ArenaOptions() :
+        pages(ARENA_THP), numa_node(-1), chunk_size(std::size_t(64) << 20), min_size(std::size_t(64) << 10) {}
+};
+
+/// <summary>
+/// Статистика арены
+/// </summary>
+struct ArenaStats
+{
+    std::size_t chunks;           // кусков памяти у ОС
+    std::size_t reserved_bytes;   // байт в кусках
+    std::size_t huge_bytes;       // из них на больших страницах (для ARENA_THP - с madvise)
+    std::size_t in_use_bytes;     // байт в выданных блоках
+    std::size_t peak_bytes;       // максимум in_use_bytes
+    std::size_t allocations;      // выдано блоков
+    std::size_t reused;           // из них повторно из освобожденных
+    std::size_t frees;            // возвращено блоков
+    std::size_t merged;           // слияний освобожденного блока с соседним или с концом куска
+    std::size_t hugetlb_failures; // кусков, для которых не нашлось явных больших страниц
+    std::size_t bind_failures;    // кусков, не привязанных к узлу NUMA
+
+    ArenaStats() :
+        chunks(0), reserved_bytes(0), huge_bytes(0), in_use_bytes(0), peak_bytes(0),
+        allocations(0), reused(0), frees(0), merged(0), hugetlb_failures(0), bind_failures(0) {}
+};
+
+
+class MatrixArena
+{
+private:
+    static const std::size_t kHugePage = std::size_t(2) << 20;
+    static const std::size_t kAlign = 64;
+
+    struct Chunk
+    {
+        char* base;       // начало выровненной области
+        std::size_t size;
+        std::size_t used;
+        void* mapping;    // то, что вернула ОС
+        std::size_t mapped;
+        bool hugetlb;
+    };
+
+    struct FreeBlock
+    {
+        std::size_t size;
+        std::size_t chunk; // номер куска: блоки разных кусков не сливаются
+    };
+
+    typedef std::map<char*, FreeBlock> FreeMap;
+
+    ArenaOptions m_opts;
+    std::vector<Chunk> m_chunks;
+    FreeMap m_free;                                   // адрес -> свободный блок, для слияния соседей
+    std::multimap<std::size_t, char*> m_free_sizes;   // размер -> адрес, для поиска блока под запрос
+    ArenaStats m_stats;
+    mutable std::mutex m_mutex;
+
+    static std::size_t round_up(const std::size_t n, const std::size_t a) { return (n + a - 1) / a * a; }
+
+    void insert_free(char* p, const std::size_t size, const std::size_t chunk)
+    {
+        FreeBlock b;
+        b.size = size;
+        b.chunk = chunk;
+
+        m_free.insert(std::make_pair(p, b));
+        m_free_sizes.insert(std::make_pair(size, p));
+    }
+
+    void erase_free(const FreeMap::iterator it)
+    {
+        typedef std::multimap<std::size_t, char*>::iterator SizeIter;
+        const std::pair<SizeIter, SizeIter> range = m_free_sizes.equal_range(it->second.size);
+
+        for (SizeIter s = range.first; s != range.second; ++s)
+        {
+            if (s->second == it->first)
+            {
+                m_free_sizes.erase(s);
+                break;
+            }
+        }
+
+        m_free.erase(it);
+    }
+
+    /// <summary>
+    /// Номер куска, в котором лежит блок
+    /// </summary>
+    std::size_t find_chunk(const char* p) const
+    {
+        for (std::size_t i = 0; i < m_chunks.size(); ++i)
+        {
+            if (p >= m_chunks[i].base && p < m_chunks[i].base + m_chunks[i].size) { return i; }
+        }
+
+        throw std::invalid_argument("[class MatrixArena]: Block does not belong to this arena");
+    }
+
+    /// <summary>
+    /// Кусок памяти у ОС, выровненный на 2 МБ
+    /// </summary>
+    Chunk map_chunk(const std::size_t size)
+    {
+        Chunk c;
+        c.size = size;
+        c.used = 0;
+        c.hugetlb = false;
+
+# ifdef _WIN32
+        c.mapping = NULL;
+
+        if (m_opts.pages == ARENA_HUGETLB && GetLargePageMinimum() > 0)
+        {
+            c.mapped = round_up(size, GetLargePageMinimum());
+            c.mapping = (m_opts.numa_node >= 0) ?
+                VirtualAllocExNuma(GetCurrentProcess(), NULL, c.mapped,
+                    MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, DWORD(m_opts.numa_node)) :
+                VirtualAlloc(NULL, c.mapped, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            c.hugetlb = c.mapping != NULL;
+        }
+
+        if (m_opts.pages == ARENA_HUGETLB && c.mapping == NULL) { ++m_stats.hugetlb_failures; }
+
+        if (c.mapping == NULL)
+        {
+            c.mapped = size;
+            c.mapping = (m_opts.numa_node >= 0) ?
+                VirtualAllocExNuma(GetCurrentProcess(), NULL, c.mapped,
+                    MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, DWORD(m_opts.numa_node)) :
+                VirtualAlloc(NULL, c.mapped, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        }
+
+        if (c.mapping == NULL) { throw std::bad_alloc(); }
+
+        c.base = static_cast<char*>(c.mapping);
+
+        if (c.hugetlb) { m_stats.huge_bytes += size; }
+# elif defined(__linux__)
+        c.mapping = MAP_FAILED;
+
+#  ifdef MAP_HUGETLB
+        if (m_opts.pages == ARENA_HUGETLB)
+        {
+            c.mapped = size;
+            c.mapping = mmap(NULL, c.mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            c.hugetlb = c.mapping != MAP_FAILED;
+        }
+#  endif
+
+        if (m_opts.pages == ARENA_HUGETLB && c.mapping == MAP_FAILED) { ++m_stats.hugetlb_failures; }
+
+        if (c.mapping == MAP_FAILED)
+        {
+            // лишние 2 МБ на выравнивание: большая страница ставится только на выровненный адрес
+            c.mapped = size + kHugePage;
+            c.mapping = mmap(NULL, c.mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (c.mapping == MAP_FAILED) { throw std::bad_alloc(); }
+        }
+
+        c.base = reinterpret_cast<char*>(round_up(reinterpret_cast<std::size_t>(c.mapping), kHugePage));
+
+        if (c.hugetlb) { m_stats.huge_bytes += size; }
+#  ifdef MADV_HUGEPAGE
+        else if (m_opts.pages != ARENA_SMALL_PAGES && madvise(c.base, size, MADV_HUGEPAGE) == 0)
+        {
+            m_stats.huge_bytes += size;
+        }
+#  endif
+
+#  ifdef SYS_mbind
+        if (m_opts.numa_node >= 0)
+        {
+            // MPOL_BIND = 2; mbind через syscall, чтобы не зависеть от libnuma
+            unsigned long mask[16] = { 0 };
+            const int bits = int(sizeof(unsigned long) * 8);
+
+            if (m_opts.numa_node < int(sizeof(mask) * 8))
+            {
+                mask[m_opts.numa_node / bits] |= 1UL << (m_opts.numa_node % bits);
+            }
+
+            if (m_opts.numa_node >= int(sizeof(mask) * 8) ||
+                syscall(SYS_mbind, c.base, size, 2, mask, (unsigned long)(sizeof(mask) * 8), 0) != 0)
+            {
+                ++m_stats.bind_failures;
+            }
+        }
+#  else
+        if (m_opts.numa_node >= 0) { ++m_stats.bind_failures; }
+#  endif
+# else
+        c.mapped = size + kHugePage;
+        c.mapping = std::malloc(c.mapped);
+
+        if (c.mapping == NULL) { throw std::bad_alloc(); }
+
+        c.base = reinterpret_cast<char*>(round_up(reinterpret_cast<std::size_t>(c.mapping), kHugePage));
+
+        if (m_opts.numa_node >= 0) { ++m_stats.bind_failures; }
+# endif
+
+        ++m_stats.chunks;
+        m_stats.reserved_bytes += size;
+
+        return c;
+    }
+
+    static void unmap_chunk(const Chunk& c)
+    {
+# ifdef _WIN32
+        VirtualFree(c.mapping, 0, MEM_RELEASE);
+# elif defined(__linux__)
+        munmap(c.mapping, c.mapped);
+# else
+        std::free(c.mapping);
+# endif
+    }
+
+public:
+    explicit MatrixArena(const ArenaOptions& opts = ArenaOptions()) :
+        m_opts(opts)
+    {
+        m_opts.chunk_size = round_up(std::max<std::size_t>(m_opts.chunk_size, 1), kHugePage);
+    }
+
+    ~MatrixArena()
+    {
+        // матрицы арены должны быть уже освобождены
+        eigen_assert(m_stats.in_use_bytes == 0 && "MatrixArena destroyed while its matrices are alive");
+
+        for (std::size_t i = 0; i < m_chunks.size(); ++i) { unmap_chunk(m_chunks[i]); }
+    }
+
+    /// <summary>
+    /// Блок от bytes байт, выровненный на 64 байта
+    /// </summary>
+    void* allocate(const std::size_t bytes)
+    {
+        const std::size_t size = round_up(std::max<std::size_t>(bytes, 1), kAlign);
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        char* p = NULL;
+        const std::multimap<std::size_t, char*>::iterator it = m_free_sizes.lower_bound(size);
+
+        if (it != m_free_sizes.end())
+        {
+            // наименьший подходящий блок, остаток остается свободным
+            p = it->second;
+
+            const FreeMap::iterator b = m_free.find(p);
+            const FreeBlock block = b->second;
+            erase_free(b);
+
+            if (block.size > size) { insert_free(p + size, block.size - size, block.chunk); }
+
+            ++m_stats.reused;
+        }
+        else
+        {
+            // первый кусок, в хвост которого блок помещается, иначе новый кусок
+            std::size_t i = 0;
+
+            while (i < m_chunks.size() && m_chunks[i].size - m_chunks[i].used < size) { ++i; }
+
+            if (i == m_chunks.size())
+            {
+                m_chunks.push_back(map_chunk(std::max(m_opts.chunk_size, round_up(size, kHugePage))));
+            }
+
+            Chunk& c = m_chunks[i];
+            p = c.base + c.used;
+            c.used += size;
+        }
+
+        ++m_stats.allocations;
+        m_stats.in_use_bytes += size;
+        m_stats.peak_bytes = std::max(m_stats.peak_bytes, m_stats.in_use_bytes);
+
+        return p;
+    }
+
+    /// <summary>
+    /// Вернуть блок для повторного использования: слить с соседними свободными
+    /// блоками куска, а в конце занятой части - вернуть в нее
+    /// </summary>
+    /// <param name="p"> - блок allocate()</param>
+    /// <param name="bytes"> - размер, с которым он был выделен</param>
+    void deallocate(void* p, const std::size_t bytes)
+    {
+        if (p == NULL) { return; }
+
+        const std::size_t size = round_up(std::max<std::size_t>(bytes, 1), kAlign);
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        char* start = static_cast<char*>(p);
+        std::size_t len = size;
+        const std::size_t chunk = find_chunk(start);
+
+        // следующий сосед
+        FreeMap::iterator it = m_free.find(start + len);
+
+        if (it != m_free.end() && it->second.chunk == chunk)
+        {
+            len += it->second.size;
+            erase_free(it);
+            ++m_stats.merged;
+        }
+
+        // предыдущий сосед
+        it = m_free.lower_bound(start);
+
+        if (it != m_free.begin())
+        {
+            --it;
+
+            if (it->second.chunk == chunk && it->first + it->second.size == start)
+            {
+                start = it->first;
+                len += it->second.size;
+                erase_free(it);
+                ++m_stats.merged;
+            }
+        }
+
+        Chunk& c = m_chunks[chunk];
+
+        if (start + len == c.base + c.used)
+        {
+            c.used -= len;
+            ++m_stats.merged;
+        }
+        else
+        {
+            insert_free(start, len, chunk);
+        }
+
+        ++m_stats.frees;
+        m_stats.in_use_bytes -= size;
+    }
+
+    std::size_t min_size() const { return m_opts.min_size; }
+
+    const ArenaOptions& options() const { return m_opts; }
+
+    ArenaStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+};
+
+
+namespace internal
+{
+    /// <summary>
+    /// Арена последнего живого ArenaScope, NULL - malloc
+    /// </summary>
+    inline std::atomic<MatrixArena*>& current_arena()
+    {
+        static std::atomic<MatrixArena*> arena(NULL);
+        return arena;
+    }
+
+    /// <summary>
+    /// Заголовок перед каждым блоком матрицы: чей блок и его размер.
+    /// 64 байта, чтобы данные матрицы оставались выровнены на 64.
+    /// </summary>
+    struct ArenaHeader
+    {
+        MatrixArena* owner; // NULL - блок malloc
+        std::size_t bytes;
+        char pad[64 - sizeof(MatrixArena*) - sizeof(std::size_t)];
+    };
+
+    inline void* arena_malloc(const std::size_t bytes)
+    {
+        if (bytes == 0) { return NULL; }
+
+        MatrixArena* arena = current_arena().load(std::memory_order_acquire);
+        const std::size_t total = bytes + sizeof(ArenaHeader);
+        ArenaHeader* h;
+
+        if (arena != NULL && bytes >= arena->min_size())
+        {
+            h = static_cast<ArenaHeader*>(arena->allocate(total));
+        }
+        else
+        {
+            arena = NULL;
+            h = static_cast<ArenaHeader*>(Eigen::internal::handmade_aligned_malloc(total, 64));
+
+            if (h == NULL) { throw std::bad_alloc(); }
+        }
+
+        h->owner = arena;
+        h->bytes = bytes;
+
+        return h + 1;
+    }
+
+    inline void arena_free(void* p)
+    {
+        if (p == NULL) { return; }
+
+        ArenaHeader* h = static_cast<ArenaHeader*>(p) - 1;
+
+        if (h->owner != NULL) { h->owner->deallocate(h, h->bytes + sizeof(ArenaHeader)); }
+        else { Eigen::internal::handmade_aligned_free(h); }
+    }
+
+    inline void* arena_realloc(void* p, const std::size_t bytes)
+    {
+        if (p == NULL) { return arena_malloc(bytes); }
+
+        const std::size_t old_bytes = (static_cast<ArenaHeader*>(p) - 1)->bytes;
+        void* res = arena_malloc(bytes);
+
+        if (res != NULL) { std::memcpy(res, p, std::min(old_bytes, bytes)); }
+
+        arena_free(p);
+
+        return res;
+    }
+}
+
+
+/// <summary>
+/// Матрицы Scalar, выделенные, пока объект жив, берутся из арены (нужен NN_USE_ARENA).
+/// Действует на все потоки процесса; вложенный ArenaScope перекрывает внешний до
+/// своего разрушения.
+/// </summary>
+class ArenaScope
+{
+private:
+    MatrixArena* m_prev;
+
+    ArenaScope(const ArenaScope&);
+    ArenaScope& operator=(const ArenaScope&);
+
+public:
+    explicit ArenaScope(MatrixArena& arena) :
+        m_prev(NULL)
+    {
+# ifdef NN_USE_ARENA
+        m_prev = internal::current_arena().exchange(&arena, std::memory_order_acq_rel);
+# else
+        (void)arena;
+        throw std::logic_error("[class ArenaScope]: Matrices use the arena only when built with NN_USE_ARENA");
+# endif
+    }
+
+    ~ArenaScope()
+    {
+        internal::current_arena().store(m_prev, std::memory_order_release);
+    }
+};
+
+
+# ifdef NN_USE_ARENA
+namespace Eigen
+{
+    namespace internal
+    {
+        // Хранилище динамических матриц (DenseStorage) выделяется только через эти три функции
+
+        template <>
+        inline Scalar* conditional_aligned_new_auto<Scalar, true>(std::size_t size)
+        {
+            if (size == 0) { return 0; }
+
+            check_size_for_overflow<Scalar>(size);
+
+            return static_cast<Scalar*>(::internal::arena_malloc(sizeof(Scalar) * size));
+        }
+
+        template <>
+        inline Scalar* conditional_aligned_realloc_new_auto<Scalar, true>(Scalar* ptr, std::size_t new_size, std::size_t old_size)
+        {
+            EIGEN_UNUSED_VARIABLE(old_size)
+
+            if (new_size == 0)
+            {
+                ::internal::arena_free(ptr);
+                return 0;
+            }
+
+            check_size_for_overflow<Scalar>(new_size);
+
+            return static_cast<Scalar*>(::internal::arena_realloc(ptr, sizeof(Scalar) * new_size));
+        }
+
+        template <>
+        inline void conditional_aligned_delete_auto<Scalar, true>(Scalar* ptr, std::size_t size)
+        {
+            EIGEN_UNUSED_VARIABLE(size)
+
+            ::internal::arena_free(ptr);
+        }
+    }
+}
+# endif
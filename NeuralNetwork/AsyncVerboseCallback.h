@@ -0,0 +1,68 @@
+﻿#pragma once
+
+# include <Eigen/Core>
+# include <chrono>
+# include "Callback.h"
+# include "Config.h"
+# include "MetricsSink.h"
+# include "NeuralNetwork.h"
+
+
+///
+/// Callback, который не пишет в консоль из потока обучения, а отправляет
+/// лосс и время батча в MetricsSink. Печать и агрегация по эпохам
+/// происходят в фоновом потоке MetricsSink.
+///
+class AsyncVerboseCallback : public Callback
+{
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	MetricsSink& m_sink;
+	Clock::time_point m_start; // начало тренировки текущего батча
+
+	void record(const NeuralNetwork* net, const int batch_size)
+	{
+		MetricsRecord rec;
+		rec.epoch = m_epoch_id;
+		rec.batch = m_batch_id;
+		rec.nbatch = m_nbatch;
+		rec.batch_size = batch_size;
+		rec.loss = net->get_output()->loss();
+		rec.seconds = std::chrono::duration<double>(Clock::now() - m_start).count();
+
+		m_sink.push(rec);
+	}
+
+public:
+	AsyncVerboseCallback(MetricsSink& sink) :
+		m_sink(sink) {}
+
+	void pre_trained_batch(const NeuralNetwork* net,
+		const Matrix& x,
+		const Matrix& y)
+	{
+		m_start = Clock::now();
+	}
+
+	void pre_trained_batch(const NeuralNetwork* net,
+		const Matrix& x,
+		const IntegerVector& y)
+	{
+		m_start = Clock::now();
+	}
+
+	void post_trained_batch(const NeuralNetwork* net,
+		const Matrix& x,
+		const Matrix& y)
+	{
+		record(net, x.cols());
+	}
+
+	void post_trained_batch(const NeuralNetwork* net,
+		const Matrix& x,
+		const IntegerVector& y)
+	{
+		record(net, x.cols());
+	}
+};
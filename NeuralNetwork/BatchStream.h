@@ -0,0 +1,255 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <functional>
+# include <exception>
+# include "Config.h"
+# include "RNG.h"
+# include "Random.h"
+# include "ThreadPool.h"
+
+///
+/// Поток батчей для NeuralNetwork::fit().
+///
+/// Без предвыборки все батчи собираются один раз до начала обучения,
+/// как в internal::create_shuffled_batches(). С предвыборкой фоновый поток
+/// собирает следующие батчи в кольцо из K заранее выделенных буферов, пока
+/// текущий батч тренируется, и сборка уходит с критического пути.
+/// Порядок и состав батчей в обоих режимах одинаковые.
+///
+/// С пулом потоков столбцы батча копируются параллельно статическими блоками.
+///
+
+
+namespace internal
+{
+    template <typename XType, typename YType>
+    class BatchStream
+    {
+    private:
+        const int m_nbuffer;              // размер кольца, 0 - собрать все батчи сразу
+        ThreadPool* m_pool;               // пул для копирования столбцов, может быть NULL
+
+        Eigen::VectorXi m_id;             // перемешанные индексы наблюдений
+        int m_batch_size;
+        int m_nbatch;
+        int m_nobs;
+        std::vector<XType> m_x;           // буферы батчей
+        std::vector<YType> m_y;
+        std::vector<XType> m_x_tail;      // буферы кольца под короткий последний батч эпохи
+        std::vector<YType> m_y_tail;
+        std::function<void(int, int)> m_gather; // собрать батч (номер батча, номер буфера)
+
+        long long m_current;              // задача (эпоха * nbatch + батч), которую тренируем
+        long long m_produced;             // задачи до этой уже собраны
+        long long m_end;                  // последняя задача + 1
+        std::exception_ptr m_error;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        bool m_stop;
+        std::thread m_worker;
+
+        bool streaming() const { return m_nbuffer > 0; }
+
+        int batch_cols(const int i) const
+        {
+            return (i == m_nbatch - 1) ? m_nobs - (m_nbatch - 1) * m_batch_size : m_batch_size;
+        }
+
+        /// <summary>
+        /// Идет ли батч i в буфер под короткий батч (только в кольце)
+        /// </summary>
+        bool to_tail(const int i) const
+        {
+            return streaming() && batch_cols(i) != m_batch_size;
+        }
+
+        XType& buffer_x(const int i, const int buf) { return to_tail(i) ? m_x_tail[buf] : m_x[buf]; }
+        YType& buffer_y(const int i, const int buf) { return to_tail(i) ? m_y_tail[buf] : m_y[buf]; }
+
+        void run(const long long first)
+        {
+            for (long long t = first; t < m_end; ++t)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+
+                    // буфер задачи t свободен, когда задача t - K уже натренирована
+                    m_cond.wait(lock, [this, t] { return m_stop || t < m_current + m_nbuffer; });
+
+                    if (m_stop) { return; }
+                }
+
+                try { m_gather(int(t % m_nbatch), int(t % m_nbuffer)); }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_error = std::current_exception();
+                    m_produced = m_end;
+                    m_cond.notify_all();
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_produced = t + 1;
+                }
+
+                m_cond.notify_all();
+            }
+        }
+
+        void wait_ready()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this] { return m_produced > m_current; });
+
+            if (m_error) { std::rethrow_exception(m_error); }
+        }
+
+        int slot() const
+        {
+            return streaming() ? int(m_current % m_nbuffer) : int(m_current % m_nbatch);
+        }
+
+        int current_batch() const { return int(m_current % m_nbatch); }
+
+    public:
+        /// <param name="nbuffer"> - кол-во буферов кольца, 0 - без предвыборки</param>
+        /// <param name="pool"> - пул потоков для сборки батча, NULL - в одном потоке</param>
+        explicit BatchStream(int nbuffer, ThreadPool* pool = NULL) :
+            m_nbuffer(std::max(0, nbuffer)), m_pool(pool),
+            m_batch_size(0), m_nbatch(0), m_nobs(0),
+            m_current(0), m_produced(0), m_end(0),
+            m_stop(false) {}
+
+        ~BatchStream()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+
+            m_cond.notify_all();
+
+            if (m_worker.joinable()) { m_worker.join(); }
+        }
+
+        /// <summary>
+        /// Перемешивание наблюдений. RNG расходуется так же, как в
+        /// internal::create_shuffled_batches(). Данные должны жить до конца обучения.
+        /// </summary>
+        /// <param name="group"> - длина последовательности, см. internal::shuffled_index()</param>
+        /// <returns>Кол-во батчей в эпохе</returns>
+        template <typename DerivedX, typename DerivedY>
+        int open(const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+            int batch_size, RNG& rng, const int group = 1)
+        {
+            m_nbatch = shuffled_index(x, y, batch_size, rng, m_id, group);
+            m_batch_size = batch_size;
+            m_nobs = x.cols();
+
+            m_gather = [this, &x, &y](int i, int buf) {
+                const int* id = m_id.data() + (std::ptrdiff_t)i * m_batch_size;
+                XType& xb = buffer_x(i, buf);
+                YType& yb = buffer_y(i, buf);
+
+                if (m_pool == NULL)
+                {
+                    gather_cols(x, y, id, 0, batch_cols(i), xb, yb);
+                    return;
+                }
+
+                m_pool->parallel_for(batch_cols(i), [&](Eigen::Index begin, Eigen::Index end) {
+                    gather_cols(x, y, id, int(begin), int(end), xb, yb);
+                }, 64);
+            };
+
+            const int nbuffer = streaming() ? m_nbuffer : m_nbatch;
+
+            m_x.resize(nbuffer);
+            m_y.resize(nbuffer);
+
+            // Буферы выделяем один раз и дальше не перевыделяем: в кольце у каждого
+            // слота есть буфер под полный батч и, если последний батч эпохи короче,
+            // буфер под него, чтобы не менять размер полного
+            const int tail = batch_cols(m_nbatch - 1);
+            const bool has_tail = streaming() && tail != m_batch_size;
+
+            m_x_tail.resize(has_tail ? nbuffer : 0);
+            m_y_tail.resize(has_tail ? nbuffer : 0);
+
+            for (int b = 0; b < nbuffer; ++b)
+            {
+                m_x[b].resize(x.rows(), streaming() ? m_batch_size : batch_cols(b));
+                m_y[b].resize(y.rows(), streaming() ? m_batch_size : batch_cols(b));
+
+                if (has_tail)
+                {
+                    m_x_tail[b].resize(x.rows(), tail);
+                    m_y_tail[b].resize(y.rows(), tail);
+                }
+            }
+
+            if (!streaming())
+            {
+                for (int i = 0; i < m_nbatch; ++i) { m_gather(i, i); }
+            }
+
+            return m_nbatch;
+        }
+
+        /// <summary>
+        /// Начать выдачу батчей. Задача t - это батч t % nbatch эпохи t / nbatch.
+        /// </summary>
+        /// <param name="first"> - первая задача</param>
+        /// <param name="end"> - последняя задача + 1</param>
+        void start(const long long first, const long long end)
+        {
+            m_current = first;
+            m_end = end;
+
+            if (!streaming())
+            {
+                m_produced = end;
+                return;
+            }
+
+            m_produced = first;
+            m_worker = std::thread(&BatchStream::run, this, first);
+        }
+
+        /// <summary>
+        /// Текущий батч, ждет его сборки
+        /// </summary>
+        const XType& x()
+        {
+            wait_ready();
+            return buffer_x(current_batch(), slot());
+        }
+
+        const YType& y()
+        {
+            wait_ready();
+            return buffer_y(current_batch(), slot());
+        }
+
+        /// <summary>
+        /// Текущий батч больше не нужен, его буфер можно переиспользовать
+        /// </summary>
+        void next()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_current++;
+            }
+
+            m_cond.notify_all();
+        }
+    };
+}
@@ -0,0 +1,238 @@
+﻿#pragma once
+
+# include <Eigen/Core>
+# include <deque>
+# include <future>
+# include <mutex>
+# include <thread>
+# include <chrono>
+# include <condition_variable>
+# include <stdexcept>
+# include "Config.h"
+# include "NeuralNetwork.h"
+
+///
+/// Динамический батчинг запросов для онлайн инференса.
+///
+/// Потоки-производители отправляют по одному наблюдению и получают std::future.
+/// Планировщик собирает запросы в столбцы одной входной матрицы, пока не наберется
+/// max_batch наблюдений или пока самый старый запрос не прождет max_delay,
+/// делает один NeuralNetwork::predict() и раздает результаты.
+///
+/// max_batch и max_delay - ручки между задержкой и пропускной способностью:
+/// маленький max_delay уменьшает p99 задержки, большой max_batch увеличивает
+/// эффективность GEMM при высокой нагрузке.
+///
+
+
+///
+/// Статистика работы сервера
+///
+struct BatchingStats
+{
+    long long requests;  // обработано запросов
+    long long batches;   // сделано проходов по сетке
+    int max_batch_seen;  // максимальный собранный батч
+
+    BatchingStats() : requests(0), batches(0), max_batch_seen(0) {}
+
+    double mean_batch_size() const
+    {
+        return batches > 0 ? double(requests) / double(batches) : 0.0;
+    }
+};
+
+
+class BatchingServer
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+    typedef std::chrono::steady_clock Clock;
+
+    struct Request
+    {
+        Vector x;
+        std::promise<Vector> result;
+        Clock::time_point arrived;
+    };
+
+    NeuralNetwork& m_net;                // сетка, вызывается только из потока планировщика
+    const int m_max_batch;               // максимальный размер батча
+    const Clock::duration m_max_delay;   // сколько может ждать самый старый запрос
+    const int m_in_size;                 // размер входа сетки
+
+    std::deque<Request> m_queue;         // очередь запросов
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop;
+    BatchingStats m_stats;
+
+    std::thread m_worker;                // поток планировщика
+
+    /// <summary>
+    /// Основной цикл планировщика
+    /// </summary>
+    void run()
+    {
+        std::vector<Request> batch;
+        Matrix x;
+
+        batch.reserve(m_max_batch);
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                m_cond.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+
+                if (m_queue.empty()) { return; }
+
+                // Ждем, пока батч не наполнится или не истечет дедлайн самого старого запроса
+                const Clock::time_point deadline = m_queue.front().arrived + m_max_delay;
+
+                m_cond.wait_until(lock, deadline, [this] {
+                    return m_stop || int(m_queue.size()) >= m_max_batch;
+                });
+
+                const int bsize = std::min(int(m_queue.size()), m_max_batch);
+
+                for (int i = 0; i < bsize; ++i)
+                {
+                    batch.push_back(std::move(m_queue.front()));
+                    m_queue.pop_front();
+                }
+            }
+
+            process(batch, x);
+            batch.clear();
+        }
+    }
+
+    /// <summary>
+    /// Сборка батча, проход по сетке и раздача результатов
+    /// </summary>
+    void process(std::vector<Request>& batch, Matrix& x)
+    {
+        const int bsize = batch.size();
+
+        x.resize(m_in_size, bsize);
+
+        for (int i = 0; i < bsize; ++i)
+        {
+            x.col(i) = batch[i].x;
+        }
+
+        try
+        {
+            const Matrix y = m_net.predict(x);
+
+            for (int i = 0; i < bsize; ++i)
+            {
+                batch[i].result.set_value(y.col(i));
+            }
+        }
+        catch (...)
+        {
+            for (int i = 0; i < bsize; ++i)
+            {
+                batch[i].result.set_exception(std::current_exception());
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.requests += bsize;
+        m_stats.batches += 1;
+        m_stats.max_batch_seen = std::max(m_stats.max_batch_seen, bsize);
+    }
+
+public:
+    /// <summary>
+    /// Запуск сервера. Пока сервер работает, сетку нельзя использовать из других потоков.
+    /// </summary>
+    /// <param name="net"> - обученная сетка</param>
+    /// <param name="max_batch"> - максимальный размер батча</param>
+    /// <param name="max_delay_us"> - максимальное ожидание запроса в очереди, мкс</param>
+    BatchingServer(NeuralNetwork& net, int max_batch = 64, int max_delay_us = 1000) :
+        m_net(net),
+        m_max_batch(max_batch),
+        m_max_delay(std::chrono::microseconds(max_delay_us)),
+        m_in_size(net.count_layers() > 0 ? net.get_layers()[0]->in_size() : 0),
+        m_stop(false)
+    {
+        if (m_in_size <= 0)
+        {
+            throw std::invalid_argument("[class BatchingServer]: Network has no layers");
+        }
+
+        if (max_batch <= 0)
+        {
+            throw std::invalid_argument("[class BatchingServer]: Batch size must be positive");
+        }
+
+        m_worker = std::thread(&BatchingServer::run, this);
+    }
+
+    ~BatchingServer()
+    {
+        stop();
+    }
+
+    /// <summary>
+    /// Отправить одно наблюдение на инференс. Потокобезопасно.
+    /// </summary>
+    /// <param name="x"> - вектор признаков длины входа сетки</param>
+    /// <returns>future с выходом сетки для этого наблюдения</returns>
+    std::future<Vector> submit(const Vector& x)
+    {
+        if (x.size() != m_in_size)
+        {
+            throw std::invalid_argument("[class BatchingServer]: Input data have incorrect dimension");
+        }
+
+        Request req;
+        req.x = x;
+        req.arrived = Clock::now();
+        std::future<Vector> res = req.result.get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (m_stop)
+            {
+                throw std::logic_error("[class BatchingServer]: Server is stopped");
+            }
+
+            m_queue.push_back(std::move(req));
+        }
+
+        m_cond.notify_one();
+
+        return res;
+    }
+
+    /// <summary>
+    /// Остановка сервера. Запросы, уже стоящие в очереди, будут обработаны.
+    /// </summary>
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+
+        m_cond.notify_all();
+
+        if (m_worker.joinable())
+        {
+            m_worker.join();
+        }
+    }
+
+    BatchingStats stats()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+};
@@ -0,0 +1,120 @@
+///
+/// Точные активации против быстрых (Fast*, см. FastMath.h).
+///
+/// Сборка из каталога NeuralNetwork:
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/ActivationBench.cpp -o actbench
+///
+/// Сначала проверяет заявленные в FastMath.h максимальные ошибки перебором по сетке,
+/// по SIMD пакетам (unaryExpr) и по одному числу: fast_exp - относительная 3e-10 на
+/// [-708, 709], fast_tanh - абсолютная 3e-7 и fast_softplus - абсолютная 1.1e-8 на
+/// [-50, 50]. Затем меряет activate() пар активаций на матрице 256 x 4096.
+/// Код возврата 1 - ошибка больше заявленной.
+///
+
+# include "../DNN.h"
+# include <chrono>
+# include <cmath>
+# include <cstdio>
+# include <string>
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
+
+static double seconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static Scalar softplus(const Scalar x)
+{
+    return max(x, Scalar(0)) + log1p(exp(-fabs(x)));
+}
+
+/// <summary>
+/// Максимальная ошибка op против ref на сетке [lo, hi], relative - относительная
+/// </summary>
+template <typename Op, typename Ref>
+static bool check(const char* name, Op op, Ref ref, const Scalar lo, const Scalar hi,
+    const bool relative, const Scalar bound)
+{
+    const int n = 4000000;
+    const Array x = Array::LinSpaced(n, lo, hi);
+    const Array packet = x.unaryExpr(op);
+    Scalar worst = 0, at = lo;
+
+    for (int i = 0; i < n; ++i)
+    {
+        const Scalar exact = ref(x[i]);
+        const Scalar scale = relative ? fabs(exact) : Scalar(1);
+
+        // пакет и одно число
+        const Scalar err = max(fabs(packet[i] - exact), fabs(op(x[i]) - exact)) / scale;
+
+        if (err > worst) { worst = err; at = x[i]; }
+    }
+
+    printf("%-14s %-8s %10.3g %10.3g  at x = %.6g  %s\n", name, relative ? "rel" : "abs", worst, bound, at,
+        worst <= bound ? "ok" : "FAIL");
+
+    return worst <= bound;
+}
+
+/// <summary>
+/// Время activate() на элемент, лучшее из нескольких замеров
+/// </summary>
+template <typename Activation>
+static double time_activation(const Matrix& z, Matrix& a)
+{
+    double best = 1e30;
+
+    for (int r = 0; r < 10; ++r)
+    {
+        const double t0 = seconds();
+        Activation::activate(z, a);
+        best = min(best, seconds() - t0);
+    }
+
+    return best / z.size() * 1e9;
+}
+
+template <typename Exact, typename Fast>
+static void compare(const Matrix& z)
+{
+    Matrix a_exact(z.rows(), z.cols()), a_fast(z.rows(), z.cols());
+
+    const double t_exact = time_activation<Exact>(z, a_exact);
+    const double t_fast = time_activation<Fast>(z, a_fast);
+
+    printf("%-10s %12.2f %12.2f %9.2fx %14.3g\n", Exact::return_type().c_str(), t_exact, t_fast,
+        t_exact / t_fast, (a_exact - a_fast).cwiseAbs().maxCoeff());
+}
+
+int main()
+{
+    bool ok = true;
+
+    printf("%-14s %-8s %10s %10s\n", "function", "error", "max", "bound");
+
+    ok &= check("fast_exp", internal::fast_exp_op(), [](Scalar x) { return Scalar(exp(x)); },
+        -708, 709, true, 3e-10);
+    ok &= check("fast_tanh", internal::fast_tanh_op(), [](Scalar x) { return Scalar(tanh(x)); },
+        -50, 50, false, 3e-7);
+    ok &= check("fast_softplus", internal::fast_softplus_op(), softplus,
+        -50, 50, false, 1.1e-8);
+
+    // Значения вокруг нуля и хвосты, где работают и приближение, и насыщение
+    const Matrix z = Matrix::Random(256, 4096) * 6.0;
+
+    printf("\n%-10s %12s %12s %10s %14s\n", "activation", "exact, ns", "fast, ns", "speedup", "max abs diff");
+
+    compare<Sigmoid, FastSigmoid>(z);
+    compare<Tanh, FastTanh>(z);
+    compare<ELU, FastELU>(z);
+    compare<GELU, FastGELU>(z);
+    compare<Swish, FastSwish>(z);
+    compare<Softplus, FastSoftplus>(z);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,282 @@
+///
+/// Матрицы в MatrixArena против malloc: промахи dTLB, page faults и время.
+///
+/// Сборка из каталога NeuralNetwork (NN_USE_ARENA определен ниже, до заголовков):
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/ArenaBench.cpp -o arenabench -pthread
+///
+/// Каждый набор тестов идет трижды: malloc, арена на прозрачных больших страницах
+/// (ARENA_THP, по умолчанию) и арена на страницах 4 КБ:
+///   - batch buffers: 5 раз выделить и заполнить матрицу 256 МБ, как Z / A батча;
+///   - growing batch: матрицы 1024 x 256k, k = 1..16, как Z / A растущего батча -
+///     арена собирает следующую из слитых блоков прежних (reserved в статистике);
+///   - random reads: 16M чтений по случайным адресам матрицы 256 МБ;
+///   - SGD step: шаг SGD по весам и производным 32 + 32 МБ;
+///   - fit epoch: эпоха fit() сетки 512 - 1024 - 1024 - 10 на 8192 наблюдениях.
+/// Счетчики читаются через perf_event_open (только Linux): промахи dTLB на чтение
+/// и page faults. Если счетчик недоступен (нет PMU, например в виртуальной машине,
+/// или perf_event_paranoid), печатается n/a. Код возврата 1 - результат fit()
+/// в арене не совпал с malloc.
+///
+
+# define NN_USE_ARENA
+# include "../DNN.h"
+# include <chrono>
+# include <cstdio>
+# include <cstring>
+# include <fstream>
+# include <string>
+
+# ifdef __linux__
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# endif
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+static double seconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+///
+/// Один счетчик perf текущего процесса, -1 - недоступен
+///
+class PerfCounter
+{
+private:
+    int m_fd;
+
+public:
+    PerfCounter(const unsigned type, const unsigned long long config) :
+        m_fd(-1)
+    {
+# ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+
+        m_fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+# else
+        (void)type; (void)config;
+# endif
+    }
+
+    ~PerfCounter()
+    {
+# ifdef __linux__
+        if (m_fd >= 0) { close(m_fd); }
+# endif
+    }
+
+    void start()
+    {
+# ifdef __linux__
+        if (m_fd >= 0)
+        {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+# endif
+    }
+
+    long long stop()
+    {
+        long long value = -1;
+# ifdef __linux__
+        if (m_fd >= 0)
+        {
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+
+            if (read(m_fd, &value, sizeof(value)) != ssize_t(sizeof(value))) { value = -1; }
+        }
+# endif
+        return value;
+    }
+};
+
+# ifdef __linux__
+static PerfCounter dtlb_misses(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+static PerfCounter page_faults(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+# else
+static PerfCounter dtlb_misses(0, 0);
+static PerfCounter page_faults(0, 0);
+# endif
+
+static string counter(const long long value)
+{
+    return value < 0 ? string("n/a") : to_string(value);
+}
+
+/// <summary>
+/// Замер f: время лучшего из reps запусков, счетчики - за этот запуск
+/// </summary>
+template <typename Func>
+static void measure(const char* mode, const char* test, const int reps, Func f)
+{
+    double best = 1e30;
+    long long best_tlb = -1, best_faults = -1;
+
+    for (int r = 0; r < reps; ++r)
+    {
+        dtlb_misses.start();
+        page_faults.start();
+
+        const double t0 = seconds();
+        f();
+        const double t = seconds() - t0;
+
+        const long long tlb = dtlb_misses.stop();
+        const long long faults = page_faults.stop();
+
+        if (t < best) { best = t; best_tlb = tlb; best_faults = faults; }
+    }
+
+    printf("%-10s %-15s %10.2f %14s %12s\n", mode, test, best * 1e3, counter(best_tlb).c_str(), counter(best_faults).c_str());
+}
+
+/// <summary>
+/// AnonHugePages процесса в МБ, -1 - нет /proc/self/smaps_rollup
+/// </summary>
+static long anon_huge_mb()
+{
+    ifstream in("/proc/self/smaps_rollup");
+    string line;
+
+    while (getline(in, line))
+    {
+        if (line.compare(0, 14, "AnonHugePages:") == 0) { return atol(line.c_str() + 14) / 1024; }
+    }
+
+    return -1;
+}
+
+static Matrix run(const char* mode, const vector<uint32_t>& index)
+{
+    // batch buffers: освобожденный блок арены берет следующий батч того же размера,
+    // и в установившемся режиме (лучший из 3 запусков) страницы уже отображены
+    measure(mode, "batch buffers", 3, [&]()
+    {
+        for (int b = 0; b < 5; ++b)
+        {
+            Matrix z(4096, 8192);
+            z.setConstant(Scalar(b));
+        }
+    });
+
+    // growing batch: без слияния каждая следующая матрица брала бы новый блок, 272 МБ на все
+    measure(mode, "growing batch", 3, [&]()
+    {
+        for (int k = 1; k <= 16; ++k)
+        {
+            Matrix z(1024, 256 * k);
+            z.setConstant(Scalar(k));
+        }
+    });
+
+    {
+        Matrix big = Matrix::Random(4096, 8192);
+        const Scalar* data = big.data();
+        volatile Scalar sink = 0;
+
+        measure(mode, "random reads", 3, [&]()
+        {
+            Scalar s = 0;
+
+            for (size_t i = 0; i < index.size(); ++i) { s += data[index[i]]; }
+
+            sink = sink + s;
+        });
+    }
+
+    {
+        Matrix w = Matrix::Random(2048, 2048), dw = Matrix::Random(2048, 2048);
+        SGD opt(0.001);
+
+        measure(mode, "SGD step", 5, [&]()
+        {
+            Vector::AlignedMapType wv(w.data(), w.size());
+            Vector::ConstAlignedMapType dv(dw.data(), dw.size());
+
+            for (int k = 0; k < 10; ++k) { opt.update(dv, wv); }
+        });
+    }
+
+    NeuralNetwork net;
+    net.add_layer(new FullyConnected<ReLU>(512, 1024));
+    net.add_layer(new FullyConnected<ReLU>(1024, 1024));
+    net.add_layer(new FullyConnected<Identity>(1024, 10));
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.01, 7);
+
+    srand(5);
+    const Matrix x = Matrix::Random(512, 8192), y = Matrix::Random(10, 8192);
+    SGD opt(0.001);
+
+    // Первая эпоха выделяет буферы слоев, меряется вторая
+    net.fit(opt, x, y, 256, 1, 3);
+    measure(mode, "fit epoch", 1, [&]() { net.fit(opt, x, y, 256, 1, 4); });
+
+    printf("%-10s AnonHugePages %ld MB\n", mode, anon_huge_mb());
+
+    return net.predict(x.leftCols(64));
+}
+
+static void print_stats(const MatrixArena& arena)
+{
+    const ArenaStats s = arena.stats();
+
+    printf("           chunks %zu, reserved %zu MB, huge %zu MB, peak %zu MB, allocations %zu, reused %zu, frees %zu, merged %zu\n",
+        s.chunks, s.reserved_bytes >> 20, s.huge_bytes >> 20, s.peak_bytes >> 20, s.allocations, s.reused, s.frees,
+        s.merged);
+}
+
+int main()
+{
+    // Случайные индексы матрицы 4096 x 8192
+    vector<uint32_t> index(size_t(1) << 24);
+    uint64_t state = 88172645463325252ull;
+
+    for (size_t i = 0; i < index.size(); ++i)
+    {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        index[i] = uint32_t(state % (uint64_t(4096) * 8192));
+    }
+
+    printf("%-10s %-15s %10s %14s %12s\n", "memory", "test", "time, ms", "dTLB misses", "page faults");
+
+    const Matrix ref = run("malloc", index);
+    bool ok = true;
+
+    for (int m = 0; m < 2; ++m)
+    {
+        ArenaOptions opts;
+        opts.pages = m == 0 ? ARENA_THP : ARENA_SMALL_PAGES;
+
+        MatrixArena arena(opts);
+        const char* mode = m == 0 ? "arena 2M" : "arena 4K";
+        {
+            ArenaScope scope(arena);
+            const Matrix p = run(mode, index);
+
+            if ((p - ref).cwiseAbs().maxCoeff() > 0)
+            {
+                printf("%s: fit() result differs from malloc\n", mode);
+                ok = false;
+            }
+        }
+
+        print_stats(arena);
+    }
+
+    return ok ? 0 : 1;
+}
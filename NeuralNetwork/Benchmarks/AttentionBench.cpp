@@ -0,0 +1,147 @@
+///
+/// Forward + backprop MultiHeadAttention против наивного внимания.
+///
+/// Сборка из каталога NeuralNetwork:
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/AttentionBench.cpp -o attbench
+///
+/// Наивный вариант строит матрицу вероятностей (время x время) целиком и хранит ее
+/// до backprop. Слой идет блоками по 128 с онлайн softmax: как создан (default_gemm_backend()),
+/// с GEMM_EIGEN и с GEMM_DISPATCH. Одна голова размера 64, вход 64, длина 1024 - 8192,
+/// время - лучшее из 3 запусков forward + backprop. Код возврата 1 - выход или производная
+/// входа расходятся с наивным вариантом.
+///
+
+# include "../DNN.h"
+# include <chrono>
+# include <cmath>
+# include <cstdio>
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+typedef Eigen::Matrix<Scalar, 1, Eigen::Dynamic> RowVector;
+
+static double seconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// <summary>
+/// Лучшее время из нескольких запусков
+/// </summary>
+template <typename Func>
+static double best_time(Func f)
+{
+    double best = 1e30;
+
+    for (int r = 0; r < 3; ++r)
+    {
+        const double t0 = seconds();
+        f();
+        best = min(best, seconds() - t0);
+    }
+
+    return best;
+}
+
+///
+/// Одна голова, одна последовательность, матрица вероятностей целиком
+///
+struct NaiveAttention
+{
+    Matrix wq, wk, wv, wo;
+    Vector bo;
+    Matrix q, k, v, o, p, y, din;
+
+    explicit NaiveAttention(const vector<Scalar>& param, const int in_size, const int out_size)
+    {
+        const Scalar* it = param.data();
+
+        wq = Eigen::Map<const Matrix>(it, in_size, out_size); it += wq.size();
+        wk = Eigen::Map<const Matrix>(it, in_size, out_size); it += wk.size();
+        wv = Eigen::Map<const Matrix>(it, in_size, out_size); it += wv.size();
+        wo = Eigen::Map<const Matrix>(it, out_size, out_size); it += wo.size();
+        bo = Eigen::Map<const Vector>(it, out_size);
+    }
+
+    void forward(const Matrix& x)
+    {
+        q.noalias() = wq.transpose() * x;
+        k.noalias() = wk.transpose() * x;
+        v.noalias() = wv.transpose() * x;
+
+        p.noalias() = k.transpose() * q / sqrt(Scalar(q.rows()));
+        const RowVector max = p.colwise().maxCoeff();
+        p = (p.array().rowwise() - max.array()).exp();
+        p.array().rowwise() /= p.colwise().sum().array();
+
+        o.noalias() = v * p;
+        y.noalias() = wo.transpose() * o;
+        y.colwise() += bo;
+    }
+
+    void backprop(const Matrix& dy)
+    {
+        const Matrix dout = wo * dy;
+        const Matrix dv = dout * p.transpose();
+        Matrix ds = v.transpose() * dout;
+        const RowVector delta = (ds.array() * p.array()).colwise().sum();
+
+        ds.array() = p.array() * (ds.array().rowwise() - delta.array()) / sqrt(Scalar(q.rows()));
+
+        const Matrix dq = k * ds;
+        const Matrix dk = q * ds.transpose();
+
+        din.noalias() = wq * dq;
+        din.noalias() += wk * dk;
+        din.noalias() += wv * dv;
+    }
+};
+
+int main()
+{
+    const int in_size = 64, out_size = 64, block = 128;
+    bool ok = true;
+
+    printf("default GEMM: %s\n", default_gemm_backend() == GEMM_DISPATCH ? "GEMM_DISPATCH" : "GEMM_EIGEN");
+    printf("%6s %12s %12s %12s %12s %10s %10s %10s\n", "T", "naive, ms", "default, ms", "eigen, ms", "dispatch, ms",
+        "default", "eigen", "dispatch");
+
+    for (int T : { 1024, 2048, 4096, 8192 })
+    {
+        const Matrix x = Matrix::Random(in_size, T);
+
+        MultiHeadAttention layer(in_size, out_size, T, 1, false, block);
+        RNG rng(1);
+        layer.init(0, 0.1, rng);
+
+        NaiveAttention naive(layer.get_parametrs(), in_size, out_size);
+
+        const double t_naive = best_time([&]() { naive.forward(x); naive.backprop(naive.y); });
+
+        // первый проход - слой как создан, без set_gemm
+        double t_layer[3];
+        const GemmBackend backends[] = { layer.gemm_backend(), GEMM_EIGEN, GEMM_DISPATCH };
+
+        for (int b = 0; b < 3; ++b)
+        {
+            layer.set_gemm(backends[b], WEIGHT_IN_OUT);
+            t_layer[b] = best_time([&]() { layer.forward(x); layer.backprop(x, naive.y); });
+
+            const Scalar err_y = (layer.output() - naive.y).cwiseAbs().maxCoeff();
+            const Scalar err_din = (layer.backprop_data() - naive.din).cwiseAbs().maxCoeff();
+
+            if (err_y > 1e-10 || err_din > 1e-10)
+            {
+                printf("T = %d: blocked attention differs from naive (output %g, input derivative %g)\n", T, err_y, err_din);
+                ok = false;
+            }
+        }
+
+        printf("%6d %12.1f %12.1f %12.1f %12.1f %9.2fx %9.2fx %9.2fx\n", T, t_naive * 1e3, t_layer[0] * 1e3,
+            t_layer[1] * 1e3, t_layer[2] * 1e3, t_naive / t_layer[0], t_naive / t_layer[1], t_naive / t_layer[2]);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+///
+/// Нагрузочный тест BatchingServer.
+///
+/// Сборка из каталога NeuralNetwork:
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/BatchingServerBench.cpp -o batching_bench -pthread
+///
+/// Запуск: batching_bench [производителей = 16] [секунд на настройку = 2]
+///
+/// Каждый производитель в замкнутом цикле отправляет одно наблюдение и ждет
+/// результат, так что в очереди не больше N запросов. Для нескольких пар
+/// max_batch / max_delay печатаются p50 и p99 задержки от submit до get,
+/// пропускная способность и средний собранный батч. Строка max_batch = 1 -
+/// инференс по одному наблюдению без батчинга.
+///
+
+# include "../DNN.h"
+# include <algorithm>
+# include <chrono>
+# include <cstdio>
+# include <cstdlib>
+# include <thread>
+# include <vector>
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+typedef chrono::steady_clock Clock;
+
+struct LoadResult
+{
+    double p50_us;
+    double p99_us;
+    double throughput;
+    double mean_batch;
+};
+
+static LoadResult run_load(NeuralNetwork& net, const Matrix& inputs, const int producers, const double seconds,
+    const int max_batch, const int max_delay_us)
+{
+    BatchingServer server(net, max_batch, max_delay_us);
+    vector<vector<double> > latencies(producers);
+    vector<thread> threads;
+
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point deadline = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(seconds));
+
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.push_back(thread([&, p]() {
+            vector<double>& lat = latencies[p];
+            Eigen::Index col = p;
+
+            while (Clock::now() < deadline)
+            {
+                const Vector x = inputs.col(col);
+                col = (col + producers) % inputs.cols();
+
+                const Clock::time_point t0 = Clock::now();
+                server.submit(x).get();
+                lat.push_back(chrono::duration<double, micro>(Clock::now() - t0).count());
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+
+    const double elapsed = chrono::duration<double>(Clock::now() - start).count();
+    server.stop();
+
+    vector<double> all;
+
+    for (int p = 0; p < producers; ++p) { all.insert(all.end(), latencies[p].begin(), latencies[p].end()); }
+
+    sort(all.begin(), all.end());
+
+    LoadResult res;
+    res.p50_us = all.empty() ? 0.0 : all[all.size() / 2];
+    res.p99_us = all.empty() ? 0.0 : all[min(all.size() - 1, all.size() * 99 / 100)];
+    res.throughput = double(all.size()) / elapsed;
+    res.mean_batch = server.stats().mean_batch_size();
+
+    return res;
+}
+
+int main(int argc, char** argv)
+{
+    const int producers = argc > 1 ? atoi(argv[1]) : 16;
+    const double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+
+    if (producers <= 0 || seconds <= 0)
+    {
+        fprintf(stderr, "usage: %s [producers > 0] [seconds > 0]\n", argv[0]);
+        return 1;
+    }
+
+    const int in_size = 256;
+
+    NeuralNetwork net;
+    net.add_layer(new FullyConnected<ReLU>(in_size, 512));
+    net.add_layer(new FullyConnected<ReLU>(512, 512));
+    net.add_layer(new FullyConnected<Identity>(512, 10));
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.05, 1);
+
+    const Matrix inputs = Matrix::Random(in_size, 1024);
+
+    const int configs[][2] = { { 1, 0 }, { 8, 100 }, { 16, 200 }, { 32, 500 }, { 64, 1000 }, { 64, 5000 } };
+
+    printf("producers %d, %.1f s per setting, net %d-512-512-10\n", producers, seconds, in_size);
+    printf("%9s %12s %10s %10s %12s %10s\n", "max_batch", "max_delay_us", "p50_us", "p99_us", "req/s", "avg_batch");
+
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); ++c)
+    {
+        const LoadResult r = run_load(net, inputs, producers, seconds, configs[c][0], configs[c][1]);
+
+        printf("%9d %12d %10.0f %10.0f %12.0f %10.1f\n", configs[c][0], configs[c][1],
+            r.p50_us, r.p99_us, r.throughput, r.mean_batch);
+    }
+
+    return 0;
+}
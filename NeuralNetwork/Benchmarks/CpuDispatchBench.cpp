@@ -0,0 +1,183 @@
+///
+/// Ядра CpuDispatch.h на каждом уровне против выражений Eigen (CPU_GENERIC).
+///
+/// Сборка из каталога NeuralNetwork:
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/CpuDispatchBench.cpp -o dispbench
+///
+/// Для каждого уровня, который поддерживает процессор, сравнивает с CPU_GENERIC
+/// активации с экспонентой и их производные, exp со сдвигом по столбцам (softmax
+/// внимания, с -inf маски причинности), сумму квадратов и GEMM с beta = 0, 1
+/// и 0.5, и меряет время ядра на матрице 256 x 4096 (z из [-20, 20] и краевые
+/// значения: 0, +-1e-300, +-40, +-700, -745). Ошибка - |x - ref| / max(|ref|, 1),
+/// допуск 1e-14 для поэлементных ядер и 1e-12 для сумм. Код возврата 1 - ошибка
+/// больше допуска.
+///
+
+# include "../DNN.h"
+# include <chrono>
+# include <cmath>
+# include <cstdio>
+# include <limits>
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef internal::CpuKernels<Scalar> Kernels;
+
+typedef void (*Unary)(const Scalar*, ptrdiff_t, Scalar*, ptrdiff_t, int, int);
+typedef void (*Jacobian)(const Scalar*, ptrdiff_t, const Scalar*, ptrdiff_t, const Scalar*, ptrdiff_t,
+    Scalar*, ptrdiff_t, int, int);
+
+static double seconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// <summary>
+/// Лучшее время из нескольких запусков
+/// </summary>
+template <typename Func>
+static double best_time(Func f)
+{
+    double best = 1e30;
+
+    for (int r = 0; r < 5; ++r)
+    {
+        const double t0 = seconds();
+        f();
+        best = min(best, seconds() - t0);
+    }
+
+    return best;
+}
+
+static Scalar max_error(const Matrix& x, const Matrix& ref)
+{
+    return ((x - ref).array().abs() / ref.array().abs().max(Scalar(1))).maxCoeff();
+}
+
+static bool report(const char* name, const double t_generic, const double t_level, const Scalar err, const Scalar bound)
+{
+    printf("%-18s %10.3f %10.3f %8.2fx %11.3g  %s\n", name, t_generic * 1e3, t_level * 1e3, t_generic / t_level, err,
+        err <= bound ? "ok" : "FAIL");
+
+    return err <= bound;
+}
+
+int main()
+{
+    const int rows = 256, cols = 4096;
+    bool ok = true;
+
+    srand(11);
+
+    Matrix z = Matrix::Random(rows, cols) * 20.0;
+    const Scalar edges[] = { 0, 1e-300, -1e-300, 40, -40, 700, -700, -745 };
+
+    // краевые значения в первом столбце, нечетное число строк в срезе - хвост короче вектора
+    for (int i = 0; i < 8; ++i) { z(i, 0) = edges[i]; }
+
+    const Matrix f = Matrix::Random(rows, cols);
+    const Kernels generic = internal::make_cpu_kernels<Scalar>(CPU_GENERIC);
+
+    const char* unary_names[] = { "sigmoid", "tanh", "swish", "elu", "softplus", "gelu" };
+    Unary Kernels::* unary[] = { &Kernels::sigmoid, &Kernels::tanh, &Kernels::swish, &Kernels::elu,
+        &Kernels::softplus, &Kernels::gelu };
+
+    const char* jacobian_names[] = { "swish_jacobian", "gelu_jacobian" };
+    Jacobian Kernels::* jacobian[] = { &Kernels::swish_jacobian, &Kernels::gelu_jacobian };
+
+    for (int level = CPU_AVX2; level <= CPU_AVX512; ++level)
+    {
+        if (level > cpu_level_supported()) { continue; }
+
+        const Kernels k = internal::make_cpu_kernels<Scalar>(CpuLevel(level));
+
+        printf("\nlevel %s\n%-18s %10s %10s %9s %11s\n", cpu_level_name(CpuLevel(level)), "kernel",
+            "generic, ms", "level, ms", "speedup", "max error");
+
+        Matrix ref(rows, cols), res(rows, cols);
+
+        for (int u = 0; u < 6; ++u)
+        {
+            const double tg = best_time([&]() { (generic.*unary[u])(z.data(), rows, ref.data(), rows, rows, cols); });
+            const double tl = best_time([&]() { (k.*unary[u])(z.data(), rows, res.data(), rows, rows, cols); });
+            ok &= report(unary_names[u], tg, tl, max_error(res, ref), 1e-14);
+
+            // срез с нечетным числом строк: хвосты столбцов
+            Matrix part = Matrix::Zero(rows, cols);
+            (k.*unary[u])(z.data() + 1, rows, part.data(), rows, rows - 3, 7);
+
+            if (max_error(part.topLeftCorner(rows - 3, 7), ref.block(1, 0, rows - 3, 7)) > 1e-14 ||
+                part.bottomRows(3).cwiseAbs().maxCoeff() != 0)
+            {
+                printf("%s: column tail differs\n", unary_names[u]);
+                ok = false;
+            }
+        }
+
+        // производные: A - выход активации на том же уровне
+        for (int j = 0; j < 2; ++j)
+        {
+            Matrix a(rows, cols);
+            (j == 0 ? k.swish : k.gelu)(z.data(), rows, a.data(), rows, rows, cols);
+
+            const double tg = best_time([&]() {
+                (generic.*jacobian[j])(z.data(), rows, a.data(), rows, f.data(), rows, ref.data(), rows, rows, cols); });
+            const double tl = best_time([&]() {
+                (k.*jacobian[j])(z.data(), rows, a.data(), rows, f.data(), rows, res.data(), rows, rows, cols); });
+            ok &= report(jacobian_names[j], tg, tl, max_error(res, ref), 1e-14);
+        }
+
+        {
+            Matrix a(rows, cols);
+            k.softplus(z.data(), rows, a.data(), rows, rows, cols);
+
+            const double tg = best_time([&]() { generic.softplus_jacobian(a.data(), rows, f.data(), rows, ref.data(), rows, rows, cols); });
+            const double tl = best_time([&]() { k.softplus_jacobian(a.data(), rows, f.data(), rows, res.data(), rows, rows, cols); });
+            ok &= report("softplus_jacobian", tg, tl, max_error(res, ref), 1e-14);
+        }
+
+        {
+            // сдвиг - максимум столбца, как в softmax; -inf - маска причинности
+            const Eigen::Matrix<Scalar, 1, Eigen::Dynamic> shift = z.colwise().maxCoeff();
+            Matrix zm = z;
+            zm.topRightCorner(5, 3).setConstant(-numeric_limits<Scalar>::infinity());
+
+            const double tg = best_time([&]() { generic.exp_shifted(zm.data(), rows, shift.data(), ref.data(), rows, rows, cols); });
+            const double tl = best_time([&]() { k.exp_shifted(zm.data(), rows, shift.data(), res.data(), rows, rows, cols); });
+            ok &= report("exp_shifted", tg, tl, max_error(res, ref), 1e-14);
+        }
+
+        {
+            Scalar s_generic = 0, s_level = 0;
+
+            const double tg = best_time([&]() { s_generic = generic.squared_norm(f.data(), f.size()); });
+            const double tl = best_time([&]() { s_level = k.squared_norm(f.data(), f.size()); });
+            ok &= report("squared_norm", tg, tl, fabs(s_level - s_generic) / max(fabs(s_generic), Scalar(1)), 1e-12);
+        }
+
+        // GEMM: C = alpha * A * B^T + beta * C
+        const Matrix a = Matrix::Random(300, 200), b = Matrix::Random(100, 200), c0 = Matrix::Random(300, 100);
+        const Scalar betas[] = { 0, 1, 0.5 };
+
+        for (int i = 0; i < 3; ++i)
+        {
+            Matrix cg = c0, cl = c0;
+            const Scalar beta = betas[i];
+            char name[32];
+
+            const double tg = best_time([&]() {
+                cg = c0; generic.gemm(false, true, 300, 100, 200, 0.7, a.data(), 300, b.data(), 100, beta, cg.data(), 300); });
+            const double tl = best_time([&]() {
+                cl = c0; k.gemm(false, true, 300, 100, 200, 0.7, a.data(), 300, b.data(), 100, beta, cl.data(), 300); });
+
+            snprintf(name, sizeof(name), "gemm, beta %g", beta);
+            ok &= report(name, tg, tl, max_error(cl, cg), 1e-12);
+        }
+    }
+
+    printf("\ndefault GEMM: %s\n", default_gemm_backend() == GEMM_DISPATCH ? "GEMM_DISPATCH" : "GEMM_EIGEN");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+///
+/// Проверка распределенного обучения: TcpRing и ShmCommunicator в нескольких процессах.
+///
+/// Сборка из каталога NeuralNetwork (только POSIX - процессы через fork()):
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/DistributedCheck.cpp -o distcheck -pthread
+///   ./distcheck [кол-во процессов, по умолчанию 3]
+///
+/// Для каждого обмена запускает процессы на 127.0.0.1 (TcpRing - на портах от
+/// случайного базового, ShmCommunicator - с маленьким слотом, чтобы вектор шел
+/// кусками) и в каждом процессе проверяет:
+///   - allreduce_sum: сумма векторов всех процессов (длина не делится на их число)
+///     совпадает с последовательной суммой, результат побитово одинаков у всех;
+///   - broadcast: вектор последнего процесса приходит всем побитово;
+///   - fit_distributed: один шаг SGD на частях батча дает те же веса, что шаг
+///     train_batch() одного процесса на объединенном батче (разница в порядке
+///     суммирования), а после нескольких эпох по батчам веса всех процессов
+///     побитово одинаковы.
+/// Начальные веса процессов разные - fit_distributed() должен разослать веса
+/// процесса 0. Код возврата 1 - хотя бы одна проверка не прошла в одном из процессов.
+///
+
+# include "../DNN.h"
+# include "../TcpRing.h"
+# include "../ShmCommunicator.h"
+# include <cmath>
+# include <cstdio>
+# include <cstring>
+# include <memory>
+# include <string>
+# include <sys/wait.h>
+# include <unistd.h>
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+static const int NOBS = 48;        // наблюдений на процесс
+static const int NVEC = 100003;    // длина вектора all-reduce
+static const Scalar LRATE = 0.1;
+
+/// <summary>
+/// Вектор процесса rank: одинаковый при каждом вызове, разный у процессов
+/// </summary>
+static Vector rank_vector(const int rank)
+{
+    srand(100 + rank);
+    return Vector::Random(NVEC);
+}
+
+static void build(NeuralNetwork& net, const int seed)
+{
+    net.add_layer(new FullyConnected<Tanh>(8, 16));
+    net.add_layer(new FullyConnected<Sigmoid>(16, 16));
+    net.add_layer(new FullyConnected<Identity>(16, 2));
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.5, seed);
+}
+
+static vector<Scalar> parameters(const NeuralNetwork& net)
+{
+    vector<Scalar> res;
+
+    for (Layer* layer : net.get_layers())
+    {
+        const vector<Scalar> p = layer->get_parametrs();
+        res.insert(res.end(), p.begin(), p.end());
+    }
+
+    return res;
+}
+
+/// <summary>
+/// Побитово ли совпадает вектор у всех процессов: сравнение с копией процесса 0
+/// </summary>
+static bool same_on_all_ranks(Communicator& comm, const Scalar* data, const int n)
+{
+    vector<Scalar> root(data, data + n);
+    comm.broadcast(&root[0], n, 0);
+
+    const bool same = memcmp(&root[0], data, n * sizeof(Scalar)) == 0;
+
+    // сравнение должно пройти у всех: иначе один процесс ошибся бы, а остальные нет
+    Scalar differ = same ? 0 : 1;
+    comm.allreduce_sum(&differ, 1);
+
+    return differ == 0;
+}
+
+static bool check(const char* name, const bool passed, const int rank, const char* what)
+{
+    if (!passed) { printf("%s, rank %d: %s\n", name, rank, what); }
+
+    return passed;
+}
+
+/// <summary>
+/// Все проверки в одном процессе
+/// </summary>
+static bool run_rank(const char* name, Communicator& comm)
+{
+    const int rank = comm.rank();
+    const int size = comm.size();
+    bool ok = true;
+
+    // allreduce_sum
+    Vector sum = rank_vector(rank);
+    comm.allreduce_sum(sum.data(), NVEC);
+
+    Vector ref = Vector::Zero(NVEC);
+    for (int r = 0; r < size; ++r) { ref += rank_vector(r); }
+
+    const Scalar err_sum = (sum - ref).cwiseAbs().maxCoeff();
+    ok &= check(name, err_sum < 1e-13, rank, "allreduce_sum differs from the serial sum");
+    ok &= check(name, same_on_all_ranks(comm, sum.data(), NVEC), rank, "allreduce_sum differs between ranks");
+
+    // broadcast с последнего процесса
+    Vector bcast = rank_vector(rank);
+    comm.broadcast(bcast.data(), NVEC, size - 1);
+
+    const Vector root = rank_vector(size - 1);
+    ok &= check(name, memcmp(bcast.data(), root.data(), NVEC * sizeof(Scalar)) == 0, rank,
+        "broadcast differs from the root vector");
+
+    // Данные у всех одинаковые, процесс берет свою часть столбцов
+    srand(7);
+    const Matrix x = Matrix::Random(8, NOBS * size);
+    const Matrix y = Matrix::Random(2, NOBS * size);
+    const Matrix x_local = x.middleCols(rank * NOBS, NOBS);
+    const Matrix y_local = y.middleCols(rank * NOBS, NOBS);
+
+    // Один шаг на батче из всех наблюдений процесса против шага на объединенном батче
+    NeuralNetwork single;
+    build(single, 1);
+    SGD opt_single(LRATE);
+    single.train_batch(opt_single, x, y);
+
+    NeuralNetwork dist;
+    build(dist, 1 + rank);
+    SGD opt(LRATE);
+    dist.fit_distributed(opt, x_local, y_local, NOBS, 1, comm, 3);
+
+    const vector<Scalar> w_single = parameters(single);
+    const vector<Scalar> w_dist = parameters(dist);
+    Scalar err_grad = 0;
+
+    for (size_t i = 0; i < w_single.size(); ++i)
+    {
+        err_grad = max(err_grad, fabs(w_dist[i] - w_single[i]) / LRATE);
+    }
+
+    ok &= check(name, err_grad < 1e-12, rank, "distributed gradient differs from the combined batch");
+
+    // Несколько эпох по батчам: веса расходятся, если хоть один обмен не побитовый
+    dist.fit_distributed(opt, x_local, y_local, 8, 5, comm, 3);
+
+    const vector<Scalar> w = parameters(dist);
+    const bool same = same_on_all_ranks(comm, &w[0], w.size());
+    ok &= check(name, same, rank, "weights after fit_distributed differ between ranks");
+
+    if (rank == 0)
+    {
+        printf("%-6s %6d %14.3g %14.3g %14s\n", name, size, err_sum, err_grad, same ? "identical" : "DIFFER");
+    }
+
+    return ok;
+}
+
+/// <summary>
+/// size процессов, в каждом свой обмен make(rank) и все проверки
+/// </summary>
+template <typename Make>
+static bool spawn(const char* name, const int size, Make make)
+{
+    vector<pid_t> pids;
+
+    fflush(stdout);
+
+    for (int r = 0; r < size; ++r)
+    {
+        const pid_t pid = fork();
+
+        if (pid < 0)
+        {
+            perror("fork");
+            break;
+        }
+
+        if (pid == 0)
+        {
+            bool ok = false;
+
+            try
+            {
+                unique_ptr<Communicator> comm(make(r));
+                ok = run_rank(name, *comm);
+            }
+            catch (const exception& e)
+            {
+                printf("%s, rank %d: %s\n", name, r, e.what());
+            }
+
+            fflush(stdout);
+            _exit(ok ? 0 : 1);
+        }
+
+        pids.push_back(pid);
+    }
+
+    bool ok = int(pids.size()) == size;
+
+    for (size_t i = 0; i < pids.size(); ++i)
+    {
+        int status = 0;
+        waitpid(pids[i], &status, 0);
+        ok &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    const int size = argc > 1 ? atoi(argv[1]) : 3;
+
+    if (size < 2)
+    {
+        printf("need at least 2 processes\n");
+        return 1;
+    }
+
+    // Свои порт и имя сегмента на запуск, чтобы не столкнуться с параллельным запуском
+    const int base_port = 20000 + int(getpid() % 20000);
+    const string shm_name = "dnn_check_" + to_string(getpid());
+
+    printf("%-6s %6s %14s %14s %14s\n", "comm", "ranks", "allreduce err", "gradient err", "weights");
+
+    bool ok = spawn("tcp", size, [&](const int rank) -> Communicator* {
+        return new TcpRing(rank, size, base_port); });
+
+    ok &= spawn("shm", size, [&](const int rank) -> Communicator* {
+        return new ShmCommunicator(rank, size, shm_name, 4096); });
+
+    return ok ? 0 : 1;
+}
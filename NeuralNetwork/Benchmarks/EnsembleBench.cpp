@@ -0,0 +1,100 @@
+///
+/// Прогноз ансамбля из 20 моделей против 20 отдельных predict().
+///
+/// Сборка из каталога NeuralNetwork:
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/EnsembleBench.cpp -o ensbench -pthread
+///
+/// Модели 64 -> 128 -> 64 -> 3 (ReLU, ReLU, Sigmoid), выход - среднее. Для каждого
+/// размера батча меряются отдельные predict() и Ensemble::predict() с GEMM Eigen
+/// и GEMM_DISPATCH (по умолчанию выше CPU_GENERIC): у ансамбля с ним веса упакованы заранее, и слой -
+/// один пакет GEMM на все модели. Код возврата 1 - ансамбль расходится с моделями.
+///
+
+# include "../DNN.h"
+# include <chrono>
+# include <cstdio>
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+static double seconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static Matrix predict_separate(vector<NeuralNetwork*>& models, const Matrix& x)
+{
+    Matrix res = Matrix::Zero(3, x.cols());
+
+    for (size_t k = 0; k < models.size(); ++k) { res += models[k]->predict(x); }
+
+    return res / Scalar(models.size());
+}
+
+int main()
+{
+    const int nmodel = 20, in_size = 64;
+    vector<NeuralNetwork*> models;
+
+    for (int k = 0; k < nmodel; ++k)
+    {
+        NeuralNetwork* net = new NeuralNetwork();
+        net->add_layer(new FullyConnected<ReLU>(in_size, 128));
+        net->add_layer(new FullyConnected<ReLU>(128, 64));
+        net->add_layer(new FullyConnected<Sigmoid>(64, 3));
+        net->set_output(new RegressionMSE());
+        net->init(0, 0.2, k + 1);
+        models.push_back(net);
+    }
+
+    Ensemble ensemble;
+
+    for (int k = 0; k < nmodel; ++k) { ensemble.add_model(*models[k]); }
+
+    const GemmBackend backends[] = { GEMM_EIGEN, GEMM_DISPATCH };
+    const char* names[] = { "eigen", "dispatch" };
+    bool ok = true;
+
+    printf("%6s %10s %14s %14s %9s\n", "batch", "gemm", "separate, ms", "ensemble, ms", "speedup");
+
+    for (int n : { 1, 8, 64, 1024 })
+    {
+        const Matrix x = Matrix::Random(in_size, n);
+        const int reps = max(5, 2000 / n);
+
+        for (int b = 0; b < 2; ++b)
+        {
+            for (int k = 0; k < nmodel; ++k) { models[k]->set_gemm(backends[b]); }
+            ensemble.set_gemm(backends[b]);
+
+            const Scalar err = (ensemble.predict(x) - predict_separate(models, x)).cwiseAbs().maxCoeff();
+
+            if (err > 1e-12)
+            {
+                printf("batch %d, %s: ensemble differs from models by %g\n", n, names[b], err);
+                ok = false;
+            }
+
+            double t_separate = 1e30, t_ensemble = 1e30;
+
+            for (int r = 0; r < reps; ++r)
+            {
+                double t0 = seconds();
+                predict_separate(models, x);
+                t_separate = min(t_separate, seconds() - t0);
+
+                t0 = seconds();
+                ensemble.predict(x);
+                t_ensemble = min(t_ensemble, seconds() - t0);
+            }
+
+            printf("%6d %10s %14.3f %14.3f %8.2fx\n", n, names[b], t_separate * 1e3, t_ensemble * 1e3,
+                t_separate / t_ensemble);
+        }
+    }
+
+    for (int k = 0; k < nmodel; ++k) { delete models[k]; }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+///
+/// Проверка export_cpp(): сгенерированный заголовок компилируется отдельно
+/// и считает то же, что NeuralNetwork::predict().
+///
+/// Сборка и запуск из каталога NeuralNetwork:
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/ExportCheck.cpp -o export_check
+///   ./export_check [компилятор, по умолчанию $CXX или g++]
+///
+/// Программа строит сетки со всеми экспортируемыми активациями, пишет в текущий
+/// каталог их заголовки (export_check_m0.h ...) и эталонные входы и выходы predict()
+/// (export_check_data.h), затем собирает этот же файл с NN_EXPORT_CHECK - без
+/// библиотеки и Eigen, только с заголовками - и запускает. Выход заголовка должен
+/// совпасть с predict() с точностью float. Код возврата 1 - расхождение или ошибка сборки.
+///
+
+# ifndef NN_EXPORT_CHECK
+
+# include "../DNN.h"
+# include <cstdio>
+# include <cstdlib>
+# include <fstream>
+# include <string>
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+static void write_matrix(ostream& out, const char* name, const Matrix& m)
+{
+    char buf[32];
+
+    out << "    constexpr double " << name << "[" << m.cols() << "][" << m.rows() << "] = {\n";
+
+    for (Eigen::Index j = 0; j < m.cols(); ++j)
+    {
+        out << "        {";
+
+        for (Eigen::Index i = 0; i < m.rows(); ++i)
+        {
+            snprintf(buf, sizeof(buf), "%.17g", double(m(i, j)));
+            out << (i ? ", " : " ") << buf;
+        }
+
+        out << " },\n";
+    }
+
+    out << "    };\n";
+}
+
+int main(int argc, char** argv)
+{
+    const int nsample = 64;
+    vector<NeuralNetwork*> nets(3);
+
+    // Все активации export_activation(), по одной модели на пространство имен m0, m1, m2
+    nets[0] = new NeuralNetwork();
+    nets[0]->add_layer(new FullyConnected<ReLU>(13, 32));
+    nets[0]->add_layer(new FullyConnected<Tanh>(32, 24));
+    nets[0]->add_layer(new FullyConnected<Sigmoid>(24, 16));
+    nets[0]->add_layer(new FullyConnected<Identity>(16, 3));
+
+    nets[1] = new NeuralNetwork();
+    nets[1]->add_layer(new FullyConnected<LeakyReLU>(13, 40));
+    nets[1]->add_layer(new FullyConnected<ELU>(40, 17));
+    nets[1]->add_layer(new FullyConnected<GELU>(17, 20));
+    nets[1]->add_layer(new FullyConnected<Swish>(20, 9));
+    nets[1]->add_layer(new FullyConnected<Softplus>(9, 5));
+
+    nets[2] = new NeuralNetwork();
+    nets[2]->add_layer(new FullyConnected<FastTanh>(13, 33));
+    nets[2]->add_layer(new FullyConnected<FastSigmoid>(33, 16));
+    nets[2]->add_layer(new FullyConnected<FastELU>(16, 16));
+    nets[2]->add_layer(new FullyConnected<FastGELU>(16, 16));
+    nets[2]->add_layer(new FullyConnected<FastSwish>(16, 8));
+    nets[2]->add_layer(new FullyConnected<FastSoftplus>(8, 1));
+
+    srand(7);
+    const Matrix x = Matrix::Random(13, nsample) * 2.0;
+
+    ofstream data("export_check_data.h");
+
+    data << "#pragma once\n\nnamespace export_check\n{\n    constexpr int kSamples = " << nsample << ";\n";
+    write_matrix(data, "X", x);
+
+    for (size_t m = 0; m < nets.size(); ++m)
+    {
+        const string name = "m" + to_string(m);
+
+        nets[m]->set_output(new RegressionMSE());
+        nets[m]->init(0, 0.5, int(m) + 1);
+
+        export_cpp(*nets[m], "export_check_" + name + ".h", name);
+        write_matrix(data, ("Y" + to_string(m)).c_str(), nets[m]->predict(x));
+    }
+
+    data << "}\n";
+    data.close();
+
+    if (!data)
+    {
+        printf("cannot write generated headers\n");
+        return 1;
+    }
+
+    for (size_t m = 0; m < nets.size(); ++m) { delete nets[m]; }
+
+    const char* env = getenv("CXX");
+    const string cxx = (argc > 1) ? argv[1] : (env ? env : "g++");
+    const string cmd = cxx + " -std=c++14 -O2 -DNN_EXPORT_CHECK -I. \"" + __FILE__ + "\" -o export_check_run";
+
+    printf("%s\n", cmd.c_str());
+    fflush(stdout);
+
+    if (system(cmd.c_str()) != 0)
+    {
+        printf("generated header does not compile\n");
+        return 1;
+    }
+
+# ifdef _WIN32
+    return system("export_check_run") == 0 ? 0 : 1;
+# else
+    return system("./export_check_run") == 0 ? 0 : 1;
+# endif
+}
+
+# else
+
+// Вторая стадия: только сгенерированные заголовки и стандартная библиотека
+# include <cmath>
+# include <cstdio>
+# include "export_check_m0.h"
+# include "export_check_m1.h"
+# include "export_check_m2.h"
+# include "export_check_data.h"
+
+template <int NIn, int NOut>
+static bool check(const char* name, void (*predict)(const float*, float*), const double (&y)[export_check::kSamples][NOut])
+{
+    // float: 24 бита мантиссы, ошибка копится по слоям
+    const double tol = 1e-5;
+    double worst = 0;
+
+    for (int j = 0; j < export_check::kSamples; ++j)
+    {
+        float in[NIn], out[NOut];
+
+        for (int i = 0; i < NIn; ++i) { in[i] = float(export_check::X[j][i]); }
+
+        predict(in, out);
+
+        for (int o = 0; o < NOut; ++o)
+        {
+            worst = std::fmax(worst, std::fabs(out[o] - y[j][o]) / (1.0 + std::fabs(y[j][o])));
+        }
+    }
+
+    printf("%s: max relative error %.3g (tolerance %.0e)\n", name, worst, tol);
+
+    return worst <= tol;
+}
+
+int main()
+{
+    bool ok = true;
+
+    ok &= check<m0::kInputSize, m0::kOutputSize>("m0", m0::predict, export_check::Y0);
+    ok &= check<m1::kInputSize, m1::kOutputSize>("m1", m1::predict, export_check::Y1);
+    ok &= check<m2::kInputSize, m2::kOutputSize>("m2", m2::predict, export_check::Y2);
+
+    return ok ? 0 : 1;
+}
+
+# endif
@@ -0,0 +1,198 @@
+///
+/// Проверка градиентов GraphNetwork: конечные разности и последовательная сетка.
+///
+/// Сборка из каталога NeuralNetwork:
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/GraphCheck.cpp -o graphcheck -pthread
+///
+/// Граф с пропускной связью и слиянием ветвей:
+///
+///   x(8) -> h1 = Tanh(8 -> 16) -> h2 = Swish(16 -> 16) -> res = h1 + h2 --+
+///     |                                                                   +-> cat(32) -> Identity(32 -> 2)
+///     +---> side = Sigmoid(8 -> 16) ------------------------------------+
+///
+/// У x и h1 по два потребителя, у res и cat - по два входа. Проверяется:
+///   - производные всех весов после backprop против центральных разностей
+///     ошибки RegressionMSE (шаг 1e-6), в вызывающем потоке и на пуле из 3 потоков
+///     (h1 и side в одном ярусе считаются параллельно);
+///   - цепочка из тех же слоев в GraphNetwork против NeuralNetwork с теми же весами:
+///     производные после backprop и веса после 5 шагов SGD.
+/// Ошибка - max |разница| / max(max |производная|, 1). Код возврата 1 - ошибка больше
+/// 1e-6 для разностей или 1e-12 для последовательной сетки.
+///
+
+# include "../DNN.h"
+# include <cmath>
+# include <cstdio>
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+static Scalar max_error(const vector<Scalar>& x, const vector<Scalar>& ref)
+{
+    Scalar err = 0, scale = 1;
+
+    for (size_t i = 0; i < ref.size(); ++i)
+    {
+        err = max(err, fabs(x[i] - ref[i]));
+        scale = max(scale, fabs(ref[i]));
+    }
+
+    return err / scale;
+}
+
+/// <summary>
+/// Производные всех слоев подряд после forward + backprop без изменения весов
+/// </summary>
+template <typename Net>
+static vector<Scalar> gradient(Net& net, const Matrix& x, const Matrix& y)
+{
+    SGD frozen(0);
+    net.train_batch(frozen, x, y);
+
+    vector<Scalar> res;
+
+    for (Layer* layer : net.get_layers())
+    {
+        const vector<Scalar> d = layer->get_derivatives();
+        res.insert(res.end(), d.begin(), d.end());
+    }
+
+    return res;
+}
+
+template <typename Net>
+static vector<Scalar> parameters(const Net& net)
+{
+    vector<Scalar> res;
+
+    for (Layer* layer : net.get_layers())
+    {
+        const vector<Scalar> p = layer->get_parametrs();
+        res.insert(res.end(), p.begin(), p.end());
+    }
+
+    return res;
+}
+
+static Scalar loss(GraphNetwork& net, const Matrix& x, const Matrix& y)
+{
+    RegressionMSE mse;
+    mse.evaluate(net.predict(x), y);
+
+    return mse.loss();
+}
+
+/// <summary>
+/// Производные по центральным разностям, вес за весом
+/// </summary>
+static vector<Scalar> numeric_gradient(GraphNetwork& net, const Matrix& x, const Matrix& y)
+{
+    const Scalar h = 1e-6;
+    vector<Scalar> res;
+
+    for (Layer* layer : net.get_layers())
+    {
+        vector<Scalar> p = layer->get_parametrs();
+
+        for (size_t i = 0; i < p.size(); ++i)
+        {
+            const Scalar w = p[i];
+
+            p[i] = w + h;
+            layer->set_parametrs(p);
+            const Scalar up = loss(net, x, y);
+
+            p[i] = w - h;
+            layer->set_parametrs(p);
+            const Scalar down = loss(net, x, y);
+
+            p[i] = w;
+            layer->set_parametrs(p);
+            res.push_back((up - down) / (2 * h));
+        }
+    }
+
+    return res;
+}
+
+static void build_dag(GraphNetwork& net)
+{
+    net.add_input("x", 8);
+    net.add_layer("h1", new FullyConnected<Tanh>(8, 16), "x");
+    net.add_layer("h2", new FullyConnected<Swish>(16, 16), "h1");
+    net.add_merge("res", MERGE_ADD, { "h1", "h2" });
+    net.add_layer("side", new FullyConnected<Sigmoid>(8, 16), "x");
+    net.add_merge("cat", MERGE_CONCAT, { "res", "side" });
+    net.add_layer("out", new FullyConnected<Identity>(32, 2), "cat");
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.5, 3);
+}
+
+static bool report(const char* name, const Scalar err, const Scalar bound)
+{
+    printf("%-36s %12.3g  %s\n", name, err, err <= bound ? "ok" : "FAIL");
+
+    return err <= bound;
+}
+
+int main()
+{
+    bool ok = true;
+
+    srand(5);
+    const Matrix x = Matrix::Random(8, 40);
+    const Matrix y = Matrix::Random(2, 40);
+
+    // DAG против конечных разностей
+    {
+        GraphNetwork net;
+        build_dag(net);
+
+        const vector<Scalar> analytic = gradient(net, x, y);
+        const vector<Scalar> numeric = numeric_gradient(net, x, y);
+        ok &= report("dag vs finite differences", max_error(analytic, numeric), 1e-6);
+
+        ThreadPool pool(3);
+        net.set_thread_pool(&pool);
+        ok &= report("dag on pool vs finite differences", max_error(gradient(net, x, y), numeric), 1e-6);
+        net.set_thread_pool(NULL);
+    }
+
+    // Цепочка в графе против NeuralNetwork с теми же весами
+    {
+        GraphNetwork graph;
+        graph.add_input("x", 8);
+        graph.add_layer("h1", new FullyConnected<Tanh>(8, 16), "x");
+        graph.add_layer("h2", new FullyConnected<Swish>(16, 16), "h1");
+        graph.add_layer("out", new FullyConnected<Identity>(16, 2), "h2");
+        graph.set_output(new RegressionMSE());
+        graph.init(0, 0.5, 3);
+
+        NeuralNetwork seq;
+        seq.add_layer(new FullyConnected<Tanh>(8, 16));
+        seq.add_layer(new FullyConnected<Swish>(16, 16));
+        seq.add_layer(new FullyConnected<Identity>(16, 2));
+        seq.set_output(new RegressionMSE());
+        seq.init(0, 0.5, 7);
+
+        for (size_t i = 0; i < seq.get_layers().size(); ++i)
+        {
+            seq.get_layers()[i]->set_parametrs(graph.get_layers()[i]->get_parametrs());
+        }
+
+        ok &= report("chain vs NeuralNetwork, gradient", max_error(gradient(graph, x, y), gradient(seq, x, y)), 1e-12);
+
+        SGD opt_graph(0.1), opt_seq(0.1);
+
+        for (int s = 0; s < 5; ++s)
+        {
+            graph.train_batch(opt_graph, x, y);
+            seq.train_batch(opt_seq, x, y);
+        }
+
+        ok &= report("chain vs NeuralNetwork, 5 SGD steps", max_error(parameters(graph), parameters(seq)), 1e-12);
+    }
+
+    return ok ? 0 : 1;
+}
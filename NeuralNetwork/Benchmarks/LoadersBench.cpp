@@ -0,0 +1,276 @@
+///
+/// Загрузчики Loaders.h против наивного разбора через std::getline.
+///
+/// Сборка из каталога NeuralNetwork:
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/LoadersBench.cpp -o loadbench -pthread
+///
+/// Программа пишет в текущий каталог CSV (200000 строк x 32 столбца), LIBSVM
+/// (200000 строк, 20 ненулевых из 1000 признаков) и .npy той же формы, что CSV,
+/// и читает каждый файл наивно (getline + stod, ifstream::read) и загрузчиком
+/// в 1 поток и во все ядра. Скорость - в ГБ/с размера файла; файлы уже в кэше
+/// страниц, диск не меряется. Для .npy загрузчик только отображает файл, поэтому
+/// в замер входит и проход по всем числам (сумма). Код возврата 1 - результаты
+/// разошлись с наивным разбором.
+///
+
+# include "../DNN.h"
+# include <chrono>
+# include <cmath>
+# include <cstdio>
+# include <fstream>
+# include <sstream>
+# include <string>
+# include <thread>
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef Eigen::SparseMatrix<Scalar> SparseMatrix;
+
+static double seconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// <summary>
+/// Лучшее время из нескольких запусков
+/// </summary>
+template <typename Func>
+static double best_time(Func f)
+{
+    double best = 1e30;
+
+    for (int r = 0; r < 3; ++r)
+    {
+        const double t0 = seconds();
+        f();
+        best = min(best, seconds() - t0);
+    }
+
+    return best;
+}
+
+static void print_row(const char* format, const char* method, const double bytes, const double t)
+{
+    printf("%-8s %-22s %10.1f %10.3f\n", format, method, t * 1e3, bytes / t * 1e-9);
+}
+
+static Scalar max_rel_diff(const Matrix& a, const Matrix& b)
+{
+    if (a.rows() != b.rows() || a.cols() != b.cols()) { return 1e30; }
+
+    return ((a - b).array().abs() / (1 + b.array().abs())).maxCoeff();
+}
+
+static void naive_csv(const string& path, const int nfeature, Matrix& x, Matrix& y)
+{
+    ifstream in(path);
+    string line, field;
+    vector<Scalar> values;
+
+    while (getline(in, line))
+    {
+        stringstream ss(line);
+
+        while (getline(ss, field, ',')) { values.push_back(stod(field)); }
+    }
+
+    // Строка файла - наблюдение, последний столбец - таргет
+    const Eigen::Index n = Eigen::Index(values.size()) / (nfeature + 1);
+    const Eigen::Map<const Matrix> all(values.data(), nfeature + 1, n);
+
+    x = all.topRows(nfeature);
+    y = all.bottomRows(1);
+}
+
+static void naive_libsvm(const string& path, const int nfeature, SparseMatrix& x, Matrix& y)
+{
+    ifstream in(path);
+    string line, token;
+    vector<Eigen::Triplet<Scalar> > triplets;
+    vector<Scalar> labels;
+
+    while (getline(in, line))
+    {
+        stringstream ss(line);
+        ss >> token;
+        labels.push_back(stod(token));
+
+        while (ss >> token)
+        {
+            const size_t colon = token.find(':');
+            triplets.push_back(Eigen::Triplet<Scalar>(stoi(token.substr(0, colon)) - 1, int(labels.size()) - 1,
+                stod(token.substr(colon + 1))));
+        }
+    }
+
+    x.resize(nfeature, Eigen::Index(labels.size()));
+    x.setFromTriplets(triplets.begin(), triplets.end());
+    y = Eigen::Map<const Matrix>(labels.data(), 1, Eigen::Index(labels.size()));
+}
+
+static Scalar naive_npy(const string& path, const int nfeature, Matrix& x)
+{
+    ifstream in(path, ios::binary);
+    char magic[10];
+    in.read(magic, 10);
+
+    const int header_len = (unsigned char)magic[8] | ((unsigned char)magic[9] << 8);
+    in.seekg(10 + header_len);
+
+    const long long n = (long long)(in.rdbuf()->pubseekoff(0, ios::end) - streamoff(10 + header_len)) /
+        (nfeature * (long long)sizeof(Scalar));
+    in.seekg(10 + header_len);
+
+    x.resize(nfeature, Eigen::Index(n));
+    in.read(reinterpret_cast<char*>(x.data()), streamsize(x.size() * sizeof(Scalar)));
+
+    return x.sum();
+}
+
+static void write_npy(const string& path, const Matrix& x)
+{
+    // Форма (наблюдения, признаки), C-порядок: в памяти это столбцы x
+    string header = "{'descr': '<f8', 'fortran_order': False, 'shape': (" + to_string(x.cols()) + ", " +
+        to_string(x.rows()) + "), }";
+
+    while ((10 + header.size() + 1) % 64 != 0) { header += ' '; }
+    header += '\n';
+
+    ofstream out(path, ios::binary);
+    const char magic[] = { '\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0,
+        char(header.size() & 0xff), char(header.size() >> 8) };
+
+    out.write(magic, sizeof(magic));
+    out.write(header.data(), streamsize(header.size()));
+    out.write(reinterpret_cast<const char*>(x.data()), streamsize(x.size() * sizeof(Scalar)));
+}
+
+static double file_size(const string& path)
+{
+    ifstream in(path, ios::binary | ios::ate);
+    return double(in.tellg());
+}
+
+int main()
+{
+    const int nrow = 200000, nfeature = 32, nsparse = 1000, nnz = 20;
+    const int ncore = int(thread::hardware_concurrency());
+    bool ok = true;
+
+    srand(3);
+
+    // Генерация файлов
+    Matrix data = Matrix::Random(nfeature + 1, nrow) * 100.0;
+    {
+        ofstream csv("loaders_bench.csv");
+        char buf[32];
+
+        for (int i = 0; i < nrow; ++i)
+        {
+            for (int j = 0; j <= nfeature; ++j)
+            {
+                snprintf(buf, sizeof(buf), "%.6f", double(data(j, i)));
+                csv << buf << (j < nfeature ? ',' : '\n');
+            }
+        }
+
+        ofstream svm("loaders_bench.svm");
+
+        for (int i = 0; i < nrow; ++i)
+        {
+            svm << (i % 2);
+
+            // Возрастающие индексы с шагом от 1 до 2 * nsparse / nnz - 1
+            for (int k = 0, idx = 0; k < nnz; ++k)
+            {
+                idx += 1 + rand() % (2 * nsparse / nnz - 1);
+                snprintf(buf, sizeof(buf), " %d:%.6f", min(idx, nsparse), double(rand()) / RAND_MAX);
+                svm << buf;
+
+                if (idx >= nsparse) { break; }
+            }
+
+            svm << '\n';
+        }
+    }
+
+    // В CSV числа с 6 знаками после точки, в .npy - ровно они
+    {
+        Matrix x, y;
+        load_csv("loaders_bench.csv", x, y);
+        write_npy("loaders_bench.npy", x);
+    }
+
+    printf("cores: %d\n%-8s %-22s %10s %10s\n", ncore, "format", "method", "time, ms", "GB/s");
+
+    // CSV
+    {
+        const double bytes = file_size("loaders_bench.csv");
+        Matrix x0, y0, x, y;
+        CsvOptions opts;
+
+        print_row("csv", "naive getline + stod", bytes, best_time([&]() { naive_csv("loaders_bench.csv", nfeature, x0, y0); }));
+
+        opts.nthread = 1;
+        print_row("csv", "load_csv, 1 thread", bytes, best_time([&]() { load_csv("loaders_bench.csv", x, y, opts); }));
+        ok &= max_rel_diff(x, x0) <= 1e-15 && max_rel_diff(y, y0) <= 1e-15;
+
+        opts.nthread = 0;
+        print_row("csv", "load_csv, all cores", bytes,
+            best_time([&]() { load_csv("loaders_bench.csv", x, y, opts); }));
+        ok &= max_rel_diff(x, x0) <= 1e-15 && max_rel_diff(y, y0) <= 1e-15;
+
+        if (!ok) { printf("load_csv differs from naive parsing\n"); }
+    }
+
+    // LIBSVM
+    {
+        const double bytes = file_size("loaders_bench.svm");
+        SparseMatrix x0, x;
+        Matrix y0, y;
+        bool same = true;
+
+        print_row("libsvm", "naive getline + stod", bytes,
+            best_time([&]() { naive_libsvm("loaders_bench.svm", nsparse, x0, y0); }));
+
+        print_row("libsvm", "load_libsvm, 1 thread", bytes,
+            best_time([&]() { load_libsvm("loaders_bench.svm", x, y, nsparse, 1); }));
+        same &= max_rel_diff(Matrix(x), Matrix(x0)) <= 1e-15 && max_rel_diff(y, y0) <= 1e-15;
+
+        print_row("libsvm", "load_libsvm, all cores", bytes,
+            best_time([&]() { load_libsvm("loaders_bench.svm", x, y, nsparse, 0); }));
+        same &= max_rel_diff(Matrix(x), Matrix(x0)) <= 1e-15 && max_rel_diff(y, y0) <= 1e-15;
+
+        if (!same) { printf("load_libsvm differs from naive parsing\n"); }
+        ok &= same;
+    }
+
+    // .npy
+    {
+        const double bytes = file_size("loaders_bench.npy");
+        Matrix x0;
+        Scalar sum0 = 0, sum = 0;
+
+        print_row("npy", "naive ifstream::read", bytes,
+            best_time([&]() { sum0 = naive_npy("loaders_bench.npy", nfeature, x0); }));
+
+        print_row("npy", "NpyArray::features", bytes, best_time([&]()
+        {
+            NpyArray npy("loaders_bench.npy");
+            sum = npy.features().sum();
+        }));
+
+        if (fabs(sum - sum0) > 1e-9 * (1 + fabs(sum0)))
+        {
+            printf("NpyArray differs from naive reading\n");
+            ok = false;
+        }
+    }
+
+    remove("loaders_bench.csv");
+    remove("loaders_bench.svm");
+    remove("loaders_bench.npy");
+
+    return ok ? 0 : 1;
+}
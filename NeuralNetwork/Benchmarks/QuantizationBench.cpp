@@ -0,0 +1,140 @@
+///
+/// Пропускная способность int8 инференса FullyConnected против Scalar.
+///
+/// Сборка из каталога NeuralNetwork:
+///   g++ -std=c++14 -O2 -I<eigen3> -I. Benchmarks/QuantizationBench.cpp -o qbench
+///
+/// Сначала проверяет, что int8 ядра всех поддерживаемых уровней QuantDispatch.h
+/// (qgemm и quantize) дают тот же результат, что и переносимые, затем меряет predict сетки
+/// 1024 -> 1024 -> 1024 -> 16 на батче 256: Scalar с GEMM Eigen (по умолчанию)
+/// и GEMM_DISPATCH, int8 на каждом уровне. Код возврата 1 - расхождение ядер.
+///
+
+# include "../DNN.h"
+# include <chrono>
+# include <cstdio>
+
+using namespace std;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+static double seconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool check_kernels()
+{
+    typedef Eigen::Matrix<int32_t, Eigen::Dynamic, Eigen::Dynamic> IntMatrix;
+
+    const internal::QuantKernels<Scalar> generic = internal::make_quant_kernels<Scalar>(QUANT_GENERIC);
+    bool ok = true;
+    srand(1);
+
+    for (int level = QUANT_AVX2; level <= quant_level_supported(); ++level)
+    {
+        const internal::QuantKernels<Scalar> kernels = internal::make_quant_kernels<Scalar>(QuantLevel(level));
+
+        for (int m : { 1, 3, 4, 5, 17, 64 })
+        {
+            for (int n : { 1, 2, 3, 5, 8, 9, 64 })
+            {
+                for (int k : { 64, 128, 320 })
+                {
+                    vector<int8_t> w(size_t(m) * k);
+                    vector<uint8_t> x(size_t(n) * k);
+
+                    for (size_t i = 0; i < w.size(); ++i) { w[i] = int8_t(rand() % 255 - 127); }
+                    for (size_t i = 0; i < x.size(); ++i) { x[i] = uint8_t(rand() % 128); }
+
+                    IntMatrix c0(m, n), c1(m, n);
+                    generic.qgemm(w.data(), k, x.data(), k, m, n, k, c0.data(), m);
+                    kernels.qgemm(w.data(), k, x.data(), k, m, n, k, c1.data(), m);
+
+                    if (c0 != c1)
+                    {
+                        printf("qgemm %s differs from generic at m = %d, n = %d, k = %d\n",
+                            quant_level_name(QuantLevel(level)), m, n, k);
+                        ok = false;
+                    }
+                }
+            }
+        }
+
+        for (int rows : { 1, 7, 8, 9, 100 })
+        {
+            const Matrix x = Matrix::Random(rows + 2, 5) * 3.0;
+            vector<uint8_t> q0(size_t(rows) * 5), q1(size_t(rows) * 5);
+
+            generic.quantize(x.data(), x.rows(), rows, 5, 21.5, 40.0, q0.data(), rows);
+            kernels.quantize(x.data(), x.rows(), rows, 5, 21.5, 40.0, q1.data(), rows);
+
+            if (q0 != q1)
+            {
+                printf("quantize %s differs from generic at rows = %d\n", quant_level_name(QuantLevel(level)), rows);
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
+
+static double best_time(NeuralNetwork& net, const Matrix& x, const int reps)
+{
+    double best = 1e30;
+
+    for (int r = 0; r < reps; ++r)
+    {
+        const double t0 = seconds();
+        net.predict(x);
+        best = min(best, seconds() - t0);
+    }
+
+    return best;
+}
+
+int main()
+{
+    if (!check_kernels()) { return 1; }
+
+    const int size = 1024, batch = 256, reps = 20;
+
+    NeuralNetwork net;
+    net.add_layer(new FullyConnected<ReLU>(size, size));
+    net.add_layer(new FullyConnected<ReLU>(size, size));
+    net.add_layer(new FullyConnected<Identity>(size, 16));
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.03, 1);
+
+    const Matrix x = Matrix::Random(size, batch);
+    const double flops = 2.0 * batch * (double(size) * size * 2 + size * 16);
+
+    net.quantize(x);
+    const QuantizationReport report = net.quantization_report(x);
+    printf("int8 max abs error %.3g, rmse %.3g\n", report.max_abs_error, report.rmse);
+
+    net.set_quantized(false);
+    net.set_gemm(GEMM_EIGEN);
+    const double t_eigen = best_time(net, x, reps);
+    net.set_gemm(GEMM_DISPATCH);
+    const double t_dispatch = best_time(net, x, reps);
+
+    printf("%-22s %9s %9s %14s\n", "mode", "ms", "GOP/s", "vs Scalar");
+    printf("%-22s %9.2f %9.1f %14s\n", "Scalar, GEMM_EIGEN", t_eigen * 1e3, flops / t_eigen * 1e-9, "1.00x");
+    printf("%-22s %9.2f %9.1f %13.2fx\n", "Scalar, GEMM_DISPATCH", t_dispatch * 1e3, flops / t_dispatch * 1e-9,
+        t_eigen / t_dispatch);
+
+    net.set_quantized(true);
+
+    for (int level = QUANT_GENERIC; level <= quant_level_supported(); ++level)
+    {
+        set_quant_level(QuantLevel(level));
+        const double t = best_time(net, x, reps);
+        const string name = string("int8, ") + quant_level_name(QuantLevel(level));
+
+        printf("%-22s %9.2f %9.1f %13.2fx\n", name.c_str(), t * 1e3, flops / t * 1e-9, t_eigen / t);
+    }
+
+    return 0;
+}
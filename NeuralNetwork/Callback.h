@@ -2,6 +2,7 @@
 
 # include <Eigen/Core>
 # include "Config.h"
+# include "Validation.h"
 
 
 class NeuralNetwork;
@@ -41,4 +42,8 @@ public:
 
 	virtual void post_trained_batch(const NeuralNetwork* net, const Matrix& x,
 		const IntegerVector& y) {}
+
+	// После валидации (см. ValidationOptions). При асинхронной валидации
+	// вызывается из потока обучения, когда результат готов
+	virtual void post_validation(const NeuralNetwork* net, const ValidationMetrics& metrics) {}
 };
\ No newline at end of file
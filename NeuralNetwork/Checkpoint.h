@@ -0,0 +1,332 @@
+﻿#pragma once
+
+# include <vector>
+# include <string>
+# include <fstream>
+# include <cstdio>
+# include <cstring>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <exception>
+# include <stdexcept>
+# include "Config.h"
+
+///
+/// Чекпоинты полного состояния обучения.
+///
+/// В чекпоинт входят веса всех слоев, состояние оптимайзера, состояние RNG
+/// на момент начала NeuralNetwork::fit() (до перемешивания батчей) и позиция
+/// в цикле обучения. Этого достаточно, чтобы fit() пересобрал те же самые батчи
+/// и продолжил обучение побитово так же, как без перезапуска.
+///
+/// Запись идет в фоновом потоке: поток обучения только копирует параметры
+/// в снимок и сразу продолжает работу. Если предыдущий снимок еще не записан,
+/// он заменяется более свежим. Ошибка записи не останавливает обучение,
+/// последняя из них выбрасывается из Checkpointer::flush().
+///
+
+
+///
+/// Снимок состояния обучения
+///
+struct CheckpointState
+{
+    int epoch;                                // эпоха последнего натренированного батча
+    int batch;                                // последний натренированный батч в эпохе
+    int nbatch;                               // кол-во батчей в эпохе
+    long rng_state;                           // состояние RNG до перемешивания батчей
+    std::vector< std::vector<Scalar> > layers; // параметры слоев (Layer::get_parametrs())
+    std::vector<Scalar> optimizer;            // состояние оптимайзера (Optimizer::get_state())
+
+    CheckpointState() :
+        epoch(0), batch(-1), nbatch(0), rng_state(0) {}
+};
+
+
+class Checkpointer
+{
+private:
+    static const char* magic() { return "DNNCKPT1"; }
+
+    const std::string m_path;       // файл чекпоинта
+    const int m_every_n_batches;    // как часто сохраняться
+    const bool m_resume;            // продолжать ли fit() с последнего чекпоинта
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    CheckpointState m_pending;      // снимок, ожидающий записи
+    bool m_has_pending;
+    bool m_writing;
+    bool m_stop;
+    std::exception_ptr m_error;     // последняя ошибка записи, выбрасывается из flush()
+    std::thread m_worker;
+
+    template <typename T>
+    static void write_pod(std::ofstream& out, const T& value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static void read_pod(std::ifstream& in, T& value)
+    {
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+
+    static void write_vector(std::ofstream& out, const std::vector<Scalar>& vec)
+    {
+        const long long n = vec.size();
+        write_pod(out, n);
+
+        if (n > 0)
+        {
+            out.write(reinterpret_cast<const char*>(&vec[0]), n * sizeof(Scalar));
+        }
+    }
+
+    static void read_vector(std::ifstream& in, std::vector<Scalar>& vec)
+    {
+        long long n = 0;
+        read_pod(in, n);
+
+        // Длина не больше остатка файла: испорченный размер не должен приводить к огромному выделению
+        const std::streamoff pos = in.tellg();
+        in.seekg(0, std::ios::end);
+        const std::streamoff end = in.tellg();
+        in.seekg(pos);
+
+        if (!in || n < 0 || n > (end - pos) / std::streamoff(sizeof(Scalar)))
+        {
+            throw std::runtime_error("[class Checkpointer]: Checkpoint file is corrupted");
+        }
+
+        vec.resize(n);
+
+        if (n > 0)
+        {
+            in.read(reinterpret_cast<char*>(&vec[0]), n * sizeof(Scalar));
+
+            if (!in)
+            {
+                throw std::runtime_error("[class Checkpointer]: Checkpoint file is corrupted");
+            }
+        }
+    }
+
+    /// <summary>
+    /// Запись снимка во временный файл и замена им основного,
+    /// чтобы падение во время записи не портило последний чекпоинт
+    /// </summary>
+    void write(const CheckpointState& state) const
+    {
+        const std::string tmp = m_path + ".tmp";
+
+        {
+            std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+
+            if (!out)
+            {
+                throw std::runtime_error("[class Checkpointer]: Cannot open checkpoint file for writing");
+            }
+
+            const int nlayer = state.layers.size();
+            const int scalar_size = sizeof(Scalar);
+
+            out.write(magic(), std::strlen(magic()));
+            write_pod(out, scalar_size);
+            write_pod(out, state.epoch);
+            write_pod(out, state.batch);
+            write_pod(out, state.nbatch);
+            write_pod(out, state.rng_state);
+            write_pod(out, nlayer);
+
+            for (int i = 0; i < nlayer; ++i)
+            {
+                write_vector(out, state.layers[i]);
+            }
+
+            write_vector(out, state.optimizer);
+
+            // Недописанный файл (нет места на диске и т.п.) не должен заменить последний чекпоинт
+            out.close();
+
+            if (!out)
+            {
+                std::remove(tmp.c_str());
+                throw std::runtime_error("[class Checkpointer]: Cannot write checkpoint file");
+            }
+        }
+
+# ifdef _WIN32
+        // rename в Windows не заменяет существующий файл
+        std::remove(m_path.c_str());
+# endif
+
+        if (std::rename(tmp.c_str(), m_path.c_str()) != 0)
+        {
+            throw std::runtime_error("[class Checkpointer]: Cannot replace checkpoint file");
+        }
+    }
+
+    void run()
+    {
+        CheckpointState state;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                m_cond.wait(lock, [this] { return m_stop || m_has_pending; });
+
+                if (!m_has_pending) { return; }
+
+                std::swap(state, m_pending);
+                m_has_pending = false;
+                m_writing = true;
+            }
+
+            // Ошибка записи не должна ронять обучение: следующий снимок попробует снова,
+            // а последняя ошибка выбрасывается из flush()
+            std::exception_ptr error;
+
+            try { write(state); }
+            catch (...) { error = std::current_exception(); }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_writing = false;
+
+                if (error) { m_error = error; }
+            }
+
+            m_cond.notify_all();
+        }
+    }
+
+public:
+    /// <summary>
+    /// Запуск фонового потока записи чекпоинтов
+    /// </summary>
+    /// <param name="path"> - файл чекпоинта</param>
+    /// <param name="every_n_batches"> - сохраняться каждые n батчей</param>
+    /// <param name="resume"> - если файл существует, fit() продолжит обучение с него</param>
+    Checkpointer(const std::string& path, int every_n_batches, bool resume = true) :
+        m_path(path),
+        m_every_n_batches(every_n_batches),
+        m_resume(resume),
+        m_has_pending(false),
+        m_writing(false),
+        m_stop(false)
+    {
+        if (every_n_batches <= 0)
+        {
+            throw std::invalid_argument("[class Checkpointer]: Checkpoint interval must be positive");
+        }
+
+        m_worker = std::thread(&Checkpointer::run, this);
+    }
+
+    ~Checkpointer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+
+        m_cond.notify_all();
+
+        if (m_worker.joinable())
+        {
+            m_worker.join();
+        }
+    }
+
+    bool resume() const { return m_resume; }
+
+    /// <summary>
+    /// Нужно ли сохраняться после очередного батча
+    /// </summary>
+    /// <param name="batches_done"> - сколько батчей натренировано с начала fit()</param>
+    bool due(const long long batches_done) const
+    {
+        return batches_done % m_every_n_batches == 0;
+    }
+
+    /// <summary>
+    /// Отдать снимок на запись. Не ждет записи на диск.
+    /// </summary>
+    void save(CheckpointState& state)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::swap(m_pending, state);
+            m_has_pending = true;
+        }
+
+        m_cond.notify_all();
+    }
+
+    /// <summary>
+    /// Дождаться записи всех отданных снимков. Если какая-то запись с прошлого
+    /// вызова не удалась, выбрасывает последнюю ошибку.
+    /// </summary>
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this] { return !m_has_pending && !m_writing; });
+
+        if (m_error)
+        {
+            std::exception_ptr error = m_error;
+            m_error = std::exception_ptr();
+            std::rethrow_exception(error);
+        }
+    }
+
+    /// <summary>
+    /// Чтение последнего чекпоинта
+    /// </summary>
+    /// <returns>false, если файла нет</returns>
+    bool load(CheckpointState& state) const
+    {
+        std::ifstream in(m_path.c_str(), std::ios::binary);
+
+        if (!in) { return false; }
+
+        std::string header(std::strlen(magic()), '\0');
+        in.read(&header[0], header.size());
+
+        int scalar_size = 0;
+        read_pod(in, scalar_size);
+
+        if (!in || header != magic() || scalar_size != int(sizeof(Scalar)))
+        {
+            throw std::runtime_error("[class Checkpointer]: Checkpoint file has unknown format");
+        }
+
+        int nlayer = 0;
+        read_pod(in, state.epoch);
+        read_pod(in, state.batch);
+        read_pod(in, state.nbatch);
+        read_pod(in, state.rng_state);
+        read_pod(in, nlayer);
+
+        if (!in || nlayer < 0)
+        {
+            throw std::runtime_error("[class Checkpointer]: Checkpoint file is corrupted");
+        }
+
+        state.layers.resize(nlayer);
+
+        for (int i = 0; i < nlayer; ++i)
+        {
+            read_vector(in, state.layers[i]);
+        }
+
+        read_vector(in, state.optimizer);
+
+        return true;
+    }
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <deque>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <exception>
+# include <algorithm>
+# include "Config.h"
+# include "Layer.h"
+
+///
+/// Обмен данными между процессами при распределенном обучении.
+///
+/// Communicator - интерфейс коллективных операций, сама передача
+/// (TCP, общая память и т.д.) реализуется в наследниках, см. TcpRing.h
+/// и ShmCommunicator.h.
+///
+/// GradientReducer усредняет производные слоев между процессами во время
+/// backprop: как только слой посчитал свои производные, они копируются в текущий
+/// бакет, заполненный бакет уходит в фоновый поток на all-reduce, а поток
+/// обучения продолжает backprop предыдущих слоев.
+///
+
+
+class Communicator
+{
+public:
+    virtual ~Communicator() {}
+
+    /// <summary>
+    /// None
+    /// </summary>
+    /// <returns>Номер текущего процесса, от 0 до size() - 1</returns>
+    virtual int rank() const = 0;
+
+    /// <summary>
+    /// None
+    /// </summary>
+    /// <returns>Кол-во процессов</returns>
+    virtual int size() const = 0;
+
+    /// <summary>
+    /// Поэлементная сумма вектора по всем процессам, результат у всех процессов.
+    /// Вызывается всеми процессами в одном и том же порядке.
+    /// </summary>
+    virtual void allreduce_sum(Scalar* data, int n) = 0;
+
+    /// <summary>
+    /// Рассылка вектора процесса root всем остальным
+    /// </summary>
+    virtual void broadcast(Scalar* data, int n, int root = 0) = 0;
+};
+
+
+namespace internal
+{
+    /// <summary>
+    /// Бакетное усреднение производных слоев с перекрытием обмена и backprop.
+    ///
+    /// Производные каждого процесса умножаются на размер его батча, в конец бакета
+    /// дописывается сам размер батча. После суммы по процессам делим на сумму
+    /// размеров и получаем тот же градиент, что и на объединенном батче.
+    /// </summary>
+    class GradientReducer
+    {
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef std::pair<Scalar*, int> Buffer;
+
+        struct Bucket
+        {
+            std::vector<Scalar> data;    // производные + размер батча в последнем элементе
+            std::vector<Buffer> targets; // куда раскладывать результат
+        };
+
+        Communicator& m_comm;
+        const int m_bucket_size;          // минимальный размер бакета в элементах
+
+        Bucket m_current;                 // заполняемый бакет
+        std::deque<Bucket> m_queue;       // бакеты, ждущие обмена
+        int m_inflight;                   // отдано бакетов, еще не разложенных обратно
+        Scalar m_weight;                  // размер локального батча
+        std::exception_ptr m_error;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        bool m_stop;
+        std::thread m_worker;
+
+        void reduce(Bucket& bucket)
+        {
+            const int n = bucket.data.size();
+
+            m_comm.allreduce_sum(&bucket.data[0], n);
+
+            const Scalar scale = Scalar(1) / bucket.data[n - 1];
+            int offset = 0;
+
+            for (std::size_t b = 0; b < bucket.targets.size(); ++b)
+            {
+                Eigen::Map<Vector>(bucket.targets[b].first, bucket.targets[b].second) =
+                    scale * Eigen::Map<const Vector>(&bucket.data[offset], bucket.targets[b].second);
+                offset += bucket.targets[b].second;
+            }
+        }
+
+        void run()
+        {
+            Bucket bucket;
+
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+
+                    m_cond.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+
+                    if (m_queue.empty()) { return; }
+
+                    std::swap(bucket, m_queue.front());
+                    m_queue.pop_front();
+                }
+
+                // После ошибки обмен дальше не идет, но бакеты забираем, чтобы finish() не завис
+                if (!m_error)
+                {
+                    try { reduce(bucket); }
+                    catch (...) { m_error = std::current_exception(); }
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_inflight--;
+                }
+
+                m_cond.notify_all();
+            }
+        }
+
+        void submit()
+        {
+            if (m_current.targets.empty()) { return; }
+
+            m_current.data.push_back(m_weight);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_queue.push_back(Bucket());
+                std::swap(m_queue.back(), m_current);
+                m_inflight++;
+            }
+
+            m_cond.notify_all();
+
+            m_current.data.clear();
+            m_current.targets.clear();
+            m_current.data.reserve(m_bucket_size + 1);
+        }
+
+    public:
+        /// <param name="comm"> - обмен между процессами</param>
+        /// <param name="bucket_size"> - размер бакета в элементах Scalar</param>
+        GradientReducer(Communicator& comm, int bucket_size) :
+            m_comm(comm),
+            m_bucket_size(std::max(1, bucket_size)),
+            m_inflight(0),
+            m_weight(0),
+            m_stop(false)
+        {
+            m_worker = std::thread(&GradientReducer::run, this);
+        }
+
+        ~GradientReducer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+
+            m_cond.notify_all();
+            m_worker.join();
+        }
+
+        /// <summary>
+        /// Начало батча
+        /// </summary>
+        /// <param name="ncols"> - размер локального батча</param>
+        void begin(const int ncols)
+        {
+            m_weight = Scalar(ncols);
+        }
+
+        /// <summary>
+        /// Производные слоя готовы: копируем их в бакет, заполненный бакет
+        /// отдаем на обмен. Слои надо передавать в одном порядке во всех процессах.
+        /// </summary>
+        void add(Layer& layer)
+        {
+            std::vector<Buffer> buffers;
+            layer.derivative_buffers(buffers);
+
+            for (std::size_t b = 0; b < buffers.size(); ++b)
+            {
+                const int offset = m_current.data.size();
+                const int len = buffers[b].second;
+
+                m_current.data.resize(offset + len);
+                Eigen::Map<Vector>(&m_current.data[offset], len) =
+                    m_weight * Eigen::Map<const Vector>(buffers[b].first, len);
+
+                m_current.targets.push_back(buffers[b]);
+            }
+
+            if (int(m_current.data.size()) >= m_bucket_size) { submit(); }
+        }
+
+        /// <summary>
+        /// Отдать последний бакет и дождаться усреднения всех производных
+        /// </summary>
+        void finish()
+        {
+            submit();
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this] { return m_inflight == 0; });
+
+            if (m_error) { std::rethrow_exception(m_error); }
+        }
+    };
+}
@@ -1,3 +1,63 @@
 #pragma once
 
-typedef double Scalar;
\ No newline at end of file
+# include <stdexcept>
+
+typedef double Scalar;
+
+// NN_USE_ARENA - хранилище матриц Scalar через MatrixArena (см. Arena.h). Заголовок
+// подключается здесь, чтобы его увидели раньше первого использования матриц.
+# ifdef NN_USE_ARENA
+# include "Arena.h"
+#  define NN_ARENA_ABI 1
+# else
+#  define NN_ARENA_ABI 0
+# endif
+
+// NN_USE_ARENA меняет выделение памяти всех матриц Scalar, поэтому все единицы
+// трансляции программы должны собираться с одним значением. MSVC проверяет это
+// при компоновке, остальные компиляторы - при запуске программы (ниже).
+# ifdef _MSC_VER
+#  ifdef NN_USE_ARENA
+#   pragma detect_mismatch("NN_USE_ARENA", "1")
+#  else
+#   pragma detect_mismatch("NN_USE_ARENA", "0")
+#  endif
+# endif
+
+namespace internal
+{
+    /// <summary>
+    /// NN_ARENA_ABI одной из единиц трансляции: у всех одно определение flag,
+    /// и компоновщик берет его из любой. volatile - чтобы компилятор не подставил
+    /// значение своей единицы.
+    /// </summary>
+    template <int N = 0>
+    struct ArenaAbi
+    {
+        static volatile int flag;
+    };
+
+    template <int N>
+    volatile int ArenaAbi<N>::flag = NN_ARENA_ABI;
+
+    /// <summary>
+    /// Проверка при статической инициализации каждой единицы трансляции: если
+    /// flag пришел из единицы с другим NN_USE_ARENA, программа падает сразу,
+    /// а не портит кучу, освобождая матрицу чужим free
+    /// </summary>
+    struct ArenaAbiCheck
+    {
+        explicit ArenaAbiCheck(const int local)
+        {
+            if (ArenaAbi<>::flag != local)
+            {
+                throw std::logic_error("[Config]: Translation units are built with different NN_USE_ARENA");
+            }
+        }
+    };
+
+    namespace
+    {
+        const ArenaAbiCheck arena_abi_check(NN_ARENA_ABI);
+    }
+}
@@ -0,0 +1,613 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <cstddef>
+# include <cmath>
+# include <cstdlib>
+# include <cstring>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+# include "CpuFeatures.h"
+
+///
+/// Выбор набора инструкций для горячих ядер во время работы.
+///
+/// Библиотека целиком в заголовках, и Eigen векторизуется под флаги сборки
+/// проекта: переносимая сборка x86-64 считает все на SSE2 и на машине с
+/// AVX-512 использует четверть ширины вектора.
+///
+/// Здесь ядра (смещение и активации ReLU / LeakyReLU в FullyConnected,
+/// активации с экспонентой - Sigmoid, Tanh, Swish, ELU, Softplus, GELU - и
+/// производные последних трех, гейты LSTM / GRU, exp softmax внимания,
+/// производная смещения, шаг SGD, производная и ошибка MSE, GEMM и пакет GEMM
+/// с заранее упакованными весами (Ensemble.h)) компилируются несколько раз -
+/// под AVX2 + FMA и под AVX-512 (CpuDispatchKernels.h внутри #pragma GCC target / clang
+/// attribute, MSVC умеет это без прагм), и при первом обращении по cpuid
+/// (CpuFeatures.h) выбирается таблица указателей на самый широкий
+/// поддерживаемый вариант. Без x86-64 или с NN_NO_CPU_DISPATCH остается только
+/// CPU_GENERIC - прежние выражения Eigen. int8 ядра квантизованных слоев
+/// выбираются так же, но своей таблицей (QuantDispatch.h).
+///
+/// Смещение, ReLU и разность совпадают с Eigen бит в бит. В шаге SGD компилятор
+/// может слить умножение и сложение в FMA, а среднее по строкам и сумма квадратов
+/// суммируют в другом порядке - расхождения в последнем бите. exp, log и erf
+/// активаций - те же приближения Cephes, что у Eigen, с FMA: до 2 ulp от
+/// CPU_GENERIC. Fast* активации (FastMath.h) остаются выражениями Eigen. GEMM
+/// своих ядер подключается в слоях как GEMM_DISPATCH (см. Gemm.h), по умолчанию
+/// выше CPU_GENERIC, и отличается от Eigen порядком суммирования.
+///
+/// Уровень можно ограничить переменной окружения NN_CPU (generic, avx2, avx512)
+/// или set_cpu_level().
+///
+
+
+/// <summary>
+/// Набор инструкций ядер
+/// </summary>
+enum CpuLevel
+{
+    CPU_GENERIC, // выражения Eigen с флагами сборки
+    CPU_AVX2,    // AVX2 + FMA
+    CPU_AVX512   // AVX-512F
+};
+
+
+namespace internal
+{
+    /// <summary>
+    /// Таблица ядер одного набора инструкций. ld* - шаг между столбцами.
+    /// </summary>
+    template <typename T>
+    struct CpuKernels
+    {
+        CpuLevel level;
+
+        void (*add_bias)(T* z, std::ptrdiff_t ldz, const T* b, int rows, int cols);
+        void (*row_mean)(const T* z, std::ptrdiff_t ldz, int rows, int cols, T* res);
+        void (*relu)(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols, T slope);
+        void (*relu_jacobian)(const T* a, std::ptrdiff_t lda, const T* f, std::ptrdiff_t ldf,
+            T* g, std::ptrdiff_t ldg, int rows, int cols, T slope);
+        void (*sgd)(const T* d, T* w, std::ptrdiff_t n, T lr, T decay);
+        void (*sub)(const T* a, const T* b, T* res, std::ptrdiff_t n);
+        T (*squared_norm)(const T* x, std::ptrdiff_t n);
+
+        // Активации с экспонентой: A = f(Z), Z и A могут совпадать
+        void (*sigmoid)(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols);
+        void (*tanh)(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols);
+        void (*swish)(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols);
+        void (*elu)(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols);
+        void (*softplus)(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols);
+        void (*gelu)(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols);
+
+        // G = f'(Z) * F для активаций, чья производная тоже с экспонентой. G может совпадать
+        // с Z или A. Производная softplus считается по выходу A
+        void (*swish_jacobian)(const T* z, std::ptrdiff_t ldz, const T* a, std::ptrdiff_t lda,
+            const T* f, std::ptrdiff_t ldf, T* g, std::ptrdiff_t ldg, int rows, int cols);
+        void (*softplus_jacobian)(const T* a, std::ptrdiff_t lda, const T* f, std::ptrdiff_t ldf,
+            T* g, std::ptrdiff_t ldg, int rows, int cols);
+        void (*gelu_jacobian)(const T* z, std::ptrdiff_t ldz, const T* a, std::ptrdiff_t lda,
+            const T* f, std::ptrdiff_t ldf, T* g, std::ptrdiff_t ldg, int rows, int cols);
+
+        // A[:, j] = exp(Z[:, j] - shift[j]) - числитель softmax по столбцам, Z и A могут совпадать
+        void (*exp_shifted)(const T* z, std::ptrdiff_t ldz, const T* shift, T* a, std::ptrdiff_t lda, int rows, int cols);
+
+        // C = alpha * op(A) * op(B) + beta * C, при beta = 0 C только пишется
+        void (*gemm)(bool ta, bool tb, int m, int n, int k, T alpha,
+            const T* a, std::ptrdiff_t lda, const T* b, std::ptrdiff_t ldb, T beta, T* c, std::ptrdiff_t ldc);
+
+        // Пакет GEMM с постоянной A: C_t = alpha * A_t * B_t, t < batch, stride_* - шаг между
+        // матрицами пакета. A_t упакованы gemm_pack() (gemm_packed_size() элементов), формат
+        // упаковки свой у каждого уровня
+        std::size_t (*gemm_packed_size)(int m, int k);
+        void (*gemm_pack)(int m, int k, const T* a, std::ptrdiff_t lda, T* ap);
+        void (*gemm_packed)(int batch, int m, int n, int k, T alpha,
+            const T* ap, std::ptrdiff_t stride_a, const T* b, std::ptrdiff_t ldb, std::ptrdiff_t stride_b,
+            T* c, std::ptrdiff_t ldc, std::ptrdiff_t stride_c);
+    };
+
+    /// <summary>
+    /// Ядра на выражениях Eigen - поведение без диспетчеризации
+    /// </summary>
+    template <typename T>
+    struct GenericKernels
+    {
+        typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Matrix<T, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Map<Matrix, 0, Eigen::OuterStride<> > MapMatrix;
+        typedef Eigen::Map<const Matrix, 0, Eigen::OuterStride<> > ConstMapMatrix;
+        typedef Eigen::Map<Vector> MapVector;
+        typedef Eigen::Map<const Vector> ConstMapVector;
+
+        static void add_bias(T* z, std::ptrdiff_t ldz, const T* b, int rows, int cols)
+        {
+            MapMatrix(z, rows, cols, Eigen::OuterStride<>(ldz)).colwise() += ConstMapVector(b, rows);
+        }
+
+        static void row_mean(const T* z, std::ptrdiff_t ldz, int rows, int cols, T* res)
+        {
+            MapVector(res, rows).noalias() = ConstMapMatrix(z, rows, cols, Eigen::OuterStride<>(ldz)).rowwise().mean();
+        }
+
+        static void relu(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols, T slope)
+        {
+            ConstMapMatrix zm(z, rows, cols, Eigen::OuterStride<>(ldz));
+            MapMatrix am(a, rows, cols, Eigen::OuterStride<>(lda));
+
+            if (slope == T(0)) { am.array() = zm.array().cwiseMax(T(0)); }
+            else { am.array() = zm.array().cwiseMax(slope * zm.array()); }
+        }
+
+        static void relu_jacobian(const T* a, std::ptrdiff_t lda, const T* f, std::ptrdiff_t ldf,
+            T* g, std::ptrdiff_t ldg, int rows, int cols, T slope)
+        {
+            ConstMapMatrix am(a, rows, cols, Eigen::OuterStride<>(lda));
+            ConstMapMatrix fm(f, rows, cols, Eigen::OuterStride<>(ldf));
+            MapMatrix gm(g, rows, cols, Eigen::OuterStride<>(ldg));
+
+            if (slope == T(0)) { gm.array() = (am.array() > T(0)).select(fm, T(0)); }
+            else { gm.array() = (am.array() > T(0)).select(fm, slope * fm.array()); }
+        }
+
+        static void sgd(const T* d, T* w, std::ptrdiff_t n, T lr, T decay)
+        {
+            MapVector wv(w, n);
+            wv.noalias() -= lr * (ConstMapVector(d, n) + decay * wv);
+        }
+
+        static void sub(const T* a, const T* b, T* res, std::ptrdiff_t n)
+        {
+            MapVector(res, n).noalias() = ConstMapVector(a, n) - ConstMapVector(b, n);
+        }
+
+        static T squared_norm(const T* x, std::ptrdiff_t n)
+        {
+            return ConstMapVector(x, n).squaredNorm();
+        }
+
+        static T gelu_cdf(const T& z) { return T(0.5) * (T(1) + std::erf(z * T(0.70710678118654752440))); }
+
+        static void sigmoid(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols)
+        {
+            ConstMapMatrix zm(z, rows, cols, Eigen::OuterStride<>(ldz));
+            MapMatrix(a, rows, cols, Eigen::OuterStride<>(lda)).array() = T(1) / (T(1) + (-zm.array()).exp());
+        }
+
+        static void tanh(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols)
+        {
+            ConstMapMatrix zm(z, rows, cols, Eigen::OuterStride<>(ldz));
+            MapMatrix(a, rows, cols, Eigen::OuterStride<>(lda)).array() =
+                T(2) / (T(1) + (T(-2) * zm.array()).exp()) - T(1);
+        }
+
+        static void swish(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols)
+        {
+            ConstMapMatrix zm(z, rows, cols, Eigen::OuterStride<>(ldz));
+            MapMatrix(a, rows, cols, Eigen::OuterStride<>(lda)).array() = zm.array() / (T(1) + (-zm.array()).exp());
+        }
+
+        static void elu(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols)
+        {
+            ConstMapMatrix zm(z, rows, cols, Eigen::OuterStride<>(ldz));
+            MapMatrix(a, rows, cols, Eigen::OuterStride<>(lda)).array() =
+                zm.array().cwiseMax(T(0)) + zm.array().cwiseMin(T(0)).expm1();
+        }
+
+        static void softplus(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols)
+        {
+            ConstMapMatrix zm(z, rows, cols, Eigen::OuterStride<>(ldz));
+            MapMatrix(a, rows, cols, Eigen::OuterStride<>(lda)).array() =
+                zm.array().cwiseMax(T(0)) + (-zm.array().abs()).exp().log1p();
+        }
+
+        static void gelu(const T* z, std::ptrdiff_t ldz, T* a, std::ptrdiff_t lda, int rows, int cols)
+        {
+            ConstMapMatrix zm(z, rows, cols, Eigen::OuterStride<>(ldz));
+            MapMatrix(a, rows, cols, Eigen::OuterStride<>(lda)).array() = zm.array() * zm.array().unaryExpr(&gelu_cdf);
+        }
+
+        static void swish_jacobian(const T* z, std::ptrdiff_t ldz, const T* a, std::ptrdiff_t lda,
+            const T* f, std::ptrdiff_t ldf, T* g, std::ptrdiff_t ldg, int rows, int cols)
+        {
+            ConstMapMatrix zm(z, rows, cols, Eigen::OuterStride<>(ldz));
+            ConstMapMatrix am(a, rows, cols, Eigen::OuterStride<>(lda));
+            ConstMapMatrix fm(f, rows, cols, Eigen::OuterStride<>(ldf));
+
+            MapMatrix(g, rows, cols, Eigen::OuterStride<>(ldg)).array() =
+                fm.array() * (T(1) + zm.array() - am.array()) / (T(1) + (-zm.array()).exp());
+        }
+
+        static void softplus_jacobian(const T* a, std::ptrdiff_t lda, const T* f, std::ptrdiff_t ldf,
+            T* g, std::ptrdiff_t ldg, int rows, int cols)
+        {
+            ConstMapMatrix am(a, rows, cols, Eigen::OuterStride<>(lda));
+            ConstMapMatrix fm(f, rows, cols, Eigen::OuterStride<>(ldf));
+
+            MapMatrix(g, rows, cols, Eigen::OuterStride<>(ldg)).array() = -(-am.array()).expm1() * fm.array();
+        }
+
+        static void gelu_jacobian(const T* z, std::ptrdiff_t ldz, const T* a, std::ptrdiff_t lda,
+            const T* f, std::ptrdiff_t ldf, T* g, std::ptrdiff_t ldg, int rows, int cols)
+        {
+            ConstMapMatrix zm(z, rows, cols, Eigen::OuterStride<>(ldz));
+            ConstMapMatrix fm(f, rows, cols, Eigen::OuterStride<>(ldf));
+
+            MapMatrix(g, rows, cols, Eigen::OuterStride<>(ldg)).array() = fm.array() * (zm.array().unaryExpr(&gelu_cdf) +
+                zm.array() * T(0.39894228040143268) * (T(-0.5) * zm.array().square()).exp());
+        }
+
+        static void exp_shifted(const T* z, std::ptrdiff_t ldz, const T* shift, T* a, std::ptrdiff_t lda, int rows, int cols)
+        {
+            ConstMapMatrix zm(z, rows, cols, Eigen::OuterStride<>(ldz));
+            MapMatrix(a, rows, cols, Eigen::OuterStride<>(lda)).array() =
+                (zm.array().rowwise() - Eigen::Map<const Eigen::Array<T, 1, Eigen::Dynamic> >(shift, cols)).exp();
+        }
+
+        static void gemm(bool ta, bool tb, int m, int n, int k, T alpha,
+            const T* a, std::ptrdiff_t lda, const T* b, std::ptrdiff_t ldb, T beta, T* c, std::ptrdiff_t ldc)
+        {
+            ConstMapMatrix am(a, ta ? k : m, ta ? m : k, Eigen::OuterStride<>(lda));
+            ConstMapMatrix bm(b, tb ? n : k, tb ? k : n, Eigen::OuterStride<>(ldb));
+            MapMatrix cm(c, m, n, Eigen::OuterStride<>(ldc));
+
+            if (beta == T(0))
+            {
+                if (ta && tb) { cm.noalias() = alpha * (am.transpose() * bm.transpose()); }
+                else if (ta)  { cm.noalias() = alpha * (am.transpose() * bm); }
+                else if (tb)  { cm.noalias() = alpha * (am * bm.transpose()); }
+                else          { cm.noalias() = alpha * (am * bm); }
+
+                return;
+            }
+
+            if (beta != T(1)) { cm *= beta; }
+
+            if (ta && tb) { cm.noalias() += alpha * (am.transpose() * bm.transpose()); }
+            else if (ta)  { cm.noalias() += alpha * (am.transpose() * bm); }
+            else if (tb)  { cm.noalias() += alpha * (am * bm.transpose()); }
+            else          { cm.noalias() += alpha * (am * bm); }
+        }
+
+        // Упакованная A здесь - просто A column-major с ld = m
+        static std::size_t gemm_packed_size(int m, int k)
+        {
+            return std::size_t(m) * k;
+        }
+
+        static void gemm_pack(int m, int k, const T* a, std::ptrdiff_t lda, T* ap)
+        {
+            MapMatrix(ap, m, k, Eigen::OuterStride<>(m)) = ConstMapMatrix(a, m, k, Eigen::OuterStride<>(lda));
+        }
+
+        static void gemm_packed(int batch, int m, int n, int k, T alpha,
+            const T* ap, std::ptrdiff_t stride_a, const T* b, std::ptrdiff_t ldb, std::ptrdiff_t stride_b,
+            T* c, std::ptrdiff_t ldc, std::ptrdiff_t stride_c)
+        {
+            for (int t = 0; t < batch; ++t)
+            {
+                gemm(false, false, m, n, k, alpha, ap + t * stride_a, m, b + t * stride_b, ldb, T(0), c + t * stride_c, ldc);
+            }
+        }
+    };
+}
+
+
+# ifdef NN_CPU_DISPATCH_X86
+
+// ---- AVX2 + FMA ----
+
+#  if defined(__clang__)
+#   pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#  elif defined(__GNUC__)
+#   pragma GCC push_options
+#   pragma GCC target("avx2,fma")
+#  endif
+
+namespace internal
+{
+    namespace cpu_avx2
+    {
+        struct V
+        {
+            typedef __m256d type;
+
+            static const int W = 4;  // double в векторе
+            static const int NR = 6; // столбцов в микроядре GEMM: 12 аккумуляторов из 16 регистров
+
+            static inline type zero() { return _mm256_setzero_pd(); }
+            static inline type set1(double x) { return _mm256_set1_pd(x); }
+            static inline type loadu(const double* p) { return _mm256_loadu_pd(p); }
+            static inline void storeu(double* p, type x) { _mm256_storeu_pd(p, x); }
+            static inline type add(type a, type b) { return _mm256_add_pd(a, b); }
+            static inline type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+            static inline type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+            static inline type fmadd(type a, type b, type c) { return _mm256_fmadd_pd(a, b, c); }
+            static inline type div(type a, type b) { return _mm256_div_pd(a, b); }
+            // аргументы как в pmax / pmin Eigen: при NaN или +-0 берется a
+            static inline type max(type a, type b) { return _mm256_max_pd(b, a); }
+            static inline type min(type a, type b) { return _mm256_min_pd(b, a); }
+            static inline type floor(type a) { return _mm256_floor_pd(a); }
+            static inline type abs(type a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+
+            /// (a > 0) ? x : y
+            static inline type select_gt0(type a, type x, type y)
+            {
+                return _mm256_blendv_pd(y, x, _mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_GT_OQ));
+            }
+
+            typedef __m256d mask;
+
+            static inline mask lt(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+            static inline mask eq(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+            /// m ? x : y
+            static inline type blend(mask m, type x, type y) { return _mm256_blendv_pd(y, x, m); }
+
+            /// 2^n для целых n из [-1022, 1023]: n + 1023 в младших битах мантиссы 2^52
+            static inline type pow2(type n)
+            {
+                const __m256i bits = _mm256_castpd_si256(_mm256_add_pd(n, _mm256_set1_pd(4503599627371519.0)));
+                return _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52));
+            }
+
+            /// x = m * 2^e, m из [0.5, 1), для положительных нормальных x
+            static inline type frexp(type x, type& e)
+            {
+                const __m256i bits = _mm256_castpd_si256(x);
+                const __m256i biased = _mm256_or_si256(_mm256_srli_epi64(bits, 52),
+                    _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.0)));
+
+                e = _mm256_sub_pd(_mm256_castsi256_pd(biased), _mm256_set1_pd(4503599627371518.0));
+
+                return _mm256_castsi256_pd(_mm256_or_si256(
+                    _mm256_and_si256(bits, _mm256_set1_epi64x(0x800FFFFFFFFFFFFFLL)),
+                    _mm256_set1_epi64x(0x3FE0000000000000LL)));
+            }
+        };
+
+#  include "CpuDispatchKernels.h"
+    }
+}
+
+#  if defined(__clang__)
+#   pragma clang attribute pop
+#  elif defined(__GNUC__)
+#   pragma GCC pop_options
+#  endif
+
+// ---- AVX-512F ----
+
+#  if defined(__clang__)
+#   pragma clang attribute push(__attribute__((target("avx512f,avx2,fma"))), apply_to = function)
+#  elif defined(__GNUC__)
+#   pragma GCC push_options
+#   pragma GCC target("avx512f,avx2,fma")
+#  endif
+
+namespace internal
+{
+    namespace cpu_avx512
+    {
+        struct V
+        {
+            typedef __m512d type;
+
+            static const int W = 8;
+            static const int NR = 8; // 16 аккумуляторов из 32 регистров
+
+            static inline type zero() { return _mm512_setzero_pd(); }
+            static inline type set1(double x) { return _mm512_set1_pd(x); }
+            static inline type loadu(const double* p) { return _mm512_loadu_pd(p); }
+            static inline void storeu(double* p, type x) { _mm512_storeu_pd(p, x); }
+            static inline type add(type a, type b) { return _mm512_add_pd(a, b); }
+            static inline type sub(type a, type b) { return _mm512_sub_pd(a, b); }
+            static inline type mul(type a, type b) { return _mm512_mul_pd(a, b); }
+            static inline type fmadd(type a, type b, type c) { return _mm512_fmadd_pd(a, b, c); }
+            // Здесь и ниже вариант с маской и явным источником: в GCC 12 обычный берет источник
+            // из _mm512_undefined_*(), и -Wall выдает ложные -Wmaybe-uninitialized
+            static inline type max(type a, type b) { return _mm512_mask_max_pd(a, 0xFF, b, a); }
+            static inline type min(type a, type b) { return _mm512_mask_min_pd(a, 0xFF, b, a); }
+            static inline type div(type a, type b) { return _mm512_div_pd(a, b); }
+            static inline type floor(type a) { return _mm512_mask_roundscale_pd(a, 0xFF, a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+            static inline type abs(type a) { return _mm512_abs_pd(a); }
+
+            static inline type select_gt0(type a, type x, type y)
+            {
+                return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(a, _mm512_setzero_pd(), _CMP_GT_OQ), y, x);
+            }
+
+            typedef __mmask8 mask;
+
+            static inline mask lt(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+            static inline mask eq(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+            static inline type blend(mask m, type x, type y) { return _mm512_mask_blend_pd(m, y, x); }
+
+            static inline type pow2(type n)
+            {
+                const __m512i bits = _mm512_castpd_si512(_mm512_add_pd(n, _mm512_set1_pd(4503599627371519.0)));
+                return _mm512_castsi512_pd(_mm512_mask_slli_epi64(bits, 0xFF, bits, 52));
+            }
+
+            static inline type frexp(type x, type& e)
+            {
+                const __m512i bits = _mm512_castpd_si512(x);
+                const __m512i biased = _mm512_or_si512(_mm512_mask_srli_epi64(bits, 0xFF, bits, 52),
+                    _mm512_castpd_si512(_mm512_set1_pd(4503599627370496.0)));
+
+                e = _mm512_sub_pd(_mm512_castsi512_pd(biased), _mm512_set1_pd(4503599627371518.0));
+
+                return _mm512_castsi512_pd(_mm512_or_si512(
+                    _mm512_and_si512(bits, _mm512_set1_epi64(0x800FFFFFFFFFFFFFLL)),
+                    _mm512_set1_epi64(0x3FE0000000000000LL)));
+            }
+        };
+
+#  include "CpuDispatchKernels.h"
+    }
+}
+
+#  if defined(__clang__)
+#   pragma clang attribute pop
+#  elif defined(__GNUC__)
+#   pragma GCC pop_options
+#  endif
+
+# endif // NN_CPU_DISPATCH_X86
+
+
+namespace internal
+{
+    /// <summary>
+    /// Самый широкий набор, который поддерживают процессор и ОС
+    /// </summary>
+    inline CpuLevel detect_cpu_level()
+    {
+        const CpuFeatures& f = cpu_features();
+
+        if (f.avx512f) { return CPU_AVX512; }
+        if (f.avx2) { return CPU_AVX2; }
+
+        return CPU_GENERIC;
+    }
+
+    inline CpuLevel supported_cpu_level()
+    {
+        static const CpuLevel level = detect_cpu_level();
+        return level;
+    }
+
+    /// <summary>
+    /// Уровень при старте: поддерживаемый, ограниченный NN_CPU
+    /// </summary>
+    inline CpuLevel initial_cpu_level()
+    {
+        const CpuLevel supported = supported_cpu_level();
+        const char* env = std::getenv("NN_CPU");
+
+        if (env == NULL) { return supported; }
+        if (std::strcmp(env, "generic") == 0) { return CPU_GENERIC; }
+        if (std::strcmp(env, "avx2") == 0) { return std::min(supported, CPU_AVX2); }
+        if (std::strcmp(env, "avx512") == 0) { return std::min(supported, CPU_AVX512); }
+
+        return supported;
+    }
+
+    template <typename T>
+    inline void fill_simd_kernels(CpuKernels<T>& kernels, const CpuLevel level) {}
+
+    /// <summary>
+    /// Свои ядра есть только для double
+    /// </summary>
+    inline void fill_simd_kernels(CpuKernels<double>& kernels, const CpuLevel level)
+    {
+# ifdef NN_CPU_DISPATCH_X86
+#  define NN_CPU_FILL(ns)                                  \
+        kernels.add_bias = ns::add_bias;                   \
+        kernels.row_mean = ns::row_mean;                   \
+        kernels.relu = ns::relu;                           \
+        kernels.relu_jacobian = ns::relu_jacobian;         \
+        kernels.sgd = ns::sgd;                             \
+        kernels.sub = ns::sub;                             \
+        kernels.squared_norm = ns::squared_norm;           \
+        kernels.sigmoid = ns::sigmoid;                     \
+        kernels.tanh = ns::tanh;                           \
+        kernels.swish = ns::swish;                         \
+        kernels.elu = ns::elu;                             \
+        kernels.softplus = ns::softplus;                   \
+        kernels.gelu = ns::gelu;                           \
+        kernels.swish_jacobian = ns::swish_jacobian;       \
+        kernels.softplus_jacobian = ns::softplus_jacobian; \
+        kernels.gelu_jacobian = ns::gelu_jacobian;         \
+        kernels.exp_shifted = ns::exp_shifted;             \
+        kernels.gemm = ns::gemm;                           \
+        kernels.gemm_packed_size = ns::gemm_packed_size;   \
+        kernels.gemm_pack = ns::gemm_pack;                 \
+        kernels.gemm_packed = ns::gemm_packed;
+
+        if (level == CPU_AVX512) { NN_CPU_FILL(cpu_avx512) kernels.level = level; }
+        else if (level == CPU_AVX2) { NN_CPU_FILL(cpu_avx2) kernels.level = level; }
+
+#  undef NN_CPU_FILL
+# endif
+    }
+
+    template <typename T>
+    inline CpuKernels<T> make_cpu_kernels(const CpuLevel level)
+    {
+        CpuKernels<T> kernels;
+
+        kernels.level = CPU_GENERIC;
+        kernels.add_bias = GenericKernels<T>::add_bias;
+        kernels.row_mean = GenericKernels<T>::row_mean;
+        kernels.relu = GenericKernels<T>::relu;
+        kernels.relu_jacobian = GenericKernels<T>::relu_jacobian;
+        kernels.sgd = GenericKernels<T>::sgd;
+        kernels.sub = GenericKernels<T>::sub;
+        kernels.squared_norm = GenericKernels<T>::squared_norm;
+        kernels.sigmoid = GenericKernels<T>::sigmoid;
+        kernels.tanh = GenericKernels<T>::tanh;
+        kernels.swish = GenericKernels<T>::swish;
+        kernels.elu = GenericKernels<T>::elu;
+        kernels.softplus = GenericKernels<T>::softplus;
+        kernels.gelu = GenericKernels<T>::gelu;
+        kernels.swish_jacobian = GenericKernels<T>::swish_jacobian;
+        kernels.softplus_jacobian = GenericKernels<T>::softplus_jacobian;
+        kernels.gelu_jacobian = GenericKernels<T>::gelu_jacobian;
+        kernels.exp_shifted = GenericKernels<T>::exp_shifted;
+        kernels.gemm = GenericKernels<T>::gemm;
+        kernels.gemm_packed_size = GenericKernels<T>::gemm_packed_size;
+        kernels.gemm_pack = GenericKernels<T>::gemm_pack;
+        kernels.gemm_packed = GenericKernels<T>::gemm_packed;
+
+        fill_simd_kernels(kernels, level);
+
+        return kernels;
+    }
+
+    /// <summary>
+    /// Текущая таблица, выбирается при первом обращении
+    /// </summary>
+    inline CpuKernels<Scalar>& cpu_kernels_table()
+    {
+        static CpuKernels<Scalar> kernels = make_cpu_kernels<Scalar>(initial_cpu_level());
+        return kernels;
+    }
+
+    inline const CpuKernels<Scalar>& cpu_kernels() { return cpu_kernels_table(); }
+}
+
+
+/// <summary>
+/// Набор инструкций, на котором сейчас считают ядра
+/// </summary>
+inline CpuLevel cpu_level() { return internal::cpu_kernels().level; }
+
+/// <summary>
+/// Самый широкий набор, доступный на этой машине
+/// </summary>
+inline CpuLevel cpu_level_supported() { return internal::supported_cpu_level(); }
+
+/// <summary>
+/// Выбрать набор инструкций ядер (например, для сравнения). Нельзя вызывать во время обучения
+/// или прогноза в других потоках. Для Scalar != double всегда остается CPU_GENERIC.
+/// </summary>
+/// <param name="level"> - набор, не шире cpu_level_supported()</param>
+inline void set_cpu_level(const CpuLevel level)
+{
+    if (level > cpu_level_supported())
+    {
+        throw std::invalid_argument("[set_cpu_level]: Instruction set is not supported by this CPU");
+    }
+
+    internal::cpu_kernels_table() = internal::make_cpu_kernels<Scalar>(level);
+}
+
+inline const char* cpu_level_name(const CpuLevel level)
+{
+    switch (level)
+    {
+    case CPU_AVX512: return "avx512";
+    case CPU_AVX2: return "avx2";
+    default: return "generic";
+    }
+}
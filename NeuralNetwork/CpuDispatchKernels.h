@@ -0,0 +1,795 @@
+// Без #pragma once: файл намеренно включается несколько раз.
+
+///
+/// Ядра CpuDispatch.h для одного набора инструкций.
+///
+/// Файл подключается из CpuDispatch.h внутри пространства имен набора
+/// (internal::cpu_avx2, internal::cpu_avx512) после определения V - обертки
+/// над векторным типом, и компилируется под target этого набора. Отдельно
+/// его подключать не нужно.
+///
+/// Поэлементные ядра делают те же операции, что и выражения Eigen в
+/// GenericKernels, max - с тем же порядком аргументов. exp, log и expm1
+/// активаций - алгоритмы Cephes, как pexp / plog Eigen (до 1-2 ulp от std::),
+/// erf в GELU - рациональные приближения Cephes.
+///
+
+
+/// <summary>
+/// Z[:, j] += b
+/// </summary>
+inline void add_bias(double* z, const std::ptrdiff_t ldz, const double* b, const int rows, const int cols)
+{
+    for (int j = 0; j < cols; ++j)
+    {
+        double* zj = z + j * ldz;
+        int i = 0;
+
+        for (; i + V::W <= rows; i += V::W) { V::storeu(zj + i, V::add(V::loadu(zj + i), V::loadu(b + i))); }
+        for (; i < rows; ++i) { zj[i] += b[i]; }
+    }
+}
+
+/// <summary>
+/// res = среднее Z по строкам
+/// </summary>
+inline void row_mean(const double* z, const std::ptrdiff_t ldz, const int rows, const int cols, double* res)
+{
+    for (int i = 0; i < rows; ++i) { res[i] = cols > 0 ? z[i] : 0.0; }
+
+    for (int j = 1; j < cols; ++j)
+    {
+        const double* zj = z + j * ldz;
+        int i = 0;
+
+        for (; i + V::W <= rows; i += V::W) { V::storeu(res + i, V::add(V::loadu(res + i), V::loadu(zj + i))); }
+        for (; i < rows; ++i) { res[i] += zj[i]; }
+    }
+
+    for (int i = 0; i < rows; ++i) { res[i] /= double(cols); }
+}
+
+/// <summary>
+/// A = max(Z, slope * Z), при slope = 0 - max(Z, 0)
+/// </summary>
+inline void relu(const double* z, const std::ptrdiff_t ldz, double* a, const std::ptrdiff_t lda,
+    const int rows, const int cols, const double slope)
+{
+    const V::type vs = V::set1(slope);
+
+    for (int j = 0; j < cols; ++j)
+    {
+        const double* zj = z + j * ldz;
+        double* aj = a + j * lda;
+        int i = 0;
+
+        if (slope == 0.0)
+        {
+            for (; i + V::W <= rows; i += V::W) { V::storeu(aj + i, V::max(V::loadu(zj + i), V::zero())); }
+            for (; i < rows; ++i) { aj[i] = std::max(zj[i], 0.0); }
+        }
+        else
+        {
+            for (; i + V::W <= rows; i += V::W)
+            {
+                const V::type x = V::loadu(zj + i);
+                V::storeu(aj + i, V::max(x, V::mul(vs, x)));
+            }
+
+            for (; i < rows; ++i) { aj[i] = std::max(zj[i], slope * zj[i]); }
+        }
+    }
+}
+
+/// <summary>
+/// G = (A > 0) ? F : slope * F, при slope = 0 - (A > 0) ? F : 0
+/// </summary>
+inline void relu_jacobian(const double* a, const std::ptrdiff_t lda, const double* f, const std::ptrdiff_t ldf,
+    double* g, const std::ptrdiff_t ldg, const int rows, const int cols, const double slope)
+{
+    const V::type vs = V::set1(slope);
+
+    for (int j = 0; j < cols; ++j)
+    {
+        const double* aj = a + j * lda;
+        const double* fj = f + j * ldf;
+        double* gj = g + j * ldg;
+        int i = 0;
+
+        for (; i + V::W <= rows; i += V::W)
+        {
+            const V::type x = V::loadu(fj + i);
+            V::storeu(gj + i, V::select_gt0(V::loadu(aj + i), x, slope == 0.0 ? V::zero() : V::mul(vs, x)));
+        }
+
+        for (; i < rows; ++i) { gj[i] = (aj[i] > 0.0) ? fj[i] : (slope == 0.0 ? 0.0 : slope * fj[i]); }
+    }
+}
+
+/// <summary>
+/// w -= lr * (d + decay * w)
+/// </summary>
+inline void sgd(const double* d, double* w, const std::ptrdiff_t n, const double lr, const double decay)
+{
+    const V::type vlr = V::set1(lr);
+    const V::type vdecay = V::set1(decay);
+    std::ptrdiff_t i = 0;
+
+    for (; i + V::W <= n; i += V::W)
+    {
+        const V::type x = V::loadu(w + i);
+        V::storeu(w + i, V::sub(x, V::mul(vlr, V::add(V::loadu(d + i), V::mul(vdecay, x)))));
+    }
+
+    for (; i < n; ++i) { w[i] -= lr * (d[i] + decay * w[i]); }
+}
+
+/// <summary>
+/// res = a - b
+/// </summary>
+inline void sub(const double* a, const double* b, double* res, const std::ptrdiff_t n)
+{
+    std::ptrdiff_t i = 0;
+
+    for (; i + V::W <= n; i += V::W) { V::storeu(res + i, V::sub(V::loadu(a + i), V::loadu(b + i))); }
+    for (; i < n; ++i) { res[i] = a[i] - b[i]; }
+}
+
+/// <summary>
+/// Сумма квадратов x
+/// </summary>
+inline double squared_norm(const double* x, const std::ptrdiff_t n)
+{
+    V::type acc0 = V::zero(), acc1 = V::zero();
+    std::ptrdiff_t i = 0;
+
+    for (; i + 2 * V::W <= n; i += 2 * V::W)
+    {
+        const V::type x0 = V::loadu(x + i);
+        const V::type x1 = V::loadu(x + i + V::W);
+
+        acc0 = V::fmadd(x0, x0, acc0);
+        acc1 = V::fmadd(x1, x1, acc1);
+    }
+
+    double tmp[V::W];
+    double res = 0.0;
+
+    V::storeu(tmp, V::add(acc0, acc1));
+
+    for (int j = 0; j < V::W; ++j) { res += tmp[j]; }
+    for (; i < n; ++i) { res += x[i] * x[i]; }
+
+    return res;
+}
+
+
+///
+/// Трансцендентные функции для активаций
+///
+
+/// <summary>
+/// exp(x): x = n ln2 + r, exp(r) - рациональное приближение Cephes, как pexp_double Eigen
+/// </summary>
+inline V::type vec_exp(const V::type x0)
+{
+    const V::type one = V::set1(1.0);
+    const V::type x = V::max(V::min(x0, V::set1(709.784)), V::set1(-709.784));
+    const V::type n = V::floor(V::fmadd(V::set1(1.4426950408889634073599), x, V::set1(0.5)));
+
+    // n ln2 вычитается в две части, чтобы не терять последние знаки
+    V::type r = V::sub(x, V::mul(n, V::set1(0.693145751953125)));
+    r = V::sub(r, V::mul(n, V::set1(1.42860682030941723212e-6)));
+
+    const V::type r2 = V::mul(r, r);
+
+    V::type p = V::fmadd(V::set1(1.26177193074810590878e-4), r2, V::set1(3.02994407707441961300e-2));
+    p = V::mul(V::fmadd(p, r2, V::set1(9.99999999999999999910e-1)), r);
+
+    V::type q = V::fmadd(V::set1(3.00198505138664455042e-6), r2, V::set1(2.52448340349684104192e-3));
+    q = V::fmadd(q, r2, V::set1(2.27265548208155028766e-1));
+    q = V::fmadd(q, r2, V::set1(2.00000000000000000009e0));
+
+    const V::type e = V::fmadd(V::set1(2.0), V::div(p, V::sub(q, p)), one);
+
+    // 2^n двумя множителями: при n < -1022 результат денормализован. max ловит +inf на входе
+    const V::type h = V::floor(V::mul(n, V::set1(0.5)));
+
+    return V::max(V::mul(V::mul(e, V::pow2(h)), V::pow2(V::sub(n, h))), x0);
+}
+
+/// <summary>
+/// log(x) для x > 0: x = m 2^e, log(m) на [sqrt(1/2), sqrt(2)) - приближение Cephes, как plog_double Eigen.
+/// Денормализованные x считаются как наименьшее нормальное, +inf и NaN не обрабатываются.
+/// </summary>
+inline V::type vec_log(const V::type x0)
+{
+    const V::type one = V::set1(1.0);
+    V::type e;
+    V::type x = V::frexp(V::max(x0, V::set1(2.2250738585072014e-308)), e);
+
+    // m < sqrt(1/2): e - 1 и 2m - 1, иначе m - 1
+    const V::mask small = V::lt(x, V::set1(0.70710678118654752440));
+
+    e = V::blend(small, V::sub(e, one), e);
+    x = V::sub(V::blend(small, V::add(x, x), x), one);
+
+    const V::type x2 = V::mul(x, x);
+    const V::type x3 = V::mul(x2, x);
+
+    V::type y = V::fmadd(V::set1(1.01875663804580931796e-4), x, V::set1(4.97494994976747001425e-1));
+    V::type y1 = V::fmadd(V::set1(1.44989225341610930846e1), x, V::set1(1.79368678507819816313e1));
+    y = V::fmadd(y, x, V::set1(4.70579119878881725854e0));
+    y1 = V::fmadd(y1, x, V::set1(7.70838733755885391666e0));
+    const V::type p = V::fmadd(y, x3, y1);
+
+    y = V::add(x, V::set1(1.12873587189167450590e1));
+    y1 = V::fmadd(V::set1(8.29875266912776603211e1), x, V::set1(7.11544750618563894466e1));
+    y = V::fmadd(y, x, V::set1(4.52279145837532221105e1));
+    y1 = V::fmadd(y1, x, V::set1(2.31251620126765340583e1));
+    const V::type q = V::fmadd(y, x3, y1);
+
+    y = V::fmadd(V::set1(-0.5), x2, V::div(V::mul(p, x3), q));
+
+    return V::fmadd(e, V::set1(0.693147180559945309417), V::add(x, y));
+}
+
+/// <summary>
+/// exp(x) - 1 по формуле Кэхэна: (u - 1) * x / log(u), u = exp(x). Для x <= 0.
+/// </summary>
+inline V::type vec_expm1(const V::type x)
+{
+    const V::type one = V::set1(1.0);
+    const V::type u = vec_exp(x);
+    const V::type um1 = V::sub(u, one);
+
+    // u = 1: x меньше половины ulp, u - 1 = -1: exp(x) ниже точности 1
+    const V::type res = V::mul(um1, V::div(x, vec_log(u)));
+
+    return V::blend(V::eq(u, one), x, V::blend(V::eq(um1, V::set1(-1.0)), V::set1(-1.0), res));
+}
+
+/// <summary>
+/// log(1 + x) по формуле Кэхэна для x из [0, 1]
+/// </summary>
+inline V::type vec_log1p(const V::type x)
+{
+    const V::type one = V::set1(1.0);
+    const V::type xp1 = V::add(x, one);
+
+    return V::blend(V::eq(xp1, one), x, V::mul(x, V::div(vec_log(xp1), V::sub(xp1, one))));
+}
+
+/// <summary>
+/// Phi(z) = (1 + erf(z / sqrt(2))) / 2. При |z / sqrt(2)| < 1 erf = x T(x^2) / U(x^2), иначе
+/// через erfc = exp(-x^2) P(x) / Q(x) (Cephes ndtr), чтобы не терять точность хвоста при z < 0
+/// </summary>
+inline V::type vec_normal_cdf(const V::type z)
+{
+    const V::type half = V::set1(0.5);
+    const V::type x = V::mul(z, V::set1(0.70710678118654752440));
+    const V::type ax = V::min(V::abs(x), V::set1(27.0));
+    const V::type x2 = V::mul(x, x);
+
+    V::type t = V::fmadd(V::set1(9.60497373987051638749e0), x2, V::set1(9.00260197203842689217e1));
+    t = V::fmadd(t, x2, V::set1(2.23200534594684319226e3));
+    t = V::fmadd(t, x2, V::set1(7.00332514112805075473e3));
+    t = V::fmadd(t, x2, V::set1(5.55923013010394962768e4));
+
+    V::type u = V::add(x2, V::set1(3.35617141647503099647e1));
+    u = V::fmadd(u, x2, V::set1(5.21357949780152679795e2));
+    u = V::fmadd(u, x2, V::set1(4.59432382970980127987e3));
+    u = V::fmadd(u, x2, V::set1(2.26290000613890934246e4));
+    u = V::fmadd(u, x2, V::set1(4.92673942608635921086e4));
+
+    const V::type erf_small = V::div(V::mul(x, t), u);
+
+    V::type p = V::fmadd(V::set1(2.46196981473530512524e-10), ax, V::set1(5.64189564831068821977e-1));
+    p = V::fmadd(p, ax, V::set1(7.46321056442269912687e0));
+    p = V::fmadd(p, ax, V::set1(4.86371970985681366614e1));
+    p = V::fmadd(p, ax, V::set1(1.96520832956077098242e2));
+    p = V::fmadd(p, ax, V::set1(5.26445194995477358631e2));
+    p = V::fmadd(p, ax, V::set1(9.34528527171957607540e2));
+    p = V::fmadd(p, ax, V::set1(1.02755188689515710272e3));
+    p = V::fmadd(p, ax, V::set1(5.57535335369399327526e2));
+
+    V::type q = V::add(ax, V::set1(1.32281951154744992508e1));
+    q = V::fmadd(q, ax, V::set1(8.67072140885989742329e1));
+    q = V::fmadd(q, ax, V::set1(3.54937778887819891062e2));
+    q = V::fmadd(q, ax, V::set1(9.75708501743205489753e2));
+    q = V::fmadd(q, ax, V::set1(1.82390916687909736289e3));
+    q = V::fmadd(q, ax, V::set1(2.24633760818710981792e3));
+    q = V::fmadd(q, ax, V::set1(1.65666309194161350182e3));
+    q = V::fmadd(q, ax, V::set1(5.57535340817727675546e2));
+
+    // erfc(|x|) / 2, Phi = 1 - это при z > 0 и само это при z < 0
+    const V::type tail = V::mul(half, V::div(V::mul(vec_exp(V::sub(V::zero(), V::mul(ax, ax))), p), q));
+    const V::type big = V::select_gt0(x, V::sub(V::set1(1.0), tail), tail);
+
+    return V::blend(V::lt(ax, V::set1(1.0)), V::fmadd(half, erf_small, half), big);
+}
+
+/// <summary>
+/// A = Op(Z) по столбцам. Хвост столбца короче вектора считается через буфер,
+/// чтобы каждый элемент шел по одной и той же формуле.
+/// </summary>
+template <typename Op>
+inline void map_elementwise(const double* z, const std::ptrdiff_t ldz, double* a, const std::ptrdiff_t lda,
+    const int rows, const int cols)
+{
+    for (int j = 0; j < cols; ++j)
+    {
+        const double* zj = z + j * ldz;
+        double* aj = a + j * lda;
+        int i = 0;
+
+        for (; i + V::W <= rows; i += V::W) { V::storeu(aj + i, Op::apply(V::loadu(zj + i))); }
+
+        if (i < rows)
+        {
+            double tmp[V::W] = {};
+
+            std::copy(zj + i, zj + rows, tmp);
+            V::storeu(tmp, Op::apply(V::loadu(tmp)));
+            std::copy(tmp, tmp + (rows - i), aj + i);
+        }
+    }
+}
+
+/// <summary>
+/// G = Op(Z, A, F) по столбцам
+/// </summary>
+template <typename Op>
+inline void map_jacobian(const double* z, const std::ptrdiff_t ldz, const double* a, const std::ptrdiff_t lda,
+    const double* f, const std::ptrdiff_t ldf, double* g, const std::ptrdiff_t ldg, const int rows, const int cols)
+{
+    for (int j = 0; j < cols; ++j)
+    {
+        const double* zj = z + j * ldz;
+        const double* aj = a + j * lda;
+        const double* fj = f + j * ldf;
+        double* gj = g + j * ldg;
+        int i = 0;
+
+        for (; i + V::W <= rows; i += V::W)
+        {
+            V::storeu(gj + i, Op::apply(V::loadu(zj + i), V::loadu(aj + i), V::loadu(fj + i)));
+        }
+
+        if (i < rows)
+        {
+            double tz[V::W] = {}, ta[V::W] = {}, tf[V::W] = {};
+
+            std::copy(zj + i, zj + rows, tz);
+            std::copy(aj + i, aj + rows, ta);
+            std::copy(fj + i, fj + rows, tf);
+            V::storeu(tz, Op::apply(V::loadu(tz), V::loadu(ta), V::loadu(tf)));
+            std::copy(tz, tz + (rows - i), gj + i);
+        }
+    }
+}
+
+struct SigmoidOp
+{
+    static inline V::type apply(const V::type z)
+    {
+        const V::type one = V::set1(1.0);
+        return V::div(one, V::add(one, vec_exp(V::sub(V::zero(), z))));
+    }
+};
+
+struct TanhOp
+{
+    static inline V::type apply(const V::type z)
+    {
+        const V::type one = V::set1(1.0);
+        return V::sub(V::div(V::set1(2.0), V::add(one, vec_exp(V::mul(V::set1(-2.0), z)))), one);
+    }
+};
+
+struct SwishOp
+{
+    static inline V::type apply(const V::type z)
+    {
+        return V::div(z, V::add(V::set1(1.0), vec_exp(V::sub(V::zero(), z))));
+    }
+};
+
+struct EluOp
+{
+    static inline V::type apply(const V::type z)
+    {
+        return V::add(V::max(z, V::zero()), vec_expm1(V::min(z, V::zero())));
+    }
+};
+
+struct SoftplusOp
+{
+    static inline V::type apply(const V::type z)
+    {
+        return V::add(V::max(z, V::zero()), vec_log1p(vec_exp(V::sub(V::zero(), V::abs(z)))));
+    }
+};
+
+struct GeluOp
+{
+    static inline V::type apply(const V::type z) { return V::mul(z, vec_normal_cdf(z)); }
+};
+
+struct SwishJacobianOp
+{
+    static inline V::type apply(const V::type z, const V::type a, const V::type f)
+    {
+        const V::type one = V::set1(1.0);
+        return V::div(V::mul(f, V::sub(V::add(one, z), a)), V::add(one, vec_exp(V::sub(V::zero(), z))));
+    }
+};
+
+struct SoftplusJacobianOp
+{
+    static inline V::type apply(const V::type z, const V::type a, const V::type f)
+    {
+        return V::mul(V::sub(V::zero(), vec_expm1(V::sub(V::zero(), a))), f);
+    }
+};
+
+struct GeluJacobianOp
+{
+    static inline V::type apply(const V::type z, const V::type a, const V::type f)
+    {
+        const V::type pdf = V::mul(V::set1(0.39894228040143268), vec_exp(V::mul(V::set1(-0.5), V::mul(z, z))));
+        return V::mul(f, V::fmadd(z, pdf, vec_normal_cdf(z)));
+    }
+};
+
+inline void sigmoid(const double* z, const std::ptrdiff_t ldz, double* a, const std::ptrdiff_t lda, const int rows, const int cols)
+{
+    map_elementwise<SigmoidOp>(z, ldz, a, lda, rows, cols);
+}
+
+inline void tanh(const double* z, const std::ptrdiff_t ldz, double* a, const std::ptrdiff_t lda, const int rows, const int cols)
+{
+    map_elementwise<TanhOp>(z, ldz, a, lda, rows, cols);
+}
+
+inline void swish(const double* z, const std::ptrdiff_t ldz, double* a, const std::ptrdiff_t lda, const int rows, const int cols)
+{
+    map_elementwise<SwishOp>(z, ldz, a, lda, rows, cols);
+}
+
+inline void elu(const double* z, const std::ptrdiff_t ldz, double* a, const std::ptrdiff_t lda, const int rows, const int cols)
+{
+    map_elementwise<EluOp>(z, ldz, a, lda, rows, cols);
+}
+
+inline void softplus(const double* z, const std::ptrdiff_t ldz, double* a, const std::ptrdiff_t lda, const int rows, const int cols)
+{
+    map_elementwise<SoftplusOp>(z, ldz, a, lda, rows, cols);
+}
+
+inline void gelu(const double* z, const std::ptrdiff_t ldz, double* a, const std::ptrdiff_t lda, const int rows, const int cols)
+{
+    map_elementwise<GeluOp>(z, ldz, a, lda, rows, cols);
+}
+
+/// <summary>
+/// A[:, j] = exp(Z[:, j] - shift[j])
+/// </summary>
+inline void exp_shifted(const double* z, const std::ptrdiff_t ldz, const double* shift, double* a, const std::ptrdiff_t lda,
+    const int rows, const int cols)
+{
+    for (int j = 0; j < cols; ++j)
+    {
+        const double* zj = z + j * ldz;
+        double* aj = a + j * lda;
+        const V::type s = V::set1(shift[j]);
+        int i = 0;
+
+        for (; i + V::W <= rows; i += V::W) { V::storeu(aj + i, vec_exp(V::sub(V::loadu(zj + i), s))); }
+
+        if (i < rows)
+        {
+            double tmp[V::W] = {};
+
+            std::copy(zj + i, zj + rows, tmp);
+            V::storeu(tmp, vec_exp(V::sub(V::loadu(tmp), s)));
+            std::copy(tmp, tmp + (rows - i), aj + i);
+        }
+    }
+}
+
+inline void swish_jacobian(const double* z, const std::ptrdiff_t ldz, const double* a, const std::ptrdiff_t lda,
+    const double* f, const std::ptrdiff_t ldf, double* g, const std::ptrdiff_t ldg, const int rows, const int cols)
+{
+    map_jacobian<SwishJacobianOp>(z, ldz, a, lda, f, ldf, g, ldg, rows, cols);
+}
+
+inline void softplus_jacobian(const double* a, const std::ptrdiff_t lda, const double* f, const std::ptrdiff_t ldf,
+    double* g, const std::ptrdiff_t ldg, const int rows, const int cols)
+{
+    map_jacobian<SoftplusJacobianOp>(a, lda, a, lda, f, ldf, g, ldg, rows, cols);
+}
+
+inline void gelu_jacobian(const double* z, const std::ptrdiff_t ldz, const double* a, const std::ptrdiff_t lda,
+    const double* f, const std::ptrdiff_t ldf, double* g, const std::ptrdiff_t ldg, const int rows, const int cols)
+{
+    map_jacobian<GeluJacobianOp>(z, ldz, a, lda, f, ldf, g, ldg, rows, cols);
+}
+
+
+///
+/// GEMM: C = alpha * op(A) * op(B), все матрицы column-major.
+///
+/// Схема BLIS: B режется на панели KC x NC, A - на блоки MC x KC, обе
+/// упаковываются полосами по NR столбцов / MR строк (с нулями на краях), и
+/// микроядро считает блок C размером MR x NR в регистрах: 2 * NR векторных
+/// аккумуляторов, на шаг по k - два вектора A и NR broadcast из B.
+///
+
+static const int kGemmMR = 2 * V::W;
+static const int kGemmNR = V::NR;
+static const int kGemmKC = 256;
+static const int kGemmMC = 96;
+static const int kGemmNC = 4032;
+
+/// <summary>
+/// Полосы по MR строк блока op(A)[i0 : i0 + mc, p0 : p0 + kc]
+/// </summary>
+inline void gemm_pack_a(const bool ta, const double* a, const std::ptrdiff_t lda,
+    const int i0, const int mc, const int p0, const int kc, double* ap)
+{
+    for (int s = 0; s < mc; s += kGemmMR)
+    {
+        const int mr = std::min(kGemmMR, mc - s);
+
+        for (int p = 0; p < kc; ++p, ap += kGemmMR)
+        {
+            for (int ii = 0; ii < mr; ++ii)
+            {
+                const std::ptrdiff_t i = i0 + s + ii;
+                ap[ii] = ta ? a[(p0 + p) + i * lda] : a[i + (p0 + p) * lda];
+            }
+
+            for (int ii = mr; ii < kGemmMR; ++ii) { ap[ii] = 0.0; }
+        }
+    }
+}
+
+/// <summary>
+/// Полосы по NR столбцов панели op(B)[p0 : p0 + kc, j0 : j0 + nc]
+/// </summary>
+inline void gemm_pack_b(const bool tb, const double* b, const std::ptrdiff_t ldb,
+    const int p0, const int kc, const int j0, const int nc, double* bp)
+{
+    for (int s = 0; s < nc; s += kGemmNR)
+    {
+        const int nr = std::min(kGemmNR, nc - s);
+
+        for (int p = 0; p < kc; ++p, bp += kGemmNR)
+        {
+            for (int jj = 0; jj < nr; ++jj)
+            {
+                const std::ptrdiff_t j = j0 + s + jj;
+                bp[jj] = tb ? b[j + (p0 + p) * ldb] : b[(p0 + p) + j * ldb];
+            }
+
+            for (int jj = nr; jj < kGemmNR; ++jj) { bp[jj] = 0.0; }
+        }
+    }
+}
+
+/// <summary>
+/// C[0 : mr, 0 : nr] (+)= alpha * Ap * Bp, first - первая панель по k (C перезаписывается)
+/// </summary>
+inline void gemm_micro(const int kc, const double* ap, const double* bp, const double alpha,
+    double* c, const std::ptrdiff_t ldc, const int mr, const int nr, const bool first)
+{
+    V::type c0[kGemmNR];
+    V::type c1[kGemmNR];
+
+    NN_CPU_UNROLL
+    for (int jj = 0; jj < kGemmNR; ++jj) { c0[jj] = V::zero(); c1[jj] = V::zero(); }
+
+    for (int p = 0; p < kc; ++p, ap += kGemmMR, bp += kGemmNR)
+    {
+        const V::type a0 = V::loadu(ap);
+        const V::type a1 = V::loadu(ap + V::W);
+
+        NN_CPU_UNROLL
+        for (int jj = 0; jj < kGemmNR; ++jj)
+        {
+            const V::type bj = V::set1(bp[jj]);
+            c0[jj] = V::fmadd(a0, bj, c0[jj]);
+            c1[jj] = V::fmadd(a1, bj, c1[jj]);
+        }
+    }
+
+    const V::type va = V::set1(alpha);
+
+    if (mr == kGemmMR && nr == kGemmNR)
+    {
+        NN_CPU_UNROLL
+        for (int jj = 0; jj < kGemmNR; ++jj)
+        {
+            double* cj = c + jj * ldc;
+
+            if (first)
+            {
+                V::storeu(cj, V::mul(va, c0[jj]));
+                V::storeu(cj + V::W, V::mul(va, c1[jj]));
+            }
+            else
+            {
+                V::storeu(cj, V::fmadd(va, c0[jj], V::loadu(cj)));
+                V::storeu(cj + V::W, V::fmadd(va, c1[jj], V::loadu(cj + V::W)));
+            }
+        }
+
+        return;
+    }
+
+    // край C: блок целиком во временный буфер, в C - только его часть
+    double tmp[kGemmMR * kGemmNR];
+
+    for (int jj = 0; jj < kGemmNR; ++jj)
+    {
+        V::storeu(tmp + jj * kGemmMR, V::mul(va, c0[jj]));
+        V::storeu(tmp + jj * kGemmMR + V::W, V::mul(va, c1[jj]));
+    }
+
+    for (int jj = 0; jj < nr; ++jj)
+    {
+        double* cj = c + jj * ldc;
+
+        for (int ii = 0; ii < mr; ++ii) { cj[ii] = first ? tmp[jj * kGemmMR + ii] : cj[ii] + tmp[jj * kGemmMR + ii]; }
+    }
+}
+
+/// <summary>
+/// C[0 : mc, 0 : nc] (+)= alpha * Ap * Bp: упакованные блок A (mc x kc) и панель B (kc x nc)
+/// </summary>
+inline void gemm_block(const int kc, const int mc, const int nc, const double* ap, const double* bp,
+    const double alpha, double* c, const std::ptrdiff_t ldc, const bool first)
+{
+    for (int jr = 0; jr < nc; jr += kGemmNR)
+    {
+        const double* bj = bp + std::ptrdiff_t(jr) * kc;
+
+        for (int ir = 0; ir < mc; ir += kGemmMR)
+        {
+            gemm_micro(kc, ap + std::ptrdiff_t(ir) * kc, bj, alpha, c + ir + jr * ldc, ldc,
+                std::min(kGemmMR, mc - ir), std::min(kGemmNR, nc - jr), first);
+        }
+    }
+}
+
+/// <summary>
+/// C = alpha * op(A) * op(B) + beta * C. При beta = 0 C не читается
+/// </summary>
+inline void gemm(const bool ta, const bool tb, const int m, const int n, const int k, const double alpha,
+    const double* a, const std::ptrdiff_t lda, const double* b, const std::ptrdiff_t ldb,
+    const double beta, double* c, const std::ptrdiff_t ldc)
+{
+    if (m == 0 || n == 0) { return; }
+
+    if (beta != 0.0 && beta != 1.0)
+    {
+        for (int j = 0; j < n; ++j)
+        {
+            for (int i = 0; i < m; ++i) { c[i + j * ldc] *= beta; }
+        }
+    }
+
+    if (k == 0)
+    {
+        if (beta == 0.0)
+        {
+            for (int j = 0; j < n; ++j) { std::fill(c + j * ldc, c + j * ldc + m, 0.0); }
+        }
+
+        return;
+    }
+
+    // буферы упаковки свои у каждого потока
+    static thread_local std::vector<double> apack;
+    static thread_local std::vector<double> bpack;
+
+    const int nc_max = std::min(kGemmNC, (n + kGemmNR - 1) / kGemmNR * kGemmNR);
+    const int kc_max = std::min(kGemmKC, k);
+
+    apack.resize(std::size_t(kGemmMC) * kc_max);
+    bpack.resize(std::size_t(nc_max) * kc_max);
+
+    for (int j0 = 0; j0 < n; j0 += kGemmNC)
+    {
+        const int nc = std::min(kGemmNC, n - j0);
+
+        for (int p0 = 0; p0 < k; p0 += kGemmKC)
+        {
+            const int kc = std::min(kGemmKC, k - p0);
+
+            gemm_pack_b(tb, b, ldb, p0, kc, j0, nc, bpack.data());
+
+            for (int i0 = 0; i0 < m; i0 += kGemmMC)
+            {
+                const int mc = std::min(kGemmMC, m - i0);
+
+                gemm_pack_a(ta, a, lda, i0, mc, p0, kc, apack.data());
+                gemm_block(kc, mc, nc, apack.data(), bpack.data(), alpha, c + i0 + j0 * ldc, ldc,
+                    p0 == 0 && beta == 0.0);
+            }
+        }
+    }
+}
+
+
+///
+/// GEMM с заранее упакованной A для постоянных весов: A упаковывается один раз
+/// (gemm_pack), и на вызов пакуется только B. Панель A по KC - полосы по MR
+/// строк всех m строк подряд, так что блок MC x KC - непрерывный кусок панели.
+///
+
+inline std::size_t gemm_packed_size(const int m, const int k)
+{
+    return std::size_t((m + kGemmMR - 1) / kGemmMR * kGemmMR) * k;
+}
+
+inline void gemm_pack(const int m, const int k, const double* a, const std::ptrdiff_t lda, double* ap)
+{
+    const std::ptrdiff_t mp = (m + kGemmMR - 1) / kGemmMR * kGemmMR;
+
+    for (int p0 = 0; p0 < k; p0 += kGemmKC)
+    {
+        gemm_pack_a(false, a, lda, 0, m, p0, std::min(kGemmKC, k - p0), ap + p0 * mp);
+    }
+}
+
+inline void gemm_packed(const int batch, const int m, const int n, const int k, const double alpha,
+    const double* ap, const std::ptrdiff_t stride_a, const double* b, const std::ptrdiff_t ldb, const std::ptrdiff_t stride_b,
+    double* c, const std::ptrdiff_t ldc, const std::ptrdiff_t stride_c)
+{
+    if (m == 0 || n == 0) { return; }
+
+    if (k == 0)
+    {
+        for (int t = 0; t < batch; ++t)
+        {
+            for (int j = 0; j < n; ++j) { std::fill(c + t * stride_c + j * ldc, c + t * stride_c + j * ldc + m, 0.0); }
+        }
+
+        return;
+    }
+
+    static thread_local std::vector<double> bpack;
+
+    const std::ptrdiff_t mp = (m + kGemmMR - 1) / kGemmMR * kGemmMR;
+    const int nc_max = std::min(kGemmNC, (n + kGemmNR - 1) / kGemmNR * kGemmNR);
+
+    bpack.resize(std::size_t(nc_max) * std::min(kGemmKC, k));
+
+    for (int t = 0; t < batch; ++t)
+    {
+        const double* at = ap + t * stride_a;
+        const double* bt = b + t * stride_b;
+        double* ct = c + t * stride_c;
+
+        for (int j0 = 0; j0 < n; j0 += kGemmNC)
+        {
+            const int nc = std::min(kGemmNC, n - j0);
+
+            for (int p0 = 0; p0 < k; p0 += kGemmKC)
+            {
+                const int kc = std::min(kGemmKC, k - p0);
+                const double* panel = at + p0 * mp;
+
+                gemm_pack_b(false, bt, ldb, p0, kc, j0, nc, bpack.data());
+
+                for (int i0 = 0; i0 < m; i0 += kGemmMC)
+                {
+                    gemm_block(kc, std::min(kGemmMC, m - i0), nc, panel + std::ptrdiff_t(i0) * kc, bpack.data(),
+                        alpha, ct + i0 + j0 * ldc, ldc, p0 == 0);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+# if !defined(NN_NO_CPU_DISPATCH) && (defined(__x86_64__) || defined(_M_X64))
+#  define NN_CPU_DISPATCH_X86
+#  include <immintrin.h>
+#  ifdef _MSC_VER
+#   include <intrin.h>
+#  endif
+# endif
+
+# if defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+# endif
+
+// Полная развертка коротких циклов микроядер
+# if defined(__clang__)
+#  define NN_CPU_UNROLL _Pragma("unroll")
+# elif defined(__GNUC__)
+#  define NN_CPU_UNROLL _Pragma("GCC unroll 16")
+# else
+#  define NN_CPU_UNROLL
+# endif
+
+///
+/// Расширения набора инструкций x86-64, которые поддерживают процессор и ОС.
+///
+/// Общая часть выбора ядер во время работы: int8 ядра квантизованных слоев
+/// (QuantDispatch.h) и ядра Scalar (CpuDispatch.h) выбирают по этим флагам свой
+/// самый широкий вариант. Без x86-64 или с NN_NO_CPU_DISPATCH все флаги false.
+///
+
+
+namespace internal
+{
+    struct CpuFeatures
+    {
+        bool avx2;       // AVX2 + FMA, ОС сохраняет YMM
+        bool avx512f;    // AVX-512F, ОС сохраняет ZMM
+        bool avx512bw;
+        bool avx512vnni;
+
+        CpuFeatures() :
+            avx2(false), avx512f(false), avx512bw(false), avx512vnni(false) {}
+    };
+
+    inline CpuFeatures detect_cpu_features()
+    {
+        CpuFeatures res;
+
+# if defined(NN_CPU_DISPATCH_X86) && defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        const int max_leaf = info[0];
+
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool fma = (info[2] & (1 << 12)) != 0;
+
+        if (!osxsave || max_leaf < 7) { return res; }
+
+        // ОС должна сохранять регистры YMM (и ZMM для AVX-512) при переключении
+        const unsigned long long xcr0 = _xgetbv(0);
+
+        __cpuidex(info, 7, 0);
+        res.avx2 = (info[1] & (1 << 5)) != 0 && fma && (xcr0 & 0x6) == 0x6;
+        res.avx512f = (info[1] & (1 << 16)) != 0 && res.avx2 && (xcr0 & 0xE6) == 0xE6;
+        res.avx512bw = res.avx512f && (info[1] & (1 << 30)) != 0;
+        res.avx512vnni = res.avx512bw && (info[2] & (1 << 11)) != 0;
+# elif defined(NN_CPU_DISPATCH_X86)
+        // проверка поддержки регистров ОС - внутри __builtin_cpu_supports
+        __builtin_cpu_init();
+
+        res.avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        res.avx512f = res.avx2 && __builtin_cpu_supports("avx512f");
+        res.avx512bw = res.avx512f && __builtin_cpu_supports("avx512bw");
+        res.avx512vnni = res.avx512bw && __builtin_cpu_supports("avx512vnni");
+# endif
+        return res;
+    }
+
+    inline const CpuFeatures& cpu_features()
+    {
+        static const CpuFeatures features = detect_cpu_features();
+        return features;
+    }
+}
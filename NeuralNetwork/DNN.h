@@ -13,11 +13,21 @@
 
 # include "ReLU.h"
 # include "Sigmoid.h"
+# include "Tanh.h"
+# include "LeakyReLU.h"
+# include "ELU.h"
+# include "GELU.h"
+# include "Swish.h"
+# include "Softplus.h"
+# include "Identity.h"
 
 
 
 # include "Layer.h"
 # include "FullyConnected.h"
+# include "LSTM.h"
+# include "GRU.h"
+# include "MultiHeadAttention.h"
 
 
 
@@ -33,4 +43,20 @@
 
 # include "Callback.h"
 # include "VerboseCallback.h"
+# include "MyVerboseCallback.h"
+# include "AsyncVerboseCallback.h"
 
+
+
+
+# include "BatchingServer.h"
+# include "Checkpoint.h"
+# include "Loaders.h"
+# include "ThreadPool.h"
+# include "Ensemble.h"
+# include "Sweep.h"
+# include "Graph.h"
+# include "Export.h"
+# include "CpuDispatch.h"
+# include "QuantDispatch.h"
+# include "Arena.h"
@@ -0,0 +1,71 @@
+#pragma once
+
+# include <Eigen/Core>
+# include "Config.h"
+# include "CpuDispatch.h"
+# include "FastMath.h"
+
+/// <summary>
+/// ELU с alpha = 1: z при z > 0, exp(z) - 1 иначе.
+/// Записана как max(z, 0) + expm1(min(z, 0)) без select, чтобы выражение векторизовалось.
+/// Производная 1 при a > 0 и a + 1 иначе, т.е. min(a, 0) + 1.
+/// </summary>
+class ELU
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		internal::cpu_kernels().elu(Z.data(), Z.outerStride(), A.data(), A.outerStride(), Z.rows(), Z.cols());
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		G.array() = (A.array().cwiseMin(Scalar(0)) + Scalar(1)) * F.array();
+	}
+
+	static std::string return_type()
+	{
+		return "ELU";
+	}
+};
+
+/// <summary>
+/// ELU через быстрый exp, абсолютная ошибка не больше 3e-10
+/// </summary>
+class FastELU
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		A.array() = Z.array().cwiseMax(Scalar(0)) +
+			Z.array().cwiseMin(Scalar(0)).unaryExpr(internal::fast_exp_op()) - Scalar(1);
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		G.array() = (A.array().cwiseMin(Scalar(0)) + Scalar(1)) * F.array();
+	}
+
+	static std::string return_type()
+	{
+		return "FastELU";
+	}
+};
@@ -0,0 +1,398 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+# include "Layer.h"
+# include "Gemm.h"
+# include "ThreadPool.h"
+# include "NeuralNetwork.h"
+
+///
+/// Прогноз ансамбля из K моделей одной архитектуры за один проход.
+///
+/// Веса первого слоя всех моделей стоят друг под другом в одной матрице
+/// (K * out_size) x in_size, и вход читается одним широким GEMM. Z следующих
+/// слоев тоже лежат друг под другом: модель k пишет строки [k * out, (k + 1) * out)
+/// своим небольшим GEMM, а смещение и активация идут одним проходом по всем
+/// моделям сразу. Последним шагом выходы моделей сводятся в один.
+///
+/// Z всех моделей в K раз выше Z одной модели, поэтому наблюдения идут
+/// кусками по tile() столбцов, чтобы Z всех слоев куска оставались в кэше.
+///
+/// С GEMM_DISPATCH веса всех слоев упаковываются под ядро один раз, и слой -
+/// один вызов пакета GEMM на все K моделей (CpuKernels::gemm_packed). Обычный
+/// GEMM пакует веса на каждый вызов, и на узких кусках это дороже самого умножения.
+///
+/// Веса копируются из моделей в refresh(), после дообучения моделей его
+/// нужно вызвать снова.
+///
+
+
+/// <summary>
+/// Сведение выходов моделей ансамбля
+/// </summary>
+enum EnsembleCombine
+{
+    COMBINE_MEAN, // среднее выходов
+    COMBINE_VOTE  // доля голосов за класс: argmax выхода, при одном выходе - выход > 0.5
+};
+
+
+class Ensemble
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+    typedef Eigen::Block<Matrix, Eigen::Dynamic, Eigen::Dynamic, true> ColBlock;
+    typedef Eigen::Block<ColBlock> ModelBlock;
+
+    std::vector<const NeuralNetwork*> m_models;
+    std::vector<const Layer*> m_layers;          // слои первой модели, от них берется активация
+    std::vector<int> m_sizes;                    // вход и выходы слоев одной модели
+    std::vector< std::vector<Matrix> > m_weight; // [слой][модель] веса out x in
+    Matrix m_first;                              // веса первого слоя всех моделей, (K * out) x in
+    std::vector<Vector> m_bias;                  // [слой] смещения всех моделей подряд
+    std::vector< std::vector<Matrix> > m_z;      // [поток][слой] Z / A всех моделей куска, (K * out) x tile
+    int m_tile;                                  // наблюдений в куске
+    std::vector< std::vector<Scalar> > m_packed; // [слой] веса всех моделей, упакованные для GEMM_DISPATCH
+    CpuLevel m_packed_level;                     // уровень ядер, под который упакованы веса
+
+    EnsembleCombine m_combine;
+    GemmBackend m_gemm;
+    ThreadPool* m_pool;
+    bool m_dirty;                                // веса еще не скопированы из моделей
+
+    int nmodel() const { return int(m_models.size()); }
+
+    int nlayer() const { return int(m_sizes.size()) - 1; }
+
+    /// <summary>
+    /// Проверка, что модель той же архитектуры, что и первая
+    /// </summary>
+    void check_model(const NeuralNetwork& model) const
+    {
+        const std::vector<Layer*>& layers = model.get_layers();
+
+        if (layers.empty())
+        {
+            throw std::invalid_argument("[class Ensemble]: Model has no layers");
+        }
+
+        for (std::size_t i = 0; i < layers.size(); ++i)
+        {
+            if (layers[i]->layer_type() != "FullyConnected")
+            {
+                throw std::invalid_argument("[class Ensemble]: Only FullyConnected layers are supported");
+            }
+        }
+
+        if (m_models.empty()) { return; }
+
+        const std::vector<Layer*>& first = m_models[0]->get_layers();
+
+        if (layers.size() != first.size())
+        {
+            throw std::invalid_argument("[class Ensemble]: Models have different number of layers");
+        }
+
+        for (std::size_t i = 0; i < layers.size(); ++i)
+        {
+            if (layers[i]->in_size() != first[i]->in_size() ||
+                layers[i]->out_size() != first[i]->out_size() ||
+                layers[i]->activation_type() != first[i]->activation_type())
+            {
+                throw std::invalid_argument("[class Ensemble]: Models have different architecture");
+            }
+        }
+    }
+
+    /// <summary>
+    /// Упаковать веса под текущие ядра: первый слой - одна матрица, следующие - по модели подряд
+    /// </summary>
+    void pack_weights()
+    {
+        const internal::CpuKernels<Scalar>& kernels = internal::cpu_kernels();
+        const int K = nmodel();
+
+        m_packed.assign(nlayer(), std::vector<Scalar>());
+        m_packed[0].resize(kernels.gemm_packed_size(int(m_first.rows()), int(m_first.cols())));
+        kernels.gemm_pack(int(m_first.rows()), int(m_first.cols()), m_first.data(), m_first.rows(), m_packed[0].data());
+
+        for (int l = 1; l < nlayer(); ++l)
+        {
+            const int in = m_sizes[l];
+            const int out = m_sizes[l + 1];
+            const std::size_t stride = kernels.gemm_packed_size(out, in);
+
+            m_packed[l].resize(stride * K);
+
+            for (int k = 0; k < K; ++k)
+            {
+                kernels.gemm_pack(out, in, m_weight[l][k].data(), out, m_packed[l].data() + stride * k);
+            }
+        }
+
+        m_packed_level = kernels.level;
+    }
+
+    /// <summary>
+    /// Все слои для куска наблюдений [c0, c0 + n) в буферах zs
+    /// </summary>
+    template <typename InputType>
+    void forward_tile(const InputType& x, const Eigen::Index c0, const Eigen::Index n, std::vector<Matrix>& zs)
+    {
+        const int K = nmodel();
+        const bool packed = !m_packed.empty();
+        const internal::CpuKernels<Scalar>& kernels = internal::cpu_kernels();
+
+        ColBlock z0 = zs[0].leftCols(n);
+
+        if (packed)
+        {
+            kernels.gemm_packed(1, int(z0.rows()), int(n), m_sizes[0], Scalar(1), m_packed[0].data(), 0,
+                x.data() + c0 * x.outerStride(), x.outerStride(), 0, z0.data(), z0.outerStride(), 0);
+        }
+        else { internal::gemm(m_gemm, false, false, Scalar(1), m_first, x.middleCols(c0, n), z0); }
+
+        internal::cpu_kernels().add_bias(z0.data(), z0.outerStride(), m_bias[0].data(), z0.rows(), z0.cols());
+        m_layers[0]->activate(z0);
+
+        for (int l = 1; l < nlayer(); ++l)
+        {
+            const int in = m_sizes[l];
+            const int out = m_sizes[l + 1];
+            ColBlock prev = zs[l - 1].leftCols(n);
+            ColBlock z = zs[l].leftCols(n);
+
+            if (packed)
+            {
+                // модель k: строки [k * in, (k + 1) * in) входа -> строки [k * out, (k + 1) * out) Z
+                kernels.gemm_packed(K, out, int(n), in, Scalar(1), m_packed[l].data(), kernels.gemm_packed_size(out, in),
+                    prev.data(), prev.outerStride(), in, z.data(), z.outerStride(), out);
+            }
+            else
+            {
+                for (int k = 0; k < K; ++k)
+                {
+                    ModelBlock zk = z.middleRows(k * out, out);
+                    internal::gemm(m_gemm, false, false, Scalar(1), m_weight[l][k], prev.middleRows(k * in, in), zk);
+                }
+            }
+
+            internal::cpu_kernels().add_bias(z.data(), z.outerStride(), m_bias[l].data(), z.rows(), z.cols());
+            m_layers[l]->activate(z);
+        }
+    }
+
+    /// <summary>
+    /// Сведение выходов моделей куска [c0, c0 + n) из последнего буфера z
+    /// </summary>
+    void combine_tile(const Matrix& z, Matrix& res, const Eigen::Index c0, const Eigen::Index n) const
+    {
+        const int K = nmodel();
+        const int out = m_sizes.back();
+
+        if (m_combine == COMBINE_MEAN)
+        {
+            res.middleCols(c0, n) = z.topLeftCorner(out, n);
+
+            for (int k = 1; k < K; ++k)
+            {
+                res.middleCols(c0, n) += z.block(k * out, 0, out, n);
+            }
+
+            res.middleCols(c0, n) *= Scalar(1) / K;
+            return;
+        }
+
+        const Scalar vote = Scalar(1) / K;
+        res.middleCols(c0, n).setZero();
+
+        for (Eigen::Index j = 0; j < n; ++j)
+        {
+            for (int k = 0; k < K; ++k)
+            {
+                if (out == 1)
+                {
+                    res(0, c0 + j) += (z(k, j) > Scalar(0.5)) ? vote : Scalar(0);
+                    continue;
+                }
+
+                Eigen::Index best = 0;
+                z.col(j).segment(k * out, out).maxCoeff(&best);
+                res(best, c0 + j) += vote;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Наблюдения [begin, end) кусками по m_tile в буферах потока t
+    /// </summary>
+    void predict_range(const Eigen::Ref<const Matrix>& x, Matrix& res,
+        const Eigen::Index begin, const Eigen::Index end, const int t)
+    {
+        std::vector<Matrix>& zs = m_z[t];
+
+        if (zs.size() != std::size_t(nlayer()))
+        {
+            zs.resize(nlayer());
+
+            for (int l = 0; l < nlayer(); ++l) { zs[l].resize(nmodel() * m_sizes[l + 1], m_tile); }
+        }
+
+        for (Eigen::Index c0 = begin; c0 < end; c0 += m_tile)
+        {
+            const Eigen::Index n = std::min<Eigen::Index>(m_tile, end - c0);
+
+            forward_tile(x, c0, n, zs);
+            combine_tile(zs.back(), res, c0, n);
+        }
+    }
+
+public:
+    /// <param name="combine"> - сведение выходов моделей</param>
+    explicit Ensemble(EnsembleCombine combine = COMBINE_MEAN) :
+        m_tile(0), m_packed_level(CPU_GENERIC), m_combine(combine), m_gemm(default_gemm_backend()), m_pool(NULL), m_dirty(false) {}
+
+    /// <summary>
+    /// Добавить модель. Модель должна жить, пока живет ансамбль.
+    /// </summary>
+    /// <param name="model"> - обученная сетка той же архитектуры, что и остальные</param>
+    void add_model(const NeuralNetwork& model)
+    {
+        check_model(model);
+        m_models.push_back(&model);
+        m_dirty = true;
+    }
+
+    int count_models() const { return nmodel(); }
+
+    void set_combine(EnsembleCombine combine) { m_combine = combine; }
+
+    /// <summary>
+    /// Реализация GEMM (см. Gemm.h). С GEMM_DISPATCH веса упаковываются при первом predict().
+    /// </summary>
+    void set_gemm(GemmBackend backend)
+    {
+        if (!internal::gemm_available(backend))
+        {
+            throw std::invalid_argument("[class Ensemble]: GEMM backend is not available in this build (define NN_USE_BLAS)");
+        }
+
+        m_gemm = backend;
+    }
+
+    /// <summary>
+    /// Делить наблюдения между потоками пула, NULL - в вызывающем потоке
+    /// </summary>
+    void set_thread_pool(ThreadPool* pool) { m_pool = pool; }
+
+    /// <summary>
+    /// Скопировать веса из моделей
+    /// </summary>
+    void refresh()
+    {
+        const int K = nmodel();
+
+        if (K == 0)
+        {
+            throw std::logic_error("[class Ensemble]: No models");
+        }
+
+        const std::vector<Layer*>& first = m_models[0]->get_layers();
+        const int L = int(first.size());
+
+        m_layers.assign(first.begin(), first.end());
+        m_sizes.resize(L + 1);
+        m_sizes[0] = first[0]->in_size();
+
+        for (int l = 0; l < L; ++l) { m_sizes[l + 1] = first[l]->out_size(); }
+
+        m_weight.assign(L, std::vector<Matrix>(K));
+        m_bias.assign(L, Vector());
+        m_z.clear();
+        m_packed.clear();
+        m_first.resize(K * m_sizes[1], m_sizes[0]);
+
+        // Z всех слоев куска - около 2 МБ. Меньше 32 наблюдений не берем:
+        // GEMM упаковывает веса на каждый вызов, и узкий кусок это не окупает
+        long long rows = 0;
+
+        for (int l = 1; l <= L; ++l) { rows += (long long)K * m_sizes[l]; }
+
+        m_tile = int(std::min<long long>(256, std::max<long long>(32, (2 << 20) / sizeof(Scalar) / rows / 8 * 8)));
+
+        for (int l = 0; l < L; ++l)
+        {
+            const int in = m_sizes[l];
+            const int out = m_sizes[l + 1];
+
+            m_bias[l].resize(K * out);
+
+            for (int k = 0; k < K; ++k)
+            {
+                // get_parametrs(): веса in x out по столбцам, затем смещения
+                const std::vector<Scalar> p = m_models[k]->get_layers()[l]->get_parametrs();
+                const Eigen::Map<const Matrix> w(p.data(), in, out);
+
+                if (l == 0) { m_first.middleRows(k * out, out) = w.transpose(); }
+                else { m_weight[l][k] = w.transpose(); }
+
+                m_bias[l].segment(k * out, out) = Eigen::Map<const Vector>(p.data() + w.size(), out);
+            }
+        }
+
+        m_dirty = false;
+    }
+
+    /// <summary>
+    /// Прогноз ансамбля
+    /// </summary>
+    /// <param name="x"> - входные данные (признаки x наблюдения), Matrix, Map или блок столбцов</param>
+    /// <returns>Сведенный выход (выходы x наблюдения)</returns>
+    Matrix predict(const Eigen::Ref<const Matrix>& x)
+    {
+        if (m_dirty) { refresh(); }
+
+        if (m_models.empty()) { return Matrix(); }
+
+        // Уровень ядер мог смениться (set_cpu_level()), упаковка у каждого своя
+        if (m_gemm != GEMM_DISPATCH) { m_packed.clear(); }
+        else if (m_packed.empty() || m_packed_level != internal::cpu_kernels().level) { pack_weights(); }
+
+        if (x.rows() != m_sizes[0])
+        {
+            throw std::invalid_argument("[class Ensemble]: Input data have incorrect dimension");
+        }
+
+        const Eigen::Index ncols = x.cols();
+        const int nthread = (m_pool && ncols > m_tile) ? m_pool->size() : 1;
+        Matrix res(m_sizes.back(), ncols);
+
+        if (int(m_z.size()) < nthread) { m_z.resize(nthread); }
+
+        if (nthread == 1)
+        {
+            predict_range(x, res, 0, ncols, 0);
+            return res;
+        }
+
+        // Поток t берет свою часть наблюдений и свои буферы
+        m_pool->parallel_for(nthread, [&](Eigen::Index t0, Eigen::Index t1) {
+            for (Eigen::Index t = t0; t < t1; ++t)
+            {
+                predict_range(x, res, ncols * t / nthread, ncols * (t + 1) / nthread, int(t));
+            }
+        });
+
+        return res;
+    }
+
+    /// <summary>
+    /// Кол-во наблюдений, которые проходят все слои за раз
+    /// </summary>
+    int tile() const { return m_tile; }
+};
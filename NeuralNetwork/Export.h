@@ -0,0 +1,208 @@
+#pragma once
+
+# include <map>
+# include <string>
+# include <vector>
+# include <cstdio>
+# include <fstream>
+# include <ostream>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+# include "Layer.h"
+# include "NeuralNetwork.h"
+
+///
+/// Экспорт обученной сетки в самостоятельный заголовок C++ без зависимостей
+/// от библиотеки и Eigen: модель встраивается в бинарник и не грузится во время
+/// работы.
+///
+/// Веса каждого слоя - constexpr массив float [in][out], смещения - [out].
+/// Размеры слоев - константы времени компиляции, и внутренний цикл слоя
+/// y[o] += x[i] * W[i][o] идет по непрерывной строке весов, поэтому компилятор
+/// разворачивает и векторизует его без -ffast-math.
+///
+/// В заголовке функция predict(const float* in, float* out) для одного
+/// наблюдения. Быстрые активации (FastTanh и т.д.) экспортируются точными
+/// формулами, расхождение с NeuralNetwork::predict() - в пределах точности float.
+///
+
+
+namespace internal
+{
+    /// <summary>
+    /// Имя и тело функции активации в сгенерированном коде
+    /// </summary>
+    inline std::pair<std::string, std::string> export_activation(const std::string& type)
+    {
+        typedef std::pair<std::string, std::string> Source;
+
+        if (type == "Identity") { return Source("act_identity", "return x;"); }
+        if (type == "ReLU") { return Source("act_relu", "return x > 0.0f ? x : 0.0f;"); }
+        if (type == "LeakyReLU") { return Source("act_leaky_relu", "return x > 0.0f ? x : 0.01f * x;"); }
+        if (type == "Sigmoid" || type == "FastSigmoid") { return Source("act_sigmoid", "return 1.0f / (1.0f + std::exp(-x));"); }
+        if (type == "Tanh" || type == "FastTanh") { return Source("act_tanh", "return std::tanh(x);"); }
+        if (type == "ELU" || type == "FastELU") { return Source("act_elu", "return x > 0.0f ? x : std::expm1(x);"); }
+        if (type == "GELU") { return Source("act_gelu", "return 0.5f * x * (1.0f + std::erf(x * 0.70710678f));"); }
+        if (type == "FastGELU")
+        {
+            return Source("act_fast_gelu",
+                "return 0.5f * x * (1.0f + std::tanh(0.79788456f * x * (1.0f + 0.044715f * x * x)));");
+        }
+        if (type == "Swish" || type == "FastSwish") { return Source("act_swish", "return x / (1.0f + std::exp(-x));"); }
+        if (type == "Softplus" || type == "FastSoftplus")
+        {
+            return Source("act_softplus", "return std::max(x, 0.0f) + std::log1p(std::exp(-std::fabs(x)));");
+        }
+
+        throw std::invalid_argument("[export_cpp]: Activation " + type + " cannot be exported");
+    }
+
+    /// <summary>
+    /// Массив float с точным (до float) представлением значений
+    /// </summary>
+    inline void export_array(std::ostream& out, const Scalar* data, const int n, const int per_line)
+    {
+        char buf[32];
+
+        for (int k = 0; k < n; ++k)
+        {
+            std::snprintf(buf, sizeof(buf), "%.9gf", double(float(data[k])));
+
+            out << ((k % per_line == 0) ? "\n        " : " ") << buf << (k + 1 < n ? "," : "");
+        }
+    }
+}
+
+
+/// <summary>
+/// Сгенерировать заголовок C++ с весами и функцией predict() сетки
+/// </summary>
+/// <param name="net"> - обученная сетка из слоев FullyConnected</param>
+/// <param name="out"> - поток для заголовка</param>
+/// <param name="name_space"> - пространство имен модели в заголовке</param>
+inline void export_cpp(const NeuralNetwork& net, std::ostream& out, const std::string& name_space = "nn_model")
+{
+    const std::vector<Layer*>& layers = net.get_layers();
+    const int nlayer = int(layers.size());
+
+    if (nlayer == 0)
+    {
+        throw std::invalid_argument("[export_cpp]: Network has no layers");
+    }
+
+    std::map<std::string, std::string> functions; // имя -> тело
+    std::vector<std::string> acts(nlayer);
+    int width = 0; // самый широкий скрытый слой
+
+    for (int l = 0; l < nlayer; ++l)
+    {
+        if (layers[l]->layer_type() != "FullyConnected")
+        {
+            throw std::invalid_argument("[export_cpp]: Only FullyConnected layers can be exported");
+        }
+
+        const std::pair<std::string, std::string> act = internal::export_activation(layers[l]->activation_type());
+
+        functions[act.first] = act.second;
+        acts[l] = act.first;
+
+        if (l + 1 < nlayer) { width = std::max(width, layers[l]->out_size()); }
+    }
+
+    out << "// Сгенерировано export_cpp() из NeuralNetwork, не редактировать.\n"
+        << "#pragma once\n\n"
+        << "#include <cmath>\n"
+        << "#include <algorithm>\n\n"
+        << "namespace " << name_space << "\n{\n"
+        << "    constexpr int kInputSize = " << layers[0]->in_size() << ";\n"
+        << "    constexpr int kOutputSize = " << layers[nlayer - 1]->out_size() << ";\n\n";
+
+    for (int l = 0; l < nlayer; ++l)
+    {
+        const int in = layers[l]->in_size();
+        const int nout = layers[l]->out_size();
+
+        // get_parametrs(): веса in x out по столбцам, затем смещения -> W[i][o]
+        const std::vector<Scalar> p = layers[l]->get_parametrs();
+        std::vector<Scalar> w(std::size_t(in) * nout);
+
+        for (int i = 0; i < in; ++i)
+        {
+            for (int o = 0; o < nout; ++o) { w[std::size_t(i) * nout + o] = p[std::size_t(o) * in + i]; }
+        }
+
+        out << "    alignas(32) constexpr float W" << l << "[" << in << "][" << nout << "] = {";
+        internal::export_array(out, w.data(), in * nout, 8);
+        out << "\n    };\n\n";
+
+        out << "    alignas(32) constexpr float B" << l << "[" << nout << "] = {";
+        internal::export_array(out, p.data() + std::size_t(in) * nout, nout, 8);
+        out << "\n    };\n\n";
+    }
+
+    out << "    namespace detail\n    {\n";
+
+    for (std::map<std::string, std::string>::const_iterator it = functions.begin(); it != functions.end(); ++it)
+    {
+        out << "        inline float " << it->first << "(float x) { " << it->second << " }\n\n";
+    }
+
+    out << "        template <int In, int Out, float (*Act)(float)>\n"
+        << "        inline void dense(const float (&w)[In][Out], const float (&b)[Out], const float* x, float* y)\n"
+        << "        {\n"
+        << "            for (int o = 0; o < Out; ++o) { y[o] = b[o]; }\n\n"
+        << "            for (int i = 0; i < In; ++i)\n"
+        << "            {\n"
+        << "                const float xi = x[i];\n\n"
+        << "                for (int o = 0; o < Out; ++o) { y[o] += xi * w[i][o]; }\n"
+        << "            }\n\n"
+        << "            for (int o = 0; o < Out; ++o) { y[o] = Act(y[o]); }\n"
+        << "        }\n"
+        << "    }\n\n";
+
+    out << "    /// Прогноз для одного наблюдения: in[kInputSize] -> out[kOutputSize]\n"
+        << "    inline void predict(const float* in, float* out)\n"
+        << "    {\n";
+
+    if (nlayer > 1)
+    {
+        out << "        alignas(32) float a[" << width << "];\n"
+            << "        alignas(32) float b[" << width << "];\n\n";
+    }
+
+    for (int l = 0; l < nlayer; ++l)
+    {
+        // скрытые слои пишут по очереди в a и b, последний - в out
+        const std::string src = (l == 0) ? "in" : ((l % 2) ? "a" : "b");
+        const std::string dst = (l == nlayer - 1) ? "out" : ((l % 2) ? "b" : "a");
+
+        out << "        detail::dense<" << layers[l]->in_size() << ", " << layers[l]->out_size()
+            << ", detail::" << acts[l] << ">(W" << l << ", B" << l << ", " << src << ", " << dst << ");\n";
+    }
+
+    out << "    }\n}\n";
+}
+
+/// <summary>
+/// Сгенерировать заголовок C++ сетки в файл
+/// </summary>
+/// <param name="net"> - обученная сетка из слоев FullyConnected</param>
+/// <param name="path"> - путь к заголовку</param>
+/// <param name="name_space"> - пространство имен модели в заголовке</param>
+inline void export_cpp(const NeuralNetwork& net, const std::string& path, const std::string& name_space = "nn_model")
+{
+    std::ofstream out(path.c_str());
+
+    if (!out)
+    {
+        throw std::runtime_error("[export_cpp]: Cannot open file " + path);
+    }
+
+    export_cpp(net, out, name_space);
+
+    if (!out)
+    {
+        throw std::runtime_error("[export_cpp]: Cannot write file " + path);
+    }
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+# include <Eigen/Core>
+# include "Config.h"
+
+///
+/// Быстрые приближения exp, tanh и log(1 + exp(x)) для активаций Fast*.
+///
+/// Функции написаны на пакетной математике Eigen (pmadd, pldexp, ...) и работают
+/// как с одним числом, так и с SIMD пакетом. Функторы ниже подставляются в
+/// unaryExpr(), и все выражение активации векторизуется целиком.
+///
+/// Максимальные ошибки (Scalar = double, проверено перебором по сетке):
+/// fast_exp      - относительная 3e-10
+/// fast_tanh     - абсолютная 3e-7
+/// fast_softplus - абсолютная 1.1e-8
+///
+
+
+namespace internal
+{
+    /// <summary>
+    /// exp(x): x = n * ln2 + r, |r| <= ln2 / 2, exp(r) - ряд Тейлора 8 степени
+    /// </summary>
+    template <typename Packet>
+    EIGEN_STRONG_INLINE Packet fast_exp(const Packet& a)
+    {
+        using namespace Eigen::internal;
+
+        const Packet x = pmax(pmin(a, pset1<Packet>(Scalar(709))), pset1<Packet>(Scalar(-708)));
+        const Packet n = pfloor(pmadd(x, pset1<Packet>(Scalar(1.44269504088896341)), pset1<Packet>(Scalar(0.5))));
+
+        // ln2 разбит на две части, чтобы r считался без потери точности
+        Packet r = psub(x, pmul(n, pset1<Packet>(Scalar(0.693145751953125))));
+        r = psub(r, pmul(n, pset1<Packet>(Scalar(1.42860682030941723212e-6))));
+
+        Packet p = pset1<Packet>(Scalar(1.0 / 40320));
+        p = pmadd(p, r, pset1<Packet>(Scalar(1.0 / 5040)));
+        p = pmadd(p, r, pset1<Packet>(Scalar(1.0 / 720)));
+        p = pmadd(p, r, pset1<Packet>(Scalar(1.0 / 120)));
+        p = pmadd(p, r, pset1<Packet>(Scalar(1.0 / 24)));
+        p = pmadd(p, r, pset1<Packet>(Scalar(1.0 / 6)));
+        p = pmadd(p, r, pset1<Packet>(Scalar(0.5)));
+        p = pmadd(p, r, pset1<Packet>(Scalar(1)));
+        p = pmadd(p, r, pset1<Packet>(Scalar(1)));
+
+        return pldexp(p, n);
+    }
+
+    /// <summary>
+    /// tanh(x): рациональное приближение 13 / 6 степени на [-7.9, 7.9], за пределами - +-1
+    /// </summary>
+    template <typename Packet>
+    EIGEN_STRONG_INLINE Packet fast_tanh(const Packet& a)
+    {
+        using namespace Eigen::internal;
+
+        const Packet x = pmax(pmin(a, pset1<Packet>(Scalar(7.90531110763549805))),
+            pset1<Packet>(Scalar(-7.90531110763549805)));
+        const Packet x2 = pmul(x, x);
+
+        Packet p = pset1<Packet>(Scalar(-2.76076847742355e-16));
+        p = pmadd(x2, p, pset1<Packet>(Scalar(2.00018790482477e-13)));
+        p = pmadd(x2, p, pset1<Packet>(Scalar(-8.60467152213735e-11)));
+        p = pmadd(x2, p, pset1<Packet>(Scalar(5.12229709037114e-08)));
+        p = pmadd(x2, p, pset1<Packet>(Scalar(1.48572235717979e-05)));
+        p = pmadd(x2, p, pset1<Packet>(Scalar(6.37261928875436e-04)));
+        p = pmadd(x2, p, pset1<Packet>(Scalar(4.89352455891786e-03)));
+        p = pmul(x, p);
+
+        Packet q = pset1<Packet>(Scalar(1.19825839466702e-06));
+        q = pmadd(x2, q, pset1<Packet>(Scalar(1.18534705686654e-04)));
+        q = pmadd(x2, q, pset1<Packet>(Scalar(2.26843463243900e-03)));
+        q = pmadd(x2, q, pset1<Packet>(Scalar(4.89352518554385e-03)));
+
+        return pdiv(p, q);
+    }
+
+    /// <summary>
+    /// log(1 + exp(x)) = max(x, 0) + log(1 + u), u = exp(-|x|) из (0, 1].
+    /// log(1 + u) = 2 atanh(s), s = u / (2 + u) <= 1/3, ряд до s^13.
+    /// </summary>
+    template <typename Packet>
+    EIGEN_STRONG_INLINE Packet fast_softplus(const Packet& x)
+    {
+        using namespace Eigen::internal;
+
+        const Packet u = fast_exp(pnegate(pabs(x)));
+        const Packet s = pdiv(u, padd(u, pset1<Packet>(Scalar(2))));
+        const Packet s2 = pmul(s, s);
+
+        Packet p = pset1<Packet>(Scalar(2.0 / 13));
+        p = pmadd(p, s2, pset1<Packet>(Scalar(2.0 / 11)));
+        p = pmadd(p, s2, pset1<Packet>(Scalar(2.0 / 9)));
+        p = pmadd(p, s2, pset1<Packet>(Scalar(2.0 / 7)));
+        p = pmadd(p, s2, pset1<Packet>(Scalar(2.0 / 5)));
+        p = pmadd(p, s2, pset1<Packet>(Scalar(2.0 / 3)));
+        p = pmadd(p, s2, pset1<Packet>(Scalar(2)));
+
+        return pmadd(p, s, pmax(x, pset1<Packet>(Scalar(0))));
+    }
+
+    struct fast_exp_op
+    {
+        EIGEN_STRONG_INLINE Scalar operator()(const Scalar& x) const { return fast_exp(x); }
+
+        template <typename Packet>
+        EIGEN_STRONG_INLINE Packet packetOp(const Packet& x) const { return fast_exp(x); }
+    };
+
+    struct fast_tanh_op
+    {
+        EIGEN_STRONG_INLINE Scalar operator()(const Scalar& x) const { return fast_tanh(x); }
+
+        template <typename Packet>
+        EIGEN_STRONG_INLINE Packet packetOp(const Packet& x) const { return fast_tanh(x); }
+    };
+
+    struct fast_softplus_op
+    {
+        EIGEN_STRONG_INLINE Scalar operator()(const Scalar& x) const { return fast_softplus(x); }
+
+        template <typename Packet>
+        EIGEN_STRONG_INLINE Packet packetOp(const Packet& x) const { return fast_softplus(x); }
+    };
+}
+
+
+namespace Eigen
+{
+    namespace internal
+    {
+        template <>
+        struct functor_traits< ::internal::fast_exp_op >
+        {
+            enum { Cost = 13 * NumTraits<Scalar>::MulCost, PacketAccess = packet_traits<Scalar>::HasFloor };
+        };
+
+        template <>
+        struct functor_traits< ::internal::fast_tanh_op >
+        {
+            enum { Cost = 12 * NumTraits<Scalar>::MulCost + scalar_div_cost<Scalar, true>::value, PacketAccess = packet_traits<Scalar>::HasDiv };
+        };
+
+        template <>
+        struct functor_traits< ::internal::fast_softplus_op >
+        {
+            enum { Cost = 20 * NumTraits<Scalar>::MulCost + scalar_div_cost<Scalar, true>::value, PacketAccess = packet_traits<Scalar>::HasFloor };
+        };
+    }
+}
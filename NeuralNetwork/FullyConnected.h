@@ -3,12 +3,49 @@
 
 # include <Eigen/Core>
 # include <vector>
+# include <algorithm>
 # include <stdexcept>
+# include <type_traits>
+# include <chrono>
+# include <functional>
 # include "Config.h"
 # include "Layer.h"
 # include "Random.h"
+# include "Quantization.h"
+# include "Pruning.h"
+# include "Gemm.h"
 
 
+namespace internal
+{
+    /// <summary>
+    /// Activation::derivative_from_output, false если активация его не объявляет
+    /// </summary>
+    template <typename Activation, typename = void>
+    struct derivative_from_output
+    {
+        static const bool value = false;
+    };
+
+    template <typename Activation>
+    struct derivative_from_output<Activation, typename std::enable_if<Activation::derivative_from_output>::type>
+    {
+        static const bool value = true;
+    };
+}
+
+
+/// <summary>
+/// Полносвязный слой.
+///
+/// Если производная активации считается по одному выходу
+/// (Activation::derivative_from_output), Z активируется на месте в m_a, а m_z не
+/// выделяется. В backprop производная по Z пишется туда же, поэтому после
+/// backprop output() больше не содержит выход слоя.
+///
+/// Веса хранятся как in_size x out_size или out_size x in_size (set_gemm()),
+/// get_parametrs() / set_parametrs() всегда используют порядок in_size x out_size.
+/// </summary>
 template <typename Activation>
 class FullyConnected : public Layer
 {
@@ -18,35 +55,198 @@ protected:
     typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
     typedef Vector::AlignedMapType AlignedMapVec;
     typedef std::map<std::string, int> Meta;
+    typedef Eigen::Block<Matrix, Eigen::Dynamic, Eigen::Dynamic, true> ColBlock; // блок столбцов
 
-    Matrix m_weight; // Веса модели
+    Matrix m_weight; // Веса модели (in_size x out_size или out_size x in_size, см. m_layout)
     Vector m_bias;   // Смещение весов
     Matrix m_dw;     // Производная весов
     Vector m_db;     // Производная смещения
-    Matrix m_z;      // Значения нейронов до активации
+    Matrix m_z;      // Значения нейронов до активации (пустая при активации на месте)
     Matrix m_a;      // Значения нейронов после активации
     Matrix m_din;    // Значения нейронов после backprop
 
+    internal::QuantizedLinear m_qlinear; // int8 копия весов для инференса
+    std::vector<uint8_t> m_qinput;       // квантизованный вход текущего батча
+    bool m_quantized;                    // считать ли forward в int8
+
+    Matrix m_mask;                               // маска прунинга (1 - вес жив, 0 - удален)
+    internal::SparseRowMatrix m_sparse_weight;   // W^T в CSR для разреженного инференса
+    internal::RowMajorMatrix m_xt;               // буфер X^T для разреженного умножения
+    internal::RowMajorMatrix m_zt;               // буфер Z^T для разреженного умножения
+    Scalar m_sparse_density;                     // порог плотности для перехода на CSR, < 0 - выбор замером
+    bool m_use_sparse;                           // считать ли forward через CSR
+    bool m_sparse_dirty;                         // структуру CSR надо построить заново (прунинг, хранение весов)
+    bool m_sparse_stale;                         // значения в CSR устарели после Layer::update()
+
+    GemmBackend m_gemm;              // реализация матричного умножения
+    WeightLayout m_layout;           // хранение весов и производной весов
+
+    FullyConnected* m_master;        // владелец весов для рабочей копии (Hogwild), иначе NULL
+    std::vector<int> m_active_rows;  // входы с ненулевыми значениями в текущем батче (только рабочая копия)
+
+    ThreadPool* m_pool;              // пул для forward / backprop, NULL - в вызывающем потоке
+
+    /// <summary>
+    /// Слой, которому принадлежат веса: сам слой или владелец рабочей копии
+    /// </summary>
+    FullyConnected& owner() { return m_master ? *m_master : *this; }
+
+    /// <summary>
+    /// Активация на месте: один буфер m_a под Z, A и производную по Z
+    /// </summary>
+    static bool in_place() { return internal::derivative_from_output<Activation>::value; }
+
+    bool out_in() const { return m_layout == WEIGHT_OUT_IN; }
+
+    /// <summary>
+    /// Минимум наблюдений (или нейронов для производной весов) на поток
+    /// </summary>
+    static int min_block() { return 16; }
+
+    bool parallel() const { return m_pool != NULL && m_pool->size() > 1; }
+
+    /// <summary>
+    /// Веса в порядке in_size x out_size для квантизации и CSR
+    /// </summary>
+    Matrix weight_in_out() const { return out_in() ? Matrix(m_weight.transpose()) : m_weight; }
+
+    /// <summary>
+    /// CSR по текущим весам: новая структура после прунинга или смены хранения весов,
+    /// иначе только значения после шага оптимизатора
+    /// </summary>
+    void sync_sparse()
+    {
+        if (m_sparse_dirty)
+        {
+            if (out_in()) { internal::build_sparse_transposed(m_weight.transpose(), m_mask.transpose(), m_sparse_weight); }
+            else { internal::build_sparse_transposed(m_weight, m_mask, m_sparse_weight); }
+        }
+        else if (m_sparse_stale)
+        {
+            if (out_in()) { internal::update_sparse_values(m_weight.transpose(), m_sparse_weight); }
+            else { internal::update_sparse_values(m_weight, m_sparse_weight); }
+        }
+
+        m_sparse_dirty = false;
+        m_sparse_stale = false;
+    }
+
+    /// <summary>
+    /// Быстрее ли разреженное умножение плотного GEMM на форме слоя: замер на батче
+    /// последнего forward (или SPARSE_TUNE_BATCH), лучший из 3 запусков, как в tune_gemm()
+    /// </summary>
+    bool sparse_faster()
+    {
+        const int ncols = m_a.cols() > 0 ? int(m_a.cols()) : internal::SPARSE_TUNE_BATCH;
+        const Matrix x = Matrix::Ones(this->m_in_size, ncols);
+        Matrix z(this->m_out_size, ncols);
+
+        const auto best_time = [](const std::function<void()>& f) {
+            f();
+            double best = -1;
+
+            for (int r = 0; r < 3; ++r)
+            {
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                f();
+                const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                if (best < 0 || elapsed < best) { best = elapsed; }
+            }
+
+            return best;
+        };
+
+        // плотный GEMM так же, как в forward: блоками наблюдений в пуле, если он есть
+        const double dense = best_time([&]() {
+            if (parallel())
+            {
+                m_pool->parallel_for(ncols, [&](Eigen::Index c0, Eigen::Index c1) {
+                    ColBlock zb = z.middleCols(c0, c1 - c0);
+                    internal::gemm(m_gemm, !out_in(), false, Scalar(1), m_weight, x.middleCols(c0, c1 - c0), zb);
+                }, min_block());
+            }
+            else
+            {
+                internal::gemm(m_gemm, !out_in(), false, Scalar(1), m_weight, x, z);
+            }
+        });
+
+        const double sparse = best_time([&]() { internal::sparse_gemm(m_sparse_weight, x, m_xt, m_zt, z); });
+
+        return sparse < dense;
+    }
+
+    /// <summary>
+    /// Плотный или разреженный forward после прунинга: по порогу плотности,
+    /// если он задан set_sparse_density(), иначе замером
+    /// </summary>
+    void choose_sparse()
+    {
+        if (m_mask.size() == 0)
+        {
+            m_use_sparse = false;
+            return;
+        }
+
+        if (m_sparse_density >= Scalar(0))
+        {
+            m_use_sparse = density() < m_sparse_density;
+            return;
+        }
+
+        sync_sparse();
+        m_use_sparse = m_sparse_weight.nonZeros() < m_weight.size() && sparse_faster();
+    }
+
 public:
     FullyConnected(const int in_size, const int out_size) :
-        Layer(in_size, out_size) {}
+        Layer(in_size, out_size), m_quantized(false),
+        m_sparse_density(Scalar(-1)),
+        m_use_sparse(false), m_sparse_dirty(false), m_sparse_stale(false),
+        m_gemm(default_gemm_backend()), m_layout(WEIGHT_IN_OUT), m_master(NULL), m_pool(NULL) {}
+
+    Layer* clone() const
+    {
+        return new FullyConnected<Activation>(*this);
+    }
+
+    Layer* clone_shared()
+    {
+        FullyConnected<Activation>* worker = new FullyConnected<Activation>(this->m_in_size, this->m_out_size);
+        worker->m_master = &owner();
+        worker->m_gemm = m_gemm;
+        worker->m_layout = m_layout;
+        worker->m_dw.resize(m_weight.rows(), m_weight.cols());
+        worker->m_db.resize(this->m_out_size);
+
+        return worker;
+    }
 
     void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
     {
         init();
 
-        internal::set_normal_random(m_weight.data(), m_weight.size(), rng, mu, sigma);
+        // Случайные веса генерируются в порядке in_size x out_size при любом хранении
+        Matrix weight(this->m_in_size, this->m_out_size);
+        internal::set_normal_random(weight.data(), weight.size(), rng, mu, sigma);
         internal::set_normal_random(m_bias.data(), m_bias.size(), rng, mu, sigma);
 
+        if (out_in()) { m_weight = weight.transpose(); }
+        else { m_weight.swap(weight); }
+
         //std::cout << "Weights " << std::endl << m_weight << std::endl;
         //std::cout << "Bias " << std::endl << m_bias << std::endl;
     }
 
     void init()
     {
-        m_weight.resize(this->m_in_size, this->m_out_size);
+        const int rows = out_in() ? this->m_out_size : this->m_in_size;
+        const int cols = out_in() ? this->m_in_size : this->m_out_size;
+
+        m_weight.resize(rows, cols);
         m_bias.resize(this->m_out_size);
-        m_dw.resize(this->m_in_size, this->m_out_size);
+        m_dw.resize(rows, cols);
         m_db.resize(this->m_out_size);
     }
 
@@ -58,17 +258,105 @@ public:
     /// </summary>
     /// <param name="prev_layer_data"> - матрица значений нейронов предыдущего слоя</param>
     void forward(const Matrix& prev_layer_data) 
+    {
+        forward_impl(prev_layer_data);
+    }
+
+    /// <summary>
+    /// Forward по Map / блоку без копии входа
+    /// </summary>
+    void forward_ref(const ConstRefMatrix& prev_layer_data)
+    {
+        forward_impl(prev_layer_data);
+    }
+
+    /// <summary>
+    /// Forward по row-major входу без копии: GEMM сам берет транспонированный вариант
+    /// </summary>
+    void forward_rows(const ConstRowRefMatrix& prev_layer_data)
+    {
+        forward_impl(prev_layer_data);
+    }
+
+private:
+    template <typename InputType>
+    void forward_impl(const InputType& prev_layer_data)
     {
         const int ncols = prev_layer_data.cols();
 
-        m_z.resize(this->m_out_size, ncols);
-        m_z.noalias() = m_weight.transpose() * prev_layer_data;
-        m_z.colwise() += m_bias;
+        Matrix& z = in_place() ? m_a : m_z;
+        z.resize(this->m_out_size, ncols);
+
+        if (m_quantized)
+        {
+            internal::quantize_input(prev_layer_data, m_qlinear, m_qinput);
+            internal::quantized_gemm(m_qlinear, m_qinput, ncols, z);
+        }
+        else if (m_use_sparse)
+        {
+            sync_sparse();
+            internal::sparse_gemm(m_sparse_weight, prev_layer_data, m_xt, m_zt, z);
+        }
+        else if (parallel())
+        {
+            // Каждый поток считает свой блок наблюдений целиком: GEMM, смещение и активацию
+            const Matrix& weight = owner().m_weight;
+            const Vector& bias = owner().m_bias;
+
+            if (!in_place()) { m_a.resize(this->m_out_size, ncols); }
+
+            m_pool->parallel_for(ncols, [&](Eigen::Index c0, Eigen::Index c1) {
+                ColBlock zb = z.middleCols(c0, c1 - c0);
+                ColBlock ab = m_a.middleCols(c0, c1 - c0);
 
-        m_a.resize(this->m_out_size, ncols);
-        Activation::activate(m_z, m_a);
+                internal::gemm(m_gemm, !out_in(), false, Scalar(1), weight,
+                    prev_layer_data.middleCols(c0, c1 - c0), zb);
+                internal::cpu_kernels().add_bias(zb.data(), zb.outerStride(), bias.data(), zb.rows(), zb.cols());
+                Activation::activate(zb, ab);
+            }, min_block());
+
+            return;
+        }
+        else
+        {
+            // Z = W^T X при хранении in x out, Z = W X при out x in
+            internal::gemm(m_gemm, !out_in(), false, Scalar(1), owner().m_weight, prev_layer_data, z);
+        }
+
+        internal::cpu_kernels().add_bias(z.data(), z.outerStride(), owner().m_bias.data(), z.rows(), z.cols());
+
+        if (in_place())
+        {
+            Activation::activate(m_a, m_a);
+        }
+        else
+        {
+            m_a.resize(this->m_out_size, ncols);
+            Activation::activate(m_z, m_a);
+        }
     }
 
+    /// <summary>
+    /// Производная по Z и производная входа по блокам наблюдений
+    /// </summary>
+    void backprop_parallel(const Matrix& prev_layer_data, const Matrix& next_layer_data, Matrix& dLz)
+    {
+        const Matrix& weight = owner().m_weight;
+
+        m_pool->parallel_for(prev_layer_data.cols(), [&](Eigen::Index c0, Eigen::Index c1) {
+            const Eigen::Index n = c1 - c0;
+            ColBlock gb = dLz.middleCols(c0, n);
+            ColBlock db = m_din.middleCols(c0, n);
+
+            // при активации на месте m_z пустая: производная берется по выходу
+            Activation::apply_jacobian(in_place() ? m_z.leftCols(0) : m_z.middleCols(c0, n),
+                m_a.middleCols(c0, n), next_layer_data.middleCols(c0, n), gb);
+            internal::gemm(m_gemm, out_in(), false, Scalar(1), weight, gb, db);
+        }, min_block());
+    }
+
+public:
+
     /// <summary>
     /// Возврат значений нейронов после активации
     /// </summary>
@@ -93,12 +381,65 @@ public:
     {
         const int ncols = prev_layer_data.cols();
 
-        Matrix& dLz = m_z;
-        Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
-        m_dw.noalias() = prev_layer_data * dLz.transpose() / ncols;
-        m_db.noalias() = dLz.rowwise().mean();
+        // Выход слоя уже использован следующим слоем, его буфер можно занять
+        Matrix& dLz = in_place() ? m_a : m_z;
         m_din.resize(this->m_in_size, ncols);
-        m_din.noalias() = m_weight * dLz;
+
+        if (parallel())
+        {
+            backprop_parallel(prev_layer_data, next_layer_data, dLz);
+        }
+        else
+        {
+            Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
+        }
+
+        m_db.resize(this->m_out_size);
+        internal::cpu_kernels().row_mean(dLz.data(), dLz.outerStride(), dLz.rows(), dLz.cols(), m_db.data());
+
+        if (parallel())
+        {
+            // Производная весов - сумма по наблюдениям, поэтому делится по нейронам
+            const Matrix& x = prev_layer_data;
+
+            m_pool->parallel_for(this->m_out_size, [&](Eigen::Index o0, Eigen::Index o1) {
+                if (out_in())
+                {
+                    Eigen::Block<Matrix> dwb = m_dw.middleRows(o0, o1 - o0);
+                    internal::gemm(m_gemm, false, true, Scalar(1) / ncols, dLz.middleRows(o0, o1 - o0), x, dwb);
+                }
+                else
+                {
+                    ColBlock dwb = m_dw.middleCols(o0, o1 - o0);
+                    internal::gemm(m_gemm, false, true, Scalar(1) / ncols, x, dLz.middleRows(o0, o1 - o0), dwb);
+                }
+            }, min_block());
+        }
+        else if (out_in())
+        {
+            internal::gemm(m_gemm, false, true, Scalar(1) / ncols, dLz, prev_layer_data, m_dw);
+            internal::gemm(m_gemm, true, false, Scalar(1), owner().m_weight, dLz, m_din);
+        }
+        else
+        {
+            internal::gemm(m_gemm, false, true, Scalar(1) / ncols, prev_layer_data, dLz, m_dw);
+            internal::gemm(m_gemm, false, false, Scalar(1), owner().m_weight, dLz, m_din);
+        }
+
+        // У рабочей копии запоминаем ненулевые входы: для разреженных данных
+        // градиент остальных строк весов нулевой и их можно не трогать
+        if (m_master)
+        {
+            m_active_rows.clear();
+
+            for (int k = 0; k < this->m_in_size; ++k)
+            {
+                if ((prev_layer_data.row(k).array() != Scalar(0)).any())
+                {
+                    m_active_rows.push_back(k);
+                }
+            }
+        }
     }
 
     /// <summary>
@@ -107,6 +448,13 @@ public:
     /// <returns>ссылка на информацию</returns>
     const Matrix& backprop_data() const { return m_din; }
 
+    void release_buffers()
+    {
+        m_z.resize(0, 0);
+        m_a.resize(0, 0);
+        m_din.resize(0, 0);
+    }
+
 
     /// <summary>
     /// Обновление весов и смещений используя переданный алгоритм оптимизации (см. Optimizer)
@@ -114,25 +462,263 @@ public:
     /// <param name="opt"> - объект класса Optimizer</param>
     void update(Optimizer& opt) 
     {
+        FullyConnected& params = owner();
+
         ConstAlignedMapVec dw(m_dw.data(), m_dw.size());
         ConstAlignedMapVec db(m_db.data(), m_db.size());
-        AlignedMapVec      w(m_weight.data(), m_weight.size());
-        AlignedMapVec      b(m_bias.data(), m_bias.size());
+        AlignedMapVec      w(params.m_weight.data(), params.m_weight.size());
+        AlignedMapVec      b(params.m_bias.data(), params.m_bias.size());
+
+        // Строки весов - входы только при хранении in x out
+        if (m_master && !out_in() && int(m_active_rows.size()) < this->m_in_size)
+        {
+            opt.update_rows(m_active_rows, this->m_in_size, dw, w);
+        }
+        else
+        {
+            opt.update(dw, w);
+        }
 
-        opt.update(dw, w);
         opt.update(db, b);
+
+        if (params.m_mask.size() > 0)
+        {
+            params.m_weight.array() *= params.m_mask.array();
+            params.m_sparse_stale = true;
+        }
+    }
+
+    /// <summary>
+    /// Квантизация весов в int8 по выходным каналам и калибровка масштаба входа.
+    /// После вызова forward считается целочисленно, смещение и активация
+    /// применяются к деквантизованному результату.
+    /// </summary>
+    /// <param name="prev_layer_data"> - батч входных данных слоя для калибровки</param>
+    bool quantize(const Matrix& prev_layer_data)
+    {
+        if (prev_layer_data.rows() != this->m_in_size)
+        {
+            throw std::invalid_argument("[class FullyConnected]: Calibration data have incorrect dimension");
+        }
+
+        internal::quantize_linear(weight_in_out(), prev_layer_data, m_qlinear);
+        m_quantized = true;
+
+        return true;
+    }
+
+    void set_quantized(bool enable)
+    {
+        if (enable && m_qlinear.out_size != this->m_out_size)
+        {
+            throw std::logic_error("[class FullyConnected]: Layer has not been quantized yet");
+        }
+
+        m_quantized = enable;
+    }
+
+    bool is_quantized() const { return m_quantized; }
+
+    void weight_magnitudes(std::vector<Scalar>& magnitudes) const
+    {
+        const Scalar* w = m_weight.data();
+
+        magnitudes.reserve(magnitudes.size() + m_weight.size());
+
+        for (int i = 0; i < m_weight.size(); ++i)
+        {
+            magnitudes.push_back(std::abs(w[i]));
+        }
+    }
+
+    /// <summary>
+    /// Прунинг весов по модулю. После прунинга слой сам выбирает плотное или
+    /// разреженное (CSR) умножение в forward: замером обоих на своей форме или
+    /// по порогу плотности из set_sparse_density().
+    /// </summary>
+    /// <param name="threshold"> - веса с модулем меньше порога обнуляются</param>
+    int prune(const Scalar& threshold)
+    {
+        if (m_mask.size() == 0)
+        {
+            m_mask.setOnes(m_weight.rows(), m_weight.cols());
+        }
+
+        m_mask.array() *= (m_weight.array().abs() >= threshold).template cast<Scalar>();
+        m_weight.array() *= m_mask.array();
+
+        m_sparse_dirty = true;
+        sync_sparse();
+        choose_sparse();
+
+        return int(m_weight.size() - m_sparse_weight.nonZeros());
+    }
+
+    void reset_pruning()
+    {
+        m_mask.resize(0, 0);
+        m_sparse_weight.resize(0, 0);
+        m_use_sparse = false;
+        m_sparse_dirty = false;
+        m_sparse_stale = false;
+    }
+
+    Scalar density() const
+    {
+        if (m_weight.size() == 0) { return Scalar(1); }
+
+        return Scalar((m_weight.array() != Scalar(0)).count()) / Scalar(m_weight.size());
+    }
+
+    /// <summary>
+    /// Порог плотности вместо замера: ниже порога forward идет через CSR
+    /// </summary>
+    /// <param name="density"> - 0 чтобы всегда считать плотно, 1 - всегда разреженно,
+    /// меньше 0 - снова выбирать замером (по умолчанию)</param>
+    void set_sparse_density(const Scalar& density)
+    {
+        m_sparse_density = density;
+        choose_sparse();
+    }
+
+    bool is_sparse() const { return m_use_sparse; }
+
+    void set_gemm(GemmBackend backend, WeightLayout layout)
+    {
+        if (!internal::gemm_available(backend))
+        {
+            throw std::invalid_argument("[class FullyConnected]: GEMM backend is not available in this build (define NN_USE_BLAS)");
+        }
+
+        if (m_master && layout != m_layout)
+        {
+            throw std::logic_error("[class FullyConnected]: Worker copy must keep the weight layout of its owner");
+        }
+
+        m_gemm = backend;
+
+        if (layout == m_layout) { return; }
+
+        m_layout = layout;
+        m_weight.transposeInPlace();
+        m_dw.transposeInPlace();
+
+        if (m_mask.size() > 0) { m_mask.transposeInPlace(); }
+
+        m_sparse_dirty = true;
     }
 
-    // TODO: Доделать методы для сохранения сетки.
-    std::vector<Scalar> get_parametrs() const { return std::vector<Scalar>(); }
+    GemmBackend gemm_backend() const { return m_gemm; }
+
+    void set_thread_pool(ThreadPool* pool) { m_pool = pool; }
+
+    WeightLayout weight_layout() const { return m_layout; }
+
+    void tune_gemm(const Matrix& prev_layer_data, int repeat)
+    {
+        const GemmBackend backends[] = { GEMM_EIGEN, GEMM_BLAS, GEMM_DISPATCH };
+        const WeightLayout layouts[] = { WEIGHT_IN_OUT, WEIGHT_OUT_IN };
+        const Matrix next = Matrix::Ones(this->m_out_size, prev_layer_data.cols());
+
+        GemmBackend best_backend = m_gemm;
+        WeightLayout best_layout = m_layout;
+        double best = -1;
+
+        for (int b = 0; b < 3; ++b)
+        {
+            if (!internal::gemm_available(backends[b])) { continue; }
+
+            for (int l = 0; l < 2; ++l)
+            {
+                if (m_master && layouts[l] != m_layout) { continue; }
+
+                set_gemm(backends[b], layouts[l]);
+
+                // первый прогон выделяет буферы и в замер не идет
+                forward(prev_layer_data);
+                backprop(prev_layer_data, next);
+
+                for (int r = 0; r < std::max(1, repeat); ++r)
+                {
+                    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    void set_parametrs(const std::vector<Scalar>& param) {};
+                    forward(prev_layer_data);
+                    backprop(prev_layer_data, next);
 
-    std::vector<Scalar> get_derivatives() const { return std::vector<Scalar>(); }
+                    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                    if (best < 0 || elapsed < best)
+                    {
+                        best = elapsed;
+                        best_backend = backends[b];
+                        best_layout = layouts[l];
+                    }
+                }
+            }
+        }
+
+        set_gemm(best_backend, best_layout);
+    }
+
+    /// <summary>
+    /// None
+    /// </summary>
+    /// <returns>Веса (по столбцам) и затем смещения одним вектором</returns>
+    std::vector<Scalar> get_parametrs() const
+    {
+        std::vector<Scalar> res(m_weight.size() + m_bias.size());
+
+        Eigen::Map<Matrix>(res.data(), this->m_in_size, this->m_out_size) = weight_in_out();
+        std::copy(m_bias.data(), m_bias.data() + m_bias.size(), res.begin() + m_weight.size());
+
+        return res;
+    }
+
+    /// <summary>
+    /// Загрузка весов и смещений в формате FullyConnected::get_parametrs()
+    /// </summary>
+    void set_parametrs(const std::vector<Scalar>& param)
+    {
+        if (static_cast<int>(param.size()) != m_weight.size() + m_bias.size())
+        {
+            throw std::invalid_argument("[class FullyConnected]: Parameter size does not match");
+        }
+
+        Eigen::Map<const Matrix> weight(param.data(), this->m_in_size, this->m_out_size);
+
+        if (out_in()) { m_weight = weight.transpose(); }
+        else { m_weight = weight; }
+
+        std::copy(param.begin() + m_weight.size(), param.end(), m_bias.data());
+        m_sparse_dirty = true;
+    }
+
+    std::vector<Scalar> get_derivatives() const
+    {
+        std::vector<Scalar> res(m_dw.size() + m_db.size());
+
+        if (out_in()) { Eigen::Map<Matrix>(res.data(), this->m_in_size, this->m_out_size) = m_dw.transpose(); }
+        else { std::copy(m_dw.data(), m_dw.data() + m_dw.size(), res.begin()); }
+        std::copy(m_db.data(), m_db.data() + m_db.size(), res.begin() + m_dw.size());
+
+        return res;
+    }
+
+    void derivative_buffers(std::vector< std::pair<Scalar*, int> >& buffers)
+    {
+        buffers.push_back(std::make_pair(m_dw.data(), int(m_dw.size())));
+        buffers.push_back(std::make_pair(m_db.data(), int(m_db.size())));
+    }
 
     std::string layer_type() const { return "FullyConnected"; }
 
     std::string activation_type() const { return Activation::return_type(); }
 
+    bool activate(Eigen::Ref<Matrix> z) const
+    {
+        Activation::activate(z, z);
+        return true;
+    }
+
     void fill_meta_info(Meta& map, int index) const {}
 };
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <cmath>
+# include "Config.h"
+# include "CpuDispatch.h"
+# include "FastMath.h"
+
+/// <summary>
+/// GELU: z * Phi(z), Phi - функция распределения N(0, 1).
+/// Производная Phi(z) + z * phi(z).
+/// </summary>
+class GELU
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производной нужен Z
+	static const bool derivative_from_output = false;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		internal::cpu_kernels().gelu(Z.data(), Z.outerStride(), A.data(), A.outerStride(), Z.rows(), Z.cols());
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		internal::cpu_kernels().gelu_jacobian(Z.data(), Z.outerStride(), A.data(), A.outerStride(), F.data(), F.outerStride(),
+			G.data(), G.outerStride(), G.rows(), G.cols());
+	}
+
+	static std::string return_type()
+	{
+		return "GELU";
+	}
+};
+
+namespace internal
+{
+	/// <summary>
+	/// Производная tanh-приближения GELU:
+	/// 0.5 (1 + t) + 0.5 z (1 - t^2) k (1 + 3 * 0.044715 z^2), t = tanh(k (z + 0.044715 z^3))
+	/// </summary>
+	struct fast_gelu_grad_op
+	{
+		template <typename Packet>
+		EIGEN_STRONG_INLINE Packet packetOp(const Packet& z) const
+		{
+			using namespace Eigen::internal;
+
+			const Packet k = pset1<Packet>(Scalar(0.79788456080286536));
+			const Packet half = pset1<Packet>(Scalar(0.5));
+			const Packet one = pset1<Packet>(Scalar(1));
+			const Packet z2 = pmul(z, z);
+			const Packet t = fast_tanh(pmul(pmul(k, z), pmadd(pset1<Packet>(Scalar(0.044715)), z2, one)));
+			const Packet dt = pmul(psub(one, pmul(t, t)), pmul(k, pmadd(pset1<Packet>(Scalar(0.134145)), z2, one)));
+
+			return pmul(half, padd(padd(one, t), pmul(z, dt)));
+		}
+
+		EIGEN_STRONG_INLINE Scalar operator()(const Scalar& z) const { return packetOp(z); }
+	};
+}
+
+
+namespace Eigen
+{
+	namespace internal
+	{
+		template <>
+		struct functor_traits< ::internal::fast_gelu_grad_op >
+		{
+			enum { Cost = 20 * NumTraits<Scalar>::MulCost + scalar_div_cost<Scalar, true>::value, PacketAccess = packet_traits<Scalar>::HasDiv };
+		};
+	}
+}
+
+
+/// <summary>
+/// GELU через tanh-приближение 0.5 z (1 + tanh(k (z + 0.044715 z^3))), k = sqrt(2 / pi),
+/// на быстром tanh. Абсолютная ошибка относительно точной GELU не больше 5e-4.
+/// </summary>
+class FastGELU
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производной нужен Z
+	static const bool derivative_from_output = false;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		A.array() = Scalar(0.5) * Z.array() * (Scalar(1) +
+			(Scalar(0.79788456080286536) * Z.array() * (Scalar(1) + Scalar(0.044715) * Z.array().square()))
+				.unaryExpr(internal::fast_tanh_op()));
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		G.array() = F.array() * Z.array().unaryExpr(internal::fast_gelu_grad_op());
+	}
+
+	static std::string return_type()
+	{
+		return "FastGELU";
+	}
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+# include "Layer.h"
+# include "Random.h"
+# include "Recurrent.h"
+
+///
+/// GRU слой.
+///
+/// Вход и выход в том же формате, что у LSTM (см. Recurrent.h).
+/// Гейты в строках идут в порядке r, z, n:
+///
+/// r = sigmoid(Wx_r x + bx_r + Wh_r h + bh_r)
+/// z = sigmoid(Wx_z x + bx_z + Wh_z h + bh_z)
+/// n = tanh(Wx_n x + bx_n + r * (Wh_n h + bh_n))
+/// h' = (1 - z) * n + z * h
+///
+/// Вклад входа считается одним GEMM до цикла по времени, на каждом шаге -
+/// один GEMM скрытого состояния сразу на все 3 гейта. GEMM идут через реализацию
+/// из set_gemm() (см. Gemm.h), сигмоида и tanh гейтов - через ядра cpu_kernels().
+///
+
+
+class GRU : public Layer
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+    typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
+    typedef Vector::AlignedMapType AlignedMapVec;
+    typedef std::map<std::string, int> Meta;
+    typedef Eigen::Block<const internal::ConstStepMap> GateBlock;
+
+    const int m_seq_len; // длина последовательности
+    GemmBackend m_gemm;  // реализация матричного умножения
+
+    Matrix m_wx;      // Веса входа (in_size x 3 * out_size)
+    Matrix m_wh;      // Веса скрытого состояния (out_size x 3 * out_size)
+    Vector m_bx;      // Смещение входной части гейтов
+    Vector m_bh;      // Смещение скрытой части гейтов
+    Matrix m_dwx;     // Производная весов входа
+    Matrix m_dwh;     // Производная весов скрытого состояния
+    Vector m_dbx;     // Производная смещения входной части
+    Vector m_dbh;     // Производная смещения скрытой части
+
+    Matrix m_gates;   // Значения гейтов после активации (3 * out_size x время * батч)
+    Matrix m_hn;      // Wh_n h + bh_n на каждом шаге
+    Matrix m_hprev;   // Скрытое состояние предыдущего шага (вход рекуррентного GEMM)
+    Matrix m_a;       // Выход слоя - скрытое состояние на каждом шаге
+    Matrix m_dgates;  // Производные входной части гейтов до активации
+    Matrix m_dhgates; // Производные скрытой части гейтов
+    Matrix m_din;     // Производная входа
+
+    Matrix m_rh;      // Wh^T h + bh текущего шага (3 * out_size x батч)
+    Matrix m_dh;      // Производная h, пришедшая с последующего шага (out_size x батч)
+
+public:
+    /// <param name="in_size"> - кол-во признаков на шаге</param>
+    /// <param name="out_size"> - размер скрытого состояния</param>
+    /// <param name="seq_len"> - длина последовательности</param>
+    GRU(const int in_size, const int out_size, const int seq_len) :
+        Layer(in_size, out_size), m_seq_len(seq_len), m_gemm(default_gemm_backend())
+    {
+        if (seq_len <= 0)
+        {
+            throw std::invalid_argument("[class GRU]: Sequence length must be positive");
+        }
+    }
+
+    Layer* clone() const
+    {
+        return new GRU(*this);
+    }
+
+    int sequence_length() const { return m_seq_len; }
+
+    void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+    {
+        init();
+
+        internal::set_normal_random(m_wx.data(), m_wx.size(), rng, mu, sigma);
+        internal::set_normal_random(m_wh.data(), m_wh.size(), rng, mu, sigma);
+        internal::set_normal_random(m_bx.data(), m_bx.size(), rng, mu, sigma);
+        internal::set_normal_random(m_bh.data(), m_bh.size(), rng, mu, sigma);
+    }
+
+    void init()
+    {
+        const int ngate = 3 * this->m_out_size;
+
+        m_wx.resize(this->m_in_size, ngate);
+        m_wh.resize(this->m_out_size, ngate);
+        m_bx.resize(ngate);
+        m_bh.resize(ngate);
+        m_dwx.resize(this->m_in_size, ngate);
+        m_dwh.resize(this->m_out_size, ngate);
+        m_dbx.resize(ngate);
+        m_dbh.resize(ngate);
+    }
+
+    void forward(const Matrix& prev_layer_data)
+    {
+        const int H = this->m_out_size;
+        const int T = m_seq_len;
+        const int ncols = prev_layer_data.cols();
+        const int nseq = ncols / T;
+
+        internal::check_sequences(prev_layer_data.rows(), ncols, this->m_in_size, T, "GRU");
+
+        // Вклад входа во все гейты всех шагов одним GEMM
+        m_gates.resize(3 * H, ncols);
+        internal::gemm(m_gemm, true, false, Scalar(1), m_wx, prev_layer_data, m_gates);
+        internal::cpu_kernels().add_bias(m_gates.data(), m_gates.outerStride(), m_bx.data(), m_gates.rows(), m_gates.cols());
+
+        m_hn.resize(H, ncols);
+        m_a.resize(H, ncols);
+        m_hprev.resize(H, ncols);
+        m_rh.resize(3 * H, nseq);
+
+        internal::step_cols(m_hprev, 0, T).setZero();
+
+        for (int t = 0; t < T; ++t)
+        {
+            internal::StepMap gates = internal::step_cols(m_gates, t, T);
+            internal::StepMap hprev = internal::step_cols(m_hprev, t, T);
+            internal::StepMap h = internal::step_cols(m_a, t, T);
+
+            m_rh.colwise() = m_bh;
+
+            if (t > 0)
+            {
+                internal::gemm(m_gemm, true, false, Scalar(1), m_wh, hprev, m_rh, Scalar(1));
+            }
+
+            gates.topRows(2 * H) += m_rh.topRows(2 * H);
+            internal::sigmoid_inplace(gates.topRows(2 * H));
+
+            internal::step_cols(m_hn, t, T) = m_rh.bottomRows(H);
+            gates.bottomRows(H).array() += gates.topRows(H).array() * m_rh.bottomRows(H).array();
+            internal::tanh_inplace(gates.bottomRows(H));
+
+            // h = n + z * (h_prev - n)
+            h.array() = gates.bottomRows(H).array() +
+                gates.middleRows(H, H).array() * (hprev.array() - gates.bottomRows(H).array());
+
+            if (t + 1 < T)
+            {
+                internal::step_cols(m_hprev, t + 1, T) = h;
+            }
+        }
+    }
+
+    const Matrix& output() { return m_a; }
+
+    /// <summary>
+    /// Backprop во времени. На шаге остается один GEMM для производной
+    /// предыдущего скрытого состояния, градиенты весов считаются после цикла.
+    /// </summary>
+    void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
+    {
+        const int H = this->m_out_size;
+        const int T = m_seq_len;
+        const int ncols = prev_layer_data.cols();
+        const int nseq = ncols / T;
+
+        m_dgates.resize(3 * H, ncols);
+        m_dhgates.resize(3 * H, ncols);
+        m_dh.setZero(H, nseq);
+
+        for (int t = T - 1; t >= 0; --t)
+        {
+            const internal::ConstStepMap gates = internal::step_cols(static_cast<const Matrix&>(m_gates), t, T);
+            const internal::ConstStepMap hprev = internal::step_cols(static_cast<const Matrix&>(m_hprev), t, T);
+            const internal::ConstStepMap hn = internal::step_cols(static_cast<const Matrix&>(m_hn), t, T);
+            internal::StepMap dgates = internal::step_cols(m_dgates, t, T);
+            internal::StepMap dhgates = internal::step_cols(m_dhgates, t, T);
+
+            const GateBlock r(gates, 0, 0, H, nseq);
+            const GateBlock z(gates, H, 0, H, nseq);
+            const GateBlock n(gates, 2 * H, 0, H, nseq);
+
+            m_dh += internal::step_cols(next_layer_data, t, T);
+
+            dgates.bottomRows(H).array() = m_dh.array() * (Scalar(1) - z.array()) * (Scalar(1) - n.array().square());
+            dgates.middleRows(H, H).array() = m_dh.array() * (hprev.array() - n.array()) *
+                z.array() * (Scalar(1) - z.array());
+            dgates.topRows(H).array() = dgates.bottomRows(H).array() * hn.array() *
+                r.array() * (Scalar(1) - r.array());
+
+            dhgates.topRows(2 * H) = dgates.topRows(2 * H);
+            dhgates.bottomRows(H).array() = dgates.bottomRows(H).array() * r.array();
+
+            m_dh.array() *= z.array();
+            internal::gemm(m_gemm, false, false, Scalar(1), m_wh, dhgates, m_dh, Scalar(1));
+        }
+
+        internal::gemm(m_gemm, false, true, Scalar(1) / ncols, prev_layer_data, m_dgates, m_dwx);
+        internal::gemm(m_gemm, false, true, Scalar(1) / ncols, m_hprev, m_dhgates, m_dwh);
+        internal::cpu_kernels().row_mean(m_dgates.data(), m_dgates.outerStride(), m_dgates.rows(), m_dgates.cols(), m_dbx.data());
+        internal::cpu_kernels().row_mean(m_dhgates.data(), m_dhgates.outerStride(), m_dhgates.rows(), m_dhgates.cols(), m_dbh.data());
+
+        m_din.resize(this->m_in_size, ncols);
+        internal::gemm(m_gemm, false, false, Scalar(1), m_wx, m_dgates, m_din);
+    }
+
+    const Matrix& backprop_data() const { return m_din; }
+
+    /// <summary>
+    /// Реализация GEMM гейтов. Хранение весов у слоя одно, layout не используется.
+    /// </summary>
+    void set_gemm(GemmBackend backend, WeightLayout layout)
+    {
+        if (!internal::gemm_available(backend))
+        {
+            throw std::invalid_argument("[class GRU]: GEMM backend is not available in this build (define NN_USE_BLAS)");
+        }
+
+        m_gemm = backend;
+    }
+
+    GemmBackend gemm_backend() const { return m_gemm; }
+
+    void release_buffers()
+    {
+        Matrix* buffers[] = { &m_gates, &m_hn, &m_hprev, &m_a, &m_dgates, &m_dhgates, &m_din };
+
+        for (int i = 0; i < 7; ++i) { buffers[i]->resize(0, 0); }
+    }
+
+    void update(Optimizer& opt)
+    {
+        ConstAlignedMapVec dwx(m_dwx.data(), m_dwx.size());
+        ConstAlignedMapVec dwh(m_dwh.data(), m_dwh.size());
+        ConstAlignedMapVec dbx(m_dbx.data(), m_dbx.size());
+        ConstAlignedMapVec dbh(m_dbh.data(), m_dbh.size());
+        AlignedMapVec      wx(m_wx.data(), m_wx.size());
+        AlignedMapVec      wh(m_wh.data(), m_wh.size());
+        AlignedMapVec      bx(m_bx.data(), m_bx.size());
+        AlignedMapVec      bh(m_bh.data(), m_bh.size());
+
+        opt.update(dwx, wx);
+        opt.update(dwh, wh);
+        opt.update(dbx, bx);
+        opt.update(dbh, bh);
+    }
+
+    /// <summary>
+    /// None
+    /// </summary>
+    /// <returns>Веса входа, веса скрытого состояния и оба смещения одним вектором</returns>
+    std::vector<Scalar> get_parametrs() const
+    {
+        std::vector<Scalar> res;
+        res.reserve(m_wx.size() + m_wh.size() + m_bx.size() + m_bh.size());
+
+        res.insert(res.end(), m_wx.data(), m_wx.data() + m_wx.size());
+        res.insert(res.end(), m_wh.data(), m_wh.data() + m_wh.size());
+        res.insert(res.end(), m_bx.data(), m_bx.data() + m_bx.size());
+        res.insert(res.end(), m_bh.data(), m_bh.data() + m_bh.size());
+
+        return res;
+    }
+
+    void set_parametrs(const std::vector<Scalar>& param)
+    {
+        if (static_cast<int>(param.size()) != m_wx.size() + m_wh.size() + m_bx.size() + m_bh.size())
+        {
+            throw std::invalid_argument("[class GRU]: Parameter size does not match");
+        }
+
+        std::vector<Scalar>::const_iterator it = param.begin();
+
+        std::copy(it, it + m_wx.size(), m_wx.data()); it += m_wx.size();
+        std::copy(it, it + m_wh.size(), m_wh.data()); it += m_wh.size();
+        std::copy(it, it + m_bx.size(), m_bx.data()); it += m_bx.size();
+        std::copy(it, it + m_bh.size(), m_bh.data());
+    }
+
+    std::vector<Scalar> get_derivatives() const
+    {
+        std::vector<Scalar> res;
+        res.reserve(m_dwx.size() + m_dwh.size() + m_dbx.size() + m_dbh.size());
+
+        res.insert(res.end(), m_dwx.data(), m_dwx.data() + m_dwx.size());
+        res.insert(res.end(), m_dwh.data(), m_dwh.data() + m_dwh.size());
+        res.insert(res.end(), m_dbx.data(), m_dbx.data() + m_dbx.size());
+        res.insert(res.end(), m_dbh.data(), m_dbh.data() + m_dbh.size());
+
+        return res;
+    }
+
+    void derivative_buffers(std::vector< std::pair<Scalar*, int> >& buffers)
+    {
+        buffers.push_back(std::make_pair(m_dwx.data(), int(m_dwx.size())));
+        buffers.push_back(std::make_pair(m_dwh.data(), int(m_dwh.size())));
+        buffers.push_back(std::make_pair(m_dbx.data(), int(m_dbx.size())));
+        buffers.push_back(std::make_pair(m_dbh.data(), int(m_dbh.size())));
+    }
+
+    std::string layer_type() const { return "GRU"; }
+
+    std::string activation_type() const { return "Tanh"; }
+
+    void fill_meta_info(Meta& map, int index) const {}
+};
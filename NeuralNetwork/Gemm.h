@@ -0,0 +1,155 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <algorithm>
+# include "Config.h"
+# include "CpuDispatch.h"
+
+///
+/// Выбор реализации матричного умножения для слоев.
+///
+/// GEMM_EIGEN - встроенные ядра Eigen. Если проект собран с EIGEN_USE_BLAS,
+/// Eigen сам отдает крупные произведения во внешний BLAS, и этот вариант уже
+/// идет через него.
+///
+/// GEMM_BLAS - прямой вызов dgemm_ / sgemm_ внешнего BLAS (OpenBLAS, BLIS, MKL или
+/// Libraries/Eigen/blas). Доступен, если определен NN_USE_BLAS и библиотека
+/// слинкована. Позволяет выбирать BLAS для отдельных слоев во время работы.
+///
+/// GEMM_DISPATCH - свое блочное ядро под AVX2 / AVX-512, выбранное по cpuid
+/// (см. CpuDispatch.h). Дает полную ширину вектора переносимой сборке без BLAS,
+/// на CPU_GENERIC - то же, что GEMM_EIGEN.
+///
+/// Слои создаются с default_gemm_backend(): GEMM_DISPATCH, если процессор умеет
+/// больше CPU_GENERIC, иначе GEMM_EIGEN. set_gemm() слоя меняет выбор.
+///
+
+
+/// <summary>
+/// Реализация матричного умножения
+/// </summary>
+enum GemmBackend
+{
+    GEMM_EIGEN,
+    GEMM_BLAS,
+    GEMM_DISPATCH
+};
+
+/// <summary>
+/// Хранение весов слоя: in_size x out_size (forward умножает на W^T)
+/// или out_size x in_size (forward умножает на W без транспонирования)
+/// </summary>
+enum WeightLayout
+{
+    WEIGHT_IN_OUT,
+    WEIGHT_OUT_IN
+};
+
+
+# ifdef NN_USE_BLAS
+extern "C"
+{
+    void dgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+        const double* alpha, const double* a, const int* lda, const double* b, const int* ldb,
+        const double* beta, double* c, const int* ldc);
+
+    void sgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+        const float* alpha, const float* a, const int* lda, const float* b, const int* ldb,
+        const float* beta, float* c, const int* ldc);
+}
+# endif
+
+
+/// <summary>
+/// Реализация для новых слоев: свое ядро, если уровень ядер выше CPU_GENERIC
+/// </summary>
+inline GemmBackend default_gemm_backend()
+{
+    return cpu_level() > CPU_GENERIC ? GEMM_DISPATCH : GEMM_EIGEN;
+}
+
+
+namespace internal
+{
+    /// <summary>
+    /// Доступна ли реализация в этой сборке
+    /// </summary>
+    inline bool gemm_available(const GemmBackend backend)
+    {
+# ifdef NN_USE_BLAS
+        return true;
+# else
+        return backend != GEMM_BLAS;
+# endif
+    }
+
+# ifdef NN_USE_BLAS
+    inline void blas_gemm(const char* ta, const char* tb, const int* m, const int* n, const int* k,
+        const double* alpha, const double* a, const int* lda, const double* b, const int* ldb,
+        const double* beta, double* c, const int* ldc)
+    {
+        dgemm_(ta, tb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+    }
+
+    inline void blas_gemm(const char* ta, const char* tb, const int* m, const int* n, const int* k,
+        const float* alpha, const float* a, const int* lda, const float* b, const int* ldb,
+        const float* beta, float* c, const int* ldc)
+    {
+        sgemm_(ta, tb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+    }
+# endif
+
+    /// <summary>
+    /// C = alpha * op(A) * op(B) + beta * C, op(X) = X^T при trans_x. Размер C задает вызывающий,
+    /// при beta = 0 C только пишется. A и B - матрицы с прямым доступом к памяти (Matrix, Map, Ref),
+    /// в том числе row-major: они передаются в BLAS без копии как транспонированные column-major.
+    /// C - column-major матрица или блок столбцов / строк такой матрицы.
+    /// </summary>
+    template <typename MatA, typename MatB, typename MatC>
+    inline void gemm(const GemmBackend backend, const bool trans_a, const bool trans_b,
+        const Scalar& alpha, const MatA& a, const MatB& b, MatC& c, const Scalar& beta = Scalar(0))
+    {
+        if (backend != GEMM_EIGEN)
+        {
+            const int m = c.rows();
+            const int n = c.cols();
+            const int k = trans_a ? a.rows() : a.cols();
+            const int lda = std::max<int>(1, a.outerStride());
+            const int ldb = std::max<int>(1, b.outerStride());
+            const int ldc = std::max<int>(1, c.outerStride());
+            const bool ta = (trans_a != bool(MatA::IsRowMajor));
+            const bool tb = (trans_b != bool(MatB::IsRowMajor));
+
+            if (m == 0 || n == 0) { return; }
+
+            if (backend == GEMM_DISPATCH)
+            {
+                cpu_kernels().gemm(ta, tb, m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, c.data(), ldc);
+                return;
+            }
+
+# ifdef NN_USE_BLAS
+            blas_gemm(ta ? "T" : "N", tb ? "T" : "N", &m, &n, &k,
+                &alpha, a.data(), &lda, b.data(), &ldb, &beta, c.data(), &ldc);
+            return;
+# endif
+        }
+
+        if (beta == Scalar(0))
+        {
+            if (trans_a && trans_b) { c.noalias() = alpha * (a.transpose() * b.transpose()); }
+            else if (trans_a)       { c.noalias() = alpha * (a.transpose() * b); }
+            else if (trans_b)       { c.noalias() = alpha * (a * b.transpose()); }
+            else                    { c.noalias() = alpha * (a * b); }
+
+            return;
+        }
+
+        if (beta != Scalar(1)) { c *= beta; }
+
+        if (trans_a && trans_b) { c.noalias() += alpha * (a.transpose() * b.transpose()); }
+        else if (trans_a)       { c.noalias() += alpha * (a.transpose() * b); }
+        else if (trans_b)       { c.noalias() += alpha * (a * b.transpose()); }
+        else                    { c.noalias() += alpha * (a * b); }
+    }
+}
@@ -0,0 +1,659 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <map>
+# include <string>
+# include <vector>
+# include <utility>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+# include "RNG.h"
+# include "Random.h"
+# include "Layer.h"
+# include "Output.h"
+# include "Optimizer.h"
+# include "ThreadPool.h"
+
+///
+/// Сетка произвольной топологии (направленный ациклический граф): пропускные
+/// связи (residual), склейка ветвей, несколько входов.
+///
+/// Узлы бывают четырех видов: вход (строки входной матрицы), слой (любой Layer
+/// с одним входом) и слияние нескольких узлов - поэлементная сумма или склейка
+/// по строкам. Узлы ссылаются на входы по именам, и вход должен быть добавлен
+/// раньше, поэтому порядок добавления уже топологический.
+///
+/// Расписание идет ярусами: ярус узла на единицу больше самого дальнего из
+/// его входов, в backprop - самого дальнего из потребителей. Узлы одного яруса
+/// друг от друга не зависят и при заданном пуле считаются параллельно, ярус из
+/// одного узла отдает пул самому слою.
+///
+/// Свои буферы узлов (входы-срезы, слияния, суммы градиентов) освобождаются,
+/// как только их прочитал последний потребитель. Значение, которое нужно слою
+/// в backprop, живет до backprop этого слоя.
+///
+
+
+/// <summary>
+/// Вид слияния узлов
+/// </summary>
+enum GraphMerge
+{
+    MERGE_ADD,    // поэлементная сумма, размеры входов одинаковые
+    MERGE_CONCAT  // склейка по строкам в порядке входов
+};
+
+
+class GraphNetwork
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+    enum NodeType { NODE_INPUT, NODE_LAYER, NODE_ADD, NODE_CONCAT };
+
+    struct Node
+    {
+        std::string name;
+        NodeType type;
+        int size;                                    // строк в значении узла
+        int row;                                     // вход: первая строка во входной матрице
+        Layer* layer;                                // слой: сам слой, владеет сетка
+        std::vector<int> inputs;                     // узлы-входы
+        std::vector< std::pair<int, int> > consumers; // (узел-потребитель, строка в его склейке)
+        int level;                                   // ярус прохода вперед
+        int back_level;                              // ярус backprop, -1 - градиент не нужен
+
+        Matrix value;                                // свой буфер значения
+        Matrix grad;                                 // свой буфер суммы градиентов
+        const Matrix* out;                           // текущее значение узла
+        const Matrix* dout;                          // текущий градиент по значению узла
+        int grad_owner;                              // чей буфер grad у dout, -1 - буфер слоя или Output
+
+        Node() : type(NODE_INPUT), size(0), row(0), layer(NULL),
+            level(0), back_level(-1), out(NULL), dout(NULL), grad_owner(-1) {}
+    };
+
+    RNG m_rng;
+    std::vector<Node> m_nodes;
+    std::map<std::string, int> m_index;
+    std::vector< std::vector<int> > m_levels;      // ярусы прохода вперед
+    std::vector< std::vector<int> > m_back_levels; // ярусы backprop
+    Output* m_output;
+    int m_output_node;                             // узел выхода, -1 - последний добавленный
+    int m_out;                                     // узел выхода после GraphNetwork::build()
+    int m_input_rows;                              // строк во входной матрице
+    ThreadPool* m_pool;
+    int m_eigen_threads;                           // Eigen::nbThreads() до set_thread_pool()
+    bool m_built;
+
+    GraphNetwork(const GraphNetwork&);
+    GraphNetwork& operator=(const GraphNetwork&);
+
+    int find_node(const std::string& name) const
+    {
+        std::map<std::string, int>::const_iterator it = m_index.find(name);
+
+        if (it == m_index.end())
+        {
+            throw std::invalid_argument("[class GraphNetwork]: Unknown node '" + name + "'");
+        }
+
+        return it->second;
+    }
+
+    int push_node(Node& node)
+    {
+        if (m_index.count(node.name))
+        {
+            throw std::invalid_argument("[class GraphNetwork]: Duplicate node name '" + node.name + "'");
+        }
+
+        const int id = int(m_nodes.size());
+
+        m_nodes.push_back(node);
+        m_index[node.name] = id;
+        m_built = false;
+
+        return id;
+    }
+
+    /// <summary>
+    /// Проверка размеров, ярусы вперед и назад
+    /// </summary>
+    void build()
+    {
+        if (m_built) { return; }
+
+        const int nnode = count_nodes();
+
+        if (nnode == 0 || m_output == NULL)
+        {
+            throw std::logic_error("[class GraphNetwork]: Graph must have nodes and an output layer");
+        }
+
+        const int out_node = (m_output_node >= 0) ? m_output_node : nnode - 1;
+
+        m_levels.clear();
+        m_back_levels.clear();
+
+        for (int n = 0; n < nnode; ++n)
+        {
+            Node& node = m_nodes[n];
+            node.consumers.clear();
+            node.level = 0;
+            node.back_level = -1;
+
+            for (std::size_t k = 0; k < node.inputs.size(); ++k)
+            {
+                node.level = std::max(node.level, m_nodes[node.inputs[k]].level + 1);
+            }
+        }
+
+        for (int n = 0; n < nnode; ++n)
+        {
+            Node& node = m_nodes[n];
+            int offset = 0;
+
+            for (std::size_t k = 0; k < node.inputs.size(); ++k)
+            {
+                Node& in = m_nodes[node.inputs[k]];
+
+                if (node.type == NODE_LAYER && node.layer->in_size() != in.size)
+                {
+                    throw std::invalid_argument("[class GraphNetwork]: Unit sizes do not match at node '" + node.name + "'");
+                }
+
+                if (node.type == NODE_ADD && in.size != node.size)
+                {
+                    throw std::invalid_argument("[class GraphNetwork]: Inputs of add node '" + node.name + "' have different sizes");
+                }
+
+                in.consumers.push_back(std::make_pair(n, offset));
+
+                if (node.type == NODE_CONCAT) { offset += in.size; }
+            }
+
+            if (int(m_levels.size()) <= node.level) { m_levels.resize(node.level + 1); }
+
+            m_levels[node.level].push_back(n);
+        }
+
+        for (int n = 0; n < nnode; ++n)
+        {
+            if (n != out_node && m_nodes[n].consumers.empty())
+            {
+                throw std::invalid_argument("[class GraphNetwork]: Node '" + m_nodes[n].name + "' is not used");
+            }
+        }
+
+        // Ярусы backprop от выхода к входам. Входным узлам градиент не нужен
+        for (int n = out_node; n >= 0; --n)
+        {
+            Node& node = m_nodes[n];
+
+            if (node.type == NODE_INPUT) { continue; }
+
+            node.back_level = 0;
+
+            for (std::size_t k = 0; k < node.consumers.size(); ++k)
+            {
+                node.back_level = std::max(node.back_level, m_nodes[node.consumers[k].first].back_level + 1);
+            }
+
+            if (int(m_back_levels.size()) <= node.back_level) { m_back_levels.resize(node.back_level + 1); }
+
+            m_back_levels[node.back_level].push_back(n);
+        }
+
+        m_out = out_node;
+        m_built = true;
+    }
+
+    /// <summary>
+    /// Значение узла по значениям его входов
+    /// </summary>
+    void forward_node(Node& node, const Matrix& input)
+    {
+        switch (node.type)
+        {
+        case NODE_INPUT:
+            if (node.size == input.rows())
+            {
+                node.out = &input;
+                return;
+            }
+
+            node.value = input.middleRows(node.row, node.size);
+            break;
+
+        case NODE_LAYER:
+            node.layer->forward(*m_nodes[node.inputs[0]].out);
+            node.out = &node.layer->output();
+            return;
+
+        case NODE_ADD:
+            node.value = *m_nodes[node.inputs[0]].out;
+
+            for (std::size_t k = 1; k < node.inputs.size(); ++k)
+            {
+                node.value += *m_nodes[node.inputs[k]].out;
+            }
+            break;
+
+        case NODE_CONCAT:
+            node.value.resize(node.size, input.cols());
+
+            for (std::size_t k = 0, row = 0; k < node.inputs.size(); ++k)
+            {
+                const Matrix& in = *m_nodes[node.inputs[k]].out;
+
+                node.value.middleRows(row, in.rows()) = in;
+                row += in.rows();
+            }
+            break;
+        }
+
+        node.out = &node.value;
+    }
+
+    /// <summary>
+    /// Градиент по значению узла из градиентов потребителей и backprop слоя
+    /// </summary>
+    void backprop_node(Node& node, const int id)
+    {
+        if (id == m_out)
+        {
+            node.dout = &m_output->backprop_data();
+            node.grad_owner = -1;
+        }
+        else if (node.consumers.size() == 1 && m_nodes[node.consumers[0].first].type != NODE_CONCAT)
+        {
+            // единственный потребитель отдает градиент целиком - без копии
+            const Node& c = m_nodes[node.consumers[0].first];
+            node.dout = (c.type == NODE_LAYER) ? &c.layer->backprop_data() : c.dout;
+            node.grad_owner = (c.type == NODE_LAYER) ? -1 : c.grad_owner;
+        }
+        else
+        {
+            for (std::size_t k = 0; k < node.consumers.size(); ++k)
+            {
+                const Node& c = m_nodes[node.consumers[k].first];
+                const Matrix& g = (c.type == NODE_LAYER) ? c.layer->backprop_data() : *c.dout;
+
+                if (k == 0)
+                {
+                    node.grad = g.middleRows(c.type == NODE_CONCAT ? node.consumers[k].second : 0, node.size);
+                }
+                else
+                {
+                    node.grad += g.middleRows(c.type == NODE_CONCAT ? node.consumers[k].second : 0, node.size);
+                }
+            }
+
+            node.dout = &node.grad;
+            node.grad_owner = id;
+        }
+
+        if (node.type == NODE_LAYER)
+        {
+            node.layer->backprop(*m_nodes[node.inputs[0]].out, *node.dout);
+        }
+    }
+
+    static void release(Matrix& m) { m.resize(0, 0); }
+
+    /// <summary>
+    /// Узлы яруса: параллельно на пуле, если узлов больше одного
+    /// </summary>
+    template <typename Func>
+    void run_level(const std::vector<int>& level, Func f)
+    {
+        if (m_pool == NULL || level.size() == 1)
+        {
+            for (std::size_t k = 0; k < level.size(); ++k) { f(level[k]); }
+            return;
+        }
+
+        m_pool->parallel_for(Eigen::Index(level.size()), [&](Eigen::Index begin, Eigen::Index end) {
+            for (Eigen::Index k = begin; k < end; ++k) { f(level[k]); }
+        });
+    }
+
+    /// <summary>
+    /// Проход вперед по графу
+    /// </summary>
+    /// <param name="training"> - будет backprop: значения, нужные слоям, не освобождаются</param>
+    void forward(const Matrix& input, const bool training)
+    {
+        build();
+
+        if (input.rows() != m_input_rows)
+        {
+            throw std::invalid_argument("[class GraphNetwork]: Input data have incorrect dimension");
+        }
+
+        std::vector<int> pending(m_nodes.size());
+
+        for (std::size_t n = 0; n < m_nodes.size(); ++n)
+        {
+            pending[n] = int(m_nodes[n].consumers.size());
+        }
+
+        for (std::size_t l = 0; l < m_levels.size(); ++l)
+        {
+            run_level(m_levels[l], [&](int n) { forward_node(m_nodes[n], input); });
+
+            // Входы яруса, которые больше никто не читает
+            for (std::size_t k = 0; k < m_levels[l].size(); ++k)
+            {
+                const Node& node = m_nodes[m_levels[l][k]];
+
+                for (std::size_t i = 0; i < node.inputs.size(); ++i)
+                {
+                    Node& in = m_nodes[node.inputs[i]];
+
+                    if (--pending[node.inputs[i]] > 0) { continue; }
+
+                    bool needed = false;
+
+                    for (std::size_t c = 0; training && c < in.consumers.size(); ++c)
+                    {
+                        needed = needed || m_nodes[in.consumers[c].first].type == NODE_LAYER;
+                    }
+
+                    if (!needed) { release(in.value); }
+                }
+            }
+        }
+    }
+
+    /// <summary>
+    /// Backprop по графу после GraphNetwork::forward()
+    /// </summary>
+    template <typename TargetType>
+    void backprop(const TargetType& target)
+    {
+        m_output->check_target_data(target);
+        m_output->evaluate(*m_nodes[m_out].out, target);
+
+        // Сколько входов слияния еще не забрали его градиент. Входы слоя
+        // берут градиент у самого слоя, поэтому у слоя счетчик нулевой
+        std::vector<int> pending(m_nodes.size());
+
+        for (std::size_t n = 0; n < m_nodes.size(); ++n)
+        {
+            for (std::size_t i = 0; m_nodes[n].type != NODE_LAYER && i < m_nodes[n].inputs.size(); ++i)
+            {
+                pending[n] += m_nodes[m_nodes[n].inputs[i]].type != NODE_INPUT;
+            }
+        }
+
+        for (std::size_t l = 0; l < m_back_levels.size(); ++l)
+        {
+            run_level(m_back_levels[l], [&](int n) { backprop_node(m_nodes[n], n); });
+
+            for (std::size_t k = 0; k < m_back_levels[l].size(); ++k)
+            {
+                const int n = m_back_levels[l][k];
+                Node& node = m_nodes[n];
+
+                // потребители значения уже прошли backprop
+                release(node.value);
+
+                // градиент узла лежит в чужом буфере - его читатели теперь читают тот буфер
+                if (node.grad_owner >= 0 && node.grad_owner != n) { pending[node.grad_owner] += pending[n]; }
+
+                if (node.grad_owner == n && pending[n] == 0) { release(node.grad); }
+
+                for (std::size_t c = 0; c < node.consumers.size(); ++c)
+                {
+                    const Node& consumer = m_nodes[node.consumers[c].first];
+                    const int owner = consumer.grad_owner;
+
+                    if (consumer.type == NODE_LAYER || owner < 0) { continue; }
+
+                    if (--pending[owner] == 0) { release(m_nodes[owner].grad); }
+                }
+            }
+        }
+
+        for (std::size_t n = 0; n < m_nodes.size(); ++n)
+        {
+            if (m_nodes[n].type == NODE_INPUT) { release(m_nodes[n].value); }
+        }
+    }
+
+    void update(Optimizer& opt)
+    {
+        for (std::size_t n = 0; n < m_nodes.size(); ++n)
+        {
+            if (m_nodes[n].layer) { m_nodes[n].layer->update(opt); }
+        }
+    }
+
+public:
+    GraphNetwork() :
+        m_rng(1), m_output(NULL), m_output_node(-1), m_out(-1), m_input_rows(0), m_pool(NULL), m_eigen_threads(0),
+        m_built(false) {}
+
+    ~GraphNetwork()
+    {
+        for (std::size_t n = 0; n < m_nodes.size(); ++n)
+        {
+            delete m_nodes[n].layer;
+        }
+
+        delete m_output;
+    }
+
+    /// <summary>
+    /// Добавить вход: следующие size строк входной матрицы
+    /// (строки входов идут в порядке добавления)
+    /// </summary>
+    /// <returns>Номер узла</returns>
+    int add_input(const std::string& name, const int size)
+    {
+        Node node;
+        node.name = name;
+        node.type = NODE_INPUT;
+        node.size = size;
+        node.row = m_input_rows;
+
+        const int id = push_node(node);
+        m_input_rows += size;
+
+        return id;
+    }
+
+    /// <summary>
+    /// Добавить слой. Сетка становится владельцем слоя.
+    /// </summary>
+    /// <param name="name"> - имя узла</param>
+    /// <param name="layer"> - слой</param>
+    /// <param name="input"> - имя узла-входа</param>
+    /// <returns>Номер узла</returns>
+    int add_layer(const std::string& name, Layer* layer, const std::string& input)
+    {
+        Node node;
+        node.name = name;
+        node.type = NODE_LAYER;
+        node.size = layer->out_size();
+        node.inputs.push_back(find_node(input));
+
+        const int id = push_node(node);
+
+        // слой принадлежит сетке, только когда узел добавлен
+        m_nodes[id].layer = layer;
+
+        if (m_pool) { layer->set_thread_pool(m_pool); }
+
+        return id;
+    }
+
+    /// <summary>
+    /// Добавить слияние узлов
+    /// </summary>
+    /// <param name="name"> - имя узла</param>
+    /// <param name="merge"> - сумма или склейка</param>
+    /// <param name="inputs"> - имена узлов-входов</param>
+    /// <returns>Номер узла</returns>
+    int add_merge(const std::string& name, GraphMerge merge, const std::vector<std::string>& inputs)
+    {
+        if (inputs.empty())
+        {
+            throw std::invalid_argument("[class GraphNetwork]: Merge node needs inputs");
+        }
+
+        Node node;
+        node.name = name;
+        node.type = (merge == MERGE_ADD) ? NODE_ADD : NODE_CONCAT;
+
+        for (std::size_t k = 0; k < inputs.size(); ++k)
+        {
+            const int in = find_node(inputs[k]);
+
+            node.inputs.push_back(in);
+            node.size = (merge == MERGE_ADD) ? m_nodes[in].size : node.size + m_nodes[in].size;
+        }
+
+        return push_node(node);
+    }
+
+    /// <summary>
+    /// Выходной слой и узел, к которому он подключен
+    /// </summary>
+    /// <param name="output"> - выходной слой, сетка становится владельцем</param>
+    /// <param name="node"> - имя узла, пусто - последний добавленный</param>
+    void set_output(Output* output, const std::string& node = std::string())
+    {
+        delete m_output;
+
+        m_output = output;
+        m_output_node = node.empty() ? -1 : find_node(node);
+        m_built = false;
+    }
+
+    const Output* get_output() const { return m_output; }
+
+    int count_nodes() const { return int(m_nodes.size()); }
+
+    /// <summary>
+    /// Слои в порядке добавления
+    /// </summary>
+    std::vector<Layer*> get_layers() const
+    {
+        std::vector<Layer*> layers;
+
+        for (std::size_t n = 0; n < m_nodes.size(); ++n)
+        {
+            if (m_nodes[n].layer) { layers.push_back(m_nodes[n].layer); }
+        }
+
+        return layers;
+    }
+
+    /// <summary>
+    /// Считать независимые ветви и сами слои на пуле, NULL - в вызывающем потоке.
+    /// С пулом потоки Eigen (OpenMP) отключаются, с NULL - возвращается прежнее Eigen::nbThreads().
+    /// </summary>
+    void set_thread_pool(ThreadPool* pool)
+    {
+        if (pool && m_pool == NULL) { m_eigen_threads = Eigen::nbThreads(); }
+        if (pool == NULL && m_pool) { Eigen::setNbThreads(m_eigen_threads); }
+
+        m_pool = pool;
+
+        if (pool) { Eigen::setNbThreads(1); }
+
+        for (std::size_t n = 0; n < m_nodes.size(); ++n)
+        {
+            if (m_nodes[n].layer) { m_nodes[n].layer->set_thread_pool(pool); }
+        }
+    }
+
+    /// <summary>
+    /// Проверка графа и инициализация весов слоев в порядке добавления
+    /// </summary>
+    void init(const Scalar& mu = Scalar(0), const Scalar& sigma = Scalar(0.01), int seed = -1)
+    {
+        build();
+
+        if (seed > 0) { m_rng.seed(seed); }
+
+        for (std::size_t n = 0; n < m_nodes.size(); ++n)
+        {
+            if (m_nodes[n].layer) { m_nodes[n].layer->init(mu, sigma, m_rng); }
+        }
+    }
+
+    /// <summary>
+    /// Один шаг обучения на готовом батче
+    /// </summary>
+    template <typename TargetType>
+    void train_batch(Optimizer& opt, const Matrix& x_batch, const TargetType& y_batch)
+    {
+        forward(x_batch, true);
+        backprop(y_batch);
+        update(opt);
+    }
+
+    /// <summary>
+    /// Обучение графа
+    /// </summary>
+    /// <param name="opt"> - оптимизатор</param>
+    /// <param name="x"> - входные данные, строки всех входов подряд (признаки x наблюдения)</param>
+    /// <param name="y"> - таргет</param>
+    /// <param name="batch_size"> - размер батча</param>
+    /// <param name="epoch"> - кол-во эпох</param>
+    /// <param name="seed"> - сид для перемешивания</param>
+    /// <returns>True если обучение прошло</returns>
+    template <typename DerivedX, typename DerivedY>
+    bool fit(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+        const Eigen::MatrixBase<DerivedY>& y,
+        int batch_size, int epoch, int seed = -1)
+    {
+        typedef typename Eigen::MatrixBase<DerivedY>::PlainObject YType;
+
+        if (m_nodes.empty()) { return false; }
+
+        build();
+        opt.reset();
+
+        if (seed > 0) { m_rng.seed(seed); }
+
+        Eigen::VectorXi id;
+        const int nbatch = internal::shuffled_index(x, y, batch_size, m_rng, id,
+            internal::sequence_length(get_layers()));
+        const int nobs = x.cols();
+        Matrix x_batch;
+        YType y_batch;
+
+        for (int e = 0; e < epoch; ++e)
+        {
+            for (int i = 0; i < nbatch; ++i)
+            {
+                const int bsize = (i == nbatch - 1) ? nobs - i * batch_size : batch_size;
+
+                internal::gather_batch(x, y, id.data() + (std::ptrdiff_t)i * batch_size, bsize, x_batch, y_batch);
+                train_batch(opt, x_batch, y_batch);
+            }
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Прогноз графа
+    /// </summary>
+    /// <param name="x"> - входные данные, строки всех входов подряд (признаки x наблюдения)</param>
+    /// <returns>Значение выходного узла</returns>
+    Matrix predict(const Matrix& x)
+    {
+        if (m_nodes.empty()) { return Matrix(); }
+
+        forward(x, false);
+
+        return *m_nodes[m_out].out;
+    }
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+# include <Eigen/Core>
+# include "Config.h"
+
+/// <summary>
+/// Тождественная активация (линейный слой)
+/// </summary>
+class Identity
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		A = Z;
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		G = F;
+	}
+
+	static std::string return_type()
+	{
+		return "Identity";
+	}
+};
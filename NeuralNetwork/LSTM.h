@@ -0,0 +1,310 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+# include "Layer.h"
+# include "Random.h"
+# include "Recurrent.h"
+
+///
+/// LSTM слой.
+///
+/// Вход - последовательности в формате (признаки x время * батч), см. Recurrent.h,
+/// выход - скрытое состояние h на каждом шаге (out_size x время * батч).
+/// Начальные h и c нулевые для каждой последовательности.
+///
+/// Вклад входа во все гейты всех шагов считается одним GEMM до цикла по времени,
+/// на каждом шаге остается один GEMM скрытого состояния сразу на все 4 гейта.
+/// Гейты в строках идут в порядке i, f, g, o.
+///
+/// GEMM идут через реализацию из set_gemm() (см. Gemm.h), сигмоида и tanh гейтов -
+/// через ядра cpu_kernels().
+///
+
+
+class LSTM : public Layer
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+    typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
+    typedef Vector::AlignedMapType AlignedMapVec;
+    typedef std::map<std::string, int> Meta;
+    typedef Eigen::Block<const internal::ConstStepMap> GateBlock;
+
+    const int m_seq_len; // длина последовательности
+    GemmBackend m_gemm;  // реализация матричного умножения
+
+    Matrix m_wx;     // Веса входа (in_size x 4 * out_size)
+    Matrix m_wh;     // Веса скрытого состояния (out_size x 4 * out_size)
+    Vector m_b;      // Смещение гейтов
+    Matrix m_dwx;    // Производная весов входа
+    Matrix m_dwh;    // Производная весов скрытого состояния
+    Vector m_db;     // Производная смещения
+
+    Matrix m_gates;  // Значения гейтов после активации (4 * out_size x время * батч)
+    Matrix m_c;      // Состояние ячейки на каждом шаге
+    Matrix m_hprev;  // Скрытое состояние предыдущего шага (вход рекуррентного GEMM)
+    Matrix m_a;      // Выход слоя - скрытое состояние на каждом шаге
+    Matrix m_dgates; // Производные гейтов до активации
+    Matrix m_din;    // Производная входа
+
+    Matrix m_dh;     // Производная h, пришедшая с последующего шага (out_size x батч)
+    Matrix m_dc;     // Производная c, пришедшая с последующего шага
+    Matrix m_tc;     // tanh(c) текущего шага при backprop
+
+public:
+    /// <param name="in_size"> - кол-во признаков на шаге</param>
+    /// <param name="out_size"> - размер скрытого состояния</param>
+    /// <param name="seq_len"> - длина последовательности</param>
+    LSTM(const int in_size, const int out_size, const int seq_len) :
+        Layer(in_size, out_size), m_seq_len(seq_len), m_gemm(default_gemm_backend())
+    {
+        if (seq_len <= 0)
+        {
+            throw std::invalid_argument("[class LSTM]: Sequence length must be positive");
+        }
+    }
+
+    Layer* clone() const
+    {
+        return new LSTM(*this);
+    }
+
+    int sequence_length() const { return m_seq_len; }
+
+    void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+    {
+        init();
+
+        internal::set_normal_random(m_wx.data(), m_wx.size(), rng, mu, sigma);
+        internal::set_normal_random(m_wh.data(), m_wh.size(), rng, mu, sigma);
+        internal::set_normal_random(m_b.data(), m_b.size(), rng, mu, sigma);
+    }
+
+    void init()
+    {
+        const int ngate = 4 * this->m_out_size;
+
+        m_wx.resize(this->m_in_size, ngate);
+        m_wh.resize(this->m_out_size, ngate);
+        m_b.resize(ngate);
+        m_dwx.resize(this->m_in_size, ngate);
+        m_dwh.resize(this->m_out_size, ngate);
+        m_db.resize(ngate);
+    }
+
+    void forward(const Matrix& prev_layer_data)
+    {
+        const int H = this->m_out_size;
+        const int T = m_seq_len;
+        const int ncols = prev_layer_data.cols();
+
+        internal::check_sequences(prev_layer_data.rows(), ncols, this->m_in_size, T, "LSTM");
+
+        // Вклад входа во все гейты всех шагов одним GEMM
+        m_gates.resize(4 * H, ncols);
+        internal::gemm(m_gemm, true, false, Scalar(1), m_wx, prev_layer_data, m_gates);
+        internal::cpu_kernels().add_bias(m_gates.data(), m_gates.outerStride(), m_b.data(), m_gates.rows(), m_gates.cols());
+
+        m_c.resize(H, ncols);
+        m_a.resize(H, ncols);
+        m_hprev.resize(H, ncols);
+
+        for (int t = 0; t < T; ++t)
+        {
+            internal::StepMap gates = internal::step_cols(m_gates, t, T);
+            internal::StepMap c = internal::step_cols(m_c, t, T);
+            internal::StepMap h = internal::step_cols(m_a, t, T);
+
+            if (t > 0)
+            {
+                internal::gemm(m_gemm, true, false, Scalar(1), m_wh, internal::step_cols(m_hprev, t, T), gates, Scalar(1));
+            }
+
+            internal::sigmoid_inplace(gates.topRows(2 * H));
+            internal::tanh_inplace(gates.middleRows(2 * H, H));
+            internal::sigmoid_inplace(gates.bottomRows(H));
+
+            if (t > 0)
+            {
+                c.array() = gates.middleRows(H, H).array() * internal::step_cols(m_c, t - 1, T).array() +
+                    gates.topRows(H).array() * gates.middleRows(2 * H, H).array();
+            }
+            else
+            {
+                c.array() = gates.topRows(H).array() * gates.middleRows(2 * H, H).array();
+            }
+
+            h = c;
+            internal::tanh_inplace(h);
+            h.array() *= gates.bottomRows(H).array();
+
+            if (t + 1 < T)
+            {
+                internal::step_cols(m_hprev, t + 1, T) = h;
+            }
+            else
+            {
+                internal::step_cols(m_hprev, 0, T).setZero();
+            }
+        }
+    }
+
+    const Matrix& output() { return m_a; }
+
+    /// <summary>
+    /// Backprop во времени. Буферы шага (m_dh, m_dc, m_tc) выделяются один раз
+    /// на батч, производные гейтов всех шагов собираются в m_dgates, и градиенты
+    /// весов считаются после цикла тремя большими GEMM.
+    /// </summary>
+    void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
+    {
+        const int H = this->m_out_size;
+        const int T = m_seq_len;
+        const int ncols = prev_layer_data.cols();
+        const int nseq = ncols / T;
+
+        m_dgates.resize(4 * H, ncols);
+        m_dh.setZero(H, nseq);
+        m_dc.setZero(H, nseq);
+        m_tc.resize(H, nseq);
+
+        for (int t = T - 1; t >= 0; --t)
+        {
+            const internal::ConstStepMap gates = internal::step_cols(static_cast<const Matrix&>(m_gates), t, T);
+            internal::StepMap dgates = internal::step_cols(m_dgates, t, T);
+
+            const GateBlock i(gates, 0, 0, H, nseq);
+            const GateBlock f(gates, H, 0, H, nseq);
+            const GateBlock g(gates, 2 * H, 0, H, nseq);
+            const GateBlock o(gates, 3 * H, 0, H, nseq);
+
+            m_tc = internal::step_cols(static_cast<const Matrix&>(m_c), t, T);
+            internal::tanh_inplace(m_tc);
+
+            // dh = производная выхода шага + производная от следующего шага
+            m_dh += internal::step_cols(next_layer_data, t, T);
+
+            // dc = dh * o * (1 - tanh(c)^2) + производная от следующего шага
+            m_dc.array() += m_dh.array() * o.array() * (Scalar(1) - m_tc.array().square());
+
+            dgates.bottomRows(H).array() = m_dh.array() * m_tc.array() * o.array() * (Scalar(1) - o.array());
+            dgates.topRows(H).array() = m_dc.array() * g.array() * i.array() * (Scalar(1) - i.array());
+            dgates.middleRows(2 * H, H).array() = m_dc.array() * i.array() * (Scalar(1) - g.array().square());
+
+            if (t > 0)
+            {
+                dgates.middleRows(H, H).array() = m_dc.array() *
+                    internal::step_cols(static_cast<const Matrix&>(m_c), t - 1, T).array() *
+                    f.array() * (Scalar(1) - f.array());
+            }
+            else
+            {
+                dgates.middleRows(H, H).setZero();
+            }
+
+            m_dc.array() *= f.array();
+            internal::gemm(m_gemm, false, false, Scalar(1), m_wh, dgates, m_dh);
+        }
+
+        internal::gemm(m_gemm, false, true, Scalar(1) / ncols, prev_layer_data, m_dgates, m_dwx);
+        internal::gemm(m_gemm, false, true, Scalar(1) / ncols, m_hprev, m_dgates, m_dwh);
+        internal::cpu_kernels().row_mean(m_dgates.data(), m_dgates.outerStride(), m_dgates.rows(), m_dgates.cols(), m_db.data());
+
+        m_din.resize(this->m_in_size, ncols);
+        internal::gemm(m_gemm, false, false, Scalar(1), m_wx, m_dgates, m_din);
+    }
+
+    const Matrix& backprop_data() const { return m_din; }
+
+    /// <summary>
+    /// Реализация GEMM гейтов. Хранение весов у слоя одно, layout не используется.
+    /// </summary>
+    void set_gemm(GemmBackend backend, WeightLayout layout)
+    {
+        if (!internal::gemm_available(backend))
+        {
+            throw std::invalid_argument("[class LSTM]: GEMM backend is not available in this build (define NN_USE_BLAS)");
+        }
+
+        m_gemm = backend;
+    }
+
+    GemmBackend gemm_backend() const { return m_gemm; }
+
+    void release_buffers()
+    {
+        Matrix* buffers[] = { &m_gates, &m_c, &m_hprev, &m_a, &m_dgates, &m_din };
+
+        for (int i = 0; i < 6; ++i) { buffers[i]->resize(0, 0); }
+    }
+
+    void update(Optimizer& opt)
+    {
+        ConstAlignedMapVec dwx(m_dwx.data(), m_dwx.size());
+        ConstAlignedMapVec dwh(m_dwh.data(), m_dwh.size());
+        ConstAlignedMapVec db(m_db.data(), m_db.size());
+        AlignedMapVec      wx(m_wx.data(), m_wx.size());
+        AlignedMapVec      wh(m_wh.data(), m_wh.size());
+        AlignedMapVec      b(m_b.data(), m_b.size());
+
+        opt.update(dwx, wx);
+        opt.update(dwh, wh);
+        opt.update(db, b);
+    }
+
+    /// <summary>
+    /// None
+    /// </summary>
+    /// <returns>Веса входа, веса скрытого состояния и смещения одним вектором</returns>
+    std::vector<Scalar> get_parametrs() const
+    {
+        std::vector<Scalar> res(m_wx.size() + m_wh.size() + m_b.size());
+
+        std::copy(m_wx.data(), m_wx.data() + m_wx.size(), res.begin());
+        std::copy(m_wh.data(), m_wh.data() + m_wh.size(), res.begin() + m_wx.size());
+        std::copy(m_b.data(), m_b.data() + m_b.size(), res.begin() + m_wx.size() + m_wh.size());
+
+        return res;
+    }
+
+    void set_parametrs(const std::vector<Scalar>& param)
+    {
+        if (static_cast<int>(param.size()) != m_wx.size() + m_wh.size() + m_b.size())
+        {
+            throw std::invalid_argument("[class LSTM]: Parameter size does not match");
+        }
+
+        std::copy(param.begin(), param.begin() + m_wx.size(), m_wx.data());
+        std::copy(param.begin() + m_wx.size(), param.begin() + m_wx.size() + m_wh.size(), m_wh.data());
+        std::copy(param.begin() + m_wx.size() + m_wh.size(), param.end(), m_b.data());
+    }
+
+    std::vector<Scalar> get_derivatives() const
+    {
+        std::vector<Scalar> res(m_dwx.size() + m_dwh.size() + m_db.size());
+
+        std::copy(m_dwx.data(), m_dwx.data() + m_dwx.size(), res.begin());
+        std::copy(m_dwh.data(), m_dwh.data() + m_dwh.size(), res.begin() + m_dwx.size());
+        std::copy(m_db.data(), m_db.data() + m_db.size(), res.begin() + m_dwx.size() + m_dwh.size());
+
+        return res;
+    }
+
+    void derivative_buffers(std::vector< std::pair<Scalar*, int> >& buffers)
+    {
+        buffers.push_back(std::make_pair(m_dwx.data(), int(m_dwx.size())));
+        buffers.push_back(std::make_pair(m_dwh.data(), int(m_dwh.size())));
+        buffers.push_back(std::make_pair(m_db.data(), int(m_db.size())));
+    }
+
+    std::string layer_type() const { return "LSTM"; }
+
+    std::string activation_type() const { return "Tanh"; }
+
+    void fill_meta_info(Meta& map, int index) const {}
+};
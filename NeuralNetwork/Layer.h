@@ -3,9 +3,14 @@
 # include <Eigen/Core>
 # include <vector>
 # include <map>
+# include <string>
+# include <utility>
+# include <stdexcept>
 # include "RNG.h"
 # include "Config.h"
 # include "Optimizer.h"
+# include "Gemm.h"
+# include "ThreadPool.h"
 
 
 class Layer
@@ -13,6 +18,9 @@ class Layer
 protected:
 	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
 	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMatrix;
+	typedef Eigen::Ref<const Matrix, 0, Eigen::OuterStride<> > ConstRefMatrix;
+	typedef Eigen::Ref<const RowMajorMatrix, 0, Eigen::OuterStride<> > ConstRowRefMatrix;
 	typedef std::map<std::string, int> Meta;
 
 	const int m_in_size;
@@ -24,6 +32,34 @@ public:
 
 	virtual ~Layer() {}
 
+	/// <summary>
+	/// Полная копия слоя (веса и буферы). Нужна для работы со снимком весов
+	/// в другом потоке, например при асинхронной валидации.
+	/// </summary>
+	/// <returns>Указатель на новый слой, удалять должен вызывающий</returns>
+	virtual Layer* clone() const
+	{
+		throw std::logic_error("[class Layer]: This layer type cannot be cloned");
+	}
+
+	/// <summary>
+	/// Рабочая копия слоя для асинхронного обучения (Hogwild): свои буферы
+	/// активаций и градиентов, но веса общие с этим слоем. Layer::update()
+	/// рабочей копии пишет прямо в веса этого слоя без блокировок.
+	/// </summary>
+	/// <returns>Указатель на новый слой, удалять должен вызывающий.
+	/// Слой-владелец весов должен жить дольше копии</returns>
+	virtual Layer* clone_shared()
+	{
+		throw std::logic_error("[class Layer]: This layer type cannot share parameters");
+	}
+
+	/// <summary>
+	/// Длина последовательности для рекуррентных слоев (см. Recurrent.h).
+	/// Наблюдения тогда перемешиваются и режутся на батчи группами по столько столбцов.
+	/// </summary>
+	/// <returns>1 для слоев, которые обрабатывают столбцы независимо</returns>
+	virtual int sequence_length() const { return 1; }
 
 	/// <summary>
 	/// None
@@ -69,6 +105,20 @@ public:
 	/// <param name="prev_layer_data"> - предыдущий слой, значения его нейронов</param>
 	virtual void forward(const Matrix& prev_layer_data) = 0;
 
+	/// <summary>
+	/// Проход вперед по чужому буферу без копии: Eigen::Map, блок столбцов или
+	/// транспонированная row-major матрица с наблюдениями в строках.
+	/// По умолчанию вход копируется в Matrix и вызывается Layer::forward().
+	/// </summary>
+	/// <param name="prev_layer_data"> - column-major вид (признаки x наблюдения)</param>
+	virtual void forward_ref(const ConstRefMatrix& prev_layer_data) { forward(Matrix(prev_layer_data)); }
+
+	/// <summary>
+	/// То же для row-major вида (признаки x наблюдения). Так выглядит
+	/// транспонированный column-major буфер с наблюдениями в строках.
+	/// </summary>
+	virtual void forward_rows(const ConstRowRefMatrix& prev_layer_data) { forward(Matrix(prev_layer_data)); }
+
 	/// <summary>
 	/// None
 	/// </summary>
@@ -93,18 +143,100 @@ public:
 	/// </returns>
 	virtual const Matrix& backprop_data() const = 0;
 
+	/// <summary>
+	/// Освободить буферы батча: Layer::output(), то, что хранится для backprop,
+	/// и Layer::backprop_data(). Следующий Layer::forward() выделит их заново.
+	/// Нужно для пересчета активаций (NeuralNetwork::set_recompute()).
+	/// </summary>
+	virtual void release_buffers() {}
+
 	/// <summary>
 	/// Обновление параметров сетки после обратного распространения
 	/// </summary>
 	/// <param name="opt"> - алгоритм оптимизации градиента</param>
 	virtual void update(Optimizer& opt) = 0;
 
+	/// <summary>
+	/// Пост-тренировочная квантизация весов слоя в int8.
+	/// Калибровка входа производится на переданном батче.
+	/// </summary>
+	/// <param name="prev_layer_data"> - входные данные слоя (в Scalar) для калибровки</param>
+	/// <returns>true, если слой поддерживает квантизацию</returns>
+	virtual bool quantize(const Matrix& prev_layer_data) { return false; }
+
+	/// <summary>
+	/// Переключение между int8 и Scalar вычислениями в Layer::forward().
+	/// Включить можно только после Layer::quantize()
+	/// </summary>
+	virtual void set_quantized(bool enable) {}
+
+	virtual bool is_quantized() const { return false; }
+
+	/// <summary>
+	/// Добавить модули весов слоя в общий вектор.
+	/// Нужно для поиска порога при глобальном прунинге.
+	/// </summary>
+	virtual void weight_magnitudes(std::vector<Scalar>& magnitudes) const {}
+
+	/// <summary>
+	/// Обнулить веса, модуль которых меньше порога. Маска обнуленных весов
+	/// сохраняется и применяется после каждого Layer::update(), поэтому
+	/// дообучение не восстанавливает удаленные связи.
+	/// </summary>
+	/// <param name="threshold"> - порог модуля весов</param>
+	/// <returns>Кол-во обнуленных весов</returns>
+	virtual int prune(const Scalar& threshold) { return 0; }
+
+	/// <summary>
+	/// Снять маску прунинга, обнуленные веса снова будут обучаться
+	/// </summary>
+	virtual void reset_pruning() {}
+
+	/// <summary>
+	/// None
+	/// </summary>
+	/// <returns>Доля ненулевых весов слоя</returns>
+	virtual Scalar density() const { return Scalar(1); }
+
+	/// <summary>
+	/// Выбор реализации матричного умножения и хранения весов (см. Gemm.h).
+	/// Менять хранение нужно до обучения: состояние оптимайзера идет в порядке хранения.
+	/// </summary>
+	virtual void set_gemm(GemmBackend backend, WeightLayout layout) {}
+
+	/// <summary>
+	/// Замерить forward + backprop на батче для всех доступных сочетаний
+	/// GemmBackend / WeightLayout и оставить самое быстрое
+	/// </summary>
+	/// <param name="prev_layer_data"> - входные данные слоя с рабочим размером батча</param>
+	/// <param name="repeat"> - кол-во замеров каждого сочетания, берется лучший</param>
+	virtual void tune_gemm(const Matrix& prev_layer_data, int repeat) {}
+
+	/// <summary>
+	/// Пул потоков для forward / backprop, NULL - в вызывающем потоке
+	/// </summary>
+	virtual void set_thread_pool(ThreadPool* pool) {}
+
+	/// <summary>
+	/// Активация слоя на месте над внешним Z, например над Z нескольких
+	/// моделей сразу (см. Ensemble)
+	/// </summary>
+	/// <returns>false, если у слоя нет поэлементной активации</returns>
+	virtual bool activate(Eigen::Ref<Matrix> z) const { return false; }
+
 	virtual std::vector<Scalar> get_parametrs() const = 0;
 
 	virtual void set_parametrs(const std::vector<Scalar>& param) {};
 
 	virtual std::vector<Scalar> get_derivatives() const = 0;
 
+	/// <summary>
+	/// Добавить буферы производных слоя (указатель, длина) в общий список.
+	/// Через них градиенты нескольких копий слоя складываются в один
+	/// перед Layer::update() без лишних копирований.
+	/// </summary>
+	virtual void derivative_buffers(std::vector< std::pair<Scalar*, int> >& buffers) {}
+
 	virtual std::string layer_type() const = 0;
 
 	virtual std::string activation_type() const = 0;
@@ -120,3 +252,32 @@ public:
 	virtual void fill_meta_info(Meta& map, int index) const = 0;
 
 };
+
+
+namespace internal
+{
+	/// <summary>
+	/// Длина последовательности цепочки слоев: сколько соседних столбцов
+	/// нельзя разделять при перемешивании и нарезке на батчи
+	/// </summary>
+	inline int sequence_length(const std::vector<Layer*>& layers)
+	{
+		int res = 1;
+
+		for (std::size_t i = 0; i < layers.size(); ++i)
+		{
+			const int len = layers[i]->sequence_length();
+
+			if (len <= 1) { continue; }
+
+			if ((res > 1) && (res != len))
+			{
+				throw std::invalid_argument("[class Layer]: Layers have different sequence lengths");
+			}
+
+			res = len;
+		}
+
+		return res;
+	}
+}
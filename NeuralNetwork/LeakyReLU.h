@@ -0,0 +1,40 @@
+#pragma once
+
+# include <Eigen/Core>
+# include "Config.h"
+# include "CpuDispatch.h"
+
+/// <summary>
+/// LeakyReLU с наклоном 0.01 на отрицательной части.
+/// Считается точно и так же быстро, как ReLU, поэтому Fast версии нет.
+/// </summary>
+class LeakyReLU
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
+
+	static Scalar slope() { return Scalar(0.01); }
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		internal::cpu_kernels().relu(Z.data(), Z.outerStride(), A.data(), A.outerStride(), Z.rows(), Z.cols(), slope());
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		internal::cpu_kernels().relu_jacobian(A.data(), A.outerStride(), F.data(), F.outerStride(),
+			G.data(), G.outerStride(), G.rows(), G.cols(), slope());
+	}
+
+	static std::string return_type()
+	{
+		return "LeakyReLU";
+	}
+};
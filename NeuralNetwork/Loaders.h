@@ -0,0 +1,945 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <Eigen/SparseCore>
+# include <vector>
+# include <string>
+# include <thread>
+# include <exception>
+# include <algorithm>
+# include <stdexcept>
+# include <cstring>
+# include <cstdlib>
+# include <cstdint>
+# include <cctype>
+# include <limits>
+# include "Config.h"
+
+# ifdef _WIN32
+# ifndef NOMINMAX
+# define NOMINMAX
+# endif
+# include <windows.h>
+# else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+# endif
+
+///
+/// Загрузка выборок в формат NeuralNetwork::fit(): признаки x наблюдения, по столбцам.
+///
+/// Файлы не читаются в память целиком, а отображаются (mmap). CSV и LIBSVM
+/// разбираются параллельно: диапазон байт делится на куски по границам строк,
+/// потоки сначала считают строки в своих кусках, а затем пишут каждую строку
+/// сразу в свой столбец результата. Числа разбираются без strtod, кроме редких
+/// случаев (больше 19 значащих цифр, большие порядки, nan / inf).
+///
+/// Для обучения на данных больше памяти CsvReader и LibsvmReader отдают файл
+/// кусками по max_rows строк (next()), а NpyArray дает Eigen::Map прямо на
+/// отображенный файл, который можно передавать в fit() и predict() без копии.
+///
+
+
+/// <summary>
+/// Настройки разбора CSV
+/// </summary>
+struct CsvOptions
+{
+    char delimiter;                   // разделитель полей
+    bool header;                      // пропустить первую строку
+    std::vector<int> target_columns;  // столбцы таргета, отрицательные - с конца (-1 - последний)
+    int nthread;                      // кол-во потоков, 0 - по числу ядер
+
+    CsvOptions() :
+        delimiter(','), header(false), target_columns(1, -1), nthread(0) {}
+};
+
+
+namespace internal
+{
+    /// <summary>
+    /// Файл, отображенный в память только для чтения
+    /// </summary>
+    class MappedFile
+    {
+    private:
+        const char* m_data;
+        std::size_t m_size;
+# ifdef _WIN32
+        HANDLE m_file;
+        HANDLE m_mapping;
+# else
+        int m_fd;
+# endif
+
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+
+    public:
+        explicit MappedFile(const std::string& path) :
+            m_data(NULL), m_size(0)
+        {
+# ifdef _WIN32
+            m_mapping = NULL;
+            m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+            if (m_file == INVALID_HANDLE_VALUE)
+            {
+                throw std::runtime_error("[class MappedFile]: Cannot open file " + path);
+            }
+
+            LARGE_INTEGER size;
+            GetFileSizeEx(m_file, &size);
+            m_size = std::size_t(size.QuadPart);
+
+            if (m_size > 0)
+            {
+                m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+                m_data = m_mapping ? static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : NULL;
+
+                if (m_data == NULL)
+                {
+                    if (m_mapping) { CloseHandle(m_mapping); }
+                    CloseHandle(m_file);
+                    throw std::runtime_error("[class MappedFile]: Cannot map file " + path);
+                }
+            }
+# else
+            m_fd = open(path.c_str(), O_RDONLY);
+
+            if (m_fd < 0)
+            {
+                throw std::runtime_error("[class MappedFile]: Cannot open file " + path);
+            }
+
+            struct stat st;
+            fstat(m_fd, &st);
+            m_size = std::size_t(st.st_size);
+
+            if (m_size > 0)
+            {
+                void* p = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+
+                if (p == MAP_FAILED)
+                {
+                    close(m_fd);
+                    throw std::runtime_error("[class MappedFile]: Cannot map file " + path);
+                }
+
+                // файл читается последовательно, ядро может читать с опережением
+                madvise(p, m_size, MADV_SEQUENTIAL);
+                m_data = static_cast<const char*>(p);
+            }
+# endif
+        }
+
+        ~MappedFile()
+        {
+# ifdef _WIN32
+            if (m_data) { UnmapViewOfFile(m_data); }
+            if (m_mapping) { CloseHandle(m_mapping); }
+            CloseHandle(m_file);
+# else
+            if (m_data) { munmap(const_cast<char*>(m_data), m_size); }
+            close(m_fd);
+# endif
+        }
+
+        const char* data() const { return m_data; }
+        const char* end() const { return m_data + m_size; }
+        std::size_t size() const { return m_size; }
+    };
+
+    inline int loader_threads(const int nthread)
+    {
+        if (nthread > 0) { return nthread; }
+
+        return std::max(1, int(std::thread::hardware_concurrency()));
+    }
+
+    inline bool is_blank(const char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    /// <summary>
+    /// Разбор числа с позиции p. Быстрый путь точен (алгоритм Клингера):
+    /// мантисса до 2^53 и порядок до 10^22, остальное уходит в strtod.
+    /// </summary>
+    /// <returns>Позиция после числа, p - если числа нет</returns>
+    inline const char* parse_scalar(const char* p, const char* end, Scalar& out)
+    {
+        static const double pow10[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+        const char* start = p;
+        bool neg = false;
+
+        if (p < end && (*p == '-' || *p == '+')) { neg = (*p == '-'); ++p; }
+
+        uint64_t mant = 0;
+        int ndigit = 0;
+        int exp10 = 0;
+        bool any = false;
+
+        for (; p < end && unsigned(*p - '0') < 10; ++p)
+        {
+            if (ndigit < 19) { mant = mant * 10 + unsigned(*p - '0'); ndigit += (mant != 0); }
+            else { exp10++; }
+
+            any = true;
+        }
+
+        if (p < end && *p == '.')
+        {
+            for (++p; p < end && unsigned(*p - '0') < 10; ++p)
+            {
+                if (ndigit < 19) { mant = mant * 10 + unsigned(*p - '0'); ndigit += (mant != 0); exp10--; }
+
+                any = true;
+            }
+        }
+
+        if (any && p < end && (*p == 'e' || *p == 'E'))
+        {
+            const char* q = p + 1;
+            bool eneg = false;
+
+            if (q < end && (*q == '-' || *q == '+')) { eneg = (*q == '-'); ++q; }
+
+            if (q < end && unsigned(*q - '0') < 10)
+            {
+                int e = 0;
+
+                for (; q < end && unsigned(*q - '0') < 10; ++q)
+                {
+                    if (e < 100000) { e = e * 10 + (*q - '0'); }
+                }
+
+                exp10 += eneg ? -e : e;
+                p = q;
+            }
+        }
+
+        if (any && mant < (uint64_t(1) << 53) && exp10 >= -22 && exp10 <= 22)
+        {
+            double v = double(mant);
+            v = (exp10 < 0) ? v / pow10[-exp10] : v * pow10[exp10];
+            out = Scalar(neg ? -v : v);
+            return p;
+        }
+
+        // Медленный путь: strtod по копии токена (файл не заканчивается нулем)
+        const char* tok_end = start;
+
+        while (tok_end < end && (std::isalnum((unsigned char)*tok_end) ||
+            *tok_end == '.' || *tok_end == '-' || *tok_end == '+')) { ++tok_end; }
+
+        if (tok_end == start) { return start; }
+
+        char buf[64];
+        const std::size_t len = std::min<std::size_t>(tok_end - start, sizeof(buf) - 1);
+        std::memcpy(buf, start, len);
+        buf[len] = 0;
+
+        char* parsed = NULL;
+        const double v = std::strtod(buf, &parsed);
+
+        if (parsed == buf) { return start; }
+
+        out = Scalar(v);
+        return start + (parsed - buf);
+    }
+
+    /// <summary>
+    /// Вызов f(begin, end) для каждой непустой строки диапазона (без '\n' и '\r')
+    /// </summary>
+    /// <returns>Кол-во непустых строк</returns>
+    template <typename Func>
+    inline long long for_each_line(const char* b, const char* e, Func f)
+    {
+        long long n = 0;
+
+        while (b < e)
+        {
+            const char* nl = static_cast<const char*>(std::memchr(b, '\n', e - b));
+            const char* le = nl ? nl : e;
+            const char* te = le;
+
+            while (te > b && is_blank(te[-1])) { --te; }
+
+            const char* s = b;
+
+            while (s < te && is_blank(*s)) { ++s; }
+
+            if (s < te)
+            {
+                f(s, te);
+                n++;
+            }
+
+            b = nl ? nl + 1 : e;
+        }
+
+        return n;
+    }
+
+    /// <summary>
+    /// Позиция после max_rows непустых строк, начиная с b
+    /// </summary>
+    inline const char* skip_lines(const char* b, const char* e, const long long max_rows)
+    {
+        long long n = 0;
+
+        while (b < e && n < max_rows)
+        {
+            const char* nl = static_cast<const char*>(std::memchr(b, '\n', e - b));
+            const char* le = nl ? nl : e;
+
+            for (const char* s = b; s < le; ++s)
+            {
+                if (!is_blank(*s)) { n++; break; }
+            }
+
+            b = nl ? nl + 1 : e;
+        }
+
+        return b;
+    }
+
+    struct NoopLine
+    {
+        void operator()(const char*, const char*) const {}
+    };
+
+    /// <summary>
+    /// Параллельный разбор строк [b, e): диапазон режется на nthread кусков по
+    /// границам строк, в первом проходе каждый поток считает свои строки, во
+    /// втором вызывает parse(begin, end, номер строки) с глобальным номером.
+    /// </summary>
+    /// <param name="prepare"> - вызывается с общим числом строк между проходами</param>
+    /// <param name="parse"> - разбор одной строки (начало, конец, номер, номер потока)</param>
+    template <typename Prepare, typename Parse>
+    inline long long parallel_lines(const char* b, const char* e, int nthread, Prepare prepare, Parse parse)
+    {
+        const long long nbytes = e - b;
+        nthread = int(std::max<long long>(1, std::min<long long>(nthread, nbytes / (1 << 16))));
+
+        std::vector<const char*> bounds(nthread + 1, e);
+        bounds[0] = b;
+
+        for (int t = 1; t < nthread; ++t)
+        {
+            const char* p = std::max(bounds[t - 1], b + nbytes * t / nthread);
+            const char* nl = (p < e) ? static_cast<const char*>(std::memchr(p, '\n', e - p)) : NULL;
+            bounds[t] = nl ? nl + 1 : e;
+        }
+
+        std::vector<long long> offset(nthread + 1, 0);
+        std::vector<std::exception_ptr> errors(nthread);
+        std::vector<std::thread> threads;
+
+        for (int t = 0; t < nthread; ++t)
+        {
+            threads.push_back(std::thread([&, t]() {
+                offset[t + 1] = for_each_line(bounds[t], bounds[t + 1], NoopLine());
+            }));
+        }
+
+        for (int t = 0; t < nthread; ++t) { threads[t].join(); }
+
+        for (int t = 0; t < nthread; ++t) { offset[t + 1] += offset[t]; }
+
+        prepare(offset[nthread]);
+        threads.clear();
+
+        for (int t = 0; t < nthread; ++t)
+        {
+            threads.push_back(std::thread([&, t]() {
+                long long row = offset[t];
+
+                try
+                {
+                    for_each_line(bounds[t], bounds[t + 1], [&](const char* lb, const char* le) {
+                        parse(lb, le, row++, t);
+                    });
+                }
+                catch (...) { errors[t] = std::current_exception(); }
+            }));
+        }
+
+        for (int t = 0; t < nthread; ++t) { threads[t].join(); }
+
+        for (int t = 0; t < nthread; ++t)
+        {
+            if (errors[t]) { std::rethrow_exception(errors[t]); }
+        }
+
+        return offset[nthread];
+    }
+
+    /// <summary>
+    /// Разбор пары "индекс:значение" формата LIBSVM
+    /// </summary>
+    /// <returns>false, если токен не пара с числовым индексом (например qid:)</returns>
+    inline bool parse_libsvm_pair(const char*& p, const char* e, long long& index, Scalar& value)
+    {
+        const char* q = p;
+        long long idx = 0;
+
+        for (; q < e && unsigned(*q - '0') < 10; ++q) { idx = idx * 10 + (*q - '0'); }
+
+        const bool numeric = (q > p) && (q < e) && (*q == ':');
+
+        if (numeric)
+        {
+            const char* v = parse_scalar(q + 1, e, value);
+
+            if (v == q + 1)
+            {
+                throw std::runtime_error("[LIBSVM]: Cannot parse feature value");
+            }
+
+            index = idx;
+            p = v;
+            return true;
+        }
+
+        // неизвестный токен пропускаем целиком
+        while (p < e && !is_blank(*p)) { ++p; }
+
+        return false;
+    }
+}
+
+
+/// <summary>
+/// Потоковое чтение CSV (наблюдение в строке) кусками в формат
+/// признаки x наблюдения. Кавычки в полях не поддерживаются, пустое поле - NaN.
+/// </summary>
+class CsvReader
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+    internal::MappedFile m_file;
+    CsvOptions m_opts;
+    const char* m_begin;     // первая строка данных
+    const char* m_pos;       // следующая непрочитанная строка
+    int m_ncol;              // кол-во полей в строке
+    int m_nx;                // кол-во признаков
+    int m_ny;                // кол-во таргетов
+    std::vector<int> m_dest; // поле -> строка x (>= 0) или строка y (-1 - нулевая)
+
+    void parse_line(const char* b, const char* e, const long long row, Matrix& x, Matrix& y) const
+    {
+        const char delim = m_opts.delimiter;
+        const int col = int(row);
+        const char* p = b;
+
+        for (int k = 0; k < m_ncol; ++k)
+        {
+            while (p < e && *p == ' ') { ++p; }
+
+            Scalar v = std::numeric_limits<Scalar>::quiet_NaN();
+            const char* q = internal::parse_scalar(p, e, v);
+
+            if (q == p && p < e && *p != delim)
+            {
+                throw std::runtime_error("[class CsvReader]: Cannot parse value in field " + std::to_string(k + 1));
+            }
+
+            p = q;
+
+            while (p < e && *p == ' ') { ++p; }
+
+            const int d = m_dest[k];
+
+            if (d >= 0) { x(d, col) = v; }
+            else { y(-d - 1, col) = v; }
+
+            if (k + 1 < m_ncol)
+            {
+                if (p >= e || *p != delim)
+                {
+                    throw std::runtime_error("[class CsvReader]: Row has too few fields");
+                }
+
+                ++p;
+            }
+        }
+
+        if (p != e)
+        {
+            throw std::runtime_error("[class CsvReader]: Row has too many fields");
+        }
+    }
+
+public:
+    /// <param name="path"> - путь к файлу</param>
+    /// <param name="opts"> - разделитель, заголовок, столбцы таргета, потоки</param>
+    explicit CsvReader(const std::string& path, const CsvOptions& opts = CsvOptions()) :
+        m_file(path), m_opts(opts), m_ncol(0), m_nx(0), m_ny(0)
+    {
+        m_begin = m_file.data();
+
+        if (m_opts.header)
+        {
+            m_begin = internal::skip_lines(m_begin, m_file.end(), 1);
+        }
+
+        m_pos = m_begin;
+
+        // Кол-во полей по первой строке данных
+        const char* first = internal::skip_lines(m_begin, m_file.end(), 1);
+        internal::for_each_line(m_begin, first, [this](const char* b, const char* e) {
+            m_ncol = 1 + int(std::count(b, e, m_opts.delimiter));
+        });
+
+        m_dest.assign(m_ncol, 0);
+
+        for (std::size_t i = 0; i < m_opts.target_columns.size(); ++i)
+        {
+            int c = m_opts.target_columns[i];
+            c = (c < 0) ? m_ncol + c : c;
+
+            if (c < 0 || c >= m_ncol)
+            {
+                throw std::invalid_argument("[class CsvReader]: Target column is out of range");
+            }
+
+            m_dest[c] = -(++m_ny);
+        }
+
+        for (int c = 0; c < m_ncol; ++c)
+        {
+            if (m_dest[c] == 0) { m_dest[c] = m_nx++; }
+        }
+
+        if (m_nx + m_ny != m_ncol)
+        {
+            throw std::invalid_argument("[class CsvReader]: Target columns must be distinct");
+        }
+    }
+
+    int x_rows() const { return m_nx; }
+
+    int y_rows() const { return m_ny; }
+
+    /// <summary>
+    /// Следующие max_rows наблюдений
+    /// </summary>
+    /// <param name="x"> - признаки (x_rows() x кол-во наблюдений)</param>
+    /// <param name="y"> - таргет (y_rows() x кол-во наблюдений)</param>
+    /// <returns>Кол-во прочитанных наблюдений, 0 - файл закончился</returns>
+    int next(Matrix& x, Matrix& y, const long long max_rows = -1)
+    {
+        const char* end = (max_rows < 0) ? m_file.end() :
+            internal::skip_lines(m_pos, m_file.end(), max_rows);
+
+        const long long n = internal::parallel_lines(m_pos, end, internal::loader_threads(m_opts.nthread),
+            [&](long long nrows) {
+                x.resize(m_nx, nrows);
+                y.resize(m_ny, nrows);
+            },
+            [&](const char* b, const char* e, long long row, int) {
+                parse_line(b, e, row, x, y);
+            });
+
+        m_pos = end;
+
+        return int(n);
+    }
+
+    /// <summary>
+    /// Вернуться к началу данных (следующая эпоха)
+    /// </summary>
+    void rewind() { m_pos = m_begin; }
+};
+
+
+/// <summary>
+/// Загрузка CSV целиком
+/// </summary>
+/// <param name="x"> - признаки x наблюдения</param>
+/// <param name="y"> - таргет x наблюдения</param>
+inline void load_csv(const std::string& path,
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& x,
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& y,
+    const CsvOptions& opts = CsvOptions())
+{
+    CsvReader reader(path, opts);
+    reader.next(x, y);
+}
+
+
+/// <summary>
+/// Потоковое чтение LIBSVM ("метка индекс:значение ...", индексы с 1)
+/// кусками в формат признаки x наблюдения
+/// </summary>
+class LibsvmReader
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::SparseMatrix<Scalar> SparseMatrix;
+    typedef Eigen::Triplet<Scalar> Triplet;
+
+    internal::MappedFile m_file;
+    const char* m_pos;
+    int m_nfeature;
+    int m_nthread;
+
+    /// <summary>
+    /// Разбор строки: метка в y(0, row), пары в f(индекс с 0, значение)
+    /// </summary>
+    template <typename Func>
+    static void parse_line(const char* b, const char* e, const long long row, Matrix& y, Func f)
+    {
+        Scalar label(0);
+        const char* p = internal::parse_scalar(b, e, label);
+
+        if (p == b)
+        {
+            throw std::runtime_error("[class LibsvmReader]: Cannot parse label");
+        }
+
+        y(0, row) = label;
+
+        long long index = 0;
+        Scalar value(0);
+
+        while (p < e)
+        {
+            while (p < e && internal::is_blank(*p)) { ++p; }
+
+            if (p < e && internal::parse_libsvm_pair(p, e, index, value))
+            {
+                if (index < 1)
+                {
+                    throw std::runtime_error("[class LibsvmReader]: Feature indices start from 1");
+                }
+
+                f(index - 1, value);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Максимальный индекс признака в [b, e)
+    /// </summary>
+    int scan_features(const char* b, const char* e) const
+    {
+        std::vector<long long> maxidx(m_nthread, 0);
+        std::vector<Matrix> labels(m_nthread, Matrix(1, 1));
+
+        internal::parallel_lines(b, e, m_nthread, [](long long) {},
+            [&](const char* lb, const char* le, long long, int t) {
+                parse_line(lb, le, 0, labels[t], [&](long long idx, Scalar) {
+                    maxidx[t] = std::max(maxidx[t], idx + 1);
+                });
+            });
+
+        return int(*std::max_element(maxidx.begin(), maxidx.end()));
+    }
+
+public:
+    /// <param name="path"> - путь к файлу</param>
+    /// <param name="nfeature"> - кол-во признаков, 0 - максимальный индекс в файле</param>
+    /// <param name="nthread"> - кол-во потоков, 0 - по числу ядер</param>
+    explicit LibsvmReader(const std::string& path, const int nfeature = 0, const int nthread = 0) :
+        m_file(path), m_pos(m_file.data()), m_nfeature(nfeature),
+        m_nthread(internal::loader_threads(nthread))
+    {
+        if (m_nfeature <= 0)
+        {
+            m_nfeature = scan_features(m_file.data(), m_file.end());
+        }
+    }
+
+    int x_rows() const { return m_nfeature; }
+
+    /// <summary>
+    /// Следующие max_rows наблюдений в разреженном виде
+    /// </summary>
+    /// <returns>Кол-во прочитанных наблюдений, 0 - файл закончился</returns>
+    int next(SparseMatrix& x, Matrix& y, const long long max_rows = -1)
+    {
+        const char* end = (max_rows < 0) ? m_file.end() :
+            internal::skip_lines(m_pos, m_file.end(), max_rows);
+
+        // У каждого потока свой вектор троек, порядок не важен для setFromTriplets
+        std::vector< std::vector<Triplet> > parts(m_nthread);
+        const int nfeature = m_nfeature;
+
+        const long long nrows = internal::parallel_lines(m_pos, end, m_nthread,
+            [&](long long n) { y.resize(1, n); },
+            [&](const char* b, const char* e, long long row, int t) {
+                parse_line(b, e, row, y, [&](long long idx, Scalar v) {
+                    if (idx >= nfeature)
+                    {
+                        throw std::runtime_error("[class LibsvmReader]: Feature index exceeds nfeature");
+                    }
+
+                    parts[t].push_back(Triplet(int(idx), int(row), v));
+                });
+            });
+
+        std::vector<Triplet> all;
+        std::size_t total = 0;
+
+        for (int t = 0; t < m_nthread; ++t) { total += parts[t].size(); }
+
+        all.reserve(total);
+
+        for (int t = 0; t < m_nthread; ++t)
+        {
+            all.insert(all.end(), parts[t].begin(), parts[t].end());
+        }
+
+        x.resize(nfeature, nrows);
+        x.setFromTriplets(all.begin(), all.end());
+
+        m_pos = end;
+
+        return int(nrows);
+    }
+
+    /// <summary>
+    /// Следующие max_rows наблюдений в плотном виде
+    /// </summary>
+    int next(Matrix& x, Matrix& y, const long long max_rows = -1)
+    {
+        const char* end = (max_rows < 0) ? m_file.end() :
+            internal::skip_lines(m_pos, m_file.end(), max_rows);
+
+        const int nfeature = m_nfeature;
+
+        const long long nrows = internal::parallel_lines(m_pos, end, m_nthread,
+            [&](long long n) {
+                x.setZero(nfeature, n);
+                y.resize(1, n);
+            },
+            [&](const char* b, const char* e, long long row, int) {
+                parse_line(b, e, row, y, [&](long long idx, Scalar v) {
+                    if (idx >= nfeature)
+                    {
+                        throw std::runtime_error("[class LibsvmReader]: Feature index exceeds nfeature");
+                    }
+
+                    x(int(idx), int(row)) = v;
+                });
+            });
+
+        m_pos = end;
+
+        return int(nrows);
+    }
+
+    void rewind() { m_pos = m_file.data(); }
+};
+
+
+/// <summary>
+/// Загрузка LIBSVM целиком в разреженную матрицу (признаки x наблюдения)
+/// </summary>
+inline void load_libsvm(const std::string& path, Eigen::SparseMatrix<Scalar>& x,
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& y, const int nfeature = 0, const int nthread = 0)
+{
+    LibsvmReader reader(path, nfeature, nthread);
+    reader.next(x, y);
+}
+
+/// <summary>
+/// Загрузка LIBSVM целиком в плотную матрицу (признаки x наблюдения)
+/// </summary>
+inline void load_libsvm(const std::string& path, Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& x,
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& y, const int nfeature = 0, const int nthread = 0)
+{
+    LibsvmReader reader(path, nfeature, nthread);
+    reader.next(x, y);
+}
+
+
+/// <summary>
+/// Массив .npy (версии 1-3), отображенный в память.
+///
+/// Обычный файл numpy (C-порядок, форма (наблюдения, признаки)) в памяти совпадает
+/// с column-major матрицей признаки x наблюдения, поэтому features() отдает ее
+/// без копии. Map живет, пока жив NpyArray.
+/// </summary>
+class NpyArray
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+    internal::MappedFile m_file;
+    std::string m_descr;          // тип элементов numpy, например <f8
+    bool m_fortran_order;
+    std::vector<long long> m_shape;
+    const char* m_payload;        // начало данных
+
+    static std::string dict_value(const std::string& header, const std::string& key)
+    {
+        const std::size_t k = header.find("'" + key + "'");
+
+        if (k == std::string::npos)
+        {
+            throw std::runtime_error("[class NpyArray]: Header has no key " + key);
+        }
+
+        std::size_t v = header.find(':', k) + 1;
+
+        while (v < header.size() && header[v] == ' ') { ++v; }
+
+        const char open = header[v];
+        const char close = (open == '(') ? ')' : ((open == '\'') ? '\'' : ',');
+        const std::size_t e = header.find(close, v + 1);
+
+        return header.substr(v, (close == ',') ? e - v : e - v + 1);
+    }
+
+    long long nrows() const { return m_shape.empty() ? 1 : m_shape[0]; }
+
+    long long ncols() const
+    {
+        long long n = 1;
+
+        for (std::size_t i = 1; i < m_shape.size(); ++i) { n *= m_shape[i]; }
+
+        return n;
+    }
+
+    /// <summary>
+    /// Элемент i плоского массива любого поддерживаемого типа
+    /// </summary>
+    Scalar element(const long long i) const
+    {
+        const char kind = m_descr[1];
+        const int bytes = std::atoi(m_descr.c_str() + 2);
+        const char* p = m_payload + i * bytes;
+
+        if (kind == 'f' && bytes == 8) { double v; std::memcpy(&v, p, 8); return Scalar(v); }
+        if (kind == 'f' && bytes == 4) { float v; std::memcpy(&v, p, 4); return Scalar(v); }
+        if (kind == 'i' && bytes == 8) { int64_t v; std::memcpy(&v, p, 8); return Scalar(v); }
+        if (kind == 'i' && bytes == 4) { int32_t v; std::memcpy(&v, p, 4); return Scalar(v); }
+        if (kind == 'i' && bytes == 1) { return Scalar(*reinterpret_cast<const int8_t*>(p)); }
+        if ((kind == 'u' || kind == 'b') && bytes == 1) { return Scalar(*reinterpret_cast<const uint8_t*>(p)); }
+
+        throw std::runtime_error("[class NpyArray]: Unsupported dtype " + m_descr);
+    }
+
+public:
+    explicit NpyArray(const std::string& path) :
+        m_file(path), m_fortran_order(false), m_payload(NULL)
+    {
+        const char* d = m_file.data();
+
+        if (m_file.size() < 10 || std::memcmp(d, "\x93NUMPY", 6) != 0)
+        {
+            throw std::runtime_error("[class NpyArray]: Not a .npy file " + path);
+        }
+
+        const int major = (unsigned char)d[6];
+        std::size_t header_len = 0;
+        std::size_t header_start = 0;
+
+        if (major == 1)
+        {
+            header_len = (unsigned char)d[8] | ((unsigned char)d[9] << 8);
+            header_start = 10;
+        }
+        else
+        {
+            for (int b = 3; b >= 0; --b) { header_len = (header_len << 8) | (unsigned char)d[8 + b]; }
+
+            header_start = 12;
+        }
+
+        if (header_start + header_len > m_file.size())
+        {
+            throw std::runtime_error("[class NpyArray]: Truncated header");
+        }
+
+        const std::string header(d + header_start, header_len);
+
+        m_descr = dict_value(header, "descr");
+        m_descr = m_descr.substr(1, m_descr.size() - 2);
+        m_fortran_order = (dict_value(header, "fortran_order") == "True");
+
+        const std::string shape = dict_value(header, "shape");
+
+        for (std::size_t i = 1; i < shape.size(); )
+        {
+            char* next = NULL;
+            const long long v = std::strtoll(shape.c_str() + i, &next, 10);
+
+            if (next == shape.c_str() + i) { ++i; continue; }
+
+            m_shape.push_back(v);
+            i = next - shape.c_str();
+        }
+
+        if (m_descr.size() < 3 || (m_descr[0] != '<' && m_descr[0] != '|' && m_descr[0] != '='))
+        {
+            throw std::runtime_error("[class NpyArray]: Only little-endian arrays are supported, got " + m_descr);
+        }
+
+        m_payload = d + header_start + header_len;
+
+        const long long bytes = std::atoi(m_descr.c_str() + 2);
+
+        if (m_payload + nrows() * ncols() * bytes > m_file.end())
+        {
+            throw std::runtime_error("[class NpyArray]: File is shorter than its shape");
+        }
+    }
+
+    const std::vector<long long>& shape() const { return m_shape; }
+
+    const std::string& dtype() const { return m_descr; }
+
+    bool fortran_order() const { return m_fortran_order; }
+
+    /// <summary>
+    /// Лежат ли данные прямо в формате Scalar (тогда features() без копии)
+    /// </summary>
+    bool is_native() const
+    {
+        return m_descr[1] == 'f' && std::atoi(m_descr.c_str() + 2) == int(sizeof(Scalar));
+    }
+
+    /// <summary>
+    /// Матрица признаки x наблюдения над отображенным файлом, без копии.
+    /// Требует тип Scalar и C-порядок; 1-мерный массив дает строку 1 x n.
+    /// </summary>
+    Eigen::Map<const Matrix> features() const
+    {
+        if (!is_native() || (m_fortran_order && m_shape.size() > 1))
+        {
+            throw std::logic_error("[class NpyArray]: Zero-copy view needs a C-order array of Scalar, use to_matrix()");
+        }
+
+        return Eigen::Map<const Matrix>(reinterpret_cast<const Scalar*>(m_payload), ncols(), nrows());
+    }
+
+    /// <summary>
+    /// Копия в матрицу признаки x наблюдения для любого порядка и числового типа
+    /// </summary>
+    Matrix to_matrix() const
+    {
+        const long long n = nrows();
+        const long long k = ncols();
+        Matrix res(k, n);
+
+        for (long long i = 0; i < n; ++i)
+        {
+            for (long long j = 0; j < k; ++j)
+            {
+                res(j, i) = element(m_fortran_order ? j * n + i : i * k + j);
+            }
+        }
+
+        return res;
+    }
+};
@@ -0,0 +1,260 @@
+﻿#pragma once
+
+# include <atomic>
+# include <vector>
+# include <thread>
+# include <chrono>
+# include <mutex>
+# include <limits>
+# include <algorithm>
+# include <ostream>
+# include <stdexcept>
+# include "Config.h"
+
+///
+/// Асинхронный сбор метрик обучения.
+///
+/// Поток обучения кладет записи в lock-free кольцевой буфер (один писатель,
+/// один читатель) и никогда не ждет ввода-вывода: если буфер переполнен,
+/// запись отбрасывается и учитывается в счетчике. Фоновый поток забирает записи,
+/// агрегирует их по эпохам и пишет итог эпохи в поток вывода.
+///
+
+
+namespace internal
+{
+    /// <summary>
+    /// Кольцевой буфер на одного писателя и одного читателя.
+    /// Емкость округляется вверх до степени двойки.
+    /// </summary>
+    template <typename T>
+    class SpscRing
+    {
+    private:
+        std::vector<T> m_data;
+        std::size_t m_mask;
+        std::atomic<std::size_t> m_head; // следующая позиция записи
+        std::atomic<std::size_t> m_tail; // следующая позиция чтения
+
+    public:
+        explicit SpscRing(std::size_t capacity) :
+            m_head(0), m_tail(0)
+        {
+            std::size_t n = 2;
+
+            while (n < capacity) { n <<= 1; }
+
+            m_data.resize(n);
+            m_mask = n - 1;
+        }
+
+        bool push(const T& value)
+        {
+            const std::size_t head = m_head.load(std::memory_order_relaxed);
+
+            if (head - m_tail.load(std::memory_order_acquire) > m_mask) { return false; }
+
+            m_data[head & m_mask] = value;
+            m_head.store(head + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        bool pop(T& value)
+        {
+            const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+
+            if (tail == m_head.load(std::memory_order_acquire)) { return false; }
+
+            value = m_data[tail & m_mask];
+            m_tail.store(tail + 1, std::memory_order_release);
+
+            return true;
+        }
+    };
+}
+
+
+///
+/// Одна запись о натренированном батче
+///
+struct MetricsRecord
+{
+    int epoch;       // номер эпохи
+    int batch;       // номер батча в эпохе
+    int nbatch;      // кол-во батчей в эпохе
+    int batch_size;  // кол-во наблюдений в батче
+    Scalar loss;     // лосс на батче
+    double seconds;  // время тренировки батча
+};
+
+
+///
+/// Итог эпохи
+///
+struct EpochMetrics
+{
+    int epoch;
+    int nbatch;            // сколько записей попало в агрегат
+    Scalar mean_loss;
+    Scalar min_loss;
+    Scalar max_loss;
+    long long samples;     // кол-во наблюдений
+    double train_seconds;  // суммарное время тренировки батчей
+    double throughput;     // наблюдений в секунду
+
+    EpochMetrics() :
+        epoch(-1), nbatch(0), mean_loss(0),
+        min_loss(std::numeric_limits<Scalar>::max()),
+        max_loss(-std::numeric_limits<Scalar>::max()),
+        samples(0), train_seconds(0), throughput(0) {}
+};
+
+
+class MetricsSink
+{
+private:
+    internal::SpscRing<MetricsRecord> m_ring;
+    std::ostream* m_out;                  // куда писать итоги эпох (может быть NULL)
+    std::atomic<bool> m_stop;
+    std::atomic<long long> m_dropped;     // отброшено записей из-за переполнения
+
+    std::mutex m_mutex;                   // защищает m_epochs
+    std::vector<EpochMetrics> m_epochs;   // итоги завершенных эпох
+    EpochMetrics m_current;               // агрегат текущей эпохи (только фоновый поток)
+    Scalar m_loss_sum;
+
+    std::thread m_worker;
+
+    void finish_epoch()
+    {
+        if (m_current.nbatch == 0) { return; }
+
+        m_current.mean_loss = m_loss_sum / m_current.nbatch;
+        m_current.throughput = (m_current.train_seconds > 0) ?
+            double(m_current.samples) / m_current.train_seconds : 0.0;
+
+        if (m_out)
+        {
+            (*m_out) << "[Epoch = " << m_current.epoch << "] Loss mean = " << m_current.mean_loss
+                << ", min = " << m_current.min_loss << ", max = " << m_current.max_loss
+                << ", throughput = " << m_current.throughput << " obs/s" << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_epochs.push_back(m_current);
+        }
+
+        m_current = EpochMetrics();
+        m_loss_sum = 0;
+    }
+
+    void consume(const MetricsRecord& rec)
+    {
+        if (rec.epoch != m_current.epoch)
+        {
+            finish_epoch();
+            m_current.epoch = rec.epoch;
+        }
+
+        m_current.nbatch += 1;
+        m_current.samples += rec.batch_size;
+        m_current.train_seconds += rec.seconds;
+        m_current.min_loss = std::min(m_current.min_loss, rec.loss);
+        m_current.max_loss = std::max(m_current.max_loss, rec.loss);
+        m_loss_sum += rec.loss;
+
+        if (rec.batch == rec.nbatch - 1)
+        {
+            finish_epoch();
+        }
+    }
+
+    void run()
+    {
+        MetricsRecord rec;
+
+        for (;;)
+        {
+            // Флаг читаем до опустошения буфера, чтобы не потерять последние записи
+            const bool stop = m_stop.load(std::memory_order_acquire);
+            bool any = false;
+
+            while (m_ring.pop(rec))
+            {
+                consume(rec);
+                any = true;
+            }
+
+            if (stop) { break; }
+
+            if (!any)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        finish_epoch();
+    }
+
+public:
+    /// <summary>
+    /// Запуск фонового потока агрегации
+    /// </summary>
+    /// <param name="out"> - поток вывода итогов эпох, NULL - не печатать</param>
+    /// <param name="capacity"> - емкость кольцевого буфера в записях</param>
+    explicit MetricsSink(std::ostream* out = NULL, std::size_t capacity = 4096) :
+        m_ring(capacity), m_out(out), m_stop(false), m_dropped(0), m_loss_sum(0)
+    {
+        m_worker = std::thread(&MetricsSink::run, this);
+    }
+
+    ~MetricsSink()
+    {
+        stop();
+    }
+
+    /// <summary>
+    /// Отправить запись. Вызывается только из потока обучения, никогда не блокируется.
+    /// </summary>
+    /// <returns>false, если буфер переполнен и запись отброшена</returns>
+    bool push(const MetricsRecord& rec)
+    {
+        if (!m_ring.push(rec))
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Дождаться обработки всех записей и остановить фоновый поток
+    /// </summary>
+    void stop()
+    {
+        m_stop.store(true, std::memory_order_release);
+
+        if (m_worker.joinable())
+        {
+            m_worker.join();
+        }
+    }
+
+    long long dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// None
+    /// </summary>
+    /// <returns>Копия итогов завершенных эпох</returns>
+    std::vector<EpochMetrics> epochs()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_epochs;
+    }
+};
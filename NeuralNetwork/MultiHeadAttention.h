@@ -0,0 +1,426 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <limits>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+# include "Layer.h"
+# include "Random.h"
+# include "Recurrent.h"
+
+///
+/// Многоголовое self-attention.
+///
+/// Вход - последовательности в формате (признаки x время * батч), см. Recurrent.h,
+/// выход - (out_size x время * батч):
+///
+/// Q = Wq^T X, K = Wk^T X, V = Wv^T X
+/// O_h = V_h softmax(K_h^T Q_h / sqrt(d_h)) для каждой головы h и последовательности
+/// Y = Wo^T [O_1; ...; O_heads] + bo
+///
+/// Матрица внимания (время x время) целиком не строится: запросы и ключи идут
+/// блоками block_size x block_size, softmax считается онлайн с пересчетом максимума
+/// и суммы по мере прохода по ключам. Для backprop хранится только logsumexp
+/// каждого запроса, вероятности блока пересчитываются заново. Память слоя
+/// линейна по длине последовательности.
+///
+/// Все произведения считает реализация из set_gemm() (см. Gemm.h), по умолчанию
+/// default_gemm_backend(): с GEMM_DISPATCH ядро AVX2 / AVX-512 выбирается по cpuid,
+/// даже если сборка без -mavx2. Накопление в выход блока идет в самом GEMM (beta = 1),
+/// exp вероятностей - ядро exp_shifted из cpu_kernels().
+///
+
+
+class MultiHeadAttention : public Layer
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+    typedef Eigen::Matrix<Scalar, 1, Eigen::Dynamic> RowVector;
+    typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
+    typedef Vector::AlignedMapType AlignedMapVec;
+    typedef std::map<std::string, int> Meta;
+
+    const int m_seq_len;    // длина последовательности
+    const int m_nhead;      // кол-во голов
+    const int m_head_size;  // размер головы
+    const int m_block;      // размер блока запросов и ключей
+    const bool m_causal;    // запрос видит только ключи не позже себя
+    GemmBackend m_gemm;     // реализация произведений блоков
+
+    Matrix m_wq, m_wk, m_wv; // Веса проекций (in_size x out_size)
+    Matrix m_wo;             // Веса выхода (out_size x out_size)
+    Vector m_bo;             // Смещение выхода
+    Matrix m_dwq, m_dwk, m_dwv, m_dwo;
+    Vector m_dbo;
+
+    Matrix m_q, m_k, m_v;    // Проекции входа (out_size x время * батч)
+    Matrix m_o;              // Выход голов до Wo
+    Matrix m_lse;            // logsumexp по ключам для каждого запроса (кол-во голов x время * батч)
+    Matrix m_a;              // Выход слоя
+    Matrix m_do;             // Производная выхода голов
+    Matrix m_dq, m_dk, m_dv; // Производные проекций
+    Matrix m_din;            // Производная входа
+
+    Matrix m_s;              // Блок оценок / вероятностей (block x block)
+    Matrix m_dp;             // Блок производных вероятностей
+    RowVector m_max;         // Текущий максимум оценок по запросам блока
+    RowVector m_sum;         // Текущая сумма exp по запросам блока
+    RowVector m_scale;       // Поправка при смене максимума
+    RowVector m_delta;       // sum(dO * O) по запросам последовательности
+    RowVector m_shift;       // logsumexp запросов блока подряд в памяти
+
+    /// <summary>
+    /// Маска причинности: ключ ks + r не виден запросу qs + c, если он позже
+    /// </summary>
+    void apply_causal_mask(const int ks, const int kb, const int qs, const int qb)
+    {
+        if (!m_causal || ks + kb - 1 <= qs) { return; }
+
+        const Scalar neg_inf = -std::numeric_limits<Scalar>::infinity();
+
+        for (int c = 0; c < qb; ++c)
+        {
+            for (int r = std::max(0, qs + c + 1 - ks); r < kb; ++r)
+            {
+                m_s(r, c) = neg_inf;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Последний блок ключей, видимый блоку запросов
+    /// </summary>
+    int key_end(const int qs, const int qb) const
+    {
+        return m_causal ? std::min(m_seq_len, qs + qb) : m_seq_len;
+    }
+
+    /// <summary>
+    /// Онлайн softmax для одной головы одной последовательности
+    /// </summary>
+    void attention_forward(const int col0, const int row0)
+    {
+        const int T = m_seq_len;
+        const int d = m_head_size;
+        const Scalar scale = Scalar(1) / std::sqrt(Scalar(d));
+
+        for (int qs = 0; qs < T; qs += m_block)
+        {
+            const int qb = std::min(m_block, T - qs);
+            const Eigen::Block<const Matrix> q = static_cast<const Matrix&>(m_q).block(row0, col0 + qs, d, qb);
+            Eigen::Block<Matrix> o = m_o.block(row0, col0 + qs, d, qb);
+
+            o.setZero();
+            m_max.setConstant(qb, -std::numeric_limits<Scalar>::infinity());
+            m_sum.setZero(qb);
+
+            for (int ks = 0; ks < key_end(qs, qb); ks += m_block)
+            {
+                const int kb = std::min(m_block, T - ks);
+                Eigen::Block<Matrix> s = m_s.topLeftCorner(kb, qb);
+
+                internal::gemm(m_gemm, true, false, scale, static_cast<const Matrix&>(m_k).block(row0, col0 + ks, d, kb), q, s);
+                apply_causal_mask(ks, kb, qs, qb);
+
+                // новый максимум и поправка к накопленным сумме и выходу
+                m_scale = m_max.cwiseMax(s.colwise().maxCoeff());
+                internal::cpu_kernels().exp_shifted(s.data(), s.outerStride(), m_scale.data(), s.data(), s.outerStride(), kb, qb);
+                m_max.swap(m_scale);
+                m_scale = (m_scale - m_max).array().exp();
+
+                m_sum.array() = m_sum.array() * m_scale.array() + s.colwise().sum().array();
+                o.array().rowwise() *= m_scale.array();
+                internal::gemm(m_gemm, false, false, Scalar(1), static_cast<const Matrix&>(m_v).block(row0, col0 + ks, d, kb), s, o,
+                    Scalar(1));
+            }
+
+            o.array().rowwise() /= m_sum.array();
+            m_lse.row(row0 / d).segment(col0 + qs, qb) = m_max.array() + m_sum.array().log();
+        }
+    }
+
+    /// <summary>
+    /// Backprop внимания одной головы одной последовательности.
+    /// Вероятности блока пересчитываются по сохраненному logsumexp.
+    /// </summary>
+    void attention_backward(const int col0, const int row0)
+    {
+        const int T = m_seq_len;
+        const int d = m_head_size;
+        const Scalar scale = Scalar(1) / std::sqrt(Scalar(d));
+
+        m_dq.block(row0, col0, d, T).setZero();
+
+        // поправка softmax зависит только от запроса - один раз на всю последовательность
+        m_delta = (static_cast<const Matrix&>(m_do).block(row0, col0, d, T).array() *
+            static_cast<const Matrix&>(m_o).block(row0, col0, d, T).array()).colwise().sum();
+
+        for (int ks = 0; ks < T; ks += m_block)
+        {
+            const int kb = std::min(m_block, T - ks);
+            const Eigen::Block<const Matrix> k = static_cast<const Matrix&>(m_k).block(row0, col0 + ks, d, kb);
+            const Eigen::Block<const Matrix> v = static_cast<const Matrix&>(m_v).block(row0, col0 + ks, d, kb);
+            Eigen::Block<Matrix> dk = m_dk.block(row0, col0 + ks, d, kb);
+            Eigen::Block<Matrix> dv = m_dv.block(row0, col0 + ks, d, kb);
+
+            dk.setZero();
+            dv.setZero();
+
+            // при маске причинности ключ не виден запросам раньше него
+            const int qfirst = m_causal ? ks / m_block * m_block : 0;
+
+            for (int qs = qfirst; qs < T; qs += m_block)
+            {
+                const int qb = std::min(m_block, T - qs);
+                const Eigen::Block<const Matrix> q = static_cast<const Matrix&>(m_q).block(row0, col0 + qs, d, qb);
+                const Eigen::Block<const Matrix> dout = static_cast<const Matrix&>(m_do).block(row0, col0 + qs, d, qb);
+                Eigen::Block<Matrix> p = m_s.topLeftCorner(kb, qb);
+                Eigen::Block<Matrix> dp = m_dp.topLeftCorner(kb, qb);
+
+                internal::gemm(m_gemm, true, false, scale, k, q, p);
+                apply_causal_mask(ks, kb, qs, qb);
+                m_shift = m_lse.row(row0 / d).segment(col0 + qs, qb);
+                internal::cpu_kernels().exp_shifted(p.data(), p.outerStride(), m_shift.data(), p.data(), p.outerStride(), kb, qb);
+
+                internal::gemm(m_gemm, false, true, Scalar(1), dout, p, dv, Scalar(1));
+
+                internal::gemm(m_gemm, true, false, Scalar(1), v, dout, dp);
+                dp.array().rowwise() -= m_delta.segment(qs, qb).array();
+                dp.array() *= p.array();
+
+                Eigen::Block<Matrix> dq = m_dq.block(row0, col0 + qs, d, qb);
+                internal::gemm(m_gemm, false, false, scale, k, dp, dq, Scalar(1));
+                internal::gemm(m_gemm, false, true, scale, q, dp, dk, Scalar(1));
+            }
+        }
+    }
+
+public:
+    /// <param name="in_size"> - кол-во признаков на шаге</param>
+    /// <param name="out_size"> - размер выхода, делится на кол-во голов</param>
+    /// <param name="seq_len"> - длина последовательности</param>
+    /// <param name="nhead"> - кол-во голов</param>
+    /// <param name="causal"> - запрос видит только ключи не позже себя</param>
+    /// <param name="block_size"> - размер блока запросов и ключей</param>
+    MultiHeadAttention(const int in_size, const int out_size, const int seq_len, const int nhead,
+        const bool causal = false, const int block_size = 128) :
+        Layer(in_size, out_size),
+        m_seq_len(seq_len),
+        m_nhead(nhead),
+        m_head_size(nhead > 0 ? out_size / nhead : 0),
+        m_block(block_size),
+        m_causal(causal),
+        m_gemm(default_gemm_backend())
+    {
+        if ((seq_len <= 0) || (nhead <= 0) || (block_size <= 0) || (out_size % nhead != 0))
+        {
+            throw std::invalid_argument("[class MultiHeadAttention]: Incorrect layer configuration");
+        }
+    }
+
+    Layer* clone() const
+    {
+        return new MultiHeadAttention(*this);
+    }
+
+    int sequence_length() const { return m_seq_len; }
+
+    void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+    {
+        init();
+
+        internal::set_normal_random(m_wq.data(), m_wq.size(), rng, mu, sigma);
+        internal::set_normal_random(m_wk.data(), m_wk.size(), rng, mu, sigma);
+        internal::set_normal_random(m_wv.data(), m_wv.size(), rng, mu, sigma);
+        internal::set_normal_random(m_wo.data(), m_wo.size(), rng, mu, sigma);
+        internal::set_normal_random(m_bo.data(), m_bo.size(), rng, mu, sigma);
+    }
+
+    void init()
+    {
+        m_wq.resize(this->m_in_size, this->m_out_size);
+        m_wk.resize(this->m_in_size, this->m_out_size);
+        m_wv.resize(this->m_in_size, this->m_out_size);
+        m_wo.resize(this->m_out_size, this->m_out_size);
+        m_bo.resize(this->m_out_size);
+        m_dwq.resize(this->m_in_size, this->m_out_size);
+        m_dwk.resize(this->m_in_size, this->m_out_size);
+        m_dwv.resize(this->m_in_size, this->m_out_size);
+        m_dwo.resize(this->m_out_size, this->m_out_size);
+        m_dbo.resize(this->m_out_size);
+
+        m_s.resize(m_block, m_block);
+        m_dp.resize(m_block, m_block);
+    }
+
+    void forward(const Matrix& prev_layer_data)
+    {
+        const int T = m_seq_len;
+        const int ncols = prev_layer_data.cols();
+
+        internal::check_sequences(prev_layer_data.rows(), ncols, this->m_in_size, T, "MultiHeadAttention");
+
+        m_q.resize(this->m_out_size, ncols);
+        m_k.resize(this->m_out_size, ncols);
+        m_v.resize(this->m_out_size, ncols);
+        internal::gemm(m_gemm, true, false, Scalar(1), m_wq, prev_layer_data, m_q);
+        internal::gemm(m_gemm, true, false, Scalar(1), m_wk, prev_layer_data, m_k);
+        internal::gemm(m_gemm, true, false, Scalar(1), m_wv, prev_layer_data, m_v);
+        m_o.resize(this->m_out_size, ncols);
+        m_lse.resize(m_nhead, ncols);
+
+        for (int b = 0; b < ncols; b += T)
+        {
+            for (int h = 0; h < m_nhead; ++h)
+            {
+                attention_forward(b, h * m_head_size);
+            }
+        }
+
+        m_a.resize(this->m_out_size, ncols);
+        internal::gemm(m_gemm, true, false, Scalar(1), m_wo, m_o, m_a);
+        internal::cpu_kernels().add_bias(m_a.data(), m_a.outerStride(), m_bo.data(), m_a.rows(), m_a.cols());
+    }
+
+    const Matrix& output() { return m_a; }
+
+    void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
+    {
+        const int T = m_seq_len;
+        const int ncols = prev_layer_data.cols();
+
+        m_do.resize(this->m_out_size, ncols);
+        internal::gemm(m_gemm, false, true, Scalar(1) / ncols, m_o, next_layer_data, m_dwo);
+        internal::cpu_kernels().row_mean(next_layer_data.data(), next_layer_data.outerStride(),
+            next_layer_data.rows(), next_layer_data.cols(), m_dbo.data());
+        internal::gemm(m_gemm, false, false, Scalar(1), m_wo, next_layer_data, m_do);
+
+        m_dq.resize(this->m_out_size, ncols);
+        m_dk.resize(this->m_out_size, ncols);
+        m_dv.resize(this->m_out_size, ncols);
+
+        for (int b = 0; b < ncols; b += T)
+        {
+            for (int h = 0; h < m_nhead; ++h)
+            {
+                attention_backward(b, h * m_head_size);
+            }
+        }
+
+        internal::gemm(m_gemm, false, true, Scalar(1) / ncols, prev_layer_data, m_dq, m_dwq);
+        internal::gemm(m_gemm, false, true, Scalar(1) / ncols, prev_layer_data, m_dk, m_dwk);
+        internal::gemm(m_gemm, false, true, Scalar(1) / ncols, prev_layer_data, m_dv, m_dwv);
+
+        m_din.resize(this->m_in_size, ncols);
+        internal::gemm(m_gemm, false, false, Scalar(1), m_wq, m_dq, m_din);
+        internal::gemm(m_gemm, false, false, Scalar(1), m_wk, m_dk, m_din, Scalar(1));
+        internal::gemm(m_gemm, false, false, Scalar(1), m_wv, m_dv, m_din, Scalar(1));
+    }
+
+    const Matrix& backprop_data() const { return m_din; }
+
+    /// <summary>
+    /// Реализация произведений внимания и проекций. Хранение весов у слоя одно, layout не используется.
+    /// </summary>
+    void set_gemm(GemmBackend backend, WeightLayout layout)
+    {
+        if (!internal::gemm_available(backend))
+        {
+            throw std::invalid_argument("[class MultiHeadAttention]: GEMM backend is not available in this build (define NN_USE_BLAS)");
+        }
+
+        m_gemm = backend;
+    }
+
+    GemmBackend gemm_backend() const { return m_gemm; }
+
+    void release_buffers()
+    {
+        Matrix* buffers[] = { &m_q, &m_k, &m_v, &m_o, &m_lse, &m_a, &m_do, &m_dq, &m_dk, &m_dv, &m_din };
+
+        for (int i = 0; i < 11; ++i) { buffers[i]->resize(0, 0); }
+    }
+
+    void update(Optimizer& opt)
+    {
+        Matrix* params[] = { &m_wq, &m_wk, &m_wv, &m_wo };
+        Matrix* derivs[] = { &m_dwq, &m_dwk, &m_dwv, &m_dwo };
+
+        for (int i = 0; i < 4; ++i)
+        {
+            ConstAlignedMapVec dw(derivs[i]->data(), derivs[i]->size());
+            AlignedMapVec      w(params[i]->data(), params[i]->size());
+            opt.update(dw, w);
+        }
+
+        ConstAlignedMapVec db(m_dbo.data(), m_dbo.size());
+        AlignedMapVec      b(m_bo.data(), m_bo.size());
+        opt.update(db, b);
+    }
+
+    /// <summary>
+    /// None
+    /// </summary>
+    /// <returns>Wq, Wk, Wv, Wo и смещение выхода одним вектором</returns>
+    std::vector<Scalar> get_parametrs() const
+    {
+        std::vector<Scalar> res;
+        res.reserve(3 * m_wq.size() + m_wo.size() + m_bo.size());
+
+        res.insert(res.end(), m_wq.data(), m_wq.data() + m_wq.size());
+        res.insert(res.end(), m_wk.data(), m_wk.data() + m_wk.size());
+        res.insert(res.end(), m_wv.data(), m_wv.data() + m_wv.size());
+        res.insert(res.end(), m_wo.data(), m_wo.data() + m_wo.size());
+        res.insert(res.end(), m_bo.data(), m_bo.data() + m_bo.size());
+
+        return res;
+    }
+
+    void set_parametrs(const std::vector<Scalar>& param)
+    {
+        if (static_cast<int>(param.size()) != 3 * m_wq.size() + m_wo.size() + m_bo.size())
+        {
+            throw std::invalid_argument("[class MultiHeadAttention]: Parameter size does not match");
+        }
+
+        std::vector<Scalar>::const_iterator it = param.begin();
+
+        std::copy(it, it + m_wq.size(), m_wq.data()); it += m_wq.size();
+        std::copy(it, it + m_wk.size(), m_wk.data()); it += m_wk.size();
+        std::copy(it, it + m_wv.size(), m_wv.data()); it += m_wv.size();
+        std::copy(it, it + m_wo.size(), m_wo.data()); it += m_wo.size();
+        std::copy(it, it + m_bo.size(), m_bo.data());
+    }
+
+    std::vector<Scalar> get_derivatives() const
+    {
+        std::vector<Scalar> res;
+        res.reserve(3 * m_dwq.size() + m_dwo.size() + m_dbo.size());
+
+        res.insert(res.end(), m_dwq.data(), m_dwq.data() + m_dwq.size());
+        res.insert(res.end(), m_dwk.data(), m_dwk.data() + m_dwk.size());
+        res.insert(res.end(), m_dwv.data(), m_dwv.data() + m_dwv.size());
+        res.insert(res.end(), m_dwo.data(), m_dwo.data() + m_dwo.size());
+        res.insert(res.end(), m_dbo.data(), m_dbo.data() + m_dbo.size());
+
+        return res;
+    }
+
+    void derivative_buffers(std::vector< std::pair<Scalar*, int> >& buffers)
+    {
+        buffers.push_back(std::make_pair(m_dwq.data(), int(m_dwq.size())));
+        buffers.push_back(std::make_pair(m_dwk.data(), int(m_dwk.size())));
+        buffers.push_back(std::make_pair(m_dwv.data(), int(m_dwv.size())));
+        buffers.push_back(std::make_pair(m_dwo.data(), int(m_dwo.size())));
+        buffers.push_back(std::make_pair(m_dbo.data(), int(m_dbo.size())));
+    }
+
+    std::string layer_type() const { return "MultiHeadAttention"; }
+
+    std::string activation_type() const { return "Identity"; }
+
+    void fill_meta_info(Meta& map, int index) const {}
+};
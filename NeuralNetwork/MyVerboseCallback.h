@@ -8,50 +8,61 @@
 # include "NeuralNetwork.h"
 
 
-// TODO: Доделать callback до конца.
+///
+/// Печать среднего лосса по эпохе. Лосс копится по батчам,
+/// вывод происходит один раз после последнего батча эпохи.
+///
 class MyVerboseCallback : public Callback
 {
 private:
+	std::vector<Scalar> m_loss_arr; // лосс каждого батча текущей эпохи
+
 	/// <summary>
 	/// Вычисление среднего лосса по эпохе
 	/// </summary>
 	/// <param name="loss_arr"> - вектор значений лосса для каждого батча</param>
-	Scalar& mean(std::vector<Scalar>& loss_arr)
+	Scalar mean(const std::vector<Scalar>& loss_arr) const
 	{
+		if (loss_arr.empty()) { return Scalar(0); }
+
 		Scalar sum = 0.0;
-		Scalar mean_loss = 0.0;
 
-		for (int i = 0; i < m_nbatch; ++i)
+		for (std::size_t i = 0; i < loss_arr.size(); ++i)
 		{
 			sum += loss_arr[i];
 		}
 
-		mean_loss = sum / m_nbatch;
-		return mean_loss;
+		return sum / loss_arr.size();
 	}
-public:
-	void post_trained_batch(const NeuralNetwork* net,
-		const Matrix& x,
-		const Matrix& y)
-	{
-		const Scalar loss = net->get_output()->loss();
 
-		int index = 0;
+	void record(const NeuralNetwork* net)
+	{
+		if (m_batch_id == 0)
+		{
+			m_loss_arr.clear();
+			m_loss_arr.reserve(m_nbatch);
+		}
 
-		std::cout << "[Epoch = " << m_epoch_id << ", batch = " << m_batch_id << "] Loss = " << loss << std::endl;
+		m_loss_arr.push_back(net->get_output()->loss());
 
-		if (m_epoch_id - 1 == index)
+		if (m_batch_id == m_nbatch - 1)
 		{
-			index++;
+			std::cout << "[Epoch = " << m_epoch_id << "] Mean loss = " << mean(m_loss_arr) << std::endl;
 		}
 	}
 
+public:
 	void post_trained_batch(const NeuralNetwork* net,
 		const Matrix& x,
-		const IntegerVector& y)
+		const Matrix& y)
 	{
-		const Scalar loss = net->get_output()->loss();
+		record(net);
+	}
 
-		std::cout << "[Epoch = " << m_epoch_id << ", batch = " << m_batch_id << "] Loss = " << loss << std::endl;
+	void post_trained_batch(const NeuralNetwork* net,
+		const Matrix& x,
+		const IntegerVector& y)
+	{
+		record(net);
 	}
 };
\ No newline at end of file
@@ -1,18 +1,31 @@
 ﻿#pragma once
 
 # include <Eigen/Core>
+# include <cmath>
 # include <map>
 # include <vector>
 # include <stdexcept>
+# include <algorithm>
 # include "Config.h"
 # include "RNG.h"
 # include "Random.h"
 # include "Layer.h"
 # include "Output.h"
 # include "Callback.h"
+# include "Quantization.h"
+# include "Pruning.h"
+# include "Validation.h"
+# include "Checkpoint.h"
+# include "Pipeline.h"
+# include "Communicator.h"
+# include "BatchStream.h"
 
 
 # include <iostream>
+# include <atomic>
+# include <thread>
+# include <exception>
+# include <type_traits>
 ///
 /// Этот модуль описывает интерфейс нейронной сети, которая будет использоваться пользователем
 /// 
@@ -33,6 +46,14 @@ private:
 	Output* m_output; // указатель на выходной слой
 	Callback m_default_callback; // дефолтный вывод на печать
 	Callback* m_callback; // пользовательский вывод на печать, иначе дефолт
+	ValidationMetrics m_last_validation; // результат последней валидации
+	Checkpointer* m_checkpointer; // запись чекпоинтов во время обучения, может быть NULL
+	int m_prefetch; // кол-во батчей, собираемых заранее в фоновом потоке (0 - все до обучения)
+	ThreadPool* m_pool; // общий пул потоков для слоев и сборки батчей, может быть NULL
+	int m_eigen_threads; // Eigen::nbThreads() до set_thread_pool(), восстанавливается в remove_thread_pool()
+	int m_recompute_every; // пересчет активаций: хранить выход каждого k-го слоя (0 - выкл, -1 - k = sqrt(кол-во слоев))
+	std::vector<int> m_recompute_layers; // пересчет активаций: свой набор слоев, чьи выходы хранятся
+	std::vector<char> m_keep; // хранится ли выход слоя до backprop, пусто - хранятся все
 
 	/// <summary>
 	/// Проверка всех слоев на соотвествие вход текущего == выход предыдущего
@@ -70,15 +91,169 @@ private:
 			throw std::invalid_argument("[class NeuralNetwork]: Input data have incorrect dimension");
 		}
 
-		// Протолкнули данные в нулевой слой
+		update_keep();
+
+		if (m_keep.empty())
+		{
+			forward_chain(m_layers, input);
+			return;
+		}
 
 		m_layers[0]->forward(input);
 
-		// Начинаем толкать данные по всей сетке
+		for (int i = 1; i < nlayer; ++i)
+		{
+			m_layers[i]->forward(m_layers[i - 1]->output());
+			release_unkept(i - 1);
+		}
+	}
+
+	/// <summary>
+	/// Проход по всей сетке по входу без копии: Eigen::Map над чужим буфером,
+	/// блок столбцов, row-major матрица или транспонированный буфер с наблюдениями
+	/// в строках. Column-major вход идет в Layer::forward_ref(), row-major -
+	/// в Layer::forward_rows(), где GEMM берет транспонированный вариант.
+	/// </summary>
+	/// <param name="input"> - входные данные (признаки x наблюдения)</param>
+	template <typename Derived>
+	void forward(const Eigen::MatrixBase<Derived>& input)
+	{
+		const int nlayer = count_layers();
+
+		if (nlayer <= 0) { return; }
+
+		if (input.rows() != m_layers[0]->in_size())
+		{
+			throw std::invalid_argument("[class NeuralNetwork]: Input data have incorrect dimension");
+		}
+
+		update_keep();
+		forward_view(m_layers[0], input.derived(), std::integral_constant<bool, bool(Derived::IsRowMajor)>());
 
 		for (int i = 1; i < nlayer; ++i)
 		{
 			m_layers[i]->forward(m_layers[i - 1]->output());
+			release_unkept(i - 1);
+		}
+	}
+
+	/// <summary>
+	/// Какие выходы слоев хранить до backprop по настройке NeuralNetwork::set_recompute()
+	/// </summary>
+	void update_keep()
+	{
+		const int nlayer = count_layers();
+
+		if (m_recompute_every == 0 && m_recompute_layers.empty())
+		{
+			m_keep.clear();
+			return;
+		}
+
+		m_keep.assign(nlayer, 0);
+
+		if (m_recompute_every != 0)
+		{
+			const int k = (m_recompute_every > 0) ? m_recompute_every :
+				std::max(1, int(std::sqrt(double(nlayer)) + 0.5));
+
+			for (int i = k - 1; i < nlayer; i += k) { m_keep[i] = 1; }
+		}
+
+		for (std::size_t j = 0; j < m_recompute_layers.size(); ++j)
+		{
+			const int i = m_recompute_layers[j];
+
+			if (i >= 0 && i < nlayer) { m_keep[i] = 1; }
+		}
+
+		// выход последнего слоя нужен выходному слою
+		m_keep[nlayer - 1] = 1;
+	}
+
+	void release_unkept(const int i)
+	{
+		if (!m_keep.empty() && !m_keep[i]) { m_layers[i]->release_buffers(); }
+	}
+
+	/// <summary>
+	/// Backprop с пересчетом активаций. Сетка идет отрезками с конца: отрезок
+	/// кончается слоем, чей выход хранится, и начинается после предыдущего такого
+	/// слоя. Проход вперед по отрезку повторяется от его входа, затем по отрезку
+	/// идет backprop, и буферы отрезка освобождаются.
+	/// </summary>
+	/// <param name="reducer"> - обмен производными между процессами, NULL - без обмена</param>
+	template <typename TargetType>
+	void backprop_recompute(const Matrix& input, const TargetType& target, internal::GradientReducer* reducer)
+	{
+		const int nlayer = count_layers();
+
+		m_output->check_target_data(target);
+		m_output->evaluate(m_layers[nlayer - 1]->output(), target);
+
+		for (int end = nlayer; end > 0; )
+		{
+			int begin = end - 1;
+
+			while (begin > 0 && !m_keep[begin - 1]) { --begin; }
+
+			for (int i = begin; i < end - 1; ++i)
+			{
+				m_layers[i]->forward(i == 0 ? input : m_layers[i - 1]->output());
+			}
+
+			for (int i = end - 1; i >= begin; --i)
+			{
+				const Matrix& prev = (i == 0) ? input : m_layers[i - 1]->output();
+				const Matrix& next = (i == nlayer - 1) ? m_output->backprop_data() : m_layers[i + 1]->backprop_data();
+
+				m_layers[i]->backprop(prev, next);
+
+				if (reducer) { reducer->add(*m_layers[i]); }
+
+				// производную входа слоя i + 1 забрал слой i
+				if (i + 1 < nlayer) { release_unkept(i + 1); }
+			}
+
+			end = begin;
+		}
+
+		release_unkept(0);
+	}
+
+	template <typename Derived>
+	static void forward_view(Layer* layer, const Derived& input, std::false_type)
+	{
+		layer->forward_ref(input);
+	}
+
+	template <typename Derived>
+	static void forward_view(Layer* layer, const Derived& input, std::true_type)
+	{
+		layer->forward_rows(input);
+	}
+
+	/// <summary>
+	/// Проход вперед по цепочке слоев. Отдельно от NeuralNetwork::forward(), 
+	/// чтобы тем же кодом гонять копии слоев в других потоках.
+	/// </summary>
+	/// <param name="layers"> - цепочка слоев</param>
+	/// <param name="input"> - входные данные</param>
+	static void forward_chain(const std::vector<Layer*>& layers, const Matrix& input)
+	{
+		const int nlayer = layers.size();
+
+		if (nlayer <= 0) { return; }
+
+		// Протолкнули данные в нулевой слой
+
+		layers[0]->forward(input);
+
+		// Начинаем толкать данные по всей сетке
+
+		for (int i = 1; i < nlayer; ++i)
+		{
+			layers[i]->forward(layers[i - 1]->output());
 		}
 
 		// На этом проход по всей сетке завершен
@@ -95,46 +270,79 @@ private:
 	template <typename TargetType>
 	void backprop(const Matrix& input, const TargetType& target)
 	{
-		const int nlayer = count_layers();
+		if (!m_keep.empty())
+		{
+			backprop_recompute(input, target, (internal::GradientReducer*)NULL);
+			return;
+		}
+
+		backprop_chain(m_layers, m_output, input, target);
+	}
+
+	/// <summary>
+	/// Backprop по цепочке слоев с заданным выходным слоем
+	/// </summary>
+	/// <param name="layers"> - цепочка слоев</param>
+	/// <param name="output"> - выходной слой</param>
+	/// <param name="input"> - входные данные</param>
+	/// <param name="target"> - собственно таргет</param>
+	template <typename TargetType>
+	static void backprop_chain(const std::vector<Layer*>& layers, Output* output,
+		const Matrix& input, TargetType& target)
+	{
+		const int nlayer = layers.size();
 
 		if (nlayer <= 0) { return; }
 
 		// Создадим указатель на первый и последний (скрытый, но не выходной)
 		// слой сетки, это поможет в дальнейшем
 
-		Layer* first_layer = m_layers[0];
-		Layer* last_layer = m_layers[nlayer - 1];
+		Layer* first_layer = layers[0];
+		Layer* last_layer = layers[nlayer - 1];
 
 		// Начнем распространение с конца сетки
-		m_output->check_target_data(target);
-		m_output->evaluate(last_layer->output(), target);
+		output->check_target_data(target);
+		output->evaluate(last_layer->output(), target);
 
 		// Если скрытый слой всего один, то 'prev_layer_data' будут выходными данными
 
 		if (nlayer == 1)
 		{
-			first_layer->backprop(input, last_layer->backprop_data());
+			first_layer->backprop(input, output->backprop_data());
 			return;
 		}
 
 		// Если это условие не выполнено, то вычисляем градиент для последнего скрытого слоя
-		last_layer->backprop(m_layers[nlayer - 2]->output(), m_output->backprop_data());
+		last_layer->backprop(layers[nlayer - 2]->output(), output->backprop_data());
 
 		// Теперь пробегаемся по всем слоям и вычисляем градиенты
 
 		for (int i = nlayer - 2; i > 0; --i)
 		{
-			m_layers[i]->backprop(m_layers[i - 1]->output(),
-				m_layers[i + 1]->backprop_data());
+			layers[i]->backprop(layers[i - 1]->output(),
+				layers[i + 1]->backprop_data());
 		}
 
 		// Теперь вычисляем грады для нулевого - входного слоя сетки
 
-		first_layer->backprop(input, m_layers[1]->backprop_data());
+		first_layer->backprop(input, layers[1]->backprop_data());
 
 		// На этом backprop окончен
 	}
 
+	/// <summary>
+	/// Обновление весов по цепочке слоев
+	/// </summary>
+	static void update_chain(const std::vector<Layer*>& layers, Optimizer& opt)
+	{
+		const int nlayer = layers.size();
+
+		for (int i = 0; i < nlayer; ++i)
+		{
+			layers[i]->update(opt);
+		}
+	}
+
 	/// <summary>
 	/// Обновление весов модели
 	/// </summary>
@@ -151,6 +359,234 @@ private:
 		}
 	}
 
+	/// <summary>
+	/// Backprop, который отдает производные каждого слоя на усреднение между
+	/// процессами сразу после его расчета. Обмен идет, пока считаются более ранние слои.
+	/// </summary>
+	template <typename TargetType>
+	void backprop_reduce(const Matrix& input, const TargetType& target, internal::GradientReducer& reducer)
+	{
+		const int nlayer = count_layers();
+
+		if (!m_keep.empty())
+		{
+			reducer.begin(input.cols());
+			backprop_recompute(input, target, &reducer);
+			reducer.finish();
+			return;
+		}
+
+		m_output->check_target_data(target);
+		m_output->evaluate(m_layers[nlayer - 1]->output(), target);
+
+		reducer.begin(input.cols());
+
+		for (int i = nlayer - 1; i >= 0; --i)
+		{
+			const Matrix& prev = (i == 0) ? input : m_layers[i - 1]->output();
+			const Matrix& next = (i == nlayer - 1) ? m_output->backprop_data() : m_layers[i + 1]->backprop_data();
+
+			m_layers[i]->backprop(prev, next);
+			reducer.add(*m_layers[i]);
+		}
+
+		reducer.finish();
+	}
+
+	/// <summary>
+	/// Общая часть NeuralNetwork::fit() с валидацией и без
+	/// </summary>
+	/// <param name="validator"> - планировщик валидации, NULL - без валидации</param>
+	template <typename DerivedX, typename DerivedY>
+	bool fit_impl(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+		const Eigen::MatrixBase<DerivedY>& y,
+		int batch_size, int epoch, int seed, internal::Validator* validator)
+	{
+
+		typedef typename Eigen::MatrixBase<DerivedX>::PlainObject PlainObjectX;
+		typedef typename Eigen::MatrixBase<DerivedY>::PlainObject PlainObjectY;
+		typedef Eigen::Matrix<typename PlainObjectX::Scalar, PlainObjectX::RowsAtCompileTime, PlainObjectX::ColsAtCompileTime>
+			XType;
+		typedef Eigen::Matrix<typename PlainObjectY::Scalar, PlainObjectY::RowsAtCompileTime, PlainObjectY::ColsAtCompileTime>
+			YType;
+
+		const int nlayer = count_layers();
+
+		if (nlayer <= 0) { return false; }
+
+		// веса будут меняться, поэтому int8 копия перестает быть актуальной
+		set_quantized(false);
+
+		// сбрасываем значения оптимизатора
+		opt.reset();
+
+		if (seed > 0)
+		{
+			m_rng.seed(seed);
+		}
+
+		// При продолжении обучения восстанавливаем RNG до перемешивания,
+		// тогда батчи получатся теми же, что и в прерванном запуске
+		CheckpointState resume_state;
+		const bool resumed = (m_checkpointer != NULL) && m_checkpointer->resume() &&
+			m_checkpointer->load(resume_state);
+
+		if (resumed)
+		{
+			m_rng.set_state(resume_state.rng_state);
+		}
+
+		const long rng_state = m_rng.state();
+
+		// начинаем генерить батчи
+		internal::BatchStream<XType, YType> batches(m_prefetch, m_pool);
+
+		const int nbatch = batches.open(x, y, batch_size, m_rng, internal::sequence_length(m_layers));
+
+		std::cout << "Batch init successfully!" << std::endl;
+
+		// Передаем параметры в callback для дальнейшего отслеживания обучения
+
+		m_callback->m_nbatch = nbatch;
+		m_callback->m_nepoch = epoch;
+
+		int start_epoch = 0;
+		int start_batch = 0;
+
+		if (resumed)
+		{
+			restore_checkpoint(resume_state, opt, nbatch);
+
+			start_epoch = resume_state.epoch;
+			start_batch = resume_state.batch + 1;
+
+			if (start_batch >= nbatch)
+			{
+				start_epoch++;
+				start_batch = 0;
+			}
+		}
+
+		batches.start((long long)start_epoch * nbatch + start_batch, (long long)epoch * nbatch);
+
+		// Начинаем процесс обучения
+		for (int e = start_epoch; e < epoch; ++e)
+		{			
+			m_callback->m_epoch_id = e;
+
+			for (int i = (e == start_epoch ? start_batch : 0); i < nbatch; ++i)
+			{
+				const XType& x_batch = batches.x();
+				const YType& y_batch = batches.y();
+
+				m_callback->m_batch_id = i;
+				m_callback->pre_trained_batch(this, x_batch, y_batch);
+				this->forward(x_batch);
+				this->backprop(x_batch, y_batch);
+				this->update(opt);
+				m_callback->post_trained_batch(this, x_batch, y_batch);
+
+				batches.next();
+
+				if (m_checkpointer && m_checkpointer->due((long long)e * nbatch + i + 1))
+				{
+					save_checkpoint(opt, rng_state, e, i, nbatch);
+				}
+
+				if (validator)
+				{
+					ValidationMetrics metrics;
+
+					if (validator->poll(metrics)) { report_validation(metrics); }
+
+					if (validator->due(i, nbatch)) { validate(*validator, e, i); }
+				}
+			}
+		}
+
+		if (validator)
+		{
+			ValidationMetrics metrics;
+
+			if (validator->wait(metrics)) { report_validation(metrics); }
+		}
+
+		if (m_checkpointer)
+		{
+			m_checkpointer->flush();
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Снимок состояния обучения и отправка его на фоновую запись
+	/// </summary>
+	void save_checkpoint(const Optimizer& opt, long rng_state, int epoch, int batch, int nbatch)
+	{
+		const int nlayer = count_layers();
+		CheckpointState state;
+
+		state.epoch = epoch;
+		state.batch = batch;
+		state.nbatch = nbatch;
+		state.rng_state = rng_state;
+		state.layers.resize(nlayer);
+
+		for (int i = 0; i < nlayer; ++i)
+		{
+			state.layers[i] = m_layers[i]->get_parametrs();
+		}
+
+		state.optimizer = opt.get_state();
+
+		m_checkpointer->save(state);
+	}
+
+	/// <summary>
+	/// Восстановление весов и оптимайзера из чекпоинта
+	/// </summary>
+	void restore_checkpoint(const CheckpointState& state, Optimizer& opt, int nbatch)
+	{
+		const int nlayer = count_layers();
+
+		if ((int(state.layers.size()) != nlayer) || (state.nbatch != nbatch))
+		{
+			throw std::invalid_argument("[class NeuralNetwork]: Checkpoint does not match the network or the data");
+		}
+
+		for (int i = 0; i < nlayer; ++i)
+		{
+			m_layers[i]->set_parametrs(state.layers[i]);
+		}
+
+		opt.set_state(state.optimizer);
+	}
+
+	/// <summary>
+	/// Валидация после батча: синхронно на текущих весах
+	/// или асинхронно на копии весов
+	/// </summary>
+	void validate(internal::Validator& validator, int epoch, int batch)
+	{
+		ValidationMetrics metrics;
+
+		if (validator.async())
+		{
+			if (validator.launch(m_layers, epoch, batch, metrics)) { report_validation(metrics); }
+
+			return;
+		}
+
+		report_validation(validator.run(m_layers, epoch, batch));
+	}
+
+	void report_validation(const ValidationMetrics& metrics)
+	{
+		m_last_validation = metrics;
+		m_callback->post_validation(this, metrics);
+	}
+
 	Meta get_meta_info() const
 	{
 		const int nlayer = count_layers();
@@ -175,7 +611,12 @@ public:
 		m_rng(m_default_rng),
 		m_output(NULL),
 		m_default_callback(),
-		m_callback(&m_default_callback)
+		m_callback(&m_default_callback),
+		m_checkpointer(NULL),
+		m_prefetch(0),
+		m_pool(NULL),
+		m_eigen_threads(0),
+		m_recompute_every(0)
 	{}
 
 	///
@@ -187,7 +628,12 @@ public:
 		m_rng(rng),
 		m_output(NULL),
 		m_default_callback(),
-		m_callback(&m_default_callback)
+		m_callback(&m_default_callback),
+		m_checkpointer(NULL),
+		m_prefetch(0),
+		m_pool(NULL),
+		m_eigen_threads(0),
+		m_recompute_every(0)
 	{}
 
 	///
@@ -218,12 +664,26 @@ public:
 	}
 
 	/// <summary>
-	/// Добавить слой в сетку
+	/// None
 	/// </summary>
-	/// <param name="layer"> - указатель на слой</param>
+	/// <returns>Слои сетки в порядке прохода вперед</returns>
+	const std::vector<Layer*>& get_layers() const
+	{
+		return m_layers;
+	}
+
+	/// <summary>
+	/// Добавить слой в сетку
+	/// </summary>
+	/// <param name="layer"> - указатель на слой</param>
 	void add_layer(Layer* layer)
 	{
 		m_layers.push_back(layer);
+
+		if (m_pool)
+		{
+			layer->set_thread_pool(m_pool);
+		}
 	}
 
 	void set_output(Output* output)
@@ -262,6 +722,101 @@ public:
 		m_callback = &m_default_callback;
 	}
 
+	/// <summary>
+	/// Включить чекпоинты в NeuralNetwork::fit(). Если у checkpointer включено
+	/// продолжение и файл существует, fit() продолжит обучение с него.
+	/// </summary>
+	/// <param name="checkpointer"> - ссылка на объект, пишущий чекпоинты</param>
+	void set_checkpointer(Checkpointer& checkpointer)
+	{
+		m_checkpointer = &checkpointer;
+	}
+
+	/// <summary>
+	/// Собирать батчи в фоновом потоке, пока тренируется текущий.
+	/// Память под батчи - nbuffer буферов вместо копии всей выборки.
+	/// </summary>
+	/// <param name="nbuffer"> - сколько батчей собирать заранее, 0 - все батчи до начала обучения</param>
+	void set_prefetch(int nbuffer)
+	{
+		m_prefetch = std::max(0, nbuffer);
+	}
+
+	/// <summary>
+	/// Пересчет активаций (gradient checkpointing): до backprop хранятся только
+	/// выходы каждого k-го слоя, остальные освобождаются сразу после следующего
+	/// слоя и пересчитываются в backprop отрезками от ближайшего хранимого выхода.
+	/// При k = sqrt(кол-во слоев) память под активации - O(sqrt(кол-во слоев))
+	/// ценой еще примерно одного прохода вперед.
+	/// Работает в fit() и fit_distributed().
+	/// </summary>
+	/// <param name="every"> - хранить выход каждого every-го слоя, 0 - хранить все (выкл),
+	/// -1 - every = sqrt(кол-во слоев)</param>
+	void set_recompute(int every)
+	{
+		m_recompute_every = every;
+		m_recompute_layers.clear();
+	}
+
+	/// <summary>
+	/// Пересчет активаций со своим разбиением на отрезки: хранятся выходы
+	/// перечисленных слоев (и последнего), например дорогих в пересчете
+	/// </summary>
+	/// <param name="layers"> - номера слоев, чьи выходы хранятся, пусто - хранить все (выкл)</param>
+	void set_recompute(const std::vector<int>& layers)
+	{
+		m_recompute_every = 0;
+		m_recompute_layers = layers;
+	}
+
+	/// <summary>
+	/// Выключить чекпоинты.
+	/// </summary>
+	void remove_checkpointer()
+	{
+		m_checkpointer = NULL;
+	}
+
+	/// <summary>
+	/// Считать GEMM и поэлементные функции слоев и собирать батчи в пуле потоков.
+	/// Собственные потоки Eigen (OpenMP) отключаются, чтобы не было переподписки,
+	/// remove_thread_pool() возвращает прежнее значение Eigen::nbThreads().
+	/// Если вызвать до init(), веса выделяются и заполняются в потоке пула и
+	/// оказываются на его узле NUMA. Пул должен жить, пока сетка его использует.
+	/// </summary>
+	/// <param name="pool"> - ссылка на пул (см. ThreadPool.h)</param>
+	void set_thread_pool(ThreadPool& pool)
+	{
+		if (m_pool == NULL) { m_eigen_threads = Eigen::nbThreads(); }
+
+		m_pool = &pool;
+		Eigen::setNbThreads(1);
+
+		const int nlayer = count_layers();
+
+		for (int i = 0; i < nlayer; ++i)
+		{
+			m_layers[i]->set_thread_pool(m_pool);
+		}
+	}
+
+	/// <summary>
+	/// Считать в вызывающем потоке. Возвращает Eigen::nbThreads(), бывшее до set_thread_pool().
+	/// </summary>
+	void remove_thread_pool()
+	{
+		if (m_pool) { Eigen::setNbThreads(m_eigen_threads); }
+
+		m_pool = NULL;
+
+		const int nlayer = count_layers();
+
+		for (int i = 0; i < nlayer; ++i)
+		{
+			m_layers[i]->set_thread_pool(NULL);
+		}
+	}
+
 
 	/// <summary>
 	/// Инициализация слоев сетки. Первая генерация весов сетки 
@@ -282,6 +837,19 @@ public:
 
 		const int nlayer = count_layers();
 
+		if (m_pool)
+		{
+			// первая запись весов из потока пула - страницы на его узле NUMA
+			m_pool->run([&]() {
+				for (int i = 0; i < nlayer; ++i)
+				{
+					m_layers[i]->init(mu, sigma, m_rng);
+				}
+			});
+
+			return;
+		}
+
 		for (int i = 0; i < nlayer; ++i)
 		{
 			m_layers[i]->init(mu, sigma, m_rng);
@@ -305,19 +873,92 @@ public:
 		const Eigen::MatrixBase<DerivedY>& y,
 		int batch_size, int epoch, int seed = -1)
 	{
+		return fit_impl(opt, x, y, batch_size, epoch, seed, NULL);
+	}
 
-		typedef typename Eigen::MatrixBase<DerivedX>::PlainObject PlainObjectX;
-		typedef typename Eigen::MatrixBase<DerivedY>::PlainObject PlainObjectY;
-		typedef Eigen::Matrix<typename PlainObjectX::Scalar, PlainObjectX::RowsAtCompileTime, PlainObjectX::ColsAtCompileTime>
-			XType;
-		typedef Eigen::Matrix<typename PlainObjectY::Scalar, PlainObjectY::RowsAtCompileTime, PlainObjectY::ColsAtCompileTime>
-			YType;
+	/// <summary>
+	/// Обучение сетки с валидацией. Метрики считаются кусками по opts.chunk_size
+	/// наблюдений каждые opts.every_n_batches батчей и передаются в
+	/// Callback::post_validation(), последний результат - NeuralNetwork::last_validation()
+	/// </summary>
+	/// <param name="x_val"> - валидационные данные</param>
+	/// <param name="y_val"> - валидационный таргет</param>
+	/// <param name="opts"> - настройки валидации</param>
+	template <typename DerivedX, typename DerivedY>
+	bool fit(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+		const Eigen::MatrixBase<DerivedY>& y,
+		int batch_size, int epoch,
+		const Matrix& x_val, const Matrix& y_val,
+		const ValidationOptions& opts = ValidationOptions(), int seed = -1)
+	{
+		internal::Validator validator(x_val, y_val, opts);
+
+		return fit_impl(opt, x, y, batch_size, epoch, seed, &validator);
+	}
+
+	/// <summary>
+	/// Один шаг обучения на готовом батче: forward, backprop и обновление весов.
+	/// Оптимизатор не сбрасывается, callback не вызывается - для своих циклов
+	/// обучения (см. SweepRunner).
+	/// </summary>
+	/// <param name="opt"> - оптимизатор</param>
+	/// <param name="x_batch"> - батч входных данных</param>
+	/// <param name="y_batch"> - батч таргета</param>
+	template <typename TargetType>
+	void train_batch(Optimizer& opt, const Matrix& x_batch, const TargetType& y_batch)
+	{
+		this->forward(x_batch);
+		this->backprop(x_batch, y_batch);
+		this->update(opt);
+	}
+
+	/// <summary>
+	/// None
+	/// </summary>
+	/// <returns>Результат последней валидации во время NeuralNetwork::fit()</returns>
+	const ValidationMetrics& last_validation() const
+	{
+		return m_last_validation;
+	}
+
+	/// <summary>
+	/// Асинхронное обучение без блокировок (Hogwild).
+	/// 
+	/// Каждый поток берет следующий батч из общей очереди, делает forward / backprop 
+	/// на своей рабочей копии слоев (Layer::clone_shared()) и сразу пишет шаг 
+	/// оптимайзера в общие веса. Для разреженных входов рабочая копия обновляет 
+	/// только строки весов ненулевых признаков, поэтому потоки редко пишут в одно место.
+	/// 
+	/// Оптимайзер общий для всех потоков, поэтому он должен быть без состояния (например SGD).
+	/// Callback здесь не вызывается.
+	/// </summary>
+	/// <param name="opt"> - оптимизатор</param>
+	/// <param name="x"> - вектор для обучения</param>
+	/// <param name="y"> - таргет</param>
+	/// <param name="batch_size"> - размер батча</param>
+	/// <param name="epoch"> - кол-во эпох</param>
+	/// <param name="nthread"> - кол-во потоков</param>
+	/// <param name="seed"> - сид для генерации случайных чисел</param>
+	/// <returns>True если все прошло хорошо</returns>
+	template <typename DerivedX, typename DerivedY>
+	bool fit_hogwild(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+		const Eigen::MatrixBase<DerivedY>& y,
+		int batch_size, int epoch, int nthread, int seed = -1)
+	{
+		typedef typename Eigen::MatrixBase<DerivedX>::PlainObject XType;
+		typedef typename Eigen::MatrixBase<DerivedY>::PlainObject YType;
 
 		const int nlayer = count_layers();
 
-		if (nlayer <= 0) { return false; }
+		if ((nlayer <= 0) || (m_output == NULL)) { return false; }
 
-		// сбрасываем значения оптимизатора
+		if (nthread <= 0)
+		{
+			throw std::invalid_argument("[class NeuralNetwork]: Number of threads must be positive");
+		}
+
+		check_unit_sizes();
+		set_quantized(false);
 		opt.reset();
 
 		if (seed > 0)
@@ -325,22 +966,225 @@ public:
 			m_rng.seed(seed);
 		}
 
-		// начинаем генерить батчи
 		std::vector<XType> x_batches;
 		std::vector<YType> y_batches;
 
-		const int nbatch = internal::create_shuffled_batches(x, y, batch_size, m_rng, x_batches, y_batches);
+		const int nbatch = internal::create_shuffled_batches(x, y, batch_size, m_rng, x_batches, y_batches,
+			internal::sequence_length(m_layers));
+		const long long ntask = (long long)nbatch * epoch;
 
-		std::cout << "Batch init successfully!" << std::endl;
+		// Рабочие копии: свои буферы активаций, общие веса
+		std::vector< std::vector<Layer*> > workers(nthread);
+		std::vector<Output*> outputs(nthread, NULL);
 
-		// Передаем параметры в callback для дальнейшего отслеживания обучения
+		std::atomic<long long> next_task(0);
+		std::vector<std::exception_ptr> errors(nthread);
+		std::vector<std::thread> threads;
+
+		// Ожидание потоков и удаление копий - и при исключении (слой без clone_shared(),
+		// ошибка запуска потока), когда часть копий и потоков уже создана
+		auto release = [&]() {
+			for (std::size_t t = 0; t < threads.size(); ++t)
+			{
+				threads[t].join();
+			}
+
+			for (int t = 0; t < nthread; ++t)
+			{
+				for (std::size_t i = 0; i < workers[t].size(); ++i)
+				{
+					delete workers[t][i];
+				}
+
+				delete outputs[t];
+			}
+		};
+
+		try
+		{
+			for (int t = 0; t < nthread; ++t)
+			{
+				for (int i = 0; i < nlayer; ++i)
+				{
+					workers[t].push_back(m_layers[i]->clone_shared());
+				}
+
+				outputs[t] = m_output->clone();
+			}
+
+			for (int t = 0; t < nthread; ++t)
+			{
+				threads.push_back(std::thread([&, t]() {
+					try
+					{
+						for (long long task = next_task++; task < ntask; task = next_task++)
+						{
+							const int i = int(task % nbatch);
+
+							forward_chain(workers[t], x_batches[i]);
+							backprop_chain(workers[t], outputs[t], x_batches[i], y_batches[i]);
+							update_chain(workers[t], opt);
+						}
+					}
+					catch (...)
+					{
+						errors[t] = std::current_exception();
+						next_task = ntask;
+					}
+				}));
+			}
+		}
+		catch (...)
+		{
+			next_task = ntask;
+			release();
+			throw;
+		}
+
+		release();
+
+		for (int t = 0; t < nthread; ++t)
+		{
+			if (errors[t]) { std::rethrow_exception(errors[t]); }
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Обучение с конвейерным параллелизмом по слоям (см. Pipeline.h).
+	///
+	/// Слои делятся на nstage стадий, каждая в своем потоке, батч делится
+	/// на nmicro микро-батчей. Градиенты микро-батчей накапливаются и применяются
+	/// один раз на батч, поэтому результат совпадает с NeuralNetwork::fit()
+	/// с тем же сидом с точностью до округления.
+	///
+	/// Callback здесь не вызывается.
+	/// </summary>
+	/// <param name="opt"> - оптимизатор</param>
+	/// <param name="x"> - вектор для обучения</param>
+	/// <param name="y"> - таргет</param>
+	/// <param name="batch_size"> - размер батча</param>
+	/// <param name="epoch"> - кол-во эпох</param>
+	/// <param name="nstage"> - кол-во стадий конвейера (потоков)</param>
+	/// <param name="nmicro"> - кол-во микро-батчей в батче</param>
+	/// <param name="seed"> - сид для генерации случайных чисел</param>
+	/// <returns>True если все прошло хорошо</returns>
+	template <typename DerivedX, typename DerivedY>
+	bool fit_pipeline(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+		const Eigen::MatrixBase<DerivedY>& y,
+		int batch_size, int epoch, int nstage, int nmicro, int seed = -1)
+	{
+		typedef typename Eigen::MatrixBase<DerivedX>::PlainObject XType;
+		typedef typename Eigen::MatrixBase<DerivedY>::PlainObject YType;
+
+		const int nlayer = count_layers();
+
+		if ((nlayer <= 0) || (m_output == NULL)) { return false; }
+
+		if ((nstage <= 0) || (nmicro <= 0))
+		{
+			throw std::invalid_argument("[class NeuralNetwork]: Number of stages and micro-batches must be positive");
+		}
+
+		check_unit_sizes();
+		set_quantized(false);
+		opt.reset();
+
+		if (seed > 0)
+		{
+			m_rng.seed(seed);
+		}
+
+		std::vector<XType> x_batches;
+		std::vector<YType> y_batches;
+
+		const int nbatch = internal::create_shuffled_batches(x, y, batch_size, m_rng, x_batches, y_batches,
+			internal::sequence_length(m_layers));
+
+		internal::PipelineExecutor pipeline(m_layers, *m_output, nstage, nmicro);
+
+		for (int e = 0; e < epoch; ++e)
+		{
+			for (int i = 0; i < nbatch; ++i)
+			{
+				pipeline.train_batch(x_batches[i], y_batches[i], opt);
+			}
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Распределенное обучение: каждый процесс учится на своей части данных,
+	/// производные слоев усредняются между процессами бакетным all-reduce
+	/// (см. Communicator.h, TcpRing.h, ShmCommunicator.h) перед каждым обновлением весов.
+	/// 
+	/// Веса процесса 0 в начале рассылаются всем, поэтому init() можно звать
+	/// с разными сидами. Все процессы делают одинаковое кол-во батчей за эпоху -
+	/// минимальное по процессам.
+	/// </summary>
+	/// <param name="opt"> - оптимизатор</param>
+	/// <param name="x"> - часть выборки этого процесса</param>
+	/// <param name="y"> - таргет</param>
+	/// <param name="batch_size"> - размер батча в каждом процессе</param>
+	/// <param name="epoch"> - кол-во эпох</param>
+	/// <param name="comm"> - обмен между процессами</param>
+	/// <param name="seed"> - сид для генерации случайных чисел</param>
+	/// <param name="bucket_size"> - размер бакета all-reduce в элементах Scalar</param>
+	/// <returns>True если все прошло хорошо</returns>
+	template <typename DerivedX, typename DerivedY>
+	bool fit_distributed(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+		const Eigen::MatrixBase<DerivedY>& y,
+		int batch_size, int epoch, Communicator& comm, int seed = -1, int bucket_size = 1 << 18)
+	{
+		typedef typename Eigen::MatrixBase<DerivedX>::PlainObject XType;
+		typedef typename Eigen::MatrixBase<DerivedY>::PlainObject YType;
+
+		const int nlayer = count_layers();
+
+		if ((nlayer <= 0) || (m_output == NULL)) { return false; }
+
+		check_unit_sizes();
+		set_quantized(false);
+		opt.reset();
+
+		if (seed > 0)
+		{
+			m_rng.seed(seed);
+		}
+
+		// Одинаковые начальные веса во всех процессах
+		for (int i = 0; i < nlayer; ++i)
+		{
+			std::vector<Scalar> param = m_layers[i]->get_parametrs();
+
+			if (param.empty()) { continue; }
+
+			comm.broadcast(&param[0], param.size());
+			m_layers[i]->set_parametrs(param);
+		}
+
+		std::vector<XType> x_batches;
+		std::vector<YType> y_batches;
+
+		const int local_nbatch = internal::create_shuffled_batches(x, y, batch_size, m_rng, x_batches, y_batches,
+			internal::sequence_length(m_layers));
+
+		// Кол-во батчей всех процессов через сумму: каждый пишет в свою ячейку
+		std::vector<Scalar> counts(comm.size(), Scalar(0));
+		counts[comm.rank()] = Scalar(local_nbatch);
+		comm.allreduce_sum(&counts[0], counts.size());
+
+		const int nbatch = int(*std::min_element(counts.begin(), counts.end()));
 
 		m_callback->m_nbatch = nbatch;
 		m_callback->m_nepoch = epoch;
 
-		// Начинаем процесс обучения
+		internal::GradientReducer reducer(comm, bucket_size);
+
 		for (int e = 0; e < epoch; ++e)
-		{			
+		{
 			m_callback->m_epoch_id = e;
 
 			for (int i = 0; i < nbatch; ++i)
@@ -348,7 +1192,7 @@ public:
 				m_callback->m_batch_id = i;
 				m_callback->pre_trained_batch(this, x_batches[i], y_batches[i]);
 				this->forward(x_batches[i]);
-				this->backprop(x_batches[i], y_batches[i]);
+				this->backprop_reduce(x_batches[i], y_batches[i], reducer);
 				this->update(opt);
 				m_callback->post_trained_batch(this, x_batches[i], y_batches[i]);
 			}
@@ -367,5 +1211,209 @@ public:
 
 		return m_layers[nlayer - 1]->output();
 	}
+
+	/// <summary>
+	/// Прогноз по Map / Ref / row-major входу без копии (см. NeuralNetwork::forward())
+	/// </summary>
+	/// <param name="x"> - входные данные (признаки x наблюдения)</param>
+	template <typename Derived>
+	Matrix predict(const Eigen::MatrixBase<Derived>& x)
+	{
+		const int nlayer = count_layers();
+
+		if (nlayer <= 0) { return Matrix(); }
+
+		this->forward(x);
+
+		return m_layers[nlayer - 1]->output();
+	}
+
+	/// <summary>
+	/// Прогноз по данным с наблюдениями в строках (наблюдения x признаки),
+	/// например по row-major блоку из хранилища признаков. Вход транспонируется
+	/// как вид, без копии.
+	/// </summary>
+	/// <returns>Выход сетки (выходы x наблюдения)</returns>
+	template <typename Derived>
+	Matrix predict_rows(const Eigen::MatrixBase<Derived>& x)
+	{
+		return predict(x.transpose());
+	}
+
+	/// <summary>
+	/// Одна реализация GEMM и одно хранение весов для всех слоев (см. Gemm.h).
+	/// Вызывать до обучения.
+	/// </summary>
+	void set_gemm(GemmBackend backend, WeightLayout layout = WEIGHT_IN_OUT)
+	{
+		const int nlayer = count_layers();
+
+		for (int i = 0; i < nlayer; ++i)
+		{
+			m_layers[i]->set_gemm(backend, layout);
+		}
+	}
+
+	/// <summary>
+	/// Подбор реализации GEMM и хранения весов для каждого слоя отдельно
+	/// замером на батче x, т.е. под размеры слоя и рабочий размер батча.
+	/// Вызывать до обучения.
+	/// </summary>
+	/// <param name="x"> - батч входных данных рабочего размера</param>
+	/// <param name="repeat"> - кол-во замеров каждого сочетания</param>
+	void tune_gemm(const Matrix& x, int repeat = 3)
+	{
+		const int nlayer = count_layers();
+
+		for (int i = 0; i < nlayer; ++i)
+		{
+			const Matrix& prev = (i == 0) ? x : m_layers[i - 1]->output();
+
+			m_layers[i]->tune_gemm(prev, repeat);
+
+			// backprop при замере мог занять буфер выхода, пересчитываем его
+			m_layers[i]->forward(prev);
+		}
+	}
+
+	/// <summary>
+	/// Пост-тренировочная квантизация сетки в int8.
+	/// Сначала делается проход в Scalar по калибровочному батчу,
+	/// затем каждый слой калибруется на своих входных данных.
+	/// </summary>
+	/// <param name="x"> - калибровочный батч (несколько сотен наблюдений обычно достаточно)</param>
+	void quantize(const Matrix& x)
+	{
+		const int nlayer = count_layers();
+
+		if (nlayer <= 0) { return; }
+
+		set_quantized(false);
+
+		// нужны выходы всех слоев, поэтому без пересчета активаций
+		forward_chain(m_layers, x);
+
+		m_layers[0]->quantize(x);
+
+		for (int i = 1; i < nlayer; ++i)
+		{
+			m_layers[i]->quantize(m_layers[i - 1]->output());
+		}
+	}
+
+	/// <summary>
+	/// Включить / выключить int8 инференс у всех квантизованных слоев
+	/// </summary>
+	void set_quantized(bool enable)
+	{
+		const int nlayer = count_layers();
+
+		for (int i = 0; i < nlayer; ++i)
+		{
+			m_layers[i]->set_quantized(enable);
+		}
+	}
+
+	/// <summary>
+	/// Прунинг весов сетки по модулю.
+	/// Маска сохраняется, поэтому последующий NeuralNetwork::fit() дообучает
+	/// только оставшиеся веса.
+	/// </summary>
+	/// <param name="sparsity"> - целевая доля нулевых весов [0, 1]</param>
+	/// <param name="global"> - true: один порог на всю сетку, 
+	/// false: каждый слой обрезается до sparsity отдельно</param>
+	/// <returns>Кол-во обнуленных весов</returns>
+	int prune(const Scalar& sparsity, bool global = true)
+	{
+		if ((sparsity < Scalar(0)) || (sparsity > Scalar(1)))
+		{
+			throw std::invalid_argument("[class NeuralNetwork]: Sparsity must be in [0, 1]");
+		}
+
+		const int nlayer = count_layers();
+		std::vector<Scalar> magnitudes;
+		int npruned = 0;
+
+		if (global)
+		{
+			for (int i = 0; i < nlayer; ++i)
+			{
+				m_layers[i]->weight_magnitudes(magnitudes);
+			}
+
+			const Scalar threshold = internal::magnitude_threshold(magnitudes, sparsity);
+
+			for (int i = 0; i < nlayer; ++i)
+			{
+				npruned += m_layers[i]->prune(threshold);
+			}
+
+			return npruned;
+		}
+
+		for (int i = 0; i < nlayer; ++i)
+		{
+			magnitudes.clear();
+			m_layers[i]->weight_magnitudes(magnitudes);
+			npruned += m_layers[i]->prune(internal::magnitude_threshold(magnitudes, sparsity));
+		}
+
+		return npruned;
+	}
+
+	/// <summary>
+	/// Снять маски прунинга со всех слоев
+	/// </summary>
+	void reset_pruning()
+	{
+		const int nlayer = count_layers();
+
+		for (int i = 0; i < nlayer; ++i)
+		{
+			m_layers[i]->reset_pruning();
+		}
+	}
+
+	/// <summary>
+	/// Сравнение выходов квантизованной сетки с исходной на данных x.
+	/// Вызывать после NeuralNetwork::quantize()
+	/// </summary>
+	/// <param name="x"> - данные для сравнения</param>
+	/// <param name="target"> - таргет, если передан, то считается и лосс обеих сеток</param>
+	QuantizationReport quantization_report(const Matrix& x, const Matrix& target = Matrix())
+	{
+		QuantizationReport report;
+
+		const int nlayer = count_layers();
+
+		if (nlayer <= 0) { return report; }
+
+		const bool with_loss = (m_output != NULL) && (target.size() > 0);
+
+		set_quantized(false);
+		const Matrix ref = predict(x);
+
+		if (with_loss)
+		{
+			m_output->evaluate(ref, target);
+			report.float_loss = m_output->loss();
+		}
+
+		set_quantized(true);
+		const Matrix& out = predict(x);
+
+		if (with_loss)
+		{
+			m_output->evaluate(out, target);
+			report.quantized_loss = m_output->loss();
+		}
+
+		const Matrix diff = out - ref;
+		report.max_abs_error = diff.cwiseAbs().maxCoeff();
+		report.mean_abs_error = diff.cwiseAbs().mean();
+		report.rmse = std::sqrt(diff.squaredNorm() / diff.size());
+
+		return report;
+	}
 };
 
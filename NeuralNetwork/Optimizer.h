@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 # include <Eigen/Core>
+# include <vector>
 # include "Config.h"
 
 
@@ -26,4 +27,26 @@ public:
 	/// 
 	
 	virtual void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec) = 0;
+
+	///
+	/// Обновление только части строк матрицы параметров (nrows x ncols, по столбцам).
+	/// Используется, когда градиент остальных строк заведомо нулевой, например
+	/// для первого слоя на разреженных данных. По умолчанию обновляется весь вектор,
+	/// оптимайзер может переопределить метод, если пропуск нулевых строк для него точен.
+	/// 
+
+	virtual void update_rows(const std::vector<int>& rows, const int nrows,
+		ConstAlignedMapVec& dvec, AlignedMapVec& vec)
+	{
+		update(dvec, vec);
+	}
+
+	///
+	/// Внутреннее состояние оптимайзера (моменты, счетчики шагов и т.д.)
+	/// в виде плоского вектора. Нужно для чекпоинтов
+	/// 
+
+	virtual std::vector<Scalar> get_state() const { return std::vector<Scalar>(); }
+
+	virtual void set_state(const std::vector<Scalar>& state) {}
 };
\ No newline at end of file
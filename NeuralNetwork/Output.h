@@ -20,6 +20,15 @@ protected:
 public:
     virtual ~Output() {}
 
+    /// <summary>
+    /// Копия выходного слоя со своими буферами, для обучения в нескольких потоках
+    /// </summary>
+    /// <returns>Указатель на новый объект, удалять должен вызывающий</returns>
+    virtual Output* clone() const
+    {
+        throw std::logic_error("[class Output]: This output type cannot be cloned");
+    }
+
     /// <summary>
     /// Здесь проверяем целевую переменную на соотвествие задачи.
     /// 
@@ -0,0 +1,392 @@
+﻿#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <deque>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <exception>
+# include <algorithm>
+# include "Config.h"
+# include "Layer.h"
+# include "Output.h"
+# include "Optimizer.h"
+
+///
+/// Конвейерный (pipeline) параллелизм по слоям.
+///
+/// Цепочка слоев делится на стадии - непрерывные диапазоны слоев, каждая стадия
+/// работает в своем потоке. Батч делится на микро-батчи, которые идут по стадиям
+/// через ограниченные очереди. Порядок работы стадии - 1F1B: сначала несколько
+/// проходов вперед для заполнения конвейера, затем попеременно один назад и
+/// один вперед, в конце оставшиеся проходы назад.
+///
+/// У каждого микро-батча свои рабочие копии слоев (Layer::clone_shared()), поэтому
+/// активации разных микро-батчей не мешают друг другу. Градиенты микро-батчей
+/// складываются с весами n_m / n и применяются один раз на батч, поэтому
+/// результат совпадает с обычным NeuralNetwork::fit().
+///
+
+
+namespace internal
+{
+    /// <summary>
+    /// Ограниченная блокирующая очередь
+    /// </summary>
+    template <typename T>
+    class BoundedQueue
+    {
+    private:
+        std::deque<T> m_items;
+        const std::size_t m_capacity;
+        std::mutex m_mutex;
+        std::condition_variable m_not_empty;
+        std::condition_variable m_not_full;
+
+    public:
+        explicit BoundedQueue(std::size_t capacity) :
+            m_capacity(std::max<std::size_t>(1, capacity)) {}
+
+        void push(const T& item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_full.wait(lock, [this] { return m_items.size() < m_capacity; });
+            m_items.push_back(item);
+            lock.unlock();
+            m_not_empty.notify_one();
+        }
+
+        T pop()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_empty.wait(lock, [this] { return !m_items.empty(); });
+            T item = m_items.front();
+            m_items.pop_front();
+            lock.unlock();
+            m_not_full.notify_one();
+            return item;
+        }
+    };
+
+
+    /// <summary>
+    /// Деление слоев на стадии примерно равной стоимости (in_size * out_size)
+    /// </summary>
+    /// <returns>Границы стадий: стадия s - слои [bounds[s], bounds[s + 1])</returns>
+    inline std::vector<int> split_stages(const std::vector<Layer*>& layers, int nstage)
+    {
+        const int nlayer = layers.size();
+        nstage = std::max(1, std::min(nstage, nlayer));
+
+        std::vector<double> cost(nlayer + 1, 0.0);
+
+        for (int i = 0; i < nlayer; ++i)
+        {
+            cost[i + 1] = cost[i] + double(layers[i]->in_size()) * layers[i]->out_size();
+        }
+
+        std::vector<int> bounds(1, 0);
+
+        for (int s = 1; s < nstage; ++s)
+        {
+            const double target = cost[nlayer] * s / nstage;
+            int b = bounds.back() + 1;
+
+            // оставляем хотя бы по одному слою на каждую следующую стадию
+            while ((b < nlayer - (nstage - s)) && (cost[b] < target)) { ++b; }
+
+            bounds.push_back(b);
+        }
+
+        bounds.push_back(nlayer);
+
+        return bounds;
+    }
+
+
+    /// <summary>
+    /// Исполнитель конвейера для одной цепочки слоев
+    /// </summary>
+    class PipelineExecutor
+    {
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef std::pair<Scalar*, int> Buffer;
+
+        const std::vector<Layer*>& m_layers;   // слои-владельцы весов
+        const int m_nmicro;                    // кол-во микро-батчей
+        const int m_group;                     // длина последовательности, микро-батчи режутся кратно ей
+        std::vector<int> m_bounds;             // границы стадий
+
+        std::vector< std::vector<Layer*> > m_workers; // рабочие копии слоев по микро-батчам
+        std::vector<Output*> m_outputs;               // выходные слои по микро-батчам
+        std::vector<Matrix> m_x;                      // входы микро-батчей
+        std::vector<Matrix> m_y;                      // таргеты микро-батчей
+        int m_nactive;                                // кол-во микро-батчей в текущем батче
+
+        std::vector< BoundedQueue<int>* > m_fwd;      // очереди проходов вперед по стадиям
+        std::vector< BoundedQueue<int>* > m_bwd;      // очереди проходов назад по стадиям
+        BoundedQueue<int> m_done;                     // стадия 0 закончила батч
+        std::vector<std::thread> m_threads;
+        std::vector<std::exception_ptr> m_errors;     // ошибки стадий в текущем батче
+
+        int nstage() const { return int(m_bounds.size()) - 1; }
+
+        void forward_stage(const int s, const int m)
+        {
+            for (int i = m_bounds[s]; i < m_bounds[s + 1]; ++i)
+            {
+                m_workers[m][i]->forward(i == 0 ? m_x[m] : m_workers[m][i - 1]->output());
+            }
+        }
+
+        void backward_stage(const int s, const int m)
+        {
+            const int nlayer = m_layers.size();
+            std::vector<Layer*>& w = m_workers[m];
+
+            if (s == nstage() - 1)
+            {
+                m_outputs[m]->check_target_data(m_y[m]);
+                m_outputs[m]->evaluate(w[nlayer - 1]->output(), m_y[m]);
+            }
+
+            for (int i = m_bounds[s + 1] - 1; i >= m_bounds[s]; --i)
+            {
+                const Matrix& prev = (i == 0) ? m_x[m] : w[i - 1]->output();
+                const Matrix& next = (i == nlayer - 1) ?
+                    m_outputs[m]->backprop_data() : w[i + 1]->backprop_data();
+
+                w[i]->backprop(prev, next);
+            }
+        }
+
+        /// <summary>
+        /// Один шаг стадии с сохранением ошибки. Сообщения по конвейеру идут
+        /// и после ошибки, иначе остальные стадии зависнут.
+        /// </summary>
+        template <typename Step>
+        void guarded(const int s, Step step)
+        {
+            if (m_errors[s]) { return; }
+
+            try { step(); }
+            catch (...) { m_errors[s] = std::current_exception(); }
+        }
+
+        /// <summary>
+        /// Остановка запущенных стадий и удаление рабочих копий. Годится и для
+        /// частично построенного объекта.
+        /// </summary>
+        void shutdown()
+        {
+            for (std::size_t s = 0; s < m_threads.size(); ++s)
+            {
+                m_fwd[s]->push(-1);
+                m_threads[s].join();
+            }
+
+            for (std::size_t s = 0; s < m_fwd.size(); ++s) { delete m_fwd[s]; }
+            for (std::size_t s = 0; s < m_bwd.size(); ++s) { delete m_bwd[s]; }
+
+            for (std::size_t m = 0; m < m_workers.size(); ++m)
+            {
+                for (std::size_t i = 0; i < m_workers[m].size(); ++i)
+                {
+                    delete m_workers[m][i];
+                }
+
+                delete m_outputs[m];
+            }
+        }
+
+        void run_stage(const int s)
+        {
+            const int last = nstage() - 1;
+
+            for (;;)
+            {
+                const int first = m_fwd[s]->pop();
+
+                if (first < 0) { return; }
+
+                const int nmicro = m_nactive;
+                const int warmup = std::min(nmicro, last - s);
+
+                // 1F1B: warmup проходов вперед, затем пары вперед / назад,
+                // в конце warmup проходов назад
+                std::vector<bool> schedule(warmup, true);
+
+                for (int k = warmup; k < nmicro; ++k)
+                {
+                    schedule.push_back(true);
+                    schedule.push_back(false);
+                }
+
+                schedule.resize(nmicro + nmicro, false);
+
+                int nfwd = 0;
+
+                for (std::size_t k = 0; k < schedule.size(); ++k)
+                {
+                    if (schedule[k])
+                    {
+                        const int m = (nfwd == 0) ? first : m_fwd[s]->pop();
+                        guarded(s, [&]() { forward_stage(s, m); });
+                        nfwd++;
+
+                        if (s < last) { m_fwd[s + 1]->push(m); }
+                        else { m_bwd[s]->push(m); }
+                    }
+                    else
+                    {
+                        const int m = m_bwd[s]->pop();
+                        guarded(s, [&]() { backward_stage(s, m); });
+
+                        if (s > 0) { m_bwd[s - 1]->push(m); }
+                    }
+                }
+
+                if (s == 0) { m_done.push(0); }
+            }
+        }
+
+    public:
+        /// <summary>
+        /// Создание рабочих копий и запуск потоков стадий
+        /// </summary>
+        /// <param name="layers"> - слои сетки (владельцы весов)</param>
+        /// <param name="output"> - выходной слой сетки</param>
+        /// <param name="nstage"> - кол-во стадий (потоков)</param>
+        /// <param name="nmicro"> - кол-во микро-батчей в батче</param>
+        PipelineExecutor(const std::vector<Layer*>& layers, const Output& output, int nstage, int nmicro) :
+            m_layers(layers),
+            m_nmicro(std::max(1, nmicro)),
+            m_group(sequence_length(layers)),
+            m_bounds(split_stages(layers, nstage)),
+            m_nactive(0),
+            m_done(1)
+        {
+            const int nlayer = layers.size();
+
+            m_workers.resize(m_nmicro);
+            m_outputs.resize(m_nmicro, NULL);
+            m_x.resize(m_nmicro);
+            m_y.resize(m_nmicro);
+
+            try
+            {
+                for (int m = 0; m < m_nmicro; ++m)
+                {
+                    for (int i = 0; i < nlayer; ++i)
+                    {
+                        m_workers[m].push_back(layers[i]->clone_shared());
+                    }
+
+                    m_outputs[m] = output.clone();
+                }
+
+                const int ns = this->nstage();
+                m_errors.resize(ns);
+
+                for (int s = 0; s < ns; ++s)
+                {
+                    // Вперед в стадию может прийти не больше m_nmicro сообщений за батч,
+                    // назад - тоже, поэтому такая емкость никогда не блокирует 1F1B
+                    m_fwd.push_back(new BoundedQueue<int>(m_nmicro + 1));
+                    m_bwd.push_back(new BoundedQueue<int>(m_nmicro));
+                }
+
+                for (int s = 0; s < ns; ++s)
+                {
+                    m_threads.push_back(std::thread(&PipelineExecutor::run_stage, this, s));
+                }
+            }
+            catch (...)
+            {
+                // Слой без clone_shared() (LSTM, GRU, MultiHeadAttention) или ошибка запуска
+                // потока: деструктор не вызовется, созданное к этому моменту освобождаем здесь
+                shutdown();
+                throw;
+            }
+        }
+
+        ~PipelineExecutor()
+        {
+            shutdown();
+        }
+
+        const std::vector<int>& stage_bounds() const { return m_bounds; }
+
+        /// <summary>
+        /// Обучение на одном батче: прогон микро-батчей по конвейеру,
+        /// накопление градиентов в слоях-владельцах и одно обновление весов
+        /// </summary>
+        template <typename XType, typename YType>
+        void train_batch(const XType& x, const YType& y, Optimizer& opt)
+        {
+            const int ncols = x.cols();
+            const int nunit = ncols / m_group;
+            const int nmicro = std::min(m_nmicro, nunit);
+            const int nlayer = m_layers.size();
+
+            // Делим батч на микро-батчи почти равного размера (в целых последовательностях)
+            std::vector<int> offset(nmicro + 1, 0);
+
+            for (int m = 0; m < nmicro; ++m)
+            {
+                offset[m + 1] = offset[m] + m_group * (nunit / nmicro + (m < nunit % nmicro ? 1 : 0));
+                m_x[m] = x.middleCols(offset[m], offset[m + 1] - offset[m]);
+                m_y[m] = y.middleCols(offset[m], offset[m + 1] - offset[m]);
+            }
+
+            std::fill(m_errors.begin(), m_errors.end(), std::exception_ptr());
+            m_nactive = nmicro;
+
+            for (int m = 0; m < nmicro; ++m)
+            {
+                m_fwd[0]->push(m);
+            }
+
+            m_done.pop();
+
+            for (std::size_t s = 0; s < m_errors.size(); ++s)
+            {
+                if (m_errors[s]) { std::rethrow_exception(m_errors[s]); }
+            }
+
+            // Градиент батча - среднее по наблюдениям, т.е. сумма градиентов
+            // микро-батчей с весами n_m / n
+            std::vector<Buffer> master, worker;
+
+            for (int i = 0; i < nlayer; ++i)
+            {
+                master.clear();
+                m_layers[i]->derivative_buffers(master);
+
+                for (std::size_t b = 0; b < master.size(); ++b)
+                {
+                    Eigen::Map<Vector>(master[b].first, master[b].second).setZero();
+                }
+
+                for (int m = 0; m < nmicro; ++m)
+                {
+                    const Scalar weight = Scalar(offset[m + 1] - offset[m]) / ncols;
+
+                    worker.clear();
+                    m_workers[m][i]->derivative_buffers(worker);
+
+                    for (std::size_t b = 0; b < master.size(); ++b)
+                    {
+                        Eigen::Map<Vector>(master[b].first, master[b].second) +=
+                            weight * Eigen::Map<Vector>(worker[b].first, worker[b].second);
+                    }
+                }
+
+                m_layers[i]->update(opt);
+            }
+        }
+    };
+}
@@ -0,0 +1,143 @@
+﻿#pragma once
+
+# include <Eigen/Core>
+# include <Eigen/SparseCore>
+# include <vector>
+# include <algorithm>
+# include "Config.h"
+
+///
+/// Утилиты для прунинга весов по модулю и разреженного инференса.
+///
+/// Разреженные веса хранятся как W^T в CSR (Eigen::SparseMatrix с RowMajor),
+/// а умножение выполняется на транспонированных (row-major) данных:
+/// каждая ненулевая связь (o, k) превращается в непрерывный axpy
+/// Z^T.row(o) += w * X^T.row(k), который Eigen векторизует по наблюдениям.
+///
+/// Структура CSR строится по маске прунинга и не меняется при обучении:
+/// после шага оптимизатора в нее копируются только значения весов.
+///
+
+
+namespace internal
+{
+    typedef Eigen::SparseMatrix<Scalar, Eigen::RowMajor> SparseRowMatrix;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMatrix;
+
+    // Кол-во наблюдений для замера плотного и разреженного умножения, если слой еще не видел батч
+    const int SPARSE_TUNE_BATCH = 256;
+
+    /// <summary>
+    /// Порог модуля весов, при котором доля обнуленных весов равна sparsity
+    /// </summary>
+    /// <param name="magnitudes"> - модули всех весов (будут переупорядочены)</param>
+    /// <param name="sparsity"> - целевая доля нулей [0, 1]</param>
+    inline Scalar magnitude_threshold(std::vector<Scalar>& magnitudes, const Scalar& sparsity)
+    {
+        const std::size_t n = magnitudes.size();
+        const std::size_t k = std::size_t(sparsity * Scalar(n));
+
+        if ((n == 0) || (k == 0)) { return Scalar(0); }
+
+        if (k >= n) { return *std::max_element(magnitudes.begin(), magnitudes.end()) + Scalar(1); }
+
+        std::nth_element(magnitudes.begin(), magnitudes.begin() + k, magnitudes.end());
+
+        return magnitudes[k];
+    }
+
+    /// <summary>
+    /// Построение CSR представления W^T из плотной матрицы весов (in_size x out_size).
+    /// В структуру попадают живые по маске связи и ненулевые веса, поэтому живой вес,
+    /// ставший при обучении нулем, не выпадает из нее.
+    /// </summary>
+    /// <param name="weight"> - веса (in_size x out_size), можно транспонированное выражение</param>
+    /// <param name="mask"> - маска прунинга того же размера</param>
+    template <typename MatW, typename MatM>
+    inline void build_sparse_transposed(const MatW& weight, const MatM& mask, SparseRowMatrix& wt)
+    {
+        typedef Eigen::Triplet<Scalar> Triplet;
+
+        std::vector<Triplet> triplets;
+
+        for (int o = 0; o < weight.cols(); ++o)
+        {
+            for (int k = 0; k < weight.rows(); ++k)
+            {
+                if (mask(k, o) != Scalar(0) || weight(k, o) != Scalar(0))
+                {
+                    triplets.push_back(Triplet(o, k, weight(k, o)));
+                }
+            }
+        }
+
+        wt.resize(weight.cols(), weight.rows());
+        wt.setFromTriplets(triplets.begin(), triplets.end());
+        wt.makeCompressed();
+    }
+
+    /// <summary>
+    /// Новые значения весов в CSR без смены структуры: веса вне структуры
+    /// обнулены маской, поэтому достаточно переписать valuePtr()
+    /// </summary>
+    /// <param name="weight"> - веса (in_size x out_size), можно транспонированное выражение</param>
+    template <typename MatW>
+    inline void update_sparse_values(const MatW& weight, SparseRowMatrix& wt)
+    {
+        const int* outer = wt.outerIndexPtr();
+        const int* inner = wt.innerIndexPtr();
+        Scalar* value = wt.valuePtr();
+
+        for (int o = 0; o < wt.rows(); ++o)
+        {
+            for (int p = outer[o]; p < outer[o + 1]; ++p)
+            {
+                value[p] = weight(inner[p], o);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Z = W^T * X для разреженной W^T.
+    /// Наблюдения обрабатываются блоками, чтобы строки X^T и Z^T оставались в кэше.
+    /// </summary>
+    /// <param name="wt"> - W^T в CSR (out_size x in_size)</param>
+    /// <param name="x"> - входные данные (in_size x ncols)</param>
+    /// <param name="xt"> - буфер под X^T</param>
+    /// <param name="zt"> - буфер под Z^T</param>
+    /// <param name="z"> - результат (out_size x ncols)</param>
+    template <typename InputType, typename Matrix>
+    inline void sparse_gemm(const SparseRowMatrix& wt, const InputType& x,
+        RowMajorMatrix& xt, RowMajorMatrix& zt, Matrix& z)
+    {
+        const int col_block = 512;
+        const int ncols = x.cols();
+        const int out_size = wt.rows();
+
+        const int* outer = wt.outerIndexPtr();
+        const int* inner = wt.innerIndexPtr();
+        const Scalar* value = wt.valuePtr();
+
+        for (int n0 = 0; n0 < ncols; n0 += col_block)
+        {
+            const int bsize = std::min(col_block, ncols - n0);
+
+            // row-major копия блока - это и есть X^T, строки которой непрерывны
+            xt.resize(x.rows(), bsize);
+            xt.noalias() = x.middleCols(n0, bsize);
+            zt.resize(out_size, bsize);
+
+            for (int o = 0; o < out_size; ++o)
+            {
+                zt.row(o).setZero();
+
+                for (int p = outer[o]; p < outer[o + 1]; ++p)
+                {
+                    zt.row(o).noalias() += value[p] * xt.row(inner[p]);
+                }
+            }
+
+            z.middleCols(n0, bsize) = zt;
+        }
+    }
+}
@@ -0,0 +1,450 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <cstddef>
+# include <cmath>
+# include <cstdint>
+# include <cstdlib>
+# include <cstring>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+# include "CpuFeatures.h"
+
+///
+/// Выбор int8 ядер квантизованных слоев во время работы.
+///
+/// Целочисленное умножение (qgemm) и квантизация входа (quantize)
+/// компилируются несколько раз - под AVX2, AVX-512BW и AVX-512 VNNI
+/// (QuantDispatchKernels.h внутри #pragma GCC target / clang attribute), и при
+/// первом обращении по cpuid (CpuFeatures.h) выбирается таблица указателей на
+/// самый широкий поддерживаемый вариант. Без x86-64 или с NN_NO_CPU_DISPATCH
+/// остается QUANT_GENERIC - SSE2 на x86-64, иначе скалярный код. Все варианты
+/// дают одинаковый результат бит в бит.
+///
+/// Уровень можно ограничить переменной окружения NN_CPU (generic, avx2, avx512,
+/// avx512vnni) или set_quant_level().
+///
+
+
+/// <summary>
+/// Набор инструкций int8 ядер
+/// </summary>
+enum QuantLevel
+{
+    QUANT_GENERIC,     // SSE2 на x86-64, иначе скалярный код
+    QUANT_AVX2,        // maddubs + madd
+    QUANT_AVX512,      // AVX-512BW maddubs + madd
+    QUANT_AVX512_VNNI  // vpdpbusd
+};
+
+
+namespace internal
+{
+    /// <summary>
+    /// Таблица int8 ядер одного набора инструкций
+    /// </summary>
+    template <typename T>
+    struct QuantKernels
+    {
+        QuantLevel level;
+
+        // C = W * X в int32: W - m строк int8 по ldw байт, X - n столбцов uint8 (7 бит)
+        // по ldx байт, k кратно 64 и хвосты строк нулевые (см. Quantization.h)
+        void (*qgemm)(const int8_t* w, std::ptrdiff_t ldw, const uint8_t* x, std::ptrdiff_t ldx,
+            int m, int n, int k, int32_t* c, std::ptrdiff_t ldc);
+        // Q = min(max(floor(X * inv + zero_point + 0.5), 0), 127) - вход квантизованного слоя
+        void (*quantize)(const T* x, std::ptrdiff_t ldx, int rows, int cols, T inv, T zero_point,
+            uint8_t* q, std::ptrdiff_t ldq);
+    };
+
+    /// <summary>
+    /// Переносимое скалярное произведение uint8 x int8, n кратно 16. На x86-64 - SSE2, он есть всегда
+    /// </summary>
+    inline int32_t generic_dot_u8s8(const uint8_t* x, const int8_t* w, const int n)
+    {
+# if defined(__SSE2__) || defined(_M_X64)
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = _mm_setzero_si128();
+
+        for (int k = 0; k < n; k += 16)
+        {
+            const __m128i vx = _mm_loadu_si128((const __m128i*)(x + k));
+            const __m128i vw = _mm_loadu_si128((const __m128i*)(w + k));
+            const __m128i xlo = _mm_unpacklo_epi8(vx, zero);
+            const __m128i xhi = _mm_unpackhi_epi8(vx, zero);
+            const __m128i wlo = _mm_srai_epi16(_mm_unpacklo_epi8(vw, vw), 8);
+            const __m128i whi = _mm_srai_epi16(_mm_unpackhi_epi8(vw, vw), 8);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(xlo, wlo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(xhi, whi));
+        }
+
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(acc);
+# else
+        int32_t acc = 0;
+
+        for (int k = 0; k < n; ++k) { acc += int32_t(x[k]) * int32_t(w[k]); }
+
+        return acc;
+# endif
+    }
+
+    /// <summary>
+    /// Переносимые int8 ядра
+    /// </summary>
+    template <typename T>
+    struct GenericQuantKernels
+    {
+        static void quantize(const T* x, std::ptrdiff_t ldx, int rows, int cols, T inv, T zero_point,
+            uint8_t* q, std::ptrdiff_t ldq)
+        {
+            Eigen::Array<T, Eigen::Dynamic, 1> col(rows);
+
+            for (int j = 0; j < cols; ++j)
+            {
+                col = (Eigen::Map<const Eigen::Array<T, Eigen::Dynamic, 1> >(x + j * ldx, rows) * inv + zero_point + T(0.5))
+                    .floor().cwiseMax(T(0)).cwiseMin(T(127));
+
+                for (int i = 0; i < rows; ++i) { q[i + j * ldq] = uint8_t(col[i]); }
+            }
+        }
+
+        static void qgemm(const int8_t* w, std::ptrdiff_t ldw, const uint8_t* x, std::ptrdiff_t ldx,
+            int m, int n, int k, int32_t* c, std::ptrdiff_t ldc)
+        {
+            for (int j = 0; j < n; ++j)
+            {
+                for (int i = 0; i < m; ++i) { c[i + j * ldc] = generic_dot_u8s8(x + j * ldx, w + i * ldw, k); }
+            }
+        }
+    };
+}
+
+
+# ifdef NN_CPU_DISPATCH_X86
+
+// ---- AVX2 ----
+
+#  if defined(__clang__)
+#   pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#  elif defined(__GNUC__)
+#   pragma GCC push_options
+#   pragma GCC target("avx2,fma")
+#  endif
+
+namespace internal
+{
+    namespace quant_avx2
+    {
+        struct D
+        {
+            typedef __m256d type;
+
+            static const int W = 4;
+
+            static inline type zero() { return _mm256_setzero_pd(); }
+            static inline type set1(double x) { return _mm256_set1_pd(x); }
+            static inline type loadu(const double* p) { return _mm256_loadu_pd(p); }
+            static inline type add(type a, type b) { return _mm256_add_pd(a, b); }
+            static inline type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+            // аргументы как в pmax / pmin Eigen: при NaN или +-0 берется a
+            static inline type max(type a, type b) { return _mm256_max_pd(b, a); }
+            static inline type min(type a, type b) { return _mm256_min_pd(b, a); }
+            static inline type floor(type a) { return _mm256_floor_pd(a); }
+
+            /// W целых значений a в [0, 255] - в байты p
+            static inline void store_u8(uint8_t* p, type a)
+            {
+                const __m128i i32 = _mm256_cvttpd_epi32(a);
+                const int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(i32, i32), i32));
+                std::memcpy(p, &bytes, sizeof(bytes));
+            }
+        };
+
+        struct Q
+        {
+            typedef __m256i type;
+
+            static const int K = 32; // байт в векторе
+            static const int NR = 2; // наблюдений в микроядре: 8 аккумуляторов
+
+            static inline type zero() { return _mm256_setzero_si256(); }
+            static inline type loadu(const void* p) { return _mm256_loadu_si256((const __m256i*)p); }
+
+            /// acc += суммы четверок x * w; пары в int16 не насыщаются при 7-битном x
+            static inline type dot(type acc, type x, type w)
+            {
+                return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(x, w), _mm256_set1_epi16(1)));
+            }
+
+            /// Суммы полос a, b, c, d
+            static inline __m128i hsum4(type a, type b, type c, type d)
+            {
+                const __m256i abcd = _mm256_hadd_epi32(_mm256_hadd_epi32(a, b), _mm256_hadd_epi32(c, d));
+                return _mm_add_epi32(_mm256_castsi256_si128(abcd), _mm256_extracti128_si256(abcd, 1));
+            }
+
+            static inline int32_t hsum(type a)
+            {
+                __m128i s = _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+                s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+                s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_cvtsi128_si32(s);
+            }
+        };
+
+#  include "QuantDispatchKernels.h"
+    }
+}
+
+#  if defined(__clang__)
+#   pragma clang attribute pop
+#  elif defined(__GNUC__)
+#   pragma GCC pop_options
+#  endif
+
+// ---- AVX-512BW ----
+
+#  if defined(__clang__)
+#   pragma clang attribute push(__attribute__((target("avx512f,avx512bw,avx2,fma"))), apply_to = function)
+#  elif defined(__GNUC__)
+#   pragma GCC push_options
+#   pragma GCC target("avx512f,avx512bw,avx2,fma")
+#  endif
+
+namespace internal
+{
+    namespace quant_avx512
+    {
+        struct D
+        {
+            typedef __m512d type;
+
+            static const int W = 8;
+
+            static inline type zero() { return _mm512_setzero_pd(); }
+            static inline type set1(double x) { return _mm512_set1_pd(x); }
+            static inline type loadu(const double* p) { return _mm512_loadu_pd(p); }
+            static inline type add(type a, type b) { return _mm512_add_pd(a, b); }
+            static inline type mul(type a, type b) { return _mm512_mul_pd(a, b); }
+            // Здесь и ниже - варианты с маской и явным источником: в GCC 12 обычные берут
+            // источник из _mm512_undefined_*, и -Wall выдает ложные -Wmaybe-uninitialized
+            static inline type max(type a, type b) { return _mm512_mask_max_pd(a, 0xFF, b, a); }
+            static inline type min(type a, type b) { return _mm512_mask_min_pd(a, 0xFF, b, a); }
+
+            static inline type floor(type a)
+            {
+                return _mm512_mask_roundscale_pd(a, 0xFF, a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+            }
+
+            static inline void store_u8(uint8_t* p, type a)
+            {
+                // старшие 8 полос не определены, в p идут только младшие 8 байт
+                const __m512i i32 = _mm512_castsi256_si512(_mm512_maskz_cvttpd_epi32(0xFF, a));
+                _mm_storel_epi64((__m128i*)p, _mm512_maskz_cvtepi32_epi8(0xFFFF, i32));
+            }
+        };
+
+        struct Q
+        {
+            typedef __m512i type;
+
+            static const int K = 64;
+            static const int NR = 4; // 16 аккумуляторов
+
+            static inline type zero() { return _mm512_setzero_si512(); }
+            static inline type loadu(const void* p) { return _mm512_loadu_si512(p); }
+
+            static inline type dot(type acc, type x, type w)
+            {
+                return _mm512_add_epi32(acc, _mm512_madd_epi16(_mm512_maddubs_epi16(x, w), _mm512_set1_epi16(1)));
+            }
+
+            static inline __m256i half_sum(type a)
+            {
+                return _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xFF, a, 0), _mm512_maskz_extracti64x4_epi64(0xFF, a, 1));
+            }
+
+            static inline __m128i hsum4(type a, type b, type c, type d)
+            {
+                const __m256i abcd = _mm256_hadd_epi32(_mm256_hadd_epi32(half_sum(a), half_sum(b)),
+                    _mm256_hadd_epi32(half_sum(c), half_sum(d)));
+                return _mm_add_epi32(_mm256_castsi256_si128(abcd), _mm256_extracti128_si256(abcd, 1));
+            }
+
+            static inline int32_t hsum(type a)
+            {
+                const __m256i h = half_sum(a);
+                __m128i s = _mm_add_epi32(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h, 1));
+                s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+                s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_cvtsi128_si32(s);
+            }
+        };
+
+#  include "QuantDispatchKernels.h"
+    }
+}
+
+#  if defined(__clang__)
+#   pragma clang attribute pop
+#  elif defined(__GNUC__)
+#   pragma GCC pop_options
+#  endif
+
+// ---- AVX-512 VNNI ----
+
+#  if defined(__clang__)
+#   pragma clang attribute push(__attribute__((target("avx512f,avx512bw,avx512vnni,avx2,fma"))), apply_to = function)
+#  elif defined(__GNUC__)
+#   pragma GCC push_options
+#   pragma GCC target("avx512f,avx512bw,avx512vnni,avx2,fma")
+#  endif
+
+namespace internal
+{
+    namespace quant_avx512_vnni
+    {
+        typedef quant_avx512::D D;
+
+        struct Q : quant_avx512::Q
+        {
+            /// vpdpbusd: четверки произведений сразу в int32, без промежуточного int16
+            static inline type dot(type acc, type x, type w) { return _mm512_dpbusd_epi32(acc, x, w); }
+        };
+
+#  include "QuantDispatchKernels.h"
+    }
+}
+
+#  if defined(__clang__)
+#   pragma clang attribute pop
+#  elif defined(__GNUC__)
+#   pragma GCC pop_options
+#  endif
+
+# endif // NN_CPU_DISPATCH_X86
+
+
+namespace internal
+{
+    inline QuantLevel supported_quant_level()
+    {
+        const CpuFeatures& f = cpu_features();
+
+        if (f.avx512vnni) { return QUANT_AVX512_VNNI; }
+        if (f.avx512bw) { return QUANT_AVX512; }
+        if (f.avx2) { return QUANT_AVX2; }
+
+        return QUANT_GENERIC;
+    }
+
+    /// <summary>
+    /// Уровень при старте: поддерживаемый, ограниченный NN_CPU
+    /// </summary>
+    inline QuantLevel initial_quant_level()
+    {
+        const QuantLevel supported = supported_quant_level();
+        const char* env = std::getenv("NN_CPU");
+
+        if (env == NULL) { return supported; }
+        if (std::strcmp(env, "generic") == 0) { return QUANT_GENERIC; }
+        if (std::strcmp(env, "avx2") == 0) { return std::min(supported, QUANT_AVX2); }
+        if (std::strcmp(env, "avx512") == 0) { return std::min(supported, QUANT_AVX512); }
+
+        return supported;
+    }
+
+    template <typename T>
+    inline void fill_simd_quant_kernels(QuantKernels<T>& kernels, const QuantLevel level) {}
+
+    /// <summary>
+    /// Квантизация входа своя только для double, qgemm от Scalar не зависит
+    /// </summary>
+    inline void fill_simd_quant_kernels(QuantKernels<double>& kernels, const QuantLevel level)
+    {
+# ifdef NN_CPU_DISPATCH_X86
+        if (level == QUANT_AVX512_VNNI)
+        {
+            kernels.qgemm = quant_avx512_vnni::qgemm;
+            kernels.quantize = quant_avx512_vnni::quantize;
+        }
+        else if (level == QUANT_AVX512)
+        {
+            kernels.qgemm = quant_avx512::qgemm;
+            kernels.quantize = quant_avx512::quantize;
+        }
+        else if (level == QUANT_AVX2)
+        {
+            kernels.qgemm = quant_avx2::qgemm;
+            kernels.quantize = quant_avx2::quantize;
+        }
+
+        kernels.level = level;
+# endif
+    }
+
+    template <typename T>
+    inline QuantKernels<T> make_quant_kernels(const QuantLevel level)
+    {
+        QuantKernels<T> kernels;
+
+        kernels.level = QUANT_GENERIC;
+        kernels.qgemm = GenericQuantKernels<T>::qgemm;
+        kernels.quantize = GenericQuantKernels<T>::quantize;
+
+        fill_simd_quant_kernels(kernels, level);
+
+        return kernels;
+    }
+
+    /// <summary>
+    /// Текущая таблица, выбирается при первом обращении
+    /// </summary>
+    inline QuantKernels<Scalar>& quant_kernels_table()
+    {
+        static QuantKernels<Scalar> kernels = make_quant_kernels<Scalar>(initial_quant_level());
+        return kernels;
+    }
+
+    inline const QuantKernels<Scalar>& quant_kernels() { return quant_kernels_table(); }
+}
+
+
+/// <summary>
+/// Набор инструкций, на котором сейчас считают int8 ядра
+/// </summary>
+inline QuantLevel quant_level() { return internal::quant_kernels().level; }
+
+/// <summary>
+/// Самый широкий набор int8 ядер, доступный на этой машине
+/// </summary>
+inline QuantLevel quant_level_supported() { return internal::supported_quant_level(); }
+
+/// <summary>
+/// Выбрать набор инструкций int8 ядер. Нельзя вызывать во время прогноза в других
+/// потоках. Для Scalar != double всегда остается QUANT_GENERIC.
+/// </summary>
+/// <param name="level"> - набор, не шире quant_level_supported()</param>
+inline void set_quant_level(const QuantLevel level)
+{
+    if (level > quant_level_supported())
+    {
+        throw std::invalid_argument("[set_quant_level]: Instruction set is not supported by this CPU");
+    }
+
+    internal::quant_kernels_table() = internal::make_quant_kernels<Scalar>(level);
+}
+
+inline const char* quant_level_name(const QuantLevel level)
+{
+    switch (level)
+    {
+    case QUANT_AVX512_VNNI: return "avx512vnni";
+    case QUANT_AVX512: return "avx512";
+    case QUANT_AVX2: return "avx2";
+    default: return "generic";
+    }
+}
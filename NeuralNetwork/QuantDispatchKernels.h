@@ -0,0 +1,127 @@
+// Без #pragma once: файл намеренно включается несколько раз.
+
+///
+/// int8 ядра квантизованных слоев для одного набора инструкций.
+///
+/// Подключается из QuantDispatch.h внутри пространства имен набора
+/// (internal::quant_avx2, internal::quant_avx512, internal::quant_avx512_vnni)
+/// после определения Q - обертки над целочисленным вектором - и D - над
+/// вектором double. Q::dot - maddubs + madd на AVX2 и AVX-512BW, одна vpdpbusd
+/// на VNNI.
+///
+/// C = W * X считается скалярными произведениями вдоль k: строка W и столбец X
+/// непрерывны и выровнены нулями до кратного 64 (QuantizedLinear). Микроядро
+/// держит в регистрах 4 x Q::NR аккумуляторов, каждый загруженный вектор W
+/// используется Q::NR раз, X - 4 раза, горизонтальные суммы - одна на 4 выхода.
+///
+
+
+static const int kQuantMR = 4;
+static const int kQuantNR = Q::NR;
+
+/// <summary>
+/// C[0 : 4, 0 : NC] = W[0 : 4] * X[:, 0 : NC]
+/// </summary>
+template <int NC>
+inline void qgemm_micro(const int8_t* w, const std::ptrdiff_t ldw, const uint8_t* x, const std::ptrdiff_t ldx,
+    const int k, int32_t* c, const std::ptrdiff_t ldc)
+{
+    Q::type acc[kQuantMR][NC];
+
+    NN_CPU_UNROLL
+    for (int ii = 0; ii < kQuantMR; ++ii)
+    {
+        NN_CPU_UNROLL
+        for (int jj = 0; jj < NC; ++jj) { acc[ii][jj] = Q::zero(); }
+    }
+
+    for (int p = 0; p < k; p += Q::K)
+    {
+        Q::type xv[NC];
+
+        NN_CPU_UNROLL
+        for (int jj = 0; jj < NC; ++jj) { xv[jj] = Q::loadu(x + jj * ldx + p); }
+
+        NN_CPU_UNROLL
+        for (int ii = 0; ii < kQuantMR; ++ii)
+        {
+            const Q::type wv = Q::loadu(w + ii * ldw + p);
+
+            NN_CPU_UNROLL
+            for (int jj = 0; jj < NC; ++jj) { acc[ii][jj] = Q::dot(acc[ii][jj], xv[jj], wv); }
+        }
+    }
+
+    NN_CPU_UNROLL
+    for (int jj = 0; jj < NC; ++jj)
+    {
+        _mm_storeu_si128((__m128i*)(c + jj * ldc), Q::hsum4(acc[0][jj], acc[1][jj], acc[2][jj], acc[3][jj]));
+    }
+}
+
+/// <summary>
+/// Одна строка W на один столбец X - хвост по выходам
+/// </summary>
+inline int32_t qdot(const int8_t* w, const uint8_t* x, const int k)
+{
+    Q::type acc = Q::zero();
+
+    for (int p = 0; p < k; p += Q::K) { acc = Q::dot(acc, Q::loadu(x + p), Q::loadu(w + p)); }
+
+    return Q::hsum(acc);
+}
+
+inline void qgemm(const int8_t* w, const std::ptrdiff_t ldw, const uint8_t* x, const std::ptrdiff_t ldx,
+    const int m, const int n, const int k, int32_t* c, const std::ptrdiff_t ldc)
+{
+    const int m4 = m - m % kQuantMR;
+    const int nr = n - n % kQuantNR;
+
+    // Блок столбцов X (kQuantNR * k байт) лежит в L1, пока по нему проходят все строки W
+    for (int j = 0; j < n; j += kQuantNR)
+    {
+        const uint8_t* xj = x + j * ldx;
+        int32_t* cj = c + j * ldc;
+
+        for (int i = 0; i < m4; i += kQuantMR)
+        {
+            if (j < nr) { qgemm_micro<kQuantNR>(w + i * ldw, ldw, xj, ldx, k, cj + i, ldc); }
+            else
+            {
+                for (int jj = 0; jj < n - nr; ++jj) { qgemm_micro<1>(w + i * ldw, ldw, xj + jj * ldx, ldx, k, cj + jj * ldc + i, ldc); }
+            }
+        }
+
+        for (int jj = 0; jj < std::min(kQuantNR, n - j); ++jj)
+        {
+            for (int i = m4; i < m; ++i) { cj[jj * ldc + i] = qdot(w + i * ldw, xj + jj * ldx, k); }
+        }
+    }
+}
+
+/// <summary>
+/// Q = min(max(floor(X * inv + zero_point + 0.5), 0), 127) в байты, операции в порядке generic_quantize
+/// </summary>
+inline void quantize(const double* x, const std::ptrdiff_t ldx, const int rows, const int cols,
+    const double inv, const double zero_point, uint8_t* q, const std::ptrdiff_t ldq)
+{
+    const D::type vinv = D::set1(inv);
+    const D::type vzp = D::set1(zero_point);
+    const D::type vhalf = D::set1(0.5);
+    const D::type vmax = D::set1(127.0);
+
+    for (int j = 0; j < cols; ++j)
+    {
+        const double* xj = x + j * ldx;
+        uint8_t* qj = q + j * ldq;
+        int i = 0;
+
+        for (; i + D::W <= rows; i += D::W)
+        {
+            const D::type t = D::floor(D::add(D::add(D::mul(D::loadu(xj + i), vinv), vzp), vhalf));
+            D::store_u8(qj + i, D::min(D::max(t, D::zero()), vmax));
+        }
+
+        for (; i < rows; ++i) { qj[i] = uint8_t(std::min(std::max(std::floor(xj[i] * inv + zero_point + 0.5), 0.0), 127.0)); }
+    }
+}
@@ -0,0 +1,169 @@
+﻿#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <cmath>
+# include <cstdint>
+# include <algorithm>
+# include "Config.h"
+# include "QuantDispatch.h"
+
+///
+/// Утилиты для пост-тренировочной квантизации слоев в int8.
+///
+/// Веса квантуются симметрично по каждому выходному каналу в int8,
+/// входные данные слоя - асимметрично в беззнаковые 7 бит [0, 127].
+/// 7 бит нужны для того, чтобы maddubs (AVX2, AVX-512BW) не насыщался:
+/// 2 * 127 * 127 = 32258 < 32767.
+///
+/// Целочисленное умножение и квантизация входа выбираются во время работы
+/// (QuantDispatch.h): AVX2, AVX-512BW, AVX-512 VNNI или переносимые.
+///
+
+
+///
+/// Сравнение квантизованной сетки с исходной (см. NeuralNetwork::quantization_report)
+///
+struct QuantizationReport
+{
+    Scalar max_abs_error;  // максимальная абсолютная ошибка выхода
+    Scalar mean_abs_error; // средняя абсолютная ошибка выхода
+    Scalar rmse;           // корень из средней квадратичной ошибки выхода
+    Scalar float_loss;     // лосс сетки в Scalar (если передан таргет)
+    Scalar quantized_loss; // лосс квантизованной сетки (если передан таргет)
+
+    QuantizationReport() :
+        max_abs_error(0), mean_abs_error(0), rmse(0), float_loss(0), quantized_loss(0) {}
+};
+
+
+namespace internal
+{
+    const int QUANT_MAX_WEIGHT = 127;
+    const int QUANT_MAX_INPUT = 127;
+    const int QUANT_ALIGN = 64; // длина строки кратна ширине AVX-512 регистра
+
+    /// <summary>
+    /// Квантизованный линейный слой: веса int8 + параметры квантизации входа
+    /// </summary>
+    struct QuantizedLinear
+    {
+        std::vector<int8_t> weight;   // out_size x stride, каждый выходной канал хранится непрерывно
+        std::vector<Scalar> scale;    // масштаб весов каждого выходного канала
+        std::vector<int32_t> row_sum; // сумма квантов канала, нужна для поправки на zero point
+        Scalar in_scale;              // масштаб входных данных
+        int in_zero_point;            // нулевая точка входных данных
+        int in_size;
+        int out_size;
+        int stride;
+
+        QuantizedLinear() :
+            in_scale(1), in_zero_point(0), in_size(0), out_size(0), stride(0) {}
+    };
+
+    inline int quant_stride(const int n)
+    {
+        return ((n + QUANT_ALIGN - 1) / QUANT_ALIGN) * QUANT_ALIGN;
+    }
+
+    /// <summary>
+    /// Квантизация весов (in_size x out_size) по выходным каналам
+    /// и калибровка входа по батчу prev_layer_data
+    /// </summary>
+    template <typename Matrix>
+    inline void quantize_linear(const Matrix& weight, const Matrix& calibration, QuantizedLinear& q)
+    {
+        const int in_size = weight.rows();
+        const int out_size = weight.cols();
+
+        q.in_size = in_size;
+        q.out_size = out_size;
+        q.stride = quant_stride(in_size);
+        q.weight.assign(std::size_t(out_size) * q.stride, 0);
+        q.scale.resize(out_size);
+        q.row_sum.resize(out_size);
+
+        for (int o = 0; o < out_size; ++o)
+        {
+            const Scalar amax = weight.col(o).cwiseAbs().maxCoeff();
+            const Scalar s = (amax > Scalar(0)) ? amax / QUANT_MAX_WEIGHT : Scalar(1);
+            int8_t* row = &q.weight[std::size_t(o) * q.stride];
+            int32_t sum = 0;
+
+            for (int k = 0; k < in_size; ++k)
+            {
+                int v = int(std::lround(weight(k, o) / s));
+                v = std::max(-QUANT_MAX_WEIGHT, std::min(QUANT_MAX_WEIGHT, v));
+                row[k] = int8_t(v);
+                sum += v;
+            }
+
+            q.scale[o] = s;
+            q.row_sum[o] = sum;
+        }
+
+        // Калибровка входа: диапазон [min, max] должен включать ноль,
+        // чтобы нули (например, после ReLU) кодировались точно
+        Scalar lo = std::min(Scalar(0), Scalar(calibration.minCoeff()));
+        Scalar hi = std::max(Scalar(0), Scalar(calibration.maxCoeff()));
+
+        if (hi - lo <= Scalar(0)) { hi = lo + Scalar(1); }
+
+        q.in_scale = (hi - lo) / QUANT_MAX_INPUT;
+        q.in_zero_point = std::max(0, std::min(QUANT_MAX_INPUT, int(std::lround(-lo / q.in_scale))));
+    }
+
+    /// <summary>
+    /// Квантизация входного батча. Каждое наблюдение (столбец) хранится непрерывно
+    /// с длиной строки q.stride, хвост заполнен нулями
+    /// </summary>
+    template <typename Matrix>
+    inline void quantize_input(const Matrix& x, const QuantizedLinear& q, std::vector<uint8_t>& buf)
+    {
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> PlainMatrix;
+
+        const int ncols = x.cols();
+
+        buf.assign(std::size_t(ncols) * q.stride, 0);
+
+        if (ncols == 0) { return; }
+
+        // Ядру нужен непрерывный по столбцам вход - выражения и row-major вычисляются во временную матрицу
+        const Eigen::Ref<const PlainMatrix> xr(x);
+
+        quant_kernels().quantize(xr.data(), xr.outerStride(), q.in_size, ncols,
+            Scalar(1) / q.in_scale, Scalar(q.in_zero_point), buf.data(), q.stride);
+    }
+
+    /// <summary>
+    /// Целочисленное умножение Z = W^T * X с накоплением в int32 и
+    /// деквантизацией результата в Scalar. Смещение и активация
+    /// применяются вызывающей стороной уже к деквантизованному Z.
+    /// </summary>
+    template <typename Matrix>
+    inline void quantized_gemm(const QuantizedLinear& q, const std::vector<uint8_t>& xq,
+        const int ncols, Matrix& z)
+    {
+        typedef Eigen::Matrix<int32_t, Eigen::Dynamic, Eigen::Dynamic> IntMatrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+        // Накопители блока наблюдений остаются в кэше до деквантизации
+        const int col_block = 64;
+        IntMatrix acc(q.out_size, std::min(ncols, col_block));
+
+        const Vector c = Eigen::Map<const Vector>(q.scale.data(), q.out_size) * q.in_scale;
+        const Vector zp = Eigen::Map<const Eigen::Matrix<int32_t, Eigen::Dynamic, 1> >(q.row_sum.data(), q.out_size)
+            .template cast<Scalar>() * Scalar(q.in_zero_point);
+
+        for (int n0 = 0; n0 < ncols; n0 += col_block)
+        {
+            const int nb = std::min(ncols - n0, col_block);
+
+            quant_kernels().qgemm(q.weight.data(), q.stride, &xq[std::size_t(n0) * q.stride], q.stride,
+                q.out_size, nb, q.stride, acc.data(), acc.rows());
+
+            z.middleCols(n0, nb) = ((acc.leftCols(nb).template cast<Scalar>().colwise() - zp).array().colwise()
+                * c.array()).matrix();
+        }
+    }
+}
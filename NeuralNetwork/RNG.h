@@ -53,6 +53,16 @@ public:
         return Scalar(m_rand) / Scalar(m_max);
     }
 
+    // Текущее состояние генератора, нужно для чекпоинтов
+    long state() const
+    {
+        return m_rand;
+    }
+
+    void set_state(long state)
+    {
+        m_rand = state;
+    }
 
 
 };
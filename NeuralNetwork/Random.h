@@ -1,9 +1,17 @@
 ﻿#pragma once
 
 # include <Eigen/Core>
+# include <vector>
+# include <algorithm>
+# include <stdexcept>
+# include <type_traits>
 # include "RNG.h"
 # include "Config.h"
 
+# if defined(_MSC_VER)
+# include <xmmintrin.h>
+# endif
+
 ///
 /// Здесь собраны утилиты для случайных зависимостей.
 /// 
@@ -24,49 +32,173 @@ namespace internal
         }
     }
 
+    /// <summary>
+    /// Подсказка процессору загрузить линию кэша заранее
+    /// </summary>
+    inline void prefetch(const void* ptr)
+    {
+# if defined(_MSC_VER)
+        _mm_prefetch(static_cast<const char*>(ptr), _MM_HINT_T0);
+# elif defined(__GNUC__)
+        __builtin_prefetch(ptr, 0, 3);
+# else
+        (void)ptr;
+# endif
+    }
+
+    /// <summary>
+    /// Предвыборка столбца матрицы. Имеет смысл только для плотных
+    /// матриц по столбцам, для остальных выражений ничего не делает.
+    /// </summary>
+    template <typename Derived>
+    inline void prefetch_col(const Eigen::MatrixBase<Derived>& m, const int col, std::true_type)
+    {
+        typedef typename Derived::Scalar T;
+        const int line = 64 / sizeof(T);
+        const T* ptr = m.derived().data() + (std::ptrdiff_t)col * m.derived().outerStride();
+
+        for (int k = 0; k < m.rows(); k += line)
+        {
+            prefetch(ptr + k);
+        }
+    }
+
+    template <typename Derived>
+    inline void prefetch_col(const Eigen::MatrixBase<Derived>& m, const int col, std::false_type) {}
+
+    template <typename Derived>
+    inline void prefetch_col(const Eigen::MatrixBase<Derived>& m, const int col)
+    {
+        typedef std::integral_constant<bool,
+            (int(Derived::Flags) & Eigen::DirectAccessBit) != 0 &&
+            (int(Derived::Flags) & Eigen::RowMajorBit) == 0> direct;
+
+        prefetch_col(m, col, direct());
+    }
+
+    /// <summary>
+    /// Столбцы [begin, end) батча из столбцов id[begin], ..., id[end - 1].
+    /// Столбцы идут в случайном порядке, поэтому подгружаем их в кэш
+    /// на несколько шагов вперед. Размер батча задает вызывающий.
+    /// </summary>
     template <typename DerivedX, typename DerivedY, typename XType, typename YType>
-    inline int create_shuffled_batches(
+    inline void gather_cols(
         const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
-        int batch_size, RNG& rng,
-        std::vector<XType>& x_batches, std::vector<YType>& y_batches
+        const int* id, const int begin, const int end, XType& x_batch, YType& y_batch
+    )
+    {
+        const int distance = 8; // на сколько столбцов вперед делать предвыборку
+
+        for (int j = begin; j < std::min(begin + distance, end); j++)
+        {
+            prefetch_col(x, id[j]);
+        }
+
+        for (int j = begin; j < end; j++)
+        {
+            if (j + distance < end)
+            {
+                prefetch_col(x, id[j + distance]);
+                prefetch_col(y, id[j + distance]);
+            }
+
+            x_batch.col(j).noalias() = x.col(id[j]);
+            y_batch.col(j).noalias() = y.col(id[j]);
+        }
+    }
+
+    /// <summary>
+    /// Сборка батча из столбцов id[0], ..., id[bsize - 1]
+    /// </summary>
+    template <typename DerivedX, typename DerivedY, typename XType, typename YType>
+    inline void gather_batch(
+        const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+        const int* id, const int bsize, XType& x_batch, YType& y_batch
+    )
+    {
+        x_batch.resize(x.rows(), bsize);
+        y_batch.resize(y.rows(), bsize);
+
+        gather_cols(x, y, id, 0, bsize, x_batch, y_batch);
+    }
+
+    /// <summary>
+    /// Перемешанные индексы наблюдений
+    /// </summary>
+    /// <param name="batch_size"> - размер батча, округляется вниз до кратного group</param>
+    /// <param name="group"> - сколько соседних столбцов перемешивать вместе (длина последовательности)</param>
+    /// <returns>Кол-во батчей</returns>
+    template <typename DerivedX, typename DerivedY>
+    inline int shuffled_index(
+        const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+        int& batch_size, RNG& rng, Eigen::VectorXi& id, const int group = 1
     )
     {
         const int nobs = x.cols();
-        const int dimx = x.rows();
-        const int dimy = y.rows();
 
         if (y.cols() != nobs)
         {
             throw std::invalid_argument("Input X and Y have different number of observations");
         }
 
-        Eigen::VectorXi id = Eigen::VectorXi::LinSpaced(nobs, 0, nobs - 1);
-        shuffle(id.data(), id.size(), rng);
+        if (group > 1)
+        {
+            if (nobs % group != 0)
+            {
+                throw std::invalid_argument("Number of observations must be a multiple of the sequence length");
+            }
+
+            Eigen::VectorXi seq = Eigen::VectorXi::LinSpaced(nobs / group, 0, nobs / group - 1);
+            shuffle(seq.data(), seq.size(), rng);
+
+            id.resize(nobs);
+
+            for (int s = 0; s < seq.size(); ++s)
+            {
+                for (int t = 0; t < group; ++t)
+                {
+                    id[s * group + t] = seq[s] * group + t;
+                }
+            }
+
+            batch_size = std::max(group, batch_size / group * group);
+        }
+        else
+        {
+            id = Eigen::VectorXi::LinSpaced(nobs, 0, nobs - 1);
+            shuffle(id.data(), id.size(), rng);
+        }
 
         if (batch_size > nobs)
         {
             batch_size = nobs;
         }
 
-        const int nbatch = (nobs - 1) / batch_size + 1;
+        return (nobs - 1) / batch_size + 1;
+    }
+
+    template <typename DerivedX, typename DerivedY, typename XType, typename YType>
+    inline int create_shuffled_batches(
+        const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+        int batch_size, RNG& rng,
+        std::vector<XType>& x_batches, std::vector<YType>& y_batches,
+        const int group = 1
+    )
+    {
+        Eigen::VectorXi id;
+        const int nbatch = shuffled_index(x, y, batch_size, rng, id, group);
+        const int nobs = x.cols();
         const int last_batch_size = nobs - (nbatch - 1) * batch_size;
+
         x_batches.clear();
         y_batches.clear();
-        x_batches.reserve(nbatch);
-        y_batches.reserve(nbatch);
+        x_batches.resize(nbatch);
+        y_batches.resize(nbatch);
 
         for (int i = 0; i < nbatch; i++)
         {
             const int bsize = (i == nbatch - 1) ? last_batch_size : batch_size;
-            x_batches.push_back(XType(dimx, bsize));
-            y_batches.push_back(YType(dimy, bsize));
-            const int offset = i * batch_size;
-
-            for (int j = 0; j < bsize; j++)
-            {
-                x_batches[i].col(j).noalias() = x.col(id[offset + j]);
-                y_batches[i].col(j).noalias() = y.col(id[offset + j]);
-            }
+            gather_batch(x, y, id.data() + i * batch_size, bsize, x_batches[i], y_batches[i]);
         }
 
         return nbatch;
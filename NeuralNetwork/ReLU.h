@@ -3,23 +3,29 @@
 
 # include <Eigen/Core>
 # include "Config.h"
+# include "CpuDispatch.h"
 
 class ReLU
 {
 private:
 	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
 
 public:
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
 
-	static inline void activate(const Matrix& Z, Matrix& A)
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
 	{
-		A.array() = Z.array().cwiseMax(Scalar(0));
+		internal::cpu_kernels().relu(Z.data(), Z.outerStride(), A.data(), A.outerStride(), Z.rows(), Z.cols(), Scalar(0));
 	}
 
-	static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-		const Matrix& F, Matrix& G)
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
 	{
-		G.array() = (A.array() > Scalar(0)).select(F, Scalar(0));
+		internal::cpu_kernels().relu_jacobian(A.data(), A.outerStride(), F.data(), F.outerStride(),
+			G.data(), G.outerStride(), G.rows(), G.cols(), Scalar(0));
 	}
 
 	static std::string return_type()
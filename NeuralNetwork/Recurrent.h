@@ -0,0 +1,82 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <string>
+# include <stdexcept>
+# include "Config.h"
+# include "CpuDispatch.h"
+
+///
+/// Общие утилиты рекуррентных слоев (LSTM, GRU).
+///
+/// Последовательности упакованы в матрицу (признаки x время * батч) так,
+/// что каждая последовательность занимает seq_len соседних столбцов:
+/// столбец b * seq_len + t - шаг t последовательности b. Тогда перемешивание
+/// наблюдений группами по seq_len (см. internal::shuffled_index()) не рвет
+/// последовательности, а шаг t всех последовательностей батча - это столбцы
+/// с шагом seq_len, которые видны как обычная матрица через Map с OuterStride
+/// и без копирования идут в GEMM.
+///
+
+
+namespace internal
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> RecurrentMatrix;
+    typedef Eigen::Map<RecurrentMatrix, 0, Eigen::OuterStride<> > StepMap;
+    typedef Eigen::Map<const RecurrentMatrix, 0, Eigen::OuterStride<> > ConstStepMap;
+
+    /// <summary>
+    /// Столбцы шага t всех последовательностей матрицы m
+    /// </summary>
+    inline StepMap step_cols(RecurrentMatrix& m, const int t, const int seq_len)
+    {
+        return StepMap(m.data() + (std::ptrdiff_t)t * m.rows(), m.rows(), m.cols() / seq_len,
+            Eigen::OuterStride<>(seq_len * m.rows()));
+    }
+
+    inline ConstStepMap step_cols(const RecurrentMatrix& m, const int t, const int seq_len)
+    {
+        return ConstStepMap(m.data() + (std::ptrdiff_t)t * m.rows(), m.rows(), m.cols() / seq_len,
+            Eigen::OuterStride<>(seq_len * m.rows()));
+    }
+
+    /// <summary>
+    /// Сигмоида на месте ядром cpu_kernels() (векторизованный exp). x - матрица
+    /// с прямым доступом к памяти: Matrix, шаг StepMap или его блок строк.
+    /// </summary>
+    template <typename Derived>
+    inline void sigmoid_inplace(const Eigen::MatrixBase<Derived>& g)
+    {
+        Derived& x = const_cast<Derived&>(g.derived());
+        cpu_kernels().sigmoid(x.data(), x.outerStride(), x.data(), x.outerStride(), x.rows(), x.cols());
+    }
+
+    /// <summary>
+    /// Гиперболический тангенс на месте: tanh(x) = 2 * sigmoid(2x) - 1, ядро cpu_kernels().
+    /// std::tanh для double не векторизован.
+    /// </summary>
+    template <typename Derived>
+    inline void tanh_inplace(const Eigen::MatrixBase<Derived>& g)
+    {
+        Derived& x = const_cast<Derived&>(g.derived());
+        cpu_kernels().tanh(x.data(), x.outerStride(), x.data(), x.outerStride(), x.rows(), x.cols());
+    }
+
+    /// <summary>
+    /// Проверка, что вход состоит из целых последовательностей
+    /// </summary>
+    inline void check_sequences(const int rows, const int cols, const int in_size, const int seq_len,
+        const char* layer)
+    {
+        if (rows != in_size)
+        {
+            throw std::invalid_argument(std::string("[class ") + layer + "]: Input data have incorrect dimension");
+        }
+
+        if (cols % seq_len != 0)
+        {
+            throw std::invalid_argument(std::string("[class ") + layer +
+                "]: Number of columns must be a multiple of the sequence length");
+        }
+    }
+}
@@ -4,6 +4,7 @@
 # include <stdexcept>
 # include "Config.h"
 # include "Output.h"
+# include "CpuDispatch.h"
 
 ///
 /// Блок управления выходным слоем при решении задачи регрессии на ошибке MSE
@@ -21,6 +22,11 @@ private:
 	Matrix m_din; // Производная от входных данных этого слоя
 
 public:
+	Output* clone() const
+	{
+		return new RegressionMSE(*this);
+	}
+
 	void evaluate(const Matrix& prev_layer_data, const Matrix& target)
 	{
 		const int ncol = prev_layer_data.cols();
@@ -35,7 +41,7 @@ public:
 		// собственно делаем расчет
 
 		m_din.resize(nrow, ncol);
-		m_din.noalias() = prev_layer_data - target;
+		internal::cpu_kernels().sub(prev_layer_data.data(), target.data(), m_din.data(), m_din.size());
 	}
 
 	const Matrix& backprop_data() const
@@ -45,7 +51,7 @@ public:
 
 	Scalar loss() const
 	{
-		return Scalar(0.5) * m_din.squaredNorm() / m_din.cols();
+		return Scalar(0.5) * internal::cpu_kernels().squared_norm(m_din.data(), m_din.size()) / m_din.cols();
 	}
 
 	std::string output_type() const
@@ -3,6 +3,7 @@
 # include <Eigen/Core>
 # include "Config.h"
 # include "Optimizer.h"
+# include "CpuDispatch.h"
 
 class SGD : public Optimizer
 {
@@ -21,6 +22,35 @@ public:
 	
 	void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec)
 	{
-		vec.noalias() -= m_lrate * (dvec + m_decay * vec);
+		internal::cpu_kernels().sgd(dvec.data(), vec.data(), vec.size(), m_lrate, m_decay);
+	}
+
+	///
+	/// Без decay шаг по нулевому градиенту ничего не меняет, 
+	/// поэтому можно трогать только переданные строки
+	/// 
+
+	void update_rows(const std::vector<int>& rows, const int nrows,
+		ConstAlignedMapVec& dvec, AlignedMapVec& vec)
+	{
+		if (m_decay != Scalar(0))
+		{
+			update(dvec, vec);
+			return;
+		}
+
+		const int ncols = vec.size() / nrows;
+		const int nactive = rows.size();
+
+		for (int j = 0; j < ncols; ++j)
+		{
+			const Scalar* d = dvec.data() + j * nrows;
+			Scalar* w = vec.data() + j * nrows;
+
+			for (int k = 0; k < nactive; ++k)
+			{
+				w[rows[k]] -= m_lrate * d[rows[k]];
+			}
+		}
 	}
 };
\ No newline at end of file
@@ -0,0 +1,414 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <atomic>
+# include <string>
+# include <thread>
+# include <chrono>
+# include <cstring>
+# include <cstddef>
+# include <cstdint>
+# include <new>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+# include "Communicator.h"
+
+# ifdef _WIN32
+# ifndef NOMINMAX
+# define NOMINMAX
+# endif
+# include <windows.h>
+# else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+# endif
+
+///
+/// All-reduce через общую память для процессов на одной машине.
+///
+/// Процесс 0 создает именованный сегмент (POSIX shm_open, в Windows - file mapping),
+/// остальные подключаются к нему по имени. В сегменте у каждого процесса свой слот
+/// на capacity элементов и два буфера результата. Вектор идет кусками по capacity:
+/// каждый процесс кладет кусок в свой слот, после барьера суммирует свою долю куска
+/// по всем слотам в буфер результата, после второго барьера забирает весь результат.
+/// Буферы результата чередуются, поэтому третий барьер не нужен.
+///
+/// Данные копируются в память и обратно без ядра и TCP, в отличие от TcpRing через
+/// loopback. Барьер - счетчик в общей памяти с ожиданием через yield. Если процесс
+/// упал, остальные выбрасывают исключение по истечении timeout_ms.
+///
+/// Имя сегмента должно быть уникальным для запуска. После подключения всех
+/// процессов имя удаляется, сегмент живет, пока его держат процессы.
+/// На Linux с glibc старше 2.34 нужно линковать с -lrt.
+///
+
+
+class ShmCommunicator : public Communicator
+{
+private:
+    static const int MAGIC = 0x444e4e53;
+
+    /// <summary>
+    /// Заголовок сегмента. std::atomic<int> без блокировок работает и между процессами.
+    /// </summary>
+    struct Header
+    {
+        std::atomic<int> ready;   // MAGIC, когда процесс 0 заполнил заголовок
+        std::atomic<int> joined;  // кол-во подключившихся процессов
+        std::atomic<int> count;   // барьер: пришедшие процессы
+        std::atomic<int> sense;   // барьер: номер фазы
+        int size;                 // кол-во процессов
+        int capacity;             // размер слота в элементах
+        int scalar_size;          // sizeof(Scalar) у создателя
+    };
+
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+    const int m_rank;
+    const int m_size;
+    const int m_capacity;
+    const int m_timeout_ms;
+    std::size_t m_bytes;      // размер сегмента
+    void* m_base;             // отображение сегмента
+    Header* m_header;
+    Scalar* m_result[2];      // буферы результата
+    Scalar* m_slots;          // слоты процессов, size x capacity
+    int m_sense;              // фаза барьера этого процесса
+    int m_phase;              // текущий буфер результата
+
+# ifdef _WIN32
+    HANDLE m_mapping;
+# endif
+
+    static void fail(const char* msg)
+    {
+        throw std::runtime_error(std::string("[class ShmCommunicator]: ") + msg);
+    }
+
+    /// <summary>
+    /// Заголовок и буферы выравниваются по строке кеша
+    /// </summary>
+    static std::size_t align64(const std::size_t bytes)
+    {
+        return (bytes + 63) / 64 * 64;
+    }
+
+    static std::size_t buffer_bytes(const int capacity)
+    {
+        return align64(std::size_t(capacity) * sizeof(Scalar));
+    }
+
+    Scalar* slot(const int rank) const
+    {
+        return reinterpret_cast<Scalar*>(reinterpret_cast<char*>(m_slots) + rank * buffer_bytes(m_capacity));
+    }
+
+    /// <summary>
+    /// Ожидание условия с yield. false - вышло время.
+    /// </summary>
+    template <typename Cond>
+    bool wait_for(Cond cond) const
+    {
+        const std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(m_timeout_ms);
+
+        for (int spin = 0; !cond(); ++spin)
+        {
+            if (spin < 64) { continue; }
+
+            std::this_thread::yield();
+
+            if ((spin % 1024 == 0) && (std::chrono::steady_clock::now() > deadline)) { return false; }
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Барьер со сменой фазы: последний пришедший сбрасывает счетчик и открывает фазу
+    /// </summary>
+    void barrier()
+    {
+        m_sense = 1 - m_sense;
+
+        if (m_header->count.fetch_add(1) + 1 == m_size)
+        {
+            m_header->count.store(0);
+            m_header->sense.store(m_sense);
+            return;
+        }
+
+        const int sense = m_sense;
+        const Header* header = m_header;
+
+        if (!wait_for([header, sense] { return header->sense.load() == sense; }))
+        {
+            fail("Timed out waiting for other processes");
+        }
+    }
+
+    void chunk(const int n, const int k, int& begin, int& len) const
+    {
+        begin = int((long long)n * k / m_size);
+        len = int((long long)n * (k + 1) / m_size) - begin;
+    }
+
+    /// <summary>
+    /// Создание (процесс 0) или открытие сегмента, отображение в память
+    /// </summary>
+    void map_segment(const std::string& name)
+    {
+# ifdef _WIN32
+        const std::string path = "Local\\" + name;
+        const DWORD high = DWORD(std::uint64_t(m_bytes) >> 32);
+        const DWORD low = DWORD(m_bytes & 0xFFFFFFFFu);
+
+        if (m_rank == 0)
+        {
+            m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, high, low, path.c_str());
+
+            if (m_mapping == NULL) { fail("Cannot create shared memory segment"); }
+        }
+        else
+        {
+            const std::string name_copy = path;
+            HANDLE mapping = NULL;
+
+            wait_for([&mapping, &name_copy] {
+                mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name_copy.c_str());
+                return mapping != NULL;
+            });
+
+            if (mapping == NULL) { fail("Cannot open shared memory segment"); }
+
+            m_mapping = mapping;
+        }
+
+        m_base = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_bytes);
+
+        if (m_base == NULL)
+        {
+            CloseHandle(m_mapping);
+            fail("Cannot map shared memory segment");
+        }
+# else
+        const std::string path = "/" + name;
+        int fd = -1;
+
+        if (m_rank == 0)
+        {
+            // Сегмент упавшего запуска с тем же именем не должен попасть к новым процессам
+            shm_unlink(path.c_str());
+            fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+            if ((fd >= 0) && (ftruncate(fd, off_t(m_bytes)) != 0))
+            {
+                ::close(fd);
+                shm_unlink(path.c_str());
+                fail("Cannot allocate shared memory segment");
+            }
+        }
+        else
+        {
+            // Процесс 0 мог еще не создать сегмент или не задать его размер
+            const std::size_t bytes = m_bytes;
+
+            const bool opened = wait_for([&fd, &path, bytes] {
+                if (fd < 0) { fd = shm_open(path.c_str(), O_RDWR, 0600); }
+
+                struct stat st;
+                return (fd >= 0) && (fstat(fd, &st) == 0) && (std::size_t(st.st_size) >= bytes);
+            });
+
+            if (!opened)
+            {
+                if (fd >= 0) { ::close(fd); }
+                fail("Cannot open shared memory segment");
+            }
+        }
+
+        if (fd < 0) { fail("Cannot create shared memory segment"); }
+
+        m_base = mmap(NULL, m_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (m_base == MAP_FAILED)
+        {
+            m_base = NULL;
+            fail("Cannot map shared memory segment");
+        }
+# endif
+    }
+
+    void unmap_segment()
+    {
+        if (m_base == NULL) { return; }
+
+# ifdef _WIN32
+        UnmapViewOfFile(m_base);
+        CloseHandle(m_mapping);
+# else
+        munmap(m_base, m_bytes);
+# endif
+
+        m_base = NULL;
+    }
+
+public:
+    /// <summary>
+    /// Подключение к сегменту. Конструктор блокируется, пока не подключатся все процессы.
+    /// </summary>
+    /// <param name="rank"> - номер процесса</param>
+    /// <param name="size"> - кол-во процессов</param>
+    /// <param name="name"> - имя сегмента, одно для всех процессов запуска</param>
+    /// <param name="capacity"> - размер слота в элементах Scalar, одинаковый у всех процессов</param>
+    /// <param name="timeout_ms"> - сколько ждать остальные процессы</param>
+    ShmCommunicator(int rank, int size, const std::string& name = "dnn_allreduce",
+        int capacity = 1 << 20, int timeout_ms = 60000) :
+        m_rank(rank),
+        m_size(size),
+        m_capacity(capacity),
+        m_timeout_ms(timeout_ms),
+        m_bytes(0),
+        m_base(NULL),
+        m_header(NULL),
+        m_slots(NULL),
+        m_sense(0),
+        m_phase(0)
+    {
+        if ((size <= 0) || (rank < 0) || (rank >= size) || (capacity <= 0))
+        {
+            throw std::invalid_argument("[class ShmCommunicator]: Incorrect rank, number of processes or capacity");
+        }
+
+        m_result[0] = m_result[1] = NULL;
+
+# ifdef _WIN32
+        m_mapping = NULL;
+# endif
+
+        if (size == 1) { return; }
+
+        const std::size_t header_bytes = align64(sizeof(Header));
+        const std::size_t buffer = buffer_bytes(capacity);
+
+        m_bytes = header_bytes + (2 + std::size_t(size)) * buffer;
+        map_segment(name);
+
+        char* base = static_cast<char*>(m_base);
+
+        m_header = reinterpret_cast<Header*>(base);
+        m_result[0] = reinterpret_cast<Scalar*>(base + header_bytes);
+        m_result[1] = reinterpret_cast<Scalar*>(base + header_bytes + buffer);
+        m_slots = reinterpret_cast<Scalar*>(base + header_bytes + 2 * buffer);
+
+        if (rank == 0)
+        {
+            new (m_header) Header();
+            m_header->joined.store(1);
+            m_header->count.store(0);
+            m_header->sense.store(0);
+            m_header->size = size;
+            m_header->capacity = capacity;
+            m_header->scalar_size = int(sizeof(Scalar));
+            m_header->ready.store(MAGIC);
+        }
+        else
+        {
+            const Header* header = m_header;
+
+            if (!wait_for([header] { return header->ready.load() == MAGIC; }))
+            {
+                unmap_segment();
+                fail("Timed out waiting for process 0");
+            }
+
+            if ((m_header->size != size) || (m_header->capacity != capacity) ||
+                (m_header->scalar_size != int(sizeof(Scalar))))
+            {
+                unmap_segment();
+                fail("Segment was created with a different number of processes, capacity or Scalar");
+            }
+
+            m_header->joined.fetch_add(1);
+        }
+
+        const Header* header = m_header;
+        const bool all = wait_for([header, size] { return header->joined.load() >= size; });
+
+# ifndef _WIN32
+        // Все процессы отобразили сегмент, имя больше не нужно
+        if (rank == 0) { shm_unlink(("/" + name).c_str()); }
+# endif
+
+        if (!all)
+        {
+            unmap_segment();
+            fail("Timed out waiting for other processes to connect");
+        }
+    }
+
+    ~ShmCommunicator()
+    {
+        unmap_segment();
+    }
+
+    int rank() const { return m_rank; }
+
+    int size() const { return m_size; }
+
+    void allreduce_sum(Scalar* data, int n)
+    {
+        if ((m_size == 1) || (n <= 0)) { return; }
+
+        for (int offset = 0; offset < n; offset += m_capacity)
+        {
+            const int len = std::min(m_capacity, n - offset);
+            Scalar* result = m_result[m_phase];
+            int begin, count;
+
+            std::memcpy(slot(m_rank), data + offset, len * sizeof(Scalar));
+            barrier();
+
+            // Своя доля куска, слагаемые в порядке номеров процессов - результат у всех одинаковый
+            chunk(len, m_rank, begin, count);
+
+            if (count > 0)
+            {
+                Eigen::Map<Vector> sum(result + begin, count);
+                sum = Eigen::Map<const Vector>(slot(0) + begin, count);
+
+                for (int r = 1; r < m_size; ++r)
+                {
+                    sum += Eigen::Map<const Vector>(slot(r) + begin, count);
+                }
+            }
+
+            barrier();
+            std::memcpy(data + offset, result, len * sizeof(Scalar));
+            m_phase = 1 - m_phase;
+        }
+    }
+
+    void broadcast(Scalar* data, int n, int root = 0)
+    {
+        if ((m_size == 1) || (n <= 0)) { return; }
+
+        for (int offset = 0; offset < n; offset += m_capacity)
+        {
+            const int len = std::min(m_capacity, n - offset);
+            Scalar* result = m_result[m_phase];
+
+            if (m_rank == root) { std::memcpy(result, data + offset, len * sizeof(Scalar)); }
+
+            barrier();
+
+            if (m_rank != root) { std::memcpy(data + offset, result, len * sizeof(Scalar)); }
+
+            m_phase = 1 - m_phase;
+        }
+    }
+};
@@ -2,20 +2,27 @@
 
 # include <Eigen/Core>
 # include "Config.h"
+# include "CpuDispatch.h"
+# include "FastMath.h"
 
 class Sigmoid
 {
 private:
 	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
 
 public:
-	static inline void activate(const Matrix& Z, Matrix& A)
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
 	{
-		A.array() = Scalar(1) / (Scalar(1) + (-Z.array()).exp());
+		internal::cpu_kernels().sigmoid(Z.data(), Z.outerStride(), A.data(), A.outerStride(), Z.rows(), Z.cols());
 	}
 
-	static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-		const Matrix& F, Matrix& G)
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
 	{
 		G.array() = A.array() * (Scalar(1) - A.array()) * F.array();
 	}
@@ -24,4 +31,36 @@ public:
 	{
 		return "Sigmoid";
 	}
+};
+
+/// <summary>
+/// Sigmoid через sigmoid(z) = (1 + tanh(z / 2)) / 2 на быстром tanh,
+/// абсолютная ошибка не больше 1.5e-7
+/// </summary>
+class FastSigmoid
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		A.array() = Scalar(0.5) + Scalar(0.5) * (Scalar(0.5) * Z.array()).unaryExpr(internal::fast_tanh_op());
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		G.array() = A.array() * (Scalar(1) - A.array()) * F.array();
+	}
+
+	static std::string return_type()
+	{
+		return "FastSigmoid";
+	}
 };
\ No newline at end of file
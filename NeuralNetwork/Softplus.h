@@ -0,0 +1,69 @@
+#pragma once
+
+# include <Eigen/Core>
+# include "Config.h"
+# include "CpuDispatch.h"
+# include "FastMath.h"
+
+/// <summary>
+/// Softplus: log(1 + exp(z)). Производная sigmoid(z) = 1 - exp(-a) считается по выходу.
+/// </summary>
+class Softplus
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		internal::cpu_kernels().softplus(Z.data(), Z.outerStride(), A.data(), A.outerStride(), Z.rows(), Z.cols());
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		internal::cpu_kernels().softplus_jacobian(A.data(), A.outerStride(), F.data(), F.outerStride(),
+			G.data(), G.outerStride(), G.rows(), G.cols());
+	}
+
+	static std::string return_type()
+	{
+		return "Softplus";
+	}
+};
+
+/// <summary>
+/// Softplus через быстрые exp и log, абсолютная ошибка не больше 1.1e-8
+/// </summary>
+class FastSoftplus
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		A = Z.unaryExpr(internal::fast_softplus_op());
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		G.array() = (Scalar(1) - (-A.array()).unaryExpr(internal::fast_exp_op())) * F.array();
+	}
+
+	static std::string return_type()
+	{
+		return "FastSoftplus";
+	}
+};
@@ -0,0 +1,296 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <atomic>
+# include <exception>
+# include <algorithm>
+# include <functional>
+# include <stdexcept>
+# include "Config.h"
+# include "RNG.h"
+# include "Random.h"
+# include "Optimizer.h"
+# include "Validation.h"
+# include "ThreadPool.h"
+# include "NeuralNetwork.h"
+
+///
+/// Обучение нескольких независимых сеток (например, перебор гиперпараметров)
+/// в одном процессе на общем пуле потоков.
+///
+/// Выборка одна на все задачи и только читается: задача держит свой
+/// перемешанный индекс наблюдений и буфер одного батча, а не копию выборки,
+/// как NeuralNetwork::fit() без предвыборки.
+///
+/// Обучение идет ступенями (successive halving): все конфигурации учатся
+/// min_epochs эпох, затем по валидации остается лучшая 1 / eta часть, она
+/// учится до min_epochs * eta эпох, и так до epoch. При min_epochs = 0 все
+/// конфигурации учатся все эпохи.
+///
+/// Внутри ступени задачи раздаются потокам пула по мере освобождения, самые
+/// долгие (параметры x наблюдения x эпохи) - первыми.
+///
+
+
+/// <summary>
+/// Настройки перебора
+/// </summary>
+struct SweepOptions
+{
+    int nthread;                  // потоков, если пул не передан (0 - по числу ядер)
+    int min_epochs;               // эпох на первой ступени, 0 - без отсева
+    int eta;                      // во сколько раз сокращать число конфигураций на ступени
+    ValidationOptions validation; // размер кусков и корзин AUC для валидации
+    std::function<Scalar(const ValidationMetrics&)> score; // чем меньше, тем лучше (по умолчанию MSE)
+
+    SweepOptions() :
+        nthread(0), min_epochs(0), eta(3),
+        score([](const ValidationMetrics& m) { return m.mse; }) {}
+};
+
+/// <summary>
+/// Итог одной задачи
+/// </summary>
+struct SweepResult
+{
+    int epochs;                 // сколько эпох обучена сетка
+    bool stopped;               // отсеяна до конца обучения
+    Scalar score;               // SweepOptions::score последней валидации
+    ValidationMetrics metrics;  // последняя валидация
+
+    SweepResult() : epochs(0), stopped(false), score(0) {}
+};
+
+
+class SweepRunner
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+    struct Job
+    {
+        NeuralNetwork* net;
+        Optimizer* opt;
+        int batch_size;
+        int seed;
+        long long cost;        // параметры сетки, для порядка раздачи
+        Eigen::VectorXi id;    // перемешанные индексы наблюдений
+        int nbatch;
+        Matrix x_batch;        // буфер текущего батча
+        Matrix y_batch;
+        SweepResult result;
+    };
+
+    SweepOptions m_opts;
+    std::vector<Job> m_jobs;
+    ThreadPool* m_pool;
+
+    static long long count_params(const NeuralNetwork& net)
+    {
+        long long n = 0;
+        const std::vector<Layer*>& layers = net.get_layers();
+
+        for (std::size_t i = 0; i < layers.size(); ++i)
+        {
+            n += (long long)(layers[i]->in_size() + 1) * layers[i]->out_size();
+        }
+
+        return n;
+    }
+
+    /// <summary>
+    /// Обучить задачу до target эпох
+    /// </summary>
+    template <typename DerivedX, typename DerivedY>
+    static void train(Job& job, const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y, const int target)
+    {
+        const int nobs = x.cols();
+
+        for (int e = job.result.epochs; e < target; ++e)
+        {
+            for (int i = 0; i < job.nbatch; ++i)
+            {
+                const int bsize = (i == job.nbatch - 1) ? nobs - i * job.batch_size : job.batch_size;
+
+                internal::gather_batch(x, y, job.id.data() + (std::ptrdiff_t)i * job.batch_size, bsize,
+                    job.x_batch, job.y_batch);
+                job.net->train_batch(*job.opt, job.x_batch, job.y_batch);
+            }
+
+            job.result.epochs = e + 1;
+        }
+    }
+
+    /// <summary>
+    /// Задачи alive до target эпох на пуле и их валидация
+    /// </summary>
+    template <typename DerivedX, typename DerivedY>
+    void run_rung(ThreadPool& pool, const std::vector<int>& alive,
+        const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+        const Matrix& x_val, const Matrix& y_val, const int target)
+    {
+        // самые долгие задачи первыми, тогда в конце ступени потоки не простаивают
+        std::vector<int> order(alive);
+        std::stable_sort(order.begin(), order.end(), [this, target](int a, int b) {
+            return m_jobs[a].cost * (target - m_jobs[a].result.epochs) >
+                m_jobs[b].cost * (target - m_jobs[b].result.epochs);
+        });
+
+        const bool validate = x_val.cols() > 0;
+        std::atomic<int> next(0);
+        std::vector<std::exception_ptr> errors(m_jobs.size());
+
+        pool.parallel_for(std::min<int>(pool.size(), int(order.size())), [&](Eigen::Index, Eigen::Index) {
+            for (int t = next++; t < int(order.size()); t = next++)
+            {
+                Job& job = m_jobs[order[t]];
+
+                try
+                {
+                    train(job, x, y, target);
+
+                    if (validate)
+                    {
+                        job.result.metrics = internal::evaluate_layers(job.net->get_layers(),
+                            x_val, y_val, m_opts.validation);
+                        job.result.score = m_opts.score(job.result.metrics);
+                    }
+                }
+                catch (...) { errors[order[t]] = std::current_exception(); }
+            }
+        });
+
+        for (std::size_t j = 0; j < errors.size(); ++j)
+        {
+            if (errors[j]) { std::rethrow_exception(errors[j]); }
+        }
+    }
+
+public:
+    explicit SweepRunner(const SweepOptions& opts = SweepOptions()) :
+        m_opts(opts), m_pool(NULL) {}
+
+    /// <summary>
+    /// Считать на готовом пуле вместо своего, NULL - свой пул на SweepOptions::nthread потоков
+    /// </summary>
+    void set_thread_pool(ThreadPool* pool) { m_pool = pool; }
+
+    /// <summary>
+    /// Добавить конфигурацию. Сетка должна быть инициализирована (init()),
+    /// сетка и оптимайзер должны жить до конца run() и не делиться с другими задачами.
+    /// </summary>
+    /// <param name="net"> - сетка</param>
+    /// <param name="opt"> - оптимайзер этой сетки</param>
+    /// <param name="batch_size"> - размер батча</param>
+    /// <param name="seed"> - сид перемешивания наблюдений</param>
+    /// <returns>Номер задачи</returns>
+    int add_job(NeuralNetwork& net, Optimizer& opt, int batch_size, int seed = 1)
+    {
+        if (net.count_layers() == 0 || net.get_output() == NULL)
+        {
+            throw std::invalid_argument("[class SweepRunner]: Network must have layers and an output layer");
+        }
+
+        Job job;
+        job.net = &net;
+        job.opt = &opt;
+        job.batch_size = batch_size;
+        job.seed = seed;
+        job.cost = count_params(net);
+        job.nbatch = 0;
+
+        m_jobs.push_back(job);
+
+        return int(m_jobs.size()) - 1;
+    }
+
+    int count_jobs() const { return int(m_jobs.size()); }
+
+    /// <summary>
+    /// Обучение всех задач
+    /// </summary>
+    /// <param name="x"> - общая выборка (признаки x наблюдения), только читается</param>
+    /// <param name="y"> - общий таргет</param>
+    /// <param name="x_val"> - валидационные данные для отсева и итоговых метрик, может быть пустой без отсева</param>
+    /// <param name="y_val"> - валидационный таргет</param>
+    /// <param name="epoch"> - кол-во эпох для лучших конфигураций</param>
+    /// <returns>Итоги в порядке добавления задач</returns>
+    template <typename DerivedX, typename DerivedY>
+    std::vector<SweepResult> run(const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+        const Matrix& x_val, const Matrix& y_val, const int epoch)
+    {
+        if (m_opts.min_epochs > 0 && x_val.cols() == 0)
+        {
+            throw std::invalid_argument("[class SweepRunner]: Successive halving needs validation data");
+        }
+
+        if (m_opts.min_epochs > 0 && m_opts.eta < 2)
+        {
+            throw std::invalid_argument("[class SweepRunner]: eta must be at least 2");
+        }
+
+        ThreadPool* own = m_pool ? NULL : new ThreadPool(m_opts.nthread);
+        ThreadPool& pool = m_pool ? *m_pool : *own;
+        std::vector<int> alive;
+
+        for (std::size_t j = 0; j < m_jobs.size(); ++j)
+        {
+            Job& job = m_jobs[j];
+            RNG rng(job.seed);
+
+            job.nbatch = internal::shuffled_index(x, y, job.batch_size, rng, job.id,
+                internal::sequence_length(job.net->get_layers()));
+            job.result = SweepResult();
+            job.opt->reset();
+            job.net->set_quantized(false);
+            alive.push_back(int(j));
+        }
+
+        try
+        {
+            int target = (m_opts.min_epochs > 0) ? std::min(m_opts.min_epochs, epoch) : epoch;
+
+            while (!alive.empty())
+            {
+                run_rung(pool, alive, x, y, x_val, y_val, target);
+
+                if (target >= epoch) { break; }
+
+                // оставляем лучшую 1 / eta часть
+                std::stable_sort(alive.begin(), alive.end(), [this](int a, int b) {
+                    return m_jobs[a].result.score < m_jobs[b].result.score;
+                });
+
+                const std::size_t keep = std::max<std::size_t>(1, (alive.size() + m_opts.eta - 1) / m_opts.eta);
+
+                for (std::size_t k = keep; k < alive.size(); ++k)
+                {
+                    m_jobs[alive[k]].result.stopped = true;
+                }
+
+                alive.resize(keep);
+                target = int(std::min<long long>((long long)target * m_opts.eta, epoch));
+            }
+        }
+        catch (...)
+        {
+            delete own;
+            throw;
+        }
+
+        delete own;
+
+        std::vector<SweepResult> res;
+
+        for (std::size_t j = 0; j < m_jobs.size(); ++j)
+        {
+            // буферы батча больше не нужны
+            m_jobs[j].x_batch.resize(0, 0);
+            m_jobs[j].y_batch.resize(0, 0);
+            res.push_back(m_jobs[j].result);
+        }
+
+        return res;
+    }
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+# include <Eigen/Core>
+# include "Config.h"
+# include "CpuDispatch.h"
+# include "FastMath.h"
+
+/// <summary>
+/// Swish (SiLU): z * sigmoid(z). Производная s * (1 + z - a), s = sigmoid(z).
+/// </summary>
+class Swish
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производной нужен Z
+	static const bool derivative_from_output = false;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		internal::cpu_kernels().swish(Z.data(), Z.outerStride(), A.data(), A.outerStride(), Z.rows(), Z.cols());
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		internal::cpu_kernels().swish_jacobian(Z.data(), Z.outerStride(), A.data(), A.outerStride(), F.data(), F.outerStride(),
+			G.data(), G.outerStride(), G.rows(), G.cols());
+	}
+
+	static std::string return_type()
+	{
+		return "Swish";
+	}
+};
+
+/// <summary>
+/// Swish через sigmoid(z) = (1 + tanh(z / 2)) / 2 на быстром tanh,
+/// абсолютная ошибка не больше 1.5e-7 * |z|
+/// </summary>
+class FastSwish
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производной нужен Z
+	static const bool derivative_from_output = false;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		A.array() = Z.array() * (Scalar(0.5) + Scalar(0.5) *
+			(Scalar(0.5) * Z.array()).unaryExpr(internal::fast_tanh_op()));
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		G.array() = F.array() * (Scalar(0.5) + Scalar(0.5) *
+			(Scalar(0.5) * Z.array()).unaryExpr(internal::fast_tanh_op())) * (Scalar(1) + Z.array() - A.array());
+	}
+
+	static std::string return_type()
+	{
+		return "FastSwish";
+	}
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+# include <Eigen/Core>
+# include "Config.h"
+# include "CpuDispatch.h"
+# include "FastMath.h"
+
+/// <summary>
+/// Tanh через векторизованный exp: 2 / (1 + exp(-2z)) - 1, как в Recurrent.h
+/// </summary>
+class Tanh
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		internal::cpu_kernels().tanh(Z.data(), Z.outerStride(), A.data(), A.outerStride(), Z.rows(), Z.cols());
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		G.array() = (Scalar(1) - A.array().square()) * F.array();
+	}
+
+	static std::string return_type()
+	{
+		return "Tanh";
+	}
+};
+
+/// <summary>
+/// Tanh через рациональное приближение, абсолютная ошибка не больше 3e-7
+/// </summary>
+class FastTanh
+{
+private:
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+	typedef Eigen::Ref<const Matrix> ConstRefMatrix;
+	typedef Eigen::Ref<Matrix> RefMatrix;
+
+public:
+	/// Производная считается по выходу A, Z не нужен
+	static const bool derivative_from_output = true;
+
+	static inline void activate(const ConstRefMatrix& Z, RefMatrix A)
+	{
+		A = Z.unaryExpr(internal::fast_tanh_op());
+	}
+
+	static inline void apply_jacobian(const ConstRefMatrix& Z, const ConstRefMatrix& A,
+		const ConstRefMatrix& F, RefMatrix G)
+	{
+		G.array() = (Scalar(1) - A.array().square()) * F.array();
+	}
+
+	static std::string return_type()
+	{
+		return "FastTanh";
+	}
+};
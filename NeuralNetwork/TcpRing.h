@@ -0,0 +1,375 @@
+#pragma once
+
+# include <vector>
+# include <string>
+# include <thread>
+# include <chrono>
+# include <cstring>
+# include <stdexcept>
+# include "Config.h"
+# include "Communicator.h"
+
+# ifdef _WIN32
+# include <winsock2.h>
+# include <ws2tcpip.h>
+# pragma comment(lib, "ws2_32.lib")
+# else
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+# include <netdb.h>
+# include <poll.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <cerrno>
+# endif
+
+///
+/// Кольцевой all-reduce по TCP.
+///
+/// Процессы образуют кольцо: каждый слушает порт base_port + rank, подключается
+/// к следующему и принимает подключение от предыдущего. Сумма считается
+/// в два прохода по кольцу (reduce-scatter, затем all-gather), каждый процесс
+/// передает 2 * (size - 1) / size объема вектора независимо от числа процессов.
+///
+/// Несколько процессов на одной машине общаются через loopback.
+///
+
+
+namespace internal
+{
+# ifdef _WIN32
+    typedef SOCKET socket_t;
+    static const socket_t INVALID_SOCKET_T = INVALID_SOCKET;
+
+    inline void close_socket(socket_t s) { closesocket(s); }
+    inline int poll_sockets(WSAPOLLFD* fds, int n, int timeout) { return WSAPoll(fds, n, timeout); }
+    inline bool would_block() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+
+    inline void set_nonblocking(socket_t s)
+    {
+        u_long mode = 1;
+        ioctlsocket(s, FIONBIO, &mode);
+    }
+
+    static const int SEND_FLAGS = 0;
+
+    inline void set_nosigpipe(socket_t) {}
+
+    typedef WSAPOLLFD pollfd_t;
+# else
+    typedef int socket_t;
+    static const socket_t INVALID_SOCKET_T = -1;
+
+    inline void close_socket(socket_t s) { ::close(s); }
+    inline int poll_sockets(pollfd* fds, int n, int timeout) { return ::poll(fds, n, timeout); }
+    inline bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+
+    inline void set_nonblocking(socket_t s)
+    {
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    // send() в закрытое соединение не должен убивать процесс сигналом SIGPIPE:
+    // он вернет EPIPE, и обмен выбросит исключение. Linux - флаг send(),
+    // macOS / BSD - опция сокета
+# ifdef MSG_NOSIGNAL
+    static const int SEND_FLAGS = MSG_NOSIGNAL;
+# else
+    static const int SEND_FLAGS = 0;
+# endif
+
+    inline void set_nosigpipe(socket_t s)
+    {
+# ifdef SO_NOSIGPIPE
+        int flag = 1;
+        setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &flag, sizeof(flag));
+# else
+        (void)s;
+# endif
+    }
+
+    typedef pollfd pollfd_t;
+# endif
+}
+
+
+class TcpRing : public Communicator
+{
+private:
+    typedef internal::socket_t socket_t;
+
+    const int m_rank;
+    const int m_size;
+    socket_t m_next;              // сокет к следующему процессу (отправка)
+    socket_t m_prev;              // сокет от предыдущего процесса (прием)
+    std::vector<Scalar> m_recv;   // буфер приема куска вектора
+
+    static void fail(const char* msg)
+    {
+        throw std::runtime_error(std::string("[class TcpRing]: ") + msg);
+    }
+
+    static void set_nodelay(socket_t s)
+    {
+        int flag = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&flag), sizeof(flag));
+    }
+
+    static socket_t listen_on(const int port)
+    {
+        socket_t s = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (s == internal::INVALID_SOCKET_T) { fail("Cannot create socket"); }
+
+        int flag = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&flag), sizeof(flag));
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(static_cast<unsigned short>(port));
+
+        if ((bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) || (listen(s, 1) != 0))
+        {
+            internal::close_socket(s);
+            fail("Cannot listen on port");
+        }
+
+        return s;
+    }
+
+    /// <summary>
+    /// Подключение к следующему процессу, пока он не начнет слушать
+    /// </summary>
+    static socket_t connect_to(const std::string& host, const int port, const int timeout_ms)
+    {
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* info = NULL;
+
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &info) != 0)
+        {
+            fail("Cannot resolve host");
+        }
+
+        const std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+        for (;;)
+        {
+            socket_t s = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+
+            if ((s != internal::INVALID_SOCKET_T) && (connect(s, info->ai_addr, int(info->ai_addrlen)) == 0))
+            {
+                freeaddrinfo(info);
+                return s;
+            }
+
+            if (s != internal::INVALID_SOCKET_T) { internal::close_socket(s); }
+
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                freeaddrinfo(info);
+                fail("Cannot connect to the next process");
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    /// <summary>
+    /// Одновременная отправка следующему и прием от предыдущего процесса.
+    /// Без этого большие куски блокировали бы send() у всех процессов сразу.
+    /// </summary>
+    void exchange(const void* send_buf, std::size_t send_bytes, void* recv_buf, std::size_t recv_bytes)
+    {
+        const char* sptr = static_cast<const char*>(send_buf);
+        char* rptr = static_cast<char*>(recv_buf);
+
+        while ((send_bytes > 0) || (recv_bytes > 0))
+        {
+            internal::pollfd_t fds[2];
+            int nfds = 0;
+            int isend = -1, irecv = -1;
+
+            if (send_bytes > 0)
+            {
+                fds[nfds].fd = m_next;
+                fds[nfds].events = POLLOUT;
+                fds[nfds].revents = 0;
+                isend = nfds++;
+            }
+
+            if (recv_bytes > 0)
+            {
+                fds[nfds].fd = m_prev;
+                fds[nfds].events = POLLIN;
+                fds[nfds].revents = 0;
+                irecv = nfds++;
+            }
+
+            if (internal::poll_sockets(fds, nfds, -1) < 0)
+            {
+                if (internal::would_block()) { continue; }
+                fail("poll() failed");
+            }
+
+            if ((isend >= 0) && (fds[isend].revents & (POLLOUT | POLLERR | POLLHUP)))
+            {
+                const int n = send(m_next, sptr, int(std::min<std::size_t>(send_bytes, 1 << 20)), internal::SEND_FLAGS);
+
+                if (n > 0) { sptr += n; send_bytes -= n; }
+                else if (!internal::would_block()) { fail("Connection to the next process is lost"); }
+            }
+
+            if ((irecv >= 0) && (fds[irecv].revents & (POLLIN | POLLERR | POLLHUP)))
+            {
+                const int n = recv(m_prev, rptr, int(std::min<std::size_t>(recv_bytes, 1 << 20)), 0);
+
+                if (n > 0) { rptr += n; recv_bytes -= n; }
+                else if ((n == 0) || !internal::would_block()) { fail("Connection to the previous process is lost"); }
+            }
+        }
+    }
+
+    void chunk(const int n, const int k, int& begin, int& len) const
+    {
+        begin = int((long long)n * k / m_size);
+        len = int((long long)n * (k + 1) / m_size) - begin;
+    }
+
+public:
+    /// <summary>
+    /// Построение кольца. Конструктор блокируется, пока все процессы не подключатся.
+    /// </summary>
+    /// <param name="rank"> - номер процесса</param>
+    /// <param name="size"> - кол-во процессов</param>
+    /// <param name="base_port"> - процесс rank слушает порт base_port + rank</param>
+    /// <param name="hosts"> - адреса процессов по номерам, пусто - все на 127.0.0.1</param>
+    /// <param name="timeout_ms"> - сколько ждать подключения к следующему процессу</param>
+    TcpRing(int rank, int size, int base_port = 29500,
+        const std::vector<std::string>& hosts = std::vector<std::string>(), int timeout_ms = 60000) :
+        m_rank(rank),
+        m_size(size),
+        m_next(internal::INVALID_SOCKET_T),
+        m_prev(internal::INVALID_SOCKET_T)
+    {
+        if ((size <= 0) || (rank < 0) || (rank >= size))
+        {
+            throw std::invalid_argument("[class TcpRing]: Incorrect rank or number of processes");
+        }
+
+        if (!hosts.empty() && int(hosts.size()) != size)
+        {
+            throw std::invalid_argument("[class TcpRing]: Number of hosts does not match number of processes");
+        }
+
+        if (size == 1) { return; }
+
+# ifdef _WIN32
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+# endif
+
+        const int next = (rank + 1) % size;
+        const socket_t listener = listen_on(base_port + rank);
+
+        try
+        {
+            m_next = connect_to(hosts.empty() ? std::string("127.0.0.1") : hosts[next],
+                base_port + next, timeout_ms);
+        }
+        catch (...)
+        {
+            internal::close_socket(listener);
+            throw;
+        }
+
+        m_prev = accept(listener, NULL, NULL);
+        internal::close_socket(listener);
+
+        if (m_prev == internal::INVALID_SOCKET_T) { fail("Cannot accept the previous process"); }
+
+        set_nodelay(m_next);
+        set_nodelay(m_prev);
+        internal::set_nosigpipe(m_next);
+        internal::set_nonblocking(m_next);
+        internal::set_nonblocking(m_prev);
+
+        // Проверяем, что кольцо собралось в правильном порядке
+        int prev_rank = -1;
+        exchange(&m_rank, sizeof(int), &prev_rank, sizeof(int));
+
+        if (prev_rank != (rank + size - 1) % size) { fail("Ring is assembled in the wrong order"); }
+    }
+
+    ~TcpRing()
+    {
+        if (m_next != internal::INVALID_SOCKET_T) { internal::close_socket(m_next); }
+        if (m_prev != internal::INVALID_SOCKET_T) { internal::close_socket(m_prev); }
+
+# ifdef _WIN32
+        if (m_size > 1) { WSACleanup(); }
+# endif
+    }
+
+    int rank() const { return m_rank; }
+
+    int size() const { return m_size; }
+
+    void allreduce_sum(Scalar* data, int n)
+    {
+        if ((m_size == 1) || (n <= 0)) { return; }
+
+        m_recv.resize(n / m_size + 1);
+
+        int sbeg, slen, rbeg, rlen;
+
+        // reduce-scatter: после size - 1 шагов процесс держит полную сумму куска rank + 1
+        for (int s = 0; s < m_size - 1; ++s)
+        {
+            chunk(n, (m_rank - s + m_size) % m_size, sbeg, slen);
+            chunk(n, (m_rank - s - 1 + 2 * m_size) % m_size, rbeg, rlen);
+
+            exchange(data + sbeg, slen * sizeof(Scalar), &m_recv[0], rlen * sizeof(Scalar));
+
+            for (int k = 0; k < rlen; ++k)
+            {
+                data[rbeg + k] += m_recv[k];
+            }
+        }
+
+        // all-gather: раздаем готовые куски по кольцу
+        for (int s = 0; s < m_size - 1; ++s)
+        {
+            chunk(n, (m_rank + 1 - s + m_size) % m_size, sbeg, slen);
+            chunk(n, (m_rank - s + m_size) % m_size, rbeg, rlen);
+
+            exchange(data + sbeg, slen * sizeof(Scalar), data + rbeg, rlen * sizeof(Scalar));
+        }
+    }
+
+    void broadcast(Scalar* data, int n, int root = 0)
+    {
+        if ((m_size == 1) || (n <= 0)) { return; }
+
+        const std::size_t bytes = n * sizeof(Scalar);
+
+        // Данные идут по кольцу от root, последний процесс перед root только принимает
+        if (m_rank != root)
+        {
+            exchange(NULL, 0, data, bytes);
+        }
+
+        if ((m_rank + 1) % m_size != root)
+        {
+            exchange(data, bytes, NULL, 0);
+        }
+    }
+};
@@ -0,0 +1,269 @@
+#pragma once
+
+# include <Eigen/Core>
+# include <unsupported/Eigen/CXX11/ThreadPool>
+# include <vector>
+# include <string>
+# include <fstream>
+# include <sstream>
+# include <thread>
+# include <exception>
+# include <algorithm>
+# include "Config.h"
+
+# ifdef _WIN32
+# ifndef NOMINMAX
+# define NOMINMAX
+# endif
+# include <windows.h>
+# elif defined(__linux__)
+# include <pthread.h>
+# include <sched.h>
+# endif
+
+///
+/// Общий пул потоков библиотеки поверх Eigen::ThreadPool.
+///
+/// Потоки пула закрепляются за заданными ядрами. Работа делится на статические
+/// блоки: блок b ставится в очередь потока b, и обычно один и тот же поток каждый
+/// батч пишет одни и те же столбцы буферов слоя. Это предпочтение, а не
+/// гарантия: Eigen::ThreadPool крадет работу, и свободный поток может забрать
+/// блок из чужой очереди. Страницы при этом остаются на узле, где их впервые
+/// записали, так что с одним пулом на узел NUMA (см. ниже) кража не уводит
+/// доступ на чужой узел. Память выделяется без записи, а первая запись идет из
+/// потока пула (ThreadPool::run()), и по политике first-touch страницы
+/// оказываются на узле NUMA этого потока.
+///
+/// Пул передается в NeuralNetwork::set_thread_pool() и используется для GEMM и
+/// поэлементных функций FullyConnected и для сборки батчей. Для одной модели на
+/// сокет у каждой модели свой пул на ядрах своего узла (ThreadPool::node_cores()).
+///
+
+
+namespace internal
+{
+    /// <summary>
+    /// Закрепить текущий поток за ядром
+    /// </summary>
+    inline bool pin_current_thread(const int core)
+    {
+# ifdef _WIN32
+        return core < 64 && SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+# elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+# else
+        (void)core;
+        return false;
+# endif
+    }
+
+    /// <summary>
+    /// Окружение Eigen::ThreadPoolTempl: поток i закрепляется за ядром cores[i % cores.size()].
+    /// Eigen создает потоки по порядку номеров, поэтому номер потока совпадает с номером ядра в списке.
+    /// </summary>
+    struct PinnedThreadEnvironment : public Eigen::StlThreadEnvironment
+    {
+        std::vector<int> cores;
+        int created;
+
+        PinnedThreadEnvironment() : created(0) {}
+
+        explicit PinnedThreadEnvironment(const std::vector<int>& cores_) :
+            cores(cores_), created(0) {}
+
+        EnvThread* CreateThread(std::function<void()> f)
+        {
+            const int i = created++;
+
+            if (cores.empty()) { return new EnvThread(std::move(f)); }
+
+            const int core = cores[i % cores.size()];
+
+            return new EnvThread([core, f]() {
+                pin_current_thread(core);
+                f();
+            });
+        }
+    };
+}
+
+
+class ThreadPool
+{
+private:
+    typedef Eigen::ThreadPoolTempl<internal::PinnedThreadEnvironment> Pool;
+
+    std::vector<int> m_cores; // ядра потоков, пусто - без закрепления
+    Pool m_pool;
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    static int default_threads(const int nthread, const std::vector<int>& cores)
+    {
+        if (nthread > 0) { return nthread; }
+
+        if (!cores.empty()) { return int(cores.size()); }
+
+        return std::max(1, int(std::thread::hardware_concurrency()));
+    }
+
+public:
+    /// <param name="nthread"> - кол-во потоков, 0 - по числу ядер в cores или в системе</param>
+    /// <param name="cores"> - ядра для закрепления потоков, пусто - не закреплять</param>
+    explicit ThreadPool(const int nthread = 0, const std::vector<int>& cores = std::vector<int>()) :
+        m_cores(cores),
+        m_pool(default_threads(nthread, cores), internal::PinnedThreadEnvironment(cores)) {}
+
+    /// <summary>
+    /// Кол-во потоков
+    /// </summary>
+    int size() const { return m_pool.NumThreads(); }
+
+    const std::vector<int>& cores() const { return m_cores; }
+
+    /// <summary>
+    /// Вызывается ли код из потока этого пула
+    /// </summary>
+    bool in_worker() const { return m_pool.CurrentThreadId() >= 0; }
+
+    /// <summary>
+    /// f(begin, end) по не более чем size() блокам [0, n), блок b - в очередь потока b
+    /// (выполнить его может и другой поток пула, если украдет). Ждет завершения всех
+    /// блоков. Внутри потока пула выполняется сразу целиком, чтобы вложенный вызов не
+    /// ждал сам себя.
+    /// </summary>
+    /// <param name="n"> - размер диапазона</param>
+    /// <param name="f"> - обработка блока</param>
+    /// <param name="min_block"> - минимальный размер блока</param>
+    template <typename Func>
+    void parallel_for(const Eigen::Index n, Func f, const Eigen::Index min_block = 1)
+    {
+        if (n <= 0) { return; }
+
+        const int nblock = int(std::min<Eigen::Index>(size(), std::max<Eigen::Index>(1, n / std::max<Eigen::Index>(1, min_block))));
+
+        if (nblock <= 1 || in_worker())
+        {
+            f(Eigen::Index(0), n);
+            return;
+        }
+
+        Eigen::Barrier barrier(nblock);
+        std::vector<std::exception_ptr> errors(nblock);
+
+        for (int b = 0; b < nblock; ++b)
+        {
+            const Eigen::Index begin = n * b / nblock;
+            const Eigen::Index end = n * (b + 1) / nblock;
+
+            m_pool.ScheduleWithHint([&f, &barrier, &errors, b, begin, end]() {
+                try { f(begin, end); }
+                catch (...) { errors[b] = std::current_exception(); }
+
+                barrier.Notify();
+            }, b, b + 1);
+        }
+
+        barrier.Wait();
+
+        for (int b = 0; b < nblock; ++b)
+        {
+            if (errors[b]) { std::rethrow_exception(errors[b]); }
+        }
+    }
+
+    /// <summary>
+    /// Выполнить f в потоке пула и дождаться. Память, которую f выделит
+    /// и заполнит, окажется на узле NUMA этого потока. Изнутри потока пула
+    /// выполняется сразу.
+    /// </summary>
+    template <typename Func>
+    void run(Func f)
+    {
+        if (in_worker())
+        {
+            f();
+            return;
+        }
+
+        Eigen::Barrier barrier(1);
+        std::exception_ptr error;
+
+        m_pool.Schedule([&f, &barrier, &error]() {
+            try { f(); }
+            catch (...) { error = std::current_exception(); }
+
+            barrier.Notify();
+        });
+
+        barrier.Wait();
+
+        if (error) { std::rethrow_exception(error); }
+    }
+
+    /// <summary>
+    /// Ядра узла NUMA (Linux - /sys/devices/system/node, Windows - GetNumaNodeProcessorMask).
+    /// Пусто, если узла нет или система не сообщает.
+    /// </summary>
+    static std::vector<int> node_cores(const int node)
+    {
+        std::vector<int> cores;
+
+# ifdef _WIN32
+        ULONGLONG mask = 0;
+
+        if (GetNumaNodeProcessorMask(UCHAR(node), &mask))
+        {
+            for (int c = 0; c < 64; ++c)
+            {
+                if (mask & (ULONGLONG(1) << c)) { cores.push_back(c); }
+            }
+        }
+# else
+        // Формат cpulist: "0-3,8-11"
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+
+        if (!std::getline(in, list)) { return cores; }
+
+        std::stringstream ss(list);
+        std::string range;
+
+        while (std::getline(ss, range, ','))
+        {
+            if (range.empty()) { continue; }
+
+            const std::size_t dash = range.find('-');
+            const int first = std::atoi(range.c_str());
+            const int last = (dash == std::string::npos) ? first : std::atoi(range.c_str() + dash + 1);
+
+            for (int c = first; c <= last; ++c) { cores.push_back(c); }
+        }
+# endif
+
+        return cores;
+    }
+
+    /// <summary>
+    /// Кол-во узлов NUMA, 1 - если система не сообщает
+    /// </summary>
+    static int numa_nodes()
+    {
+# ifdef _WIN32
+        ULONG highest = 0;
+
+        return GetNumaHighestNodeNumber(&highest) ? int(highest) + 1 : 1;
+# else
+        int n = 0;
+
+        while (!node_cores(n).empty()) { n++; }
+
+        return std::max(1, n);
+# endif
+    }
+};
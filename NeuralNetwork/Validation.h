@@ -0,0 +1,334 @@
+﻿#pragma once
+
+# include <Eigen/Core>
+# include <vector>
+# include <thread>
+# include <future>
+# include <chrono>
+# include <cmath>
+# include <algorithm>
+# include <stdexcept>
+# include "Config.h"
+# include "Layer.h"
+
+///
+/// Потоковый расчет метрик на валидационной выборке во время NeuralNetwork::fit().
+///
+/// Валидация идет кусками по chunk_size наблюдений, поэтому слоям не нужно
+/// держать m_z / m_a на всю выборку сразу. Метрики накапливаются по кускам,
+/// AUC считается по гистограмме предсказаний без сортировки.
+///
+
+
+///
+/// Настройки валидации
+///
+struct ValidationOptions
+{
+    int every_n_batches; // как часто валидировать (0 - только в конце каждой эпохи)
+    int chunk_size;      // сколько наблюдений прогонять через сетку за раз
+    int auc_bins;        // кол-во корзин гистограммы для AUC
+    bool async;          // валидировать копию весов в отдельном потоке
+
+    ValidationOptions() :
+        every_n_batches(0), chunk_size(1024), auc_bins(1024), async(false) {}
+};
+
+
+///
+/// Результат валидации
+///
+struct ValidationMetrics
+{
+    int epoch;        // эпоха, на которой сделан снимок весов
+    int batch;        // батч, после которого сделан снимок весов
+    long long nobs;   // кол-во наблюдений
+    Scalar mse;       // средняя квадратичная ошибка (по всем выходам)
+    Scalar mae;       // средняя абсолютная ошибка (по всем выходам)
+    Scalar accuracy;  // доля верных классов (порог 0.5 или argmax)
+    Scalar log_loss;  // бинарная / категориальная кросс-энтропия
+    Scalar auc;       // ROC AUC (среднее по выходам)
+
+    ValidationMetrics() :
+        epoch(0), batch(0), nobs(0), mse(0), mae(0), accuracy(0), log_loss(0), auc(0) {}
+};
+
+
+namespace internal
+{
+    /// <summary>
+    /// Накопитель метрик по кускам выборки
+    /// </summary>
+    class MetricsAccumulator
+    {
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Matrix<long long, Eigen::Dynamic, Eigen::Dynamic> CountMatrix;
+
+        const int m_bins;
+        long long m_nobs;
+        long long m_nvalues;
+        long long m_correct;
+        Scalar m_sq_err;
+        Scalar m_abs_err;
+        Scalar m_log_loss;
+        CountMatrix m_pos; // гистограмма предсказаний положительного класса (bins x выходы)
+        CountMatrix m_neg; // гистограмма предсказаний отрицательного класса
+
+    public:
+        explicit MetricsAccumulator(const int bins) :
+            m_bins(bins), m_nobs(0), m_nvalues(0), m_correct(0),
+            m_sq_err(0), m_abs_err(0), m_log_loss(0) {}
+
+        void add(const Matrix& pred, const Matrix& target)
+        {
+            const Scalar eps = Scalar(1e-12);
+            const int nout = pred.rows();
+            const int ncols = pred.cols();
+
+            if (m_pos.size() == 0)
+            {
+                m_pos.setZero(m_bins, nout);
+                m_neg.setZero(m_bins, nout);
+            }
+
+            const Matrix diff = pred - target;
+            m_sq_err += diff.squaredNorm();
+            m_abs_err += diff.cwiseAbs().sum();
+
+            const Matrix p = pred.cwiseMax(eps).cwiseMin(Scalar(1) - eps);
+
+            if (nout == 1)
+            {
+                m_log_loss -= (target.array() * p.array().log() +
+                    (Scalar(1) - target.array()) * (Scalar(1) - p.array()).log()).sum();
+                m_correct += ((pred.array() >= Scalar(0.5)) == (target.array() >= Scalar(0.5))).count();
+            }
+            else
+            {
+                m_log_loss -= (target.array() * p.array().log()).sum();
+
+                for (int j = 0; j < ncols; ++j)
+                {
+                    int ip, it;
+                    pred.col(j).maxCoeff(&ip);
+                    target.col(j).maxCoeff(&it);
+                    m_correct += (ip == it);
+                }
+            }
+
+            for (int j = 0; j < ncols; ++j)
+            {
+                for (int r = 0; r < nout; ++r)
+                {
+                    const int b = std::min(m_bins - 1, int(p(r, j) * m_bins));
+
+                    if (target(r, j) >= Scalar(0.5)) { m_pos(b, r)++; }
+                    else { m_neg(b, r)++; }
+                }
+            }
+
+            m_nobs += ncols;
+            m_nvalues += pred.size();
+        }
+
+        ValidationMetrics result() const
+        {
+            ValidationMetrics res;
+
+            if (m_nobs == 0) { return res; }
+
+            res.nobs = m_nobs;
+            res.mse = m_sq_err / m_nvalues;
+            res.mae = m_abs_err / m_nvalues;
+            res.accuracy = Scalar(m_correct) / m_nobs;
+            res.log_loss = m_log_loss / m_nobs;
+
+            // AUC = P(score(pos) > score(neg)), наблюдения в одной корзине считаются за 1/2
+            Scalar auc_sum = 0;
+            int nauc = 0;
+
+            for (int r = 0; r < m_pos.cols(); ++r)
+            {
+                const Scalar npos = Scalar(m_pos.col(r).sum());
+                const Scalar nneg = Scalar(m_neg.col(r).sum());
+
+                if ((npos == 0) || (nneg == 0)) { continue; }
+
+                Scalar neg_below = 0;
+                Scalar area = 0;
+
+                for (int b = 0; b < m_bins; ++b)
+                {
+                    area += Scalar(m_pos(b, r)) * (neg_below + Scalar(0.5) * Scalar(m_neg(b, r)));
+                    neg_below += Scalar(m_neg(b, r));
+                }
+
+                auc_sum += area / (npos * nneg);
+                nauc++;
+            }
+
+            res.auc = nauc > 0 ? auc_sum / nauc : Scalar(0);
+
+            return res;
+        }
+    };
+
+
+    /// <summary>
+    /// Прогон выборки кусками через цепочку слоев с накоплением метрик
+    /// </summary>
+    template <typename Matrix>
+    inline ValidationMetrics evaluate_layers(const std::vector<Layer*>& layers,
+        const Matrix& x, const Matrix& y, const ValidationOptions& opts)
+    {
+        const int nlayer = layers.size();
+        const int nobs = x.cols();
+        const int group = sequence_length(layers);
+
+        // куски из целых последовательностей
+        const int chunk = std::max(group, opts.chunk_size / group * group);
+
+        MetricsAccumulator acc(opts.auc_bins);
+
+        if (nlayer <= 0) { return acc.result(); }
+
+        for (int c = 0; c < nobs; c += chunk)
+        {
+            const int n = std::min(chunk, nobs - c);
+            layers[0]->forward_ref(x.middleCols(c, n));
+
+            for (int i = 1; i < nlayer; ++i)
+            {
+                layers[i]->forward(layers[i - 1]->output());
+            }
+
+            acc.add(layers[nlayer - 1]->output(), y.middleCols(c, n));
+        }
+
+        return acc.result();
+    }
+
+
+    /// <summary>
+    /// Планировщик валидации внутри NeuralNetwork::fit()
+    /// </summary>
+    class Validator
+    {
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+        const Matrix& m_x;
+        const Matrix& m_y;
+        const ValidationOptions m_opts;
+
+        std::vector<Layer*> m_snapshot;           // копия слоев для асинхронной валидации
+        std::future<ValidationMetrics> m_pending; // незавершенная асинхронная валидация
+
+        void release_snapshot()
+        {
+            for (std::size_t i = 0; i < m_snapshot.size(); ++i)
+            {
+                delete m_snapshot[i];
+            }
+
+            m_snapshot.clear();
+        }
+
+    public:
+        Validator(const Matrix& x, const Matrix& y, const ValidationOptions& opts) :
+            m_x(x), m_y(y), m_opts(opts)
+        {
+            if (x.cols() != y.cols())
+            {
+                throw std::invalid_argument("[class Validator]: Validation X and Y have different number of observations");
+            }
+        }
+
+        ~Validator()
+        {
+            if (m_pending.valid()) { m_pending.wait(); }
+
+            release_snapshot();
+        }
+
+        /// <summary>
+        /// Нужна ли валидация после батча batch_id из nbatch
+        /// </summary>
+        bool due(const int batch_id, const int nbatch) const
+        {
+            if (m_opts.every_n_batches <= 0)
+            {
+                return batch_id == nbatch - 1;
+            }
+
+            return (batch_id + 1) % m_opts.every_n_batches == 0 || batch_id == nbatch - 1;
+        }
+
+        bool async() const { return m_opts.async; }
+
+        /// <summary>
+        /// Синхронная валидация на текущих весах
+        /// </summary>
+        ValidationMetrics run(const std::vector<Layer*>& layers, const int epoch, const int batch)
+        {
+            ValidationMetrics res = evaluate_layers(layers, m_x, m_y, m_opts);
+            res.epoch = epoch;
+            res.batch = batch;
+
+            return res;
+        }
+
+        /// <summary>
+        /// Запуск валидации на копии весов в отдельном потоке.
+        /// Если предыдущая валидация еще идет, сначала дожидаемся ее.
+        /// </summary>
+        /// <param name="finished"> - результат предыдущей валидации, если она была</param>
+        /// <returns>true, если в finished записан результат</returns>
+        bool launch(const std::vector<Layer*>& layers, const int epoch, const int batch,
+            ValidationMetrics& finished)
+        {
+            const bool has_result = wait(finished);
+
+            release_snapshot();
+
+            for (std::size_t i = 0; i < layers.size(); ++i)
+            {
+                m_snapshot.push_back(layers[i]->clone());
+            }
+
+            m_pending = std::async(std::launch::async, [this, epoch, batch]() {
+                return this->run(m_snapshot, epoch, batch);
+            });
+
+            return has_result;
+        }
+
+        /// <summary>
+        /// Забрать результат асинхронной валидации, если она уже закончилась
+        /// </summary>
+        bool poll(ValidationMetrics& finished)
+        {
+            if (!m_pending.valid()) { return false; }
+
+            if (m_pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                return false;
+            }
+
+            finished = m_pending.get();
+            return true;
+        }
+
+        /// <summary>
+        /// Дождаться результата асинхронной валидации
+        /// </summary>
+        bool wait(ValidationMetrics& finished)
+        {
+            if (!m_pending.valid()) { return false; }
+
+            finished = m_pending.get();
+            return true;
+        }
+    };
+}
@@ -7,6 +7,10 @@
 # include "NeuralNetwork.h"
 
 
+///
+/// Печать лосса после каждого батча. Поток не сбрасывается на каждой строке,
+/// для больших объемов вывода см. AsyncVerboseCallback.
+///
 class VerboseCallback : public Callback
 {
 public:
@@ -16,7 +20,7 @@ public:
 	{
 		const Scalar loss = net->get_output()->loss();
 
-		std::cout << "[Epoch = " << m_epoch_id << ", batch = " << m_batch_id << "] Loss = " << loss << std::endl;
+		std::cout << "[Epoch = " << m_epoch_id << ", batch = " << m_batch_id << "] Loss = " << loss << "\n";
 	}
 
 	void post_trained_batch(const NeuralNetwork* net,
@@ -25,6 +29,6 @@ public:
 	{
 		const Scalar loss = net->get_output()->loss();
 
-		std::cout << "[Epoch = " << m_epoch_id << ", batch = " << m_batch_id << "] Loss = " << loss << std::endl;
+		std::cout << "[Epoch = " << m_epoch_id << ", batch = " << m_batch_id << "] Loss = " << loss << "\n";
 	}
 };
\ No newline at end of file